@@ -3,6 +3,8 @@
 #include "glmcommon.hpp"
 #include "imgui.h"
 #include "Log.hpp"
+#include "Profiler.hpp"
+#include "ProgramBinaryCache.hpp"
 #include "Game.hpp"
 
 bool Game::init()
@@ -13,12 +15,14 @@ bool Game::init()
 
     forwardRenderer = std::make_shared<eeng::ForwardRenderer>();
     forwardRenderer->init("shaders/phong_vert.glsl", "shaders/phong_frag.glsl");
+    forwardRenderer->initSkinning("shaders/skin_vert.glsl", "shaders/skin_comp.glsl");
 
     shapeRenderer = std::make_shared<ShapeRendering::ShapeRenderer>();
     shapeRenderer->init();
 
     // Do some entt stuff
     entity_registry = std::make_shared<entt::registry>();
+    entity_registry->on_destroy<AABBComponent>().connect<&Game::OnAABBDestroyed>(*this);
     auto ent1 = entity_registry->create();
     struct Tfm
     {
@@ -28,11 +32,11 @@ bool Game::init()
 
     // Grass
     grassMesh = std::make_shared<eeng::RenderableMesh>();
-    grassMesh->load("assets/grass/grass_trees_merged2.fbx", false);
+    grassMesh->load("assets/grass/grass_trees_merged2.fbx", false, eeng::xi_optimize_meshes | eeng::xi_build_meshlets);
 
     // Horse
     horseMesh = std::make_shared<eeng::RenderableMesh>();
-    horseMesh->load("assets/Animals/Horse.fbx", false);
+    horseMesh->load("assets/Animals/Horse.fbx", false, eeng::xi_optimize_meshes | eeng::xi_generate_lods);
 
     // Character
     characterMesh = std::make_shared<eeng::RenderableMesh>();
@@ -54,7 +58,7 @@ bool Game::init()
 #endif
 #if 1
     // Amy 5.0.1 PACK FBX
-    characterMesh->load("assets/Amy/Ch46_nonPBR.fbx");
+    characterMesh->load("assets/Amy/Ch46_nonPBR.fbx", false, eeng::xi_optimize_meshes | eeng::xi_generate_lods);
     characterMesh->load("assets/Amy/idle.fbx", true);
     characterMesh->load("assets/Amy/walking.fbx", true);
     characterMesh->load("assets/Amy/jump.fbx", true);
@@ -82,6 +86,16 @@ bool Game::init()
         { 30.0f, 0.0f, -35.0f },
         35.0f, { 0, 1, 0 },
         { 0.01f, 0.01f, 0.01f });
+
+    // Leaf bones (fingers, face) are skipped at low animation detail
+    for (auto& mesh : { horseMesh, characterMesh })
+        for (int i = 0; i < mesh->getNbrAnimations(); i++)
+            mesh->buildLodMask(i);
+
+    characterClip1 = characterGraph.add_clip(1);
+    characterClip2 = characterGraph.add_clip(2);
+    characterBlendNode = characterGraph.add_blend({ characterClip1, characterClip2 });
+
     CreateEntities();
     InitPlayer();
     return true;
@@ -92,8 +106,8 @@ void Game::update(
     float deltaTime,
     InputManagerPtr input)
 {
+    EENG_PROFILE_FUNCTION();
     Time(time);
-    updateCamera(input);
 
     //updatePlayer(deltaTime, input);
     PlayerControllerSystem(input);
@@ -119,10 +133,19 @@ void Game::update(
         time * glm::radians(50.0f), { 0, 1, 0 },
         { 0.03f, 0.03f, 0.03f });
 
-    // Intersect player view ray with AABBs of other objects 
-    glm_aux::intersect_ray_AABB(player.viewRay, character_aabb2.min, character_aabb2.max);
-    glm_aux::intersect_ray_AABB(player.viewRay, character_aabb3.min, character_aabb3.max);
-    glm_aux::intersect_ray_AABB(player.viewRay, horse_aabb.min, horse_aabb.max);
+    // Intersect player view ray with AABBs of other objects, except the player's own
+    sceneBVH.query_ray(player.viewRay, [&](auto proxy) {
+        const auto entity = entt::entity{ sceneBVH.get_user_data(proxy) };
+        return entity == entt::null || !entity_registry->all_of<PlayerControllerComponent>(entity);
+        });
+}
+
+void Game::update_frame(
+    float deltaTime,
+    InputManagerPtr input)
+{
+    EENG_PROFILE_FUNCTION();
+    updateCamera(input);
 
     // We can also compute a ray from the current mouse position,
     // to use for object picking and such ...
@@ -130,24 +153,36 @@ void Game::update(
     {
         glm::ivec2 windowPos(camera.mouse_xy_prev.x, matrices.windowSize.y - camera.mouse_xy_prev.y);
         auto ray = glm_aux::world_ray_from_window_coords(windowPos, matrices.V, matrices.P, matrices.VP);
-        // Intersect with e.g. AABBs ...
-
         eeng::Log("Picking ray origin = %s, dir = %s",
             glm_aux::to_string(ray.origin).c_str(),
             glm_aux::to_string(ray.dir).c_str());
 
+        // Intersect with entity AABBs
+        auto proxy = sceneBVH.query_ray(ray);
+        if (proxy != EENG_NULL_INDEX && entt::entity{ sceneBVH.get_user_data(proxy) } != entt::null)
+            eeng::Log("Picked entity %u at distance %f", sceneBVH.get_user_data(proxy), ray.z_near);
+        else if (proxy != EENG_NULL_INDEX)
+            eeng::Log("Picked mesh at distance %f", ray.z_near);
 
     }
 }
 
 void Game::render(
     float time,
+    float alpha,
     int windowWidth,
     int windowHeight)
 {
-    renderMyWindow(p_win_open);
-    renderUI();
+    renderAlpha = alpha;
+    render(time, windowWidth, windowHeight);
+}
 
+void Game::render(
+    float time,
+    int windowWidth,
+    int windowHeight)
+{
+    EENG_PROFILE_FUNCTION();
     matrices.windowSize = glm::ivec2(windowWidth, windowHeight);
 
     // Projection matrix
@@ -159,37 +194,74 @@ void Game::render(
 
     matrices.VP = glm_aux::create_viewport_matrix(0.0f, 0.0f, windowWidth, windowHeight, 0.0f, 1.0f);
 
-    // Begin rendering pass
-    forwardRenderer->beginPass(matrices.P, matrices.V, pointlight.pos, pointlight.color, camera.pos);
-
-    RenderSystem(time);
-    BoneTest(time);
-    // Grass
-    forwardRenderer->renderMesh(grassMesh, grassWorldMatrix);
-    grass_aabb = grassMesh->m_model_aabb.post_transform(grassWorldMatrix);
+    // Pose and skin every animated mesh before the pass, each into a range of its own,
+    // so that skinning does not interrupt the draws of the pass
+    forwardRenderer->beginFrame();
+    animationLOD.begin_frame(matrices.P, matrices.V);
+    AnimationSystem(time);
 
     // Horse
     horseMesh->animate(3, time);
-    forwardRenderer->renderMesh(horseMesh, horseWorldMatrix);
+    horseInstance = forwardRenderer->skinMesh(horseMesh);
     horse_aabb = horseMesh->m_model_aabb.post_transform(horseWorldMatrix);
 
     // Character, instance 1
     characterMesh->animate(characterAnimIndex, time * characterAnimSpeed);
-    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix1);
+    characterInstance1 = forwardRenderer->skinMesh(characterMesh);
     character_aabb1 = characterMesh->m_model_aabb.post_transform(characterWorldMatrix1);
 
     // Character, instance 2
-    characterMesh->animate(1, time * characterAnimSpeed);
-    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix2);
+    characterGraph.set_time(characterClip1, time * characterAnimSpeed);
+    characterGraph.set_time(characterClip2, time * characterAnimSpeed);
+    characterGraph.set_input_weight(characterBlendNode, 0, 1.0f - characterBlend);
+    characterGraph.set_input_weight(characterBlendNode, 1, characterBlend);
+    characterGraph.evaluate(*characterMesh);
+    characterInstance2 = forwardRenderer->skinMesh(characterMesh);
     character_aabb2 = characterMesh->m_model_aabb.post_transform(characterWorldMatrix2);
 
     // Character, instance 3
     characterMesh->animate(2, time * characterAnimSpeed);
-    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix3);
+    characterInstance3 = forwardRenderer->skinMesh(characterMesh);
     character_aabb3 = characterMesh->m_model_aabb.post_transform(characterWorldMatrix3);
 
+    // Begin rendering pass
+    forwardRenderer->beginPass(matrices.P, matrices.V, pointlight.pos, pointlight.color, camera.pos);
+
+    RenderSystem(time);
+
+    // Grass
+    forwardRenderer->renderMesh(grassMesh, grassWorldMatrix);
+    grass_aabb = grassMesh->m_model_aabb.post_transform(grassWorldMatrix);
+
+    // Horse and characters, in the poses stored above
+    forwardRenderer->renderMesh(horseMesh, horseWorldMatrix, horseInstance);
+    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix1, characterInstance1);
+    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix2, characterInstance2);
+    forwardRenderer->renderMesh(characterMesh, characterWorldMatrix3, characterInstance3);
+
+    // Meshes drawn outside the registry are in the BVH too, with null user data
+    const eeng::AABB propAABBs[] = { horse_aabb, character_aabb2, character_aabb3 };
+    for (int i = 0; i < 3; i++)
+    {
+        if (propProxies[i] == EENG_NULL_INDEX)
+            propProxies[i] = sceneBVH.insert(propAABBs[i], entt::to_integral(static_cast<entt::entity>(entt::null)));
+        else
+            sceneBVH.update(propProxies[i], propAABBs[i]);
+    }
+
+    // Refit the hierarchy and count entities in view
+    sceneBVH.rebuild_if_degraded();
+    visibleEntityCount = 0;
+    sceneBVH.query_frustum(eeng::Frustum{ matrices.P * matrices.V }, [&](auto proxy) {
+        if (entt::entity{ sceneBVH.get_user_data(proxy) } != entt::null)
+            visibleEntityCount++;
+        });
+
     // End rendering pass
     drawcallCount = forwardRenderer->endPass();
+    triangleCount = forwardRenderer->getTriangleCount();
+    meshletCount = forwardRenderer->getMeshletCount();
+    culledMeshletCount = forwardRenderer->getCulledMeshletCount();
 
     // Draw player view ray
     if (player.viewRay)
@@ -238,6 +310,12 @@ void Game::render(
     shapeRenderer->post_render();
 }
 
+void Game::render_ui()
+{
+    renderMyWindow(p_win_open);
+    renderUI();
+}
+
 void Game::renderMyWindow(bool* p_open) 
 {
     ImGui::Begin("MyWindow", p_open);
@@ -251,7 +329,8 @@ void Game::renderUI()
 {
     ImGui::Begin("Game Info");
 
-    ImGui::Text("Drawcall count %i", drawcallCount);
+    ImGui::Text("Drawcall count %i, triangles %i", drawcallCount, triangleCount);
+    ImGui::Text("BVH entities %i, in view %i, height %i", sceneBVH.size(), visibleEntityCount, sceneBVH.height());
 
     ImGui::Text("Total Time %i:%i", time_minutes, time_seconds);
     if (ImGui::ColorEdit3("Light color",
@@ -318,15 +397,75 @@ void Game::renderUI()
         }
     }
 
+    ImGui::Checkbox("GPU pre-skinning", &forwardRenderer->preSkinning);
+    ImGui::SameLine();
+    ImGui::Checkbox("Dual-quaternion skinning", &characterMesh->dualQuatSkinning);
+
+    ImGui::Checkbox("Mesh LOD", &forwardRenderer->lodEnabled);
+    ImGui::SameLine();
+    ImGui::SliderFloat("Full detail size", &forwardRenderer->lodFullDetailSize, 0.05f, 1.0f);
+
+    ImGui::Checkbox("Indirect draws", &forwardRenderer->indirectDraws);
+    ImGui::SameLine();
+    ImGui::Checkbox("Meshlet culling", &forwardRenderer->meshletCulling);
+    ImGui::SameLine();
+    ImGui::Text("%d meshlets drawn, %d culled", meshletCount, culledMeshletCount);
+    ImGui::Text("%d shader variants", forwardRenderer->getShaderVariantCount());
+    ImGui::Text("%d shader programs loaded from cache, %d cache misses", eeng::ProgramBinaryCache::instance().hits(), eeng::ProgramBinaryCache::instance().misses());
+
+    auto& lodStats = animationLOD.stats();
+    ImGui::Checkbox("Animation LOD", &animationLOD.settings.enabled);
+    ImGui::SameLine();
+    ImGui::Text("%d updated, %d interpolated, %d frozen, %d deferred, %u nodes",
+        lodStats.updated, lodStats.interpolated, lodStats.frozen, lodStats.deferred, lodStats.nodes_evaluated);
+    int nodeBudget = (int)animationLOD.settings.node_budget;
+    if (ImGui::SliderInt("Animation node budget", &nodeBudget, 100, 10000))
+        animationLOD.settings.node_budget = nodeBudget;
+
     ImGui::SliderFloat("Animation speed", &characterAnimSpeed, 0.1f, 5.0f);
+    ImGui::SliderFloat("Animation blend", &characterBlend, 0.0f, 1.0f);
+    ImGui::SameLine();
+    if (ImGui::Button("Benchmark blend"))
+        BenchmarkBlend(1000);
     ImGui::SliderFloat("character speed", character_speed, 0.1f, 50.0f);
 
     ImGui::End(); // end info window
 }
 
+void Game::BenchmarkBlend(int iterations) {
+    // Two-clip blend, animateBlend vs the blend graph
+    const float t = 0.5f;
+    characterGraph.set_time(characterClip1, t);
+    characterGraph.set_time(characterClip2, t);
+    characterGraph.set_input_weight(characterBlendNode, 0, 0.5f);
+    characterGraph.set_input_weight(characterBlendNode, 1, 0.5f);
+
+    uint64_t start = eeng::profiler::now_ns();
+    for (int i = 0; i < iterations; i++)
+        characterMesh->animateBlend(1, 2, t, t, 0.5f);
+    const double blendUs = (eeng::profiler::now_ns() - start) * 1e-3 / iterations;
+
+    start = eeng::profiler::now_ns();
+    for (int i = 0; i < iterations; i++)
+        characterGraph.evaluate(*characterMesh);
+    const double graphUs = (eeng::profiler::now_ns() - start) * 1e-3 / iterations;
+
+    eeng::Log("Blend of %zu nodes: animateBlend %.2f us, AnimationGraph %.2f us",
+        characterMesh->m_nodetree.size(), blendUs, graphUs);
+}
+
 void Game::destroy()
 {
+    entity_registry->on_destroy<AABBComponent>().disconnect<&Game::OnAABBDestroyed>(*this);
+}
 
+void Game::OnAABBDestroyed(entt::registry& registry, entt::entity entity)
+{
+    // Destroyed entities leave the scene BVH
+    auto& aabb = registry.get<AABBComponent>(entity);
+    if (aabb.bvh_proxy != EENG_NULL_INDEX)
+        sceneBVH.remove(aabb.bvh_proxy);
+    aabb.bvh_proxy = EENG_NULL_INDEX;
 }
 
 void Game::updateCamera(
@@ -381,11 +520,13 @@ void Game::updatePlayer(
 }
 
 void Game::MovementSystem(float deltaTime) {
+    EENG_PROFILE_FUNCTION();
     auto view = entity_registry->view<TransformComponent, LinearVelocityComponent>();
 
     for (auto entity : view) {
 
         auto [transform, velocity] = view.get<TransformComponent, LinearVelocityComponent>(entity);
+        entity_registry->emplace_or_replace<InterpolationComponent>(entity, transform.translation);
         transform.translation += velocity.velocity * velocity.speed * deltaTime;
         //transform.translation.z += velocity.velocity.z * velocity.speed * deltaTime;
     }
@@ -406,6 +547,7 @@ void Game::MovementSystem(float deltaTime) {
 }
 
 void Game::PlayerControllerSystem(InputManagerPtr input) {
+    EENG_PROFILE_FUNCTION();
     auto view = entity_registry->view<TransformComponent, LinearVelocityComponent, PlayerControllerComponent>();
 
     bool W, A, S, D, spacebar = false;
@@ -432,6 +574,7 @@ void Game::PlayerControllerSystem(InputManagerPtr input) {
 }
 
 void Game::NPCControllerSystem() {
+    EENG_PROFILE_FUNCTION();
     auto view = entity_registry->view<NPCControllerComponent, TransformComponent, LinearVelocityComponent>();
     int point_index;
     int point_max;
@@ -454,22 +597,63 @@ void Game::NPCControllerSystem() {
     }
 }
 
-void Game::RenderSystem(float time) {
-    auto view = entity_registry->view<TransformComponent, MeshComponent, AABBComponent>();
+glm::mat4 Game::EntityWorldMatrix(entt::entity entity, const TransformComponent& transform) const {
+    // Interpolate moving entities between simulation steps
+    glm::vec3 translation = transform.translation;
+    if (auto interp = entity_registry->try_get<InterpolationComponent>(entity))
+        translation = glm::mix(interp->prev_translation, transform.translation, renderAlpha);
 
+    glm::mat4 T = glm_aux::T(translation);
+    glm::mat4 R = glm_aux::R(transform.yaw, transform.pitch);
+    glm::mat4 S = glm_aux::S(transform.scale);
+    return T * R * S;
+}
+
+void Game::AnimationSystem(float time) {
+    EENG_PROFILE_FUNCTION();
+    auto view = entity_registry->view<TransformComponent, MeshComponent, AABBComponent, AnimationLODComponent>();
+    const int animIndex = 9;
+
+    // Pick animation detail per entity, then spend the bone budget on the most visible ones
     for (auto entity : view) {
+        auto [transform, mesh_ptr, lod] = view.get<TransformComponent, MeshComponent, AnimationLODComponent>(entity);
+        animationLOD.request(lod.state, *mesh_ptr.renderable_mesh, EntityWorldMatrix(entity, transform), animIndex);
+    }
+    animationLOD.grant();
 
-        auto [transform, mesh_ptr, aabb] = view.get<TransformComponent, MeshComponent, AABBComponent>(entity);
+    for (auto entity : view) {
 
-        glm::mat4 T = glm_aux::T(transform.translation);
-        glm::mat4 R = glm_aux::R(transform.yaw, transform.pitch);
-        glm::mat4 S = glm_aux::S(transform.scale);
-        glm::mat4 TRS = T * R * S;
+        auto [transform, mesh_ptr, aabb, lod] = view.get<TransformComponent, MeshComponent, AABBComponent, AnimationLODComponent>(entity);
+        glm::mat4 TRS = EntityWorldMatrix(entity, transform);
 
-        mesh_ptr.renderable_mesh->animate(9, time * 3);
-        forwardRenderer->renderMesh(mesh_ptr.renderable_mesh, TRS);
+        // Meshes are shared, so each entity keeps its pose in a range of its own
+        animationLOD.animate(lod.state, *mesh_ptr.renderable_mesh, animIndex, time * 3);
+        lod.skinned = forwardRenderer->skinMesh(mesh_ptr.renderable_mesh);
         aabb.mesh_aabb = mesh_ptr.renderable_mesh->m_model_aabb.post_transform(TRS);
 
+        // The shared mesh only holds this entity's pose until the next one is animated
+        if (entity_registry->all_of<PlayerControllerComponent>(entity))
+            BoneTest(mesh_ptr, TRS);
+
+        if (aabb.bvh_proxy == EENG_NULL_INDEX)
+            aabb.bvh_proxy = sceneBVH.insert(aabb.mesh_aabb, entt::to_integral(entity));
+        else
+            sceneBVH.update(aabb.bvh_proxy, aabb.mesh_aabb);
+    }
+}
+
+void Game::RenderSystem(float time) {
+    EENG_PROFILE_FUNCTION();
+    auto view = entity_registry->view<TransformComponent, MeshComponent, AABBComponent, AnimationLODComponent>();
+
+    for (auto entity : view) {
+
+        auto [transform, mesh_ptr, aabb, lod] = view.get<TransformComponent, MeshComponent, AABBComponent, AnimationLODComponent>(entity);
+        glm::mat4 TRS = EntityWorldMatrix(entity, transform);
+
+        // Drawn in the pose stored by AnimationSystem
+        forwardRenderer->renderMesh(mesh_ptr.renderable_mesh, TRS, lod.skinned);
+
         shapeRenderer->push_basis_basic(TRS, 1.0f);
 
         shapeRenderer->push_states(ShapeRendering::Color4u{ 0xFFE61A80 });
@@ -498,6 +682,8 @@ void Game::CreateEntities()
 
         entity_registry->emplace<AABBComponent>(entity);
 
+        entity_registry->emplace<AnimationLODComponent>(entity);
+
         entity_registry->emplace<NPCControllerComponent>(entity);
         GeneratePath(entity);
     }
@@ -535,6 +721,8 @@ void Game::InitPlayer() {
 
     entity_registry->emplace<AABBComponent>(entity);
 
+    entity_registry->emplace<AnimationLODComponent>(entity);
+
     entity_registry->emplace<PlayerControllerComponent>(entity);
 
     camera.lookAt = entity_registry->get<TransformComponent>(entity).translation;
@@ -574,27 +762,7 @@ void Game::Time(float time) {
     }
 }
 
-void Game::BoneTest(float time) {
-    auto view = entity_registry->view<TransformComponent, MeshComponent, AABBComponent, PlayerControllerComponent>();
-
-    for (auto entity : view) {
-
-        auto [transform, mesh_ptr, aabb] = view.get<TransformComponent, MeshComponent, AABBComponent>(entity);
-
-        glm::mat4 T = glm_aux::T(transform.translation);
-        glm::mat4 R = glm_aux::R(transform.yaw, transform.pitch);
-        glm::mat4 S = glm_aux::S(transform.scale);
-        glm::mat4 TRS = T * R * S;
-
-        mesh_ptr.renderable_mesh->animate(9, time * 3);
-        forwardRenderer->renderMesh(mesh_ptr.renderable_mesh, TRS);
-        aabb.mesh_aabb = mesh_ptr.renderable_mesh->m_model_aabb.post_transform(TRS);
-
-        shapeRenderer->push_basis_basic(TRS, 1.0f);
-
-        shapeRenderer->push_states(ShapeRendering::Color4u{ 0xFFE61A80 });
-        shapeRenderer->push_AABB(aabb.mesh_aabb.min, aabb.mesh_aabb.max);
-        shapeRenderer->pop_states<ShapeRendering::Color4u>();
-        boneGizmo->draw_bone_gizmo(mesh_ptr.renderable_mesh, shapeRenderer, TRS);
-    }
+void Game::BoneTest(const MeshComponent& mesh_ptr, const glm::mat4& worldMatrix) {
+    // Debug drawing only; the player itself is drawn by RenderSystem
+    boneGizmo->draw_bone_gizmo(mesh_ptr.renderable_mesh, shapeRenderer, worldMatrix);
 }
\ No newline at end of file
@@ -5,8 +5,10 @@
 #include <entt/fwd.hpp>
 #include "GameBase.h"
 #include "RenderableMesh.hpp"
+#include "AnimationGraph.hpp"
 #include "ForwardRenderer.hpp"
 #include "ShapeRenderer.hpp"
+#include "BVH.h"
 #include "component.h"
 #include <random>
 #include "BoneGizmo.h"
@@ -28,6 +30,13 @@ public:
         float deltaTime,
         InputManagerPtr input) override;
 
+    /// @brief Camera and picking, once per frame before rendering
+    /// @param deltaTime Time elapsed since the last frame
+    /// @param input Input from mouse, keyboard and controllers
+    void update_frame(
+        float deltaTime,
+        InputManagerPtr input) override;
+
     /// @brief For rendering of game contents
     /// @param time Total time elapsed in seconds
     /// @param screenWidth Current width of the window in pixels
@@ -37,6 +46,17 @@ public:
         int windowWidth,
         int windowHeight) override;
 
+    /// @brief Rendering interpolated between simulation steps
+    /// @param alpha Fraction of a time step since the last update
+    void render(
+        float time,
+        float alpha,
+        int windowWidth,
+        int windowHeight) override;
+
+    /// @brief For rendering of GUI elements, once per frame after render()
+    void render_ui() override;
+
     /// @brief For destruction of game resources
     void destroy() override;
 
@@ -45,7 +65,7 @@ private:
     BoneGizmo* boneGizmo;
     bool win_open;
     bool* p_win_open;
-    /// @brief For rendering of GUI elements
+    /// @brief Game info window
     void renderUI();
     void renderMyWindow(bool* p_open);
     // Renderer for rendering imported animated or non-animated models
@@ -54,9 +74,18 @@ private:
     // Immediate-mode renderer for basic 2D or 3D primitives
     ShapeRendererPtr shapeRenderer;
 
+    // Update rate and detail of entity animations
+    eeng::AnimationLOD animationLOD;
+
     // Entity registry - to use in labs
     std::shared_ptr<entt::registry> entity_registry;
 
+    // Hierarchy over entity world AABBs (updated by AnimationSystem) and the meshes drawn
+    // outside the registry, used for ray picking and view queries
+    eeng::BVH sceneBVH{ 1.0f };
+    eeng::BVH::ProxyId propProxies[3] = { EENG_NULL_INDEX, EENG_NULL_INDEX, EENG_NULL_INDEX };
+    int visibleEntityCount = 0;
+
     // Matrices for view, projection and viewport
     struct Matrices
     {
@@ -113,12 +142,25 @@ private:
     // Game entity AABBs (for collision detection or visualization)
     eeng::AABB character_aabb1, character_aabb2, character_aabb3, horse_aabb, grass_aabb;
 
+    // Poses of the animated meshes drawn outside the registry, skinned before the pass
+    eeng::SkinnedInstance horseInstance, characterInstance1, characterInstance2, characterInstance3;
+
     // Placeholder animation state
     int characterAnimIndex = -1;
     float characterAnimSpeed = 1.0f;
 
+    // Blend of clips 1 and 2 for character instance 2
+    eeng::AnimationGraph characterGraph;
+    eeng::AnimationGraph::NodeHandle characterClip1, characterClip2, characterBlendNode;
+    float characterBlend = 0.5f;
+
     // Stats
     int drawcallCount = 0;
+    int triangleCount = 0;
+    int meshletCount = 0, culledMeshletCount = 0;
+
+    // Interpolation factor between the last two simulation steps
+    float renderAlpha = 1.0f;
 
     /// @brief Placeholder system for updating the camera position based on inputs
     /// @param input Input from mouse, keyboard and controllers
@@ -133,9 +175,14 @@ private:
 
     void MovementSystem(float deltaTime);
     void PlayerControllerSystem(InputManagerPtr input);
+    void AnimationSystem(float time);
     void RenderSystem(float time);
     void NPCControllerSystem();
-    void BoneTest(float time);
+    void BoneTest(const MeshComponent& mesh_ptr, const glm::mat4& worldMatrix);
+    void OnAABBDestroyed(entt::registry& registry, entt::entity entity);
+    void BenchmarkBlend(int iterations);
+
+    glm::mat4 EntityWorldMatrix(entt::entity entity, const TransformComponent& transform) const;
 
     void CreateEntities();
     void CreateAnimEntity();
@@ -1,22 +1,57 @@
 #include "Engine.hpp"
 #include "Game.hpp"
 #include <memory>
+#include <string>
 
 int main(int argc, char* argv[])
 {
     std::cout << "Starting eduEngine..." << std::endl;
 
+    // Headless mode: --headless [--frames N] [--timestep S] [--stats FILE]
+    bool headless = false;
+    eeng::HeadlessConfig config;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--headless")
+            headless = true;
+        else if (arg == "--frames" && i + 1 < argc)
+            config.frame_count = std::stoi(argv[++i]);
+        else if (arg == "--timestep" && i + 1 < argc)
+            config.timestep_s = std::stof(argv[++i]);
+        else if (arg == "--stats" && i + 1 < argc)
+            config.stats_file = argv[++i];
+        else
+            std::cerr << "Unknown argument " << arg << std::endl;
+    }
+
     eeng::Engine engine;
 
-    if (!engine.init("eduEngine", 1600, 900))
+    if (!engine.init("eduEngine", 1600, 900, headless))
     {
         std::cerr << "Engine failed to initialize." << std::endl;
         return -1;
     }
 
     auto game = std::make_unique<Game>();
-    engine.run(std::move(game));
+    if (headless)
+    {
+        // Walk the player around for a repeatable workload
+        using Key = eeng::InputManager::Key;
+        const int leg = 120;
+        const Key keys[] = { Key::W, Key::D, Key::S, Key::A };
+        for (int frame = 0, k = 0; frame < config.frame_count; frame += leg, k = (k + 1) % 4)
+        {
+            config.script.push_back({ frame, keys[k], true });
+            config.script.push_back({ frame + leg, keys[k], false });
+        }
+
+        if (!engine.run_headless(std::move(game), config))
+            return -1;
+    }
+    else
+        engine.run(std::move(game));
 
     std::cout << "Exiting eduEngine." << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,24 +1,37 @@
 #version 410 core
+/* Permutation defines, see ForwardRenderer::ShaderVariant:
+   DIFFUSE_TEXTURE, NORMAL_TEXTURE, SPECULAR_TEXTURE: sample the texture
+   ALPHA_TEST: discard where the opacity texture is below 0.5 */
 
-uniform sampler2D diffuseTexture;
-uniform sampler2D normalTexture;
-uniform sampler2D specularTexture;
-uniform sampler2D opacityTexture;
+/* Texture arrays of TexturePool, one per image size. Matches TexturePool::MaxPools. */
+#define MAX_TEXTURE_POOLS 8
+uniform sampler2DArray texturePools[MAX_TEXTURE_POOLS];
 uniform samplerCube cubeTexture;
 
-uniform int has_diffuseTexture;
-uniform int has_normalTexture;
-uniform int has_specularTexture;
-uniform int has_opacityTexture;
 uniform int has_cubemap;
 
 uniform vec3 lightpos;
 uniform vec3 lightColor;
 uniform vec3 eyepos;
+#ifdef INDIRECT_DRAW
+struct Material
+{
+   vec4 Ka;
+   vec4 Kd;
+   vec4 Ks;             /* Shininess in w */
+   ivec4 textures;      /* As textureLayers */
+};
+layout (std430, binding = 1) readonly buffer MaterialBuffer { Material materials[]; };
+
+flat in uint material_index;
+#else
 uniform vec3 Ka;
 uniform vec3 Kd;
 uniform vec3 Ks;
 uniform float shininess;
+/* TexturePool layer ids of the diffuse, normal, specular and opacity textures */
+uniform ivec4 textureLayers;
+#endif
 // uniform vec3 ucolor; // !!!
 
 in vec3 wpos;
@@ -29,38 +42,60 @@ in vec3 binormal;
 in vec3 color;
 out vec4 fragcolor;
 
+/* Sample a TexturePool layer with id (array index << 16 | layer).
+   Samplers are indexed by constants, and gradients are taken before branching. */
+vec4 samplePool(int id, vec2 uv, vec2 dx, vec2 dy)
+{
+   vec3 uvl = vec3(uv, float(id & 0xFFFF));
+   switch (id >> 16)
+   {
+      case 0: return textureGrad(texturePools[0], uvl, dx, dy);
+      case 1: return textureGrad(texturePools[1], uvl, dx, dy);
+      case 2: return textureGrad(texturePools[2], uvl, dx, dy);
+      case 3: return textureGrad(texturePools[3], uvl, dx, dy);
+      case 4: return textureGrad(texturePools[4], uvl, dx, dy);
+      case 5: return textureGrad(texturePools[5], uvl, dx, dy);
+      case 6: return textureGrad(texturePools[6], uvl, dx, dy);
+      case 7: return textureGrad(texturePools[7], uvl, dx, dy);
+   }
+   return vec4(0.0);
+}
+
 void main()
 {
+#ifdef INDIRECT_DRAW
+   vec3 Kd = materials[material_index].Kd.rgb;
+   vec3 Ks = materials[material_index].Ks.rgb;
+   ivec4 textureLayers = materials[material_index].textures;
+#endif
    vec3 N = normal;
    vec2 texflip = vec2(texcoord.x, texcoord.y);
+   vec2 dx = dFdx(texflip);
+   vec2 dy = dFdy(texflip);
    vec3 V = normalize(eyepos - wpos);
    vec3 L = normalize(lightpos - wpos);
    vec3 C = Kd;
    vec3 S = Ks;
 
-   if (has_opacityTexture > 0)
-   {
-       if (texture(opacityTexture, texflip).x < 0.5)
-           discard;
-   }
+#ifdef ALPHA_TEST
+   if (samplePool(textureLayers.w, texflip, dx, dy).x < 0.5)
+       discard;
+#endif
 
-   if (has_diffuseTexture > 0)
-   {
-       C = texture(diffuseTexture, texflip).rgb;
-   }
+#ifdef DIFFUSE_TEXTURE
+   C = samplePool(textureLayers.x, texflip, dx, dy).rgb;
+#endif
 
-   if (has_specularTexture > 0)
-   {
-       S = texture(specularTexture, texflip).rgb;
-   }
+#ifdef SPECULAR_TEXTURE
+   S = samplePool(textureLayers.z, texflip, dx, dy).rgb;
+#endif
 
-   if (has_normalTexture > 0)
-   {
-       mat3 TBN = mat3(tangent, binormal, normal);
-       vec3 bnormal = texture(normalTexture, texflip).xyz * 2.0 - 1.0;
-       N = normalize( TBN * bnormal );
-    //    fragcolor = vec4(N*0.5+0.5, 1.0); return;
-   }
+#ifdef NORMAL_TEXTURE
+   mat3 TBN = mat3(tangent, binormal, normal);
+   vec3 bnormal = samplePool(textureLayers.y, texflip, dx, dy).xyz * 2.0 - 1.0;
+   N = normalize( TBN * bnormal );
+//    fragcolor = vec4(N*0.5+0.5, 1.0); return;
+#endif
 
    vec3 R = reflect(-L, N);
    float ldot = max(0.0, dot(N, L));
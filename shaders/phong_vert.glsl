@@ -1,5 +1,6 @@
 #version 410 core
-const int MaxBones = 128;
+/* Permutation defines, see ForwardRenderer::ShaderVariant:
+   SKINNING: blend positions by bone weights */
 
 layout (location = 0) in vec3 attr_Position;
 layout (location = 1) in vec2 attr_Texcoord;
@@ -10,9 +11,31 @@ layout (location = 5) in ivec4 BoneIDs;
 layout (location = 6) in vec4 BoneWeights;
 
 uniform mat4 ProjViewMatrix;
+
+#ifdef INDIRECT_DRAW
+/* Draw index, sourced per instance so that the base instance of each indirect draw selects it */
+layout (location = 7) in uint attr_DrawIndex;
+
+struct DrawData
+{
+   mat4 world;
+   uint material_index;
+   uint bone_offset;    /* First bone texel of the instance */
+   uint flags;          /* 1: skinned, 2: dual-quaternion skinning (SKINNING) */
+   uint pad;
+};
+layout (std430, binding = 0) readonly buffer DrawBuffer { DrawData draws[]; };
+
+flat out uint material_index;
+#else
 uniform mat4 WorldMatrix;
-uniform mat4 BoneMatrices[MaxBones];
-uniform int u_is_skinned;
+uniform int u_dq_skinning;
+uniform int u_bone_offset;
+#endif
+
+#include "skinning.glsl"
+
+int bone_offset = 0;
 
 out vec3 wpos;
 out vec2 texcoord;
@@ -23,19 +46,21 @@ out vec3 color;
 
 void main()
 {
+#ifdef INDIRECT_DRAW
+   DrawData draw = draws[attr_DrawIndex];
+   mat4 WorldMatrix = draw.world;
+   bool dq_skinning = (draw.flags & 2u) != 0u;
+   bone_offset = int(draw.bone_offset);
+   material_index = draw.material_index;
+#else
+   bool dq_skinning = u_dq_skinning > 0;
+   bone_offset = u_bone_offset;
+#endif
+
    mat4 BoneMatrix = mat4(1.0);
-   if (u_is_skinned > 0)
-   {
-       BoneMatrix *=    BoneMatrices[BoneIDs.x] * BoneWeights.x + 
-                        BoneMatrices[BoneIDs.y] * BoneWeights.y + 
-                        BoneMatrices[BoneIDs.z] * BoneWeights.z + 
-                        BoneMatrices[BoneIDs.w] * BoneWeights.w;
-       /* Fallback when bone weights are zero */
-       if (BoneWeights.x+BoneWeights.y+BoneWeights.z+BoneWeights.w < 0.01)
-       {
-           BoneMatrix = BoneMatrices[0];
-       }
-   }
+#ifdef SKINNING
+   BoneMatrix = skinMatrix(bone_offset, BoneIDs, BoneWeights, dq_skinning);
+#endif
 
    wpos = (WorldMatrix * BoneMatrix * vec4(attr_Position, 1)).xyz;
    texcoord = attr_Texcoord;
@@ -0,0 +1,69 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+/* Tightly packed vec3 attributes */
+layout (std430, binding = 0) readonly buffer Positions { float positions[]; };
+layout (std430, binding = 1) readonly buffer Normals { float normals[]; };
+layout (std430, binding = 2) readonly buffer Tangents { float tangents[]; };
+layout (std430, binding = 3) readonly buffer Binormals { float binormals[]; };
+/* SkinData: 4 bone indices, 4 bone weights, 1 counter */
+layout (std430, binding = 4) readonly buffer Skin { uint skin[]; };
+/* Tightly packed vec2 attributes */
+layout (std430, binding = 5) readonly buffer Texcoords { float texcoords[]; };
+/* Output: position, normal, tangent, binormal, texcoord */
+layout (std430, binding = 6) writeonly buffer Skinned { float skinned[]; };
+
+const uint SkinStride = 9;
+const uint SkinnedStride = 14;
+
+uniform int u_is_skinned;
+uniform int u_dq_skinning;
+uniform int u_bone_offset;
+uniform uint u_base_vertex;
+/* First vertex of the mesh in the input buffers, and of the instance in the output */
+uniform uint u_arena_base_vertex;
+uniform uint u_output_base_vertex;
+uniform uint u_nbr_vertices;
+
+#include "skinning.glsl"
+
+vec3 fetch3(uint v, uint which)
+{
+   uint i = 3 * v;
+   if (which == 0) return vec3(positions[i], positions[i + 1], positions[i + 2]);
+   if (which == 1) return vec3(normals[i], normals[i + 1], normals[i + 2]);
+   if (which == 2) return vec3(tangents[i], tangents[i + 1], tangents[i + 2]);
+   return vec3(binormals[i], binormals[i + 1], binormals[i + 2]);
+}
+
+void store3(uint v, uint which, vec3 value)
+{
+   uint i = SkinnedStride * v + 3 * which;
+   skinned[i] = value.x;
+   skinned[i + 1] = value.y;
+   skinned[i + 2] = value.z;
+}
+
+void main()
+{
+   if (gl_GlobalInvocationID.x >= u_nbr_vertices)
+      return;
+   uint v = u_base_vertex + gl_GlobalInvocationID.x;
+   uint a = u_arena_base_vertex + v;
+   uint o = u_output_base_vertex + v;
+
+   mat4 BoneMatrix = mat4(1.0);
+   uint s = SkinStride * a;
+   uvec4 BoneIDs = uvec4(skin[s], skin[s + 1], skin[s + 2], skin[s + 3]);
+   vec4 BoneWeights = uintBitsToFloat(uvec4(skin[s + 4], skin[s + 5], skin[s + 6], skin[s + 7]));
+
+   if (u_is_skinned > 0)
+       BoneMatrix = skinMatrix(u_bone_offset, ivec4(BoneIDs), BoneWeights, u_dq_skinning > 0);
+
+   store3(o, 0, (BoneMatrix * vec4(fetch3(a, 0), 1)).xyz);
+   store3(o, 1, (BoneMatrix * vec4(fetch3(a, 1), 0)).xyz);
+   store3(o, 2, (BoneMatrix * vec4(fetch3(a, 2), 0)).xyz);
+   store3(o, 3, (BoneMatrix * vec4(fetch3(a, 3), 0)).xyz);
+   skinned[SkinnedStride * o + 12] = texcoords[2 * a];
+   skinned[SkinnedStride * o + 13] = texcoords[2 * a + 1];
+}
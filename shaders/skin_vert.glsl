@@ -0,0 +1,35 @@
+#version 410 core
+
+layout (location = 0) in vec3 attr_Position;
+layout (location = 1) in vec2 attr_Texcoord;
+layout (location = 2) in vec3 attr_Normal;
+layout (location = 3) in vec3 attr_Tangent;
+layout (location = 4) in vec3 attr_Binormal;
+layout (location = 5) in ivec4 BoneIDs;
+layout (location = 6) in vec4 BoneWeights;
+
+uniform int u_is_skinned;
+uniform int u_dq_skinning;
+uniform int u_bone_offset;
+
+/* Captured interleaved by transform feedback */
+out vec3 skinned_position;
+out vec3 skinned_normal;
+out vec3 skinned_tangent;
+out vec3 skinned_binormal;
+out vec2 skinned_texcoord;
+
+#include "skinning.glsl"
+
+void main()
+{
+   mat4 BoneMatrix = mat4(1.0);
+   if (u_is_skinned > 0)
+       BoneMatrix = skinMatrix(u_bone_offset, BoneIDs, BoneWeights, u_dq_skinning > 0);
+
+   skinned_position = (BoneMatrix * vec4(attr_Position, 1)).xyz;
+   skinned_normal = (BoneMatrix * vec4(attr_Normal, 0)).xyz;
+   skinned_tangent = (BoneMatrix * vec4(attr_Tangent, 0)).xyz;
+   skinned_binormal = (BoneMatrix * vec4(attr_Binormal, 0)).xyz;
+   skinned_texcoord = attr_Texcoord;
+}
@@ -0,0 +1,66 @@
+/* Linear blend and dual quaternion skinning, shared by phong_vert.glsl, skin_vert.glsl and skin_comp.glsl
+   through #include (expanded when ForwardRenderer loads them).
+   Bone palettes of all instances are read from BoneTexture, each from its own first texel. */
+
+uniform samplerBuffer BoneTexture;
+
+/* Bone matrices are stored as four texels each */
+mat4 boneMatrix(int offset, int i)
+{
+   int j = offset + 4 * i;
+   return mat4(texelFetch(BoneTexture, j),
+               texelFetch(BoneTexture, j + 1),
+               texelFetch(BoneTexture, j + 2),
+               texelFetch(BoneTexture, j + 3));
+}
+
+/* Weighted sum of bone matrices */
+mat4 linearBlend(int offset, ivec4 ids, vec4 weights)
+{
+   /* Fallback when bone weights are zero */
+   if (weights.x + weights.y + weights.z + weights.w < 0.01)
+      return boneMatrix(offset, 0);
+   return boneMatrix(offset, ids.x) * weights.x +
+          boneMatrix(offset, ids.y) * weights.y +
+          boneMatrix(offset, ids.z) * weights.z +
+          boneMatrix(offset, ids.w) * weights.w;
+}
+
+/* Bone dual quaternions are stored as two texels each, real part first */
+mat4 dualQuatBlend(int offset, ivec4 ids, vec4 weights)
+{
+   vec4 real0 = texelFetch(BoneTexture, offset + 2 * ids.x);
+   vec4 real = vec4(0.0);
+   vec4 dual = vec4(0.0);
+   for (int k = 0; k < 4; k++)
+   {
+      vec4 r = texelFetch(BoneTexture, offset + 2 * ids[k]);
+      vec4 d = texelFetch(BoneTexture, offset + 2 * ids[k] + 1);
+      /* Blend along the shortest path relative to the first bone */
+      float w = dot(real0, r) < 0.0 ? -weights[k] : weights[k];
+      real += r * w;
+      dual += d * w;
+   }
+   float len = length(real);
+   real /= len;
+   dual /= len;
+
+   vec3 t = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+   float x = real.x, y = real.y, z = real.z, w = real.w;
+   return mat4(
+      1.0 - 2.0 * (y * y + z * z), 2.0 * (x * y + w * z), 2.0 * (x * z - w * y), 0.0,
+      2.0 * (x * y - w * z), 1.0 - 2.0 * (x * x + z * z), 2.0 * (y * z + w * x), 0.0,
+      2.0 * (x * z + w * y), 2.0 * (y * z - w * x), 1.0 - 2.0 * (x * x + y * y), 0.0,
+      t, 1.0);
+}
+
+/* Bone transform of a vertex, from matrices or dual quaternions */
+mat4 skinMatrix(int offset, ivec4 ids, vec4 weights, bool dq)
+{
+   if (!dq)
+      return linearBlend(offset, ids, weights);
+   /* Fallback when bone weights are zero */
+   if (weights.x + weights.y + weights.z + weights.w < 0.01)
+      return dualQuatBlend(offset, ivec4(0), vec4(1, 0, 0, 0));
+   return dualQuatBlend(offset, ids, weights);
+}
@@ -4,8 +4,14 @@
 #ifndef EENG_AABB_h
 #define EENG_AABB_h
 
+#include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 #include <float.h>
+#include "config.h"
+#ifdef EENG_SSE
+#include <xmmintrin.h>
+#endif
 
 namespace eeng
 {
@@ -175,5 +181,177 @@ namespace eeng
             r.split2(2, 0.5f, aabb[2], aabb[3]); // split in z
         }
     };
+
+    /// Structure-of-arrays set of AABBs, for batch processing
+    struct AABBSoA
+    {
+        std::vector<float> min_x, min_y, min_z;
+        std::vector<float> max_x, max_y, max_z;
+
+        inline size_t size() const
+        {
+            return min_x.size();
+        }
+
+        /// Resize set. New AABBs are in negative-space state.
+        inline void resize(size_t n)
+        {
+            min_x.resize(n, std::numeric_limits<float>::max());
+            min_y.resize(n, std::numeric_limits<float>::max());
+            min_z.resize(n, std::numeric_limits<float>::max());
+            max_x.resize(n, std::numeric_limits<float>::lowest());
+            max_y.resize(n, std::numeric_limits<float>::lowest());
+            max_z.resize(n, std::numeric_limits<float>::lowest());
+        }
+
+        inline void set(size_t i, const AABB& aabb)
+        {
+            min_x[i] = aabb.min.x; min_y[i] = aabb.min.y; min_z[i] = aabb.min.z;
+            max_x[i] = aabb.max.x; max_y[i] = aabb.max.y; max_z[i] = aabb.max.z;
+        }
+
+        inline AABB get(size_t i) const
+        {
+            AABB aabb;
+            aabb.min = { min_x[i], min_y[i], min_z[i] };
+            aabb.max = { max_x[i], max_y[i], max_z[i] };
+            return aabb;
+        }
+
+        inline void assign(const std::vector<AABB>& aabbs)
+        {
+            resize(0);
+            resize(aabbs.size());
+            for (size_t i = 0; i < aabbs.size(); i++)
+                set(i, aabbs[i]);
+        }
+    };
+
+    /// Batch version of AABB::post_transform: out[i] = in[i] transformed by M[i].
+    /// AABBs that are not valid (see AABB::operator bool) are output in negative-space
+    /// state, so they are ignored by union_batch.
+    /// The SSE path transforms four AABBs per iteration and gives the same result as
+    /// the scalar version.
+    inline void post_transform_batch(
+        const AABBSoA& in,
+        const glm::mat4* M,
+        AABBSoA& out)
+    {
+        const size_t n = in.size();
+        out.resize(n);
+        size_t i = 0;
+
+#ifdef EENG_SSE
+        const __m128 neg_min = _mm_set1_ps(std::numeric_limits<float>::max());
+        const __m128 neg_max = _mm_set1_ps(std::numeric_limits<float>::lowest());
+        const float* in_min[3] = { in.min_x.data(), in.min_y.data(), in.min_z.data() };
+        const float* in_max[3] = { in.max_x.data(), in.max_y.data(), in.max_z.data() };
+        float* out_min[3] = { out.min_x.data(), out.min_y.data(), out.min_z.data() };
+        float* out_max[3] = { out.max_x.data(), out.max_y.data(), out.max_z.data() };
+
+        for (; i + 4 <= n; i += 4)
+        {
+            // Transpose the four matrices so that m[col][row] holds
+            // element (col, row) for each of the four AABBs
+            __m128 m[4][4];
+            for (int col = 0; col < 4; col++)
+            {
+                __m128 r0 = _mm_loadu_ps(glm::value_ptr(M[i + 0]) + 4 * col);
+                __m128 r1 = _mm_loadu_ps(glm::value_ptr(M[i + 1]) + 4 * col);
+                __m128 r2 = _mm_loadu_ps(glm::value_ptr(M[i + 2]) + 4 * col);
+                __m128 r3 = _mm_loadu_ps(glm::value_ptr(M[i + 3]) + 4 * col);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                m[col][0] = r0; m[col][1] = r1; m[col][2] = r2; m[col][3] = r3;
+            }
+
+            __m128 bmin[3], bmax[3];
+            for (int j = 0; j < 3; j++)
+            {
+                bmin[j] = _mm_loadu_ps(in_min[j] + i);
+                bmax[j] = _mm_loadu_ps(in_max[j] + i);
+            }
+            const __m128 valid = _mm_and_ps(
+                _mm_and_ps(_mm_cmpgt_ps(bmax[0], bmin[0]), _mm_cmpgt_ps(bmax[1], bmin[1])),
+                _mm_cmpgt_ps(bmax[2], bmin[2]));
+
+            // For all three axes
+            for (int k = 0; k < 3; k++)
+            {
+                // Start by adding in translation
+                __m128 lo = m[3][k], hi = m[3][k];
+                // Form extent by summing smaller and larger terms respectively
+                for (int j = 0; j < 3; j++)
+                {
+                    const __m128 e = _mm_mul_ps(m[j][k], bmin[j]);
+                    const __m128 f = _mm_mul_ps(m[j][k], bmax[j]);
+                    lo = _mm_add_ps(lo, _mm_min_ps(e, f));
+                    hi = _mm_add_ps(hi, _mm_max_ps(e, f));
+                }
+                lo = _mm_or_ps(_mm_and_ps(valid, lo), _mm_andnot_ps(valid, neg_min));
+                hi = _mm_or_ps(_mm_and_ps(valid, hi), _mm_andnot_ps(valid, neg_max));
+                _mm_storeu_ps(out_min[k] + i, lo);
+                _mm_storeu_ps(out_max[k] + i, hi);
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            AABB aabb = in.get(i);
+            out.set(i, aabb ? aabb.post_transform(M[i]) : AABB{});
+        }
+    }
+
+    /// Union of all AABBs in a set, i.e. the AABB that contains them all.
+    /// AABBs in negative-space state do not contribute.
+    inline AABB union_batch(const AABBSoA& aabbs)
+    {
+        const size_t n = aabbs.size();
+        AABB result;
+        size_t i = 0;
+
+#ifdef EENG_SSE
+        if (n >= 4)
+        {
+            __m128 min_x = _mm_set1_ps(std::numeric_limits<float>::max());
+            __m128 min_y = min_x, min_z = min_x;
+            __m128 max_x = _mm_set1_ps(std::numeric_limits<float>::lowest());
+            __m128 max_y = max_x, max_z = max_x;
+
+            for (; i + 4 <= n; i += 4)
+            {
+                min_x = _mm_min_ps(min_x, _mm_loadu_ps(aabbs.min_x.data() + i));
+                min_y = _mm_min_ps(min_y, _mm_loadu_ps(aabbs.min_y.data() + i));
+                min_z = _mm_min_ps(min_z, _mm_loadu_ps(aabbs.min_z.data() + i));
+                max_x = _mm_max_ps(max_x, _mm_loadu_ps(aabbs.max_x.data() + i));
+                max_y = _mm_max_ps(max_y, _mm_loadu_ps(aabbs.max_y.data() + i));
+                max_z = _mm_max_ps(max_z, _mm_loadu_ps(aabbs.max_z.data() + i));
+            }
+
+            // Horizontal reduction of the four lanes
+            alignas(16) float lanes[6][4];
+            _mm_store_ps(lanes[0], min_x); _mm_store_ps(lanes[1], min_y); _mm_store_ps(lanes[2], min_z);
+            _mm_store_ps(lanes[3], max_x); _mm_store_ps(lanes[4], max_y); _mm_store_ps(lanes[5], max_z);
+            for (int l = 0; l < 4; l++)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    result.min[k] = std::fminf(result.min[k], lanes[k][l]);
+                    result.max[k] = std::fmaxf(result.max[k], lanes[3 + k][l]);
+                }
+            }
+        }
+#endif
+        for (; i < n; i++)
+        {
+            result.min.x = std::fminf(result.min.x, aabbs.min_x[i]);
+            result.min.y = std::fminf(result.min.y, aabbs.min_y[i]);
+            result.min.z = std::fminf(result.min.z, aabbs.min_z[i]);
+            result.max.x = std::fmaxf(result.max.x, aabbs.max_x[i]);
+            result.max.y = std::fmaxf(result.max.y, aabbs.max_y[i]);
+            result.max.z = std::fmaxf(result.max.z, aabbs.max_z[i]);
+        }
+
+        return result;
+    }
 } // namespace eeng
 #endif
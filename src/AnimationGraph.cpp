@@ -0,0 +1,247 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <glm/gtc/quaternion.hpp>
+#include "AnimationGraph.hpp"
+#include "config.h"
+
+namespace eeng {
+
+    int PosePool::acquire(size_t nbr_nodes)
+    {
+        int index;
+        if (free_indices.size())
+        {
+            index = free_indices.back();
+            free_indices.pop_back();
+        }
+        else
+        {
+            index = (int)poses.size();
+            poses.emplace_back();
+            free_indices.reserve(poses.size());
+        }
+        poses[index].resize(nbr_nodes);
+        return index;
+    }
+
+    void PosePool::release(int index)
+    {
+        free_indices.push_back(index);
+    }
+
+    LocalPose& PosePool::operator[](int index)
+    {
+        return poses[index];
+    }
+
+    size_t PosePool::size() const
+    {
+        return poses.size();
+    }
+
+    AnimationGraph::NodeHandle AnimationGraph::add_clip(int anim_index, AnmationTimeFormat time_format)
+    {
+        Node node{ NodeType::Clip };
+        node.anim_index = anim_index;
+        node.time_format = time_format;
+        nodes.push_back(std::move(node));
+        return root = (NodeHandle)nodes.size() - 1;
+    }
+
+    AnimationGraph::NodeHandle AnimationGraph::add_blend(const std::vector<NodeHandle>& inputs)
+    {
+        EENG_ASSERT(inputs.size(), "Blend node without inputs");
+        Node node{ NodeType::Blend };
+        node.inputs = inputs;
+        node.weights.assign(inputs.size(), 0.0f);
+        node.weights[0] = 1.0f;
+        nodes.push_back(std::move(node));
+        return root = (NodeHandle)nodes.size() - 1;
+    }
+
+    AnimationGraph::NodeHandle AnimationGraph::add_layer(NodeHandle base, NodeHandle layer, bool additive, NodeHandle reference)
+    {
+        Node node{ NodeType::Layer };
+        node.inputs = { base, layer, reference };
+        node.additive = additive;
+        nodes.push_back(std::move(node));
+        return root = (NodeHandle)nodes.size() - 1;
+    }
+
+    void AnimationGraph::set_time(NodeHandle clip, float time)
+    {
+        EENG_ASSERT(nodes[clip].type == NodeType::Clip, "Node {0} is not a clip", clip);
+        nodes[clip].time = time;
+    }
+
+    void AnimationGraph::set_input_weight(NodeHandle blend, int input, float weight)
+    {
+        EENG_ASSERT(nodes[blend].type == NodeType::Blend, "Node {0} is not a blend", blend);
+        nodes[blend].weights[input] = weight;
+    }
+
+    void AnimationGraph::set_layer_weight(NodeHandle layer, float weight)
+    {
+        EENG_ASSERT(nodes[layer].type == NodeType::Layer, "Node {0} is not a layer", layer);
+        nodes[layer].weight = weight;
+    }
+
+    void AnimationGraph::set_layer_mask(NodeHandle layer, const RenderableMesh& mesh, const std::vector<std::string>& node_names)
+    {
+        EENG_ASSERT(nodes[layer].type == NodeType::Layer, "Node {0} is not a layer", layer);
+        auto& mask = nodes[layer].mask;
+        mask.clear();
+        if (node_names.empty())
+            return;
+
+        mask.assign(mesh.m_nodetree.size(), 0.0f);
+        for (auto& name : node_names)
+        {
+            const size_t node_index = mesh.m_nodetree.find_node_index(name);
+            if (node_index == VecTree_NullIndex)
+                continue;
+            auto [node, nbr_children, branch_stride, parent_ofs] = mesh.m_nodetree.get_node_info_at(node_index);
+            for (size_t i = node_index; i < node_index + branch_stride; i++)
+                mask[i] = 1.0f;
+        }
+    }
+
+    void AnimationGraph::set_root(NodeHandle node)
+    {
+        root = node;
+    }
+
+    void AnimationGraph::evaluate(RenderableMesh& mesh)
+    {
+        EENG_ASSERT(root != NoNode, "Evaluating an empty graph");
+        const int buffer = evaluate_node(root, mesh);
+        mesh.setLocalPose(pool[buffer]);
+        pool.release(buffer);
+    }
+
+    void AnimationGraph::evaluate(const RenderableMesh& mesh, LocalPose& pose)
+    {
+        EENG_ASSERT(root != NoNode, "Evaluating an empty graph");
+        const int buffer = evaluate_node(root, mesh);
+        pose = pool[buffer];
+        pool.release(buffer);
+    }
+
+    int AnimationGraph::evaluate_node(NodeHandle handle, const RenderableMesh& mesh)
+    {
+        const auto& node = nodes[handle];
+        switch (node.type)
+        {
+        case NodeType::Blend:
+            return evaluate_blend(node, mesh);
+        case NodeType::Layer:
+            return evaluate_layer(node, mesh);
+        default:
+        {
+            const int buffer = pool.acquire(mesh.m_nodetree.size());
+            mesh.sampleLocalPose(node.anim_index, node.time, pool[buffer], node.time_format);
+            return buffer;
+        }
+        }
+    }
+
+    int AnimationGraph::evaluate_blend(const Node& node, const RenderableMesh& mesh)
+    {
+        float total_weight = 0.0f;
+        int nbr_active = 0;
+        size_t last_active = 0;
+        for (size_t i = 0; i < node.inputs.size(); i++)
+        {
+            if (node.weights[i] <= 0.0f)
+                continue;
+            total_weight += node.weights[i];
+            nbr_active++;
+            last_active = i;
+        }
+
+        // Inputs without weight are not evaluated
+        if (nbr_active <= 1)
+            return evaluate_node(node.inputs[last_active], mesh);
+
+        const size_t nbr_nodes = mesh.m_nodetree.size();
+        const int result = pool.acquire(nbr_nodes);
+        bool first = true;
+        for (size_t i = 0; i < node.inputs.size(); i++)
+        {
+            if (node.weights[i] <= 0.0f)
+                continue;
+            const float w = node.weights[i] / total_weight;
+            const int buffer = evaluate_node(node.inputs[i], mesh);
+
+            // Evaluating inputs may grow the pool, so buffers are looked up afterwards
+            auto& out = pool[result];
+            const auto& in = pool[buffer];
+
+            if (first)
+            {
+                for (size_t n = 0; n < nbr_nodes; n++)
+                {
+                    out[n].pos = in[n].pos * w;
+                    out[n].rot = in[n].rot * w;
+                    out[n].scale = in[n].scale * w;
+                }
+                first = false;
+            }
+            else
+            {
+                // Rotations are accumulated in the hemisphere of the first input
+                for (size_t n = 0; n < nbr_nodes; n++)
+                {
+                    out[n].pos += in[n].pos * w;
+                    out[n].rot += in[n].rot * (glm::dot(out[n].rot, in[n].rot) < 0.0f ? -w : w);
+                    out[n].scale += in[n].scale * w;
+                }
+            }
+            pool.release(buffer);
+        }
+
+        for (auto& trs : pool[result])
+            trs.rot = glm::normalize(trs.rot);
+        return result;
+    }
+
+    int AnimationGraph::evaluate_layer(const Node& node, const RenderableMesh& mesh)
+    {
+        const int base = evaluate_node(node.inputs[0], mesh);
+        if (node.weight <= 0.0f)
+            return base;
+        const int layer = evaluate_node(node.inputs[1], mesh);
+        const int reference = (node.additive && node.inputs[2] != NoNode) ? evaluate_node(node.inputs[2], mesh) : -1;
+
+        auto& out = pool[base];
+        const auto& in = pool[layer];
+        const auto& ref = reference >= 0 ? pool[reference] : mesh.getBindPose();
+        for (size_t n = 0; n < out.size(); n++)
+        {
+            const float w = node.weight * (node.mask.size() ? node.mask[n] : 1.0f);
+            if (w <= 0.0f)
+                continue;
+
+            if (node.additive)
+            {
+                // Delta from the reference, applied on top of the base
+                const glm::quat delta_rot = glm::inverse(ref[n].rot) * in[n].rot;
+                out[n].pos += (in[n].pos - ref[n].pos) * w;
+                out[n].rot = glm::normalize(out[n].rot * glm::slerp(glm::quat(1.0f, 0.0f, 0.0f, 0.0f), delta_rot, w));
+                out[n].scale *= glm::mix(glm::vec3(1.0f), in[n].scale / ref[n].scale, w);
+            }
+            else
+            {
+                out[n].pos = glm::mix(out[n].pos, in[n].pos, w);
+                out[n].rot = glm::slerp(out[n].rot, in[n].rot, w);
+                out[n].scale = glm::mix(out[n].scale, in[n].scale, w);
+            }
+        }
+
+        pool.release(layer);
+        if (reference >= 0)
+            pool.release(reference);
+        return base;
+    }
+
+} // namespace eeng
@@ -0,0 +1,119 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef AnimationGraph_hpp
+#define AnimationGraph_hpp
+
+#include <vector>
+#include <string>
+#include "RenderableMesh.hpp"
+
+namespace eeng {
+
+    /// @brief Reusable local pose buffers. Once warmed up, acquiring a buffer does not allocate.
+    class PosePool
+    {
+    public:
+        /// @brief Get a free buffer
+        /// @param nbr_nodes Number of nodes of the pose
+        /// @return Buffer index
+        int acquire(size_t nbr_nodes);
+
+        /// @brief Return a buffer to the pool
+        void release(int index);
+
+        LocalPose& operator[](int index);
+
+        /// @brief Number of buffers allocated so far
+        size_t size() const;
+
+    private:
+        std::vector<LocalPose> poses;
+        std::vector<int> free_indices;
+    };
+
+    /// @brief Evaluates a tree of clips, N-way blends and masked layers into a mesh pose.
+    /// Each clip is sampled once into a pooled buffer, and blend and layer nodes combine buffers.
+    ///
+    /// Build the graph once, then per frame set times and weights and call evaluate().
+    class AnimationGraph
+    {
+    public:
+        using NodeHandle = int;
+        static constexpr NodeHandle NoNode = -1;
+
+        /// @brief Add a clip node
+        /// @param anim_index Clip index of the mesh. Use -1 for bind pose.
+        /// @param time_format Interpretation of time when mapping to keyframes.
+        NodeHandle add_clip(int anim_index, AnmationTimeFormat time_format = AnmationTimeFormat::RealTime);
+
+        /// @brief Add a blend node with a weight per input. Weights are normalized when evaluated.
+        /// @param inputs Nodes to blend. Initial weights are 1 for the first input and 0 for the rest.
+        NodeHandle add_blend(const std::vector<NodeHandle>& inputs);
+
+        /// @brief Add a layer that overrides or adds to a base pose, weighted per node by a mask
+        /// @param base Base pose
+        /// @param layer Layered pose
+        /// @param additive If true, the difference between layer and reference is added to the base.
+        ///                 Otherwise the base is blended toward the layer.
+        /// @param reference Reference of an additive layer, e.g. the first frame of its clip. NoNode for bind pose.
+        NodeHandle add_layer(NodeHandle base, NodeHandle layer, bool additive, NodeHandle reference = NoNode);
+
+        /// @brief Set the time of a clip node
+        void set_time(NodeHandle clip, float time);
+
+        /// @brief Set the weight of an input of a blend node
+        void set_input_weight(NodeHandle blend, int input, float weight);
+
+        /// @brief Set the overall weight of a layer node
+        void set_layer_weight(NodeHandle layer, float weight);
+
+        /// @brief Restrict a layer to named nodes and their descendants
+        /// @param layer Layer node
+        /// @param mesh Mesh the graph is evaluated for
+        /// @param node_names Roots of the masked branches. Empty to clear the mask.
+        void set_layer_mask(NodeHandle layer, const RenderableMesh& mesh, const std::vector<std::string>& node_names);
+
+        /// @brief Set the node to evaluate. Defaults to the last node added.
+        void set_root(NodeHandle node);
+
+        /// @brief Evaluate the graph and pose the mesh
+        void evaluate(RenderableMesh& mesh);
+
+        /// @brief Evaluate the graph into a local pose without posing the mesh
+        /// @param pose Output pose
+        void evaluate(const RenderableMesh& mesh, LocalPose& pose);
+
+    private:
+        enum class NodeType { Clip, Blend, Layer };
+
+        struct Node
+        {
+            NodeType type;
+
+            // Clip
+            int anim_index = -1;
+            AnmationTimeFormat time_format = AnmationTimeFormat::RealTime;
+            float time = 0.0f;
+
+            // Blend: all inputs. Layer: base, layer and optionally reference.
+            std::vector<NodeHandle> inputs;
+            std::vector<float> weights;
+
+            // Layer
+            bool additive = false;
+            float weight = 1.0f;
+            std::vector<float> mask;    // Per node, empty for all nodes
+        };
+
+        std::vector<Node> nodes;
+        NodeHandle root = NoNode;
+        PosePool pool;
+
+        int evaluate_node(NodeHandle handle, const RenderableMesh& mesh);
+        int evaluate_blend(const Node& node, const RenderableMesh& mesh);
+        int evaluate_layer(const Node& node, const RenderableMesh& mesh);
+    };
+
+} // namespace eeng
+
+#endif /* AnimationGraph_hpp */
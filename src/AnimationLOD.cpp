@@ -0,0 +1,137 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/gtc/quaternion.hpp>
+#include "AnimationLOD.hpp"
+
+namespace eeng {
+
+    void AnimationLOD::begin_frame(const glm::mat4& ProjMatrix, const glm::mat4& ViewMatrix)
+    {
+        P = ProjMatrix;
+        V = ViewMatrix;
+        pending.clear();
+        frame_stats = Stats{};
+    }
+
+    void AnimationLOD::request(AnimationLODState& state, const RenderableMesh& mesh, const glm::mat4& WorldMatrix, int anim_index)
+    {
+        // Projected height of the bounding sphere relative to the viewport.
+        // The mesh may be shared, so its bounds are those of another instance once this one has a pose.
+        const AABB& bounds = state.pose.empty() || !state.bounds ? mesh.m_model_aabb : state.bounds;
+        const glm::vec4 sphere = bounds.post_transform(WorldMatrix).getBoundingSphere();
+        const float depth = std::max(-(V * glm::vec4(glm::vec3(sphere), 1.0f)).z, 1e-3f);
+        state.screen_size = sphere.w * P[1][1] / depth;
+
+        // Instances without a cached pose are animated in full once
+        if (!settings.enabled || state.pose.empty())
+        {
+            state.interval = 1;
+            state.reduced_detail = false;
+            state.frozen = false;
+        }
+        else
+        {
+            const float rel_size = std::max(state.screen_size / settings.full_rate_size, 1e-3f);
+            state.interval = rel_size >= 1.0f ? 1 : std::min(settings.max_interval, (int)std::ceil(1.0f / rel_size));
+            state.reduced_detail = state.screen_size < settings.reduced_detail_size;
+            state.frozen = state.screen_size < settings.freeze_size;
+        }
+
+        state.cost = mesh.getNbrAnimatedNodes(anim_index, state.reduced_detail);
+        state.granted = false;
+        state.wants_update = !state.frozen && (state.pose.empty() || state.frames_since_update + 1 >= state.interval);
+        if (state.wants_update)
+            pending.push_back(&state);
+    }
+
+    void AnimationLOD::grant()
+    {
+        auto priority = [](const AnimationLODState* state)
+        {
+            if (state->pose.empty())
+                return std::numeric_limits<float>::max();
+            return state->screen_size * float(state->frames_since_update + 1) / state->interval;
+        };
+        std::sort(pending.begin(), pending.end(), [&](auto a, auto b) { return priority(a) > priority(b); });
+
+        // Smaller requests later in the queue may still fit when a larger one does not
+        unsigned spent = 0;
+        for (auto state : pending)
+        {
+            if (!settings.enabled || state->pose.empty() || spent + state->cost <= settings.node_budget)
+            {
+                state->granted = true;
+                spent += state->cost;
+            }
+            else
+                frame_stats.deferred++;
+        }
+    }
+
+    void AnimationLOD::animate(AnimationLODState& state, RenderableMesh& mesh, int anim_index, float time)
+    {
+        float frac = 1.0f;
+        if (state.granted)
+        {
+            std::swap(state.prev_pose, state.pose);
+            mesh.sampleLocalPose(anim_index, time, state.pose, AnmationTimeFormat::RealTime, state.reduced_detail);
+            if (state.prev_pose.size() != state.pose.size())
+                state.prev_pose = state.pose;
+            state.global_pose.clear();
+            state.frames_since_update = 0;
+
+            frame_stats.updated++;
+            frame_stats.nodes_evaluated += state.cost;
+            frac = 1.0f / state.interval;
+        }
+        else if (state.frozen)
+        {
+            state.frames_since_update++;
+            frame_stats.frozen++;
+        }
+        else
+        {
+            state.frames_since_update++;
+            frame_stats.interpolated++;
+            frac = std::min(1.0f, float(state.frames_since_update + 1) / state.interval);
+        }
+
+        // The mesh may be shared, so the pose of this instance is always set.
+        // Poses trail by up to one interval, so that updates blend in without popping.
+        // Global transforms of the last update are kept, so held and frozen poses are not rebuilt.
+        if (frac >= 1.0f)
+        {
+            if (state.global_pose.empty())
+            {
+                mesh.setLocalPose(state.pose);
+                mesh.getPose(state.global_pose);
+                state.bounds = mesh.m_model_aabb;
+            }
+            else
+                mesh.setPose(state.global_pose);
+            return;
+        }
+
+        // Blending local transforms keeps bones rigid, where blending global matrices would shear them
+        scratch_pose.resize(state.pose.size());
+        for (size_t i = 0; i < state.pose.size(); i++)
+        {
+            const auto& a = state.prev_pose[i];
+            const auto& b = state.pose[i];
+            scratch_pose[i].pos = glm::mix(a.pos, b.pos, frac);
+            scratch_pose[i].rot = glm::slerp(a.rot, b.rot, frac);
+            scratch_pose[i].scale = glm::mix(a.scale, b.scale, frac);
+        }
+        mesh.setLocalPose(scratch_pose);
+        state.bounds = mesh.m_model_aabb;
+    }
+
+    const AnimationLOD::Stats& AnimationLOD::stats() const
+    {
+        return frame_stats;
+    }
+
+} // namespace eeng
@@ -0,0 +1,94 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef AnimationLOD_hpp
+#define AnimationLOD_hpp
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "RenderableMesh.hpp"
+
+namespace eeng {
+
+    /// @brief Animation level of detail of one animated instance
+    struct AnimationLODState
+    {
+        LocalPose prev_pose;                ///< Local node transforms at the update before the last
+        LocalPose pose;                     ///< Local node transforms at the last update
+        std::vector<glm::mat4> global_pose; ///< Global node transforms of pose, once computed
+        AABB bounds;                        ///< Model space bounds of pose
+        float screen_size = 0.0f;           ///< Projected height as a fraction of the viewport height
+        int interval = 1;                   ///< Frames between updates
+        int frames_since_update = 0;
+        bool reduced_detail = false;        ///< Masked nodes are skipped
+        bool frozen = false;                ///< Pose is kept as is
+
+        // Set by AnimationLOD::request and grant
+        unsigned cost = 0;
+        bool wants_update = false;
+        bool granted = false;
+    };
+
+    /// @brief Selects animation update rate and detail per instance, within a per-frame node budget.
+    /// Instances are updated every Nth frame based on their projected size and interpolated in between,
+    /// by blending local node transforms (lerp of translation and scale, slerp of rotation).
+    /// Small instances skip masked nodes (see RenderableMesh::buildLodMask), the smallest are frozen.
+    ///
+    /// Per frame: begin_frame(), request() for every instance, grant(), then animate() for every instance.
+    class AnimationLOD
+    {
+    public:
+        struct Settings
+        {
+            float full_rate_size = 0.25f;   ///< Instances at least this large update every frame
+            float reduced_detail_size = 0.1f; ///< Below this, masked nodes are skipped
+            float freeze_size = 0.02f;      ///< Below this, poses are frozen
+            int max_interval = 8;           ///< Longest update interval of instances that are not frozen
+            unsigned node_budget = 2048;    ///< Nodes evaluated per frame across all instances
+            bool enabled = true;            ///< If false, every instance updates at full detail
+        } settings;
+
+        struct Stats
+        {
+            unsigned nodes_evaluated = 0;
+            int updated = 0;
+            int interpolated = 0;
+            int frozen = 0;
+            int deferred = 0;               ///< Due for update but over budget
+        };
+
+        /// @brief Start a frame
+        /// @param ProjMatrix Projection matrix, used for projected sizes
+        /// @param ViewMatrix View matrix
+        void begin_frame(const glm::mat4& ProjMatrix, const glm::mat4& ViewMatrix);
+
+        /// @brief Choose the level of detail of an instance and queue it for update if due
+        /// @param state Instance state
+        /// @param mesh Mesh of the instance. Sizes instances that have no pose yet, by its current bounds.
+        /// @param WorldMatrix Instance world transform
+        /// @param anim_index Clip the instance is animated with
+        void request(AnimationLODState& state, const RenderableMesh& mesh, const glm::mat4& WorldMatrix, int anim_index);
+
+        /// @brief Grant updates to queued instances in order of priority until the budget is spent.
+        /// Priority grows with projected size and time since the last update, so deferred instances are not starved.
+        void grant();
+
+        /// @brief Pose a mesh for an instance: animate it if granted, otherwise interpolate or reuse its cached pose
+        /// @param state Instance state, requested this frame
+        /// @param mesh Mesh of the instance
+        /// @param anim_index Clip index
+        /// @param time Animation time
+        void animate(AnimationLODState& state, RenderableMesh& mesh, int anim_index, float time);
+
+        /// @brief Statistics of the current frame
+        const Stats& stats() const;
+
+    private:
+        glm::mat4 P{ 1.0f }, V{ 1.0f };
+        std::vector<AnimationLODState*> pending;
+        Stats frame_stats;
+        LocalPose scratch_pose;
+    };
+
+} // namespace eeng
+
+#endif /* AnimationLOD_hpp */
@@ -0,0 +1,811 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef EENG_BVH_h
+#define EENG_BVH_h
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "AABB.h"
+#include "glmcommon.hpp"
+#include "config.h"
+#ifdef EENG_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace eeng
+{
+    /// View frustum as six planes (xyz = normal, w = distance) facing inwards,
+    /// extracted from a projection-view matrix (Gribb & Hartmann).
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+
+        Frustum() = default;
+
+        explicit Frustum(const glm::mat4& PV)
+        {
+            const glm::vec4 row3{ PV[0][3], PV[1][3], PV[2][3], PV[3][3] };
+            for (int i = 0; i < 3; i++)
+            {
+                const glm::vec4 row{ PV[0][i], PV[1][i], PV[2][i], PV[3][i] };
+                planes[2 * i + 0] = row3 + row;
+                planes[2 * i + 1] = row3 - row;
+            }
+        }
+
+        /// @brief Classify AABB against the frustum
+        /// @return -1 if outside, 0 if intersecting, 1 if fully inside
+        inline int classify(const AABB& aabb) const
+        {
+            int result = 1;
+            for (const auto& p : planes)
+            {
+                // Corners farthest along and against the plane normal
+                glm::vec3 pv, nv;
+                for (int k = 0; k < 3; k++)
+                {
+                    pv[k] = p[k] >= 0.0f ? aabb.max[k] : aabb.min[k];
+                    nv[k] = p[k] >= 0.0f ? aabb.min[k] : aabb.max[k];
+                }
+                if (glm::dot(glm::vec3(p), pv) + p.w < 0.0f)
+                    return -1;
+                if (glm::dot(glm::vec3(p), nv) + p.w < 0.0f)
+                    result = 0;
+            }
+            return result;
+        }
+
+        /// @brief Test a sphere against the frustum. Planes need not be normalized.
+        /// @return False if the sphere is fully outside some plane
+        inline bool intersects_sphere(const glm::vec3& center, float radius) const
+        {
+            for (const auto& p : planes)
+            {
+                const glm::vec3 n{ p };
+                if (glm::dot(n, center) + p.w < -radius * glm::length(n))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    /// Stack of nodes to visit during traversal. Lives on the call stack, and only
+    /// spills to the heap for trees deeper than N (the tree is not strictly balanced).
+    template<class T, int N = 64>
+    class TraversalStack
+    {
+    public:
+        inline bool empty() const { return count == 0; }
+
+        inline void push(const T& item)
+        {
+            if (count < N)
+                local[count] = item;
+            else
+                spill.push_back(item);
+            count++;
+        }
+
+        inline T pop()
+        {
+            count--;
+            if (count < N)
+                return local[count];
+            const T item = spill.back();
+            spill.pop_back();
+            return item;
+        }
+
+    private:
+        T local[N];
+        std::vector<T> spill;
+        int count = 0;
+    };
+
+    /**
+    Dynamic bounding volume hierarchy over AABBs, e.g. entity world bounds.
+    Leaves are stored with a fattened AABB so that small movements do not affect the tree.
+    Moved leaves mark their ancestors, which are refit incrementally by refit().
+    The tree is rebuilt top-down using a binned SAH when its quality has degraded.
+    Proxy ids are stable for the lifetime of a leaf, also across rebuilds.
+    */
+    class BVH
+    {
+    public:
+        using ProxyId = int;
+
+        /// Ray filter that accepts all proxies
+        struct AcceptAll
+        {
+            inline bool operator()(ProxyId) const { return true; }
+        };
+
+        /// @param fat_margin Margin added to leaf AABBs
+        explicit BVH(float fat_margin = 0.1f)
+            : fat_margin(fat_margin)
+        {
+        }
+
+        /// @brief Insert an AABB
+        /// @param aabb World AABB
+        /// @param user_data Data associated with the AABB, e.g. an entity id
+        /// @return Proxy id for later updates and removal
+        ProxyId insert(const AABB& aabb, uint32_t user_data)
+        {
+            const int leaf = alloc_node();
+            nodes[leaf].aabb = aabb;
+            nodes[leaf].fat = fatten(aabb);
+            nodes[leaf].user_data = user_data;
+            nodes[leaf].height = 0;
+            insert_leaf(leaf);
+            leaf_count++;
+            return leaf;
+        }
+
+        void remove(ProxyId proxy)
+        {
+            EENG_ASSERT(is_leaf_proxy(proxy), "{0} is not a valid proxy", proxy);
+            remove_leaf(proxy);
+            free_node(proxy);
+            leaf_count--;
+        }
+
+        /// @brief Update the AABB of a proxy. Call refit() before doing queries.
+        /// @return True if the leaf moved outside its fattened AABB
+        bool update(ProxyId proxy, const AABB& aabb)
+        {
+            EENG_ASSERT(is_leaf_proxy(proxy), "{0} is not a valid proxy", proxy);
+            nodes[proxy].aabb = aabb;
+            if (contains(nodes[proxy].fat, aabb))
+                return false;
+
+            nodes[proxy].fat = fatten(aabb);
+            // Mark path to root, stopping at nodes that are already marked
+            for (int i = nodes[proxy].parent; i != EENG_NULL_INDEX && !nodes[i].dirty; i = nodes[i].parent)
+                nodes[i].dirty = true;
+            return true;
+        }
+
+        /// Refit internal nodes above leaves that have moved
+        void refit()
+        {
+            if (root != EENG_NULL_INDEX && nodes[root].dirty)
+                refit_node(root);
+        }
+
+        /// Rebuild the tree top-down using binned SAH
+        void rebuild()
+        {
+            std::vector<int> leaves;
+            leaves.reserve(leaf_count);
+            for (int i = 0; i < nodes.size(); i++)
+            {
+                if (nodes[i].height == 0)
+                {
+                    nodes[i].fat = fatten(nodes[i].aabb);
+                    leaves.push_back(i);
+                }
+                else if (nodes[i].height > 0)
+                    free_node(i);
+            }
+
+            root = EENG_NULL_INDEX;
+            internal_area = 0.0;
+            if (!leaves.empty())
+            {
+                root = build_range(leaves, 0, (int)leaves.size());
+                nodes[root].parent = EENG_NULL_INDEX;
+            }
+            rebuild_cost = sah_cost();
+        }
+
+        /// @brief Refit, and rebuild if the SAH cost has grown since the last rebuild
+        /// @param ratio Allowed cost growth
+        /// @return True if the tree was rebuilt
+        bool rebuild_if_degraded(float ratio = 1.5f)
+        {
+            refit();
+            if (leaf_count < 2 || sah_cost() <= rebuild_cost * ratio)
+                return false;
+            rebuild();
+            return true;
+        }
+
+        /// @brief Find the nearest AABB hit by a ray.
+        /// Follows the convention of glm_aux::intersect_ray_AABB: only hits closer than
+        /// ray.z_near are considered, and ray.z_near is set to the distance of the hit.
+        /// @param ray Ray to test
+        /// @param filter Predicate for proxies to consider, bool(ProxyId)
+        /// @return Proxy id of nearest hit, or EENG_NULL_INDEX
+        template<class F = AcceptAll>
+        ProxyId query_ray(glm_aux::Ray& ray, F&& filter = F{}) const
+        {
+            EENG_ASSERT(!is_dirty(), "BVH queried before refit");
+            ProxyId hit = EENG_NULL_INDEX;
+            const glm::vec3 inv_dir = 1.0f / ray.dir;
+
+            struct Entry { int index; float t; };
+            TraversalStack<Entry> stack;
+            float t;
+            if (root == EENG_NULL_INDEX || !intersect_ray(ray.origin, inv_dir, nodes[root].fat, ray.z_near, t))
+                return hit;
+            stack.push({ root, t });
+
+            while (!stack.empty())
+            {
+                const Entry entry = stack.pop();
+                if (entry.t > ray.z_near)
+                    continue;
+
+                const Node& node = nodes[entry.index];
+                if (node.is_leaf())
+                {
+                    if (intersect_ray(ray.origin, inv_dir, node.aabb, ray.z_near, t) && filter(entry.index))
+                    {
+                        ray.z_near = t;
+                        hit = entry.index;
+                    }
+                    continue;
+                }
+
+                // Visit the nearest child first
+                float tl, tr;
+                const bool hl = intersect_ray(ray.origin, inv_dir, nodes[node.left].fat, ray.z_near, tl);
+                const bool hr = intersect_ray(ray.origin, inv_dir, nodes[node.right].fat, ray.z_near, tr);
+                if (hl && hr)
+                {
+                    if (tl < tr)
+                    {
+                        stack.push({ node.right, tr });
+                        stack.push({ node.left, tl });
+                    }
+                    else
+                    {
+                        stack.push({ node.left, tl });
+                        stack.push({ node.right, tr });
+                    }
+                }
+                else if (hl)
+                    stack.push({ node.left, tl });
+                else if (hr)
+                    stack.push({ node.right, tr });
+            }
+            return hit;
+        }
+
+        /// @brief Find the nearest hits for a packet of four rays, traversing the tree once.
+        /// Rays are updated the same way as for query_ray.
+        /// @param rays Rays to test
+        /// @param hits Proxy id of nearest hit per ray, or EENG_NULL_INDEX
+        /// @param filter Predicate for proxies to consider, bool(ProxyId)
+        template<class F = AcceptAll>
+        void query_ray_packet(glm_aux::Ray(&rays)[4], ProxyId(&hits)[4], F&& filter = F{}) const
+        {
+            EENG_ASSERT(!is_dirty(), "BVH queried before refit");
+#ifdef EENG_SSE
+            for (int k = 0; k < 4; k++)
+                hits[k] = EENG_NULL_INDEX;
+            if (root == EENG_NULL_INDEX)
+                return;
+
+            __m128 origin[3], inv_dir[3];
+            for (int j = 0; j < 3; j++)
+            {
+                origin[j] = _mm_setr_ps(rays[0].origin[j], rays[1].origin[j], rays[2].origin[j], rays[3].origin[j]);
+                inv_dir[j] = _mm_div_ps(_mm_set1_ps(1.0f),
+                    _mm_setr_ps(rays[0].dir[j], rays[1].dir[j], rays[2].dir[j], rays[3].dir[j]));
+            }
+            __m128 t_max = _mm_setr_ps(rays[0].z_near, rays[1].z_near, rays[2].z_near, rays[3].z_near);
+
+            TraversalStack<int> stack;
+            stack.push(root);
+            while (!stack.empty())
+            {
+                const int index = stack.pop();
+
+                const Node& node = nodes[index];
+                __m128 t_entry;
+                if (!_mm_movemask_ps(intersect_ray_packet(origin, inv_dir, node.fat, t_max, t_entry)))
+                    continue;
+
+                if (!node.is_leaf())
+                {
+                    stack.push(node.right);
+                    stack.push(node.left);
+                    continue;
+                }
+
+                const int mask = _mm_movemask_ps(intersect_ray_packet(origin, inv_dir, node.aabb, t_max, t_entry));
+                if (!mask || !filter(index))
+                    continue;
+                alignas(16) float t[4];
+                _mm_store_ps(t, t_entry);
+                for (int k = 0; k < 4; k++)
+                {
+                    if (mask & (1 << k))
+                    {
+                        rays[k].z_near = t[k];
+                        hits[k] = index;
+                    }
+                }
+                t_max = _mm_setr_ps(rays[0].z_near, rays[1].z_near, rays[2].z_near, rays[3].z_near);
+            }
+#else
+            for (int k = 0; k < 4; k++)
+                hits[k] = query_ray(rays[k], filter);
+#endif
+        }
+
+        /// @brief Find AABBs that overlap an AABB
+        /// @param aabb AABB to test
+        /// @param callback Called for each overlapping proxy, void(ProxyId)
+        template<class F>
+        void query_aabb(const AABB& aabb, F&& callback) const
+        {
+            EENG_ASSERT(!is_dirty(), "BVH queried before refit");
+            if (root == EENG_NULL_INDEX)
+                return;
+
+            TraversalStack<int> stack;
+            stack.push(root);
+            while (!stack.empty())
+            {
+                const int index = stack.pop();
+                const Node& node = nodes[index];
+                if (!node.fat.intersect(aabb))
+                    continue;
+
+                if (node.is_leaf())
+                {
+                    if (node.aabb.intersect(aabb))
+                        callback(index);
+                }
+                else
+                {
+                    stack.push(node.right);
+                    stack.push(node.left);
+                }
+            }
+        }
+
+        /// @brief Find AABBs that are inside or intersect a frustum
+        /// @param frustum Frustum to test
+        /// @param callback Called for each proxy in the frustum, void(ProxyId)
+        template<class F>
+        void query_frustum(const Frustum& frustum, F&& callback) const
+        {
+            EENG_ASSERT(!is_dirty(), "BVH queried before refit");
+            if (root == EENG_NULL_INDEX)
+                return;
+
+            TraversalStack<int> stack;
+            stack.push(root);
+            while (!stack.empty())
+            {
+                const int index = stack.pop();
+                const Node& node = nodes[index];
+
+                const int c = frustum.classify(node.fat);
+                if (c < 0)
+                    continue;
+                if (node.is_leaf())
+                {
+                    if (c > 0 || frustum.classify(node.aabb) >= 0)
+                        callback(index);
+                }
+                else if (c > 0)
+                    for_each_leaf(index, callback);
+                else
+                {
+                    stack.push(node.right);
+                    stack.push(node.left);
+                }
+            }
+        }
+
+        inline uint32_t get_user_data(ProxyId proxy) const
+        {
+            EENG_ASSERT(is_leaf_proxy(proxy), "{0} is not a valid proxy", proxy);
+            return nodes[proxy].user_data;
+        }
+
+        inline const AABB& get_aabb(ProxyId proxy) const
+        {
+            EENG_ASSERT(is_leaf_proxy(proxy), "{0} is not a valid proxy", proxy);
+            return nodes[proxy].aabb;
+        }
+
+        /// Number of proxies
+        inline int size() const
+        {
+            return leaf_count;
+        }
+
+        inline int height() const
+        {
+            return root == EENG_NULL_INDEX ? 0 : nodes[root].height;
+        }
+
+        inline bool is_dirty() const
+        {
+            return root != EENG_NULL_INDEX && nodes[root].dirty;
+        }
+
+        /// @brief SAH cost of the tree: total surface area of internal nodes relative the root.
+        /// The total is kept up to date as nodes change, so this is cheap to call every frame.
+        float sah_cost() const
+        {
+            if (root == EENG_NULL_INDEX || nodes[root].is_leaf())
+                return 0.0f;
+            return float(internal_area / surface_area(nodes[root].fat));
+        }
+
+        /// @brief sah_cost() computed from all nodes, for validation
+        float compute_sah_cost() const
+        {
+            if (root == EENG_NULL_INDEX || nodes[root].is_leaf())
+                return 0.0f;
+
+            double area = 0.0;
+            for (const auto& node : nodes)
+            {
+                if (node.height > 0)
+                    area += surface_area(node.fat);
+            }
+            return float(area / surface_area(nodes[root].fat));
+        }
+
+    private:
+        struct Node
+        {
+            AABB fat;                       // Node bounds, fattened for leaves
+            AABB aabb;                      // Exact bounds (leaves)
+            int parent = EENG_NULL_INDEX;   // Parent, or next free node
+            int left = EENG_NULL_INDEX;
+            int right = EENG_NULL_INDEX;
+            int height = -1;                // 0 for leaves, -1 for free nodes
+            uint32_t user_data = 0;
+            bool dirty = false;             // Has a descendant leaf that moved
+
+            inline bool is_leaf() const { return left == EENG_NULL_INDEX; }
+        };
+
+        std::vector<Node> nodes;
+        int root = EENG_NULL_INDEX;
+        int free_list = EENG_NULL_INDEX;
+        int leaf_count = 0;
+        float fat_margin;
+        float rebuild_cost = 0.0f;
+        double internal_area = 0.0;     // Total surface area of internal nodes
+
+        static constexpr int SAHBinCount = 12;
+
+        inline bool is_leaf_proxy(ProxyId proxy) const
+        {
+            return proxy >= 0 && proxy < nodes.size() && nodes[proxy].height == 0;
+        }
+
+        int alloc_node()
+        {
+            if (free_list == EENG_NULL_INDEX)
+            {
+                nodes.emplace_back();
+                return (int)nodes.size() - 1;
+            }
+            const int index = free_list;
+            free_list = nodes[index].parent;
+            nodes[index] = Node{};
+            return index;
+        }
+
+        void free_node(int index)
+        {
+            nodes[index].height = -1;
+            nodes[index].parent = free_list;
+            free_list = index;
+        }
+
+        inline AABB fatten(const AABB& aabb) const
+        {
+            AABB fat = aabb;
+            fat.min -= glm::vec3(fat_margin);
+            fat.max += glm::vec3(fat_margin);
+            return fat;
+        }
+
+        static inline AABB merge(const AABB& a, const AABB& b)
+        {
+            AABB aabb;
+            aabb.min = glm::min(a.min, b.min);
+            aabb.max = glm::max(a.max, b.max);
+            return aabb;
+        }
+
+        static inline bool contains(const AABB& outer, const AABB& inner)
+        {
+            return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+                outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+        }
+
+        static inline float surface_area(const AABB& aabb)
+        {
+            const glm::vec3 d = aabb.max - aabb.min;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+
+        /// Slab test. t is the entry distance, clamped to zero if the origin is inside.
+        static inline bool intersect_ray(
+            const glm::vec3& origin,
+            const glm::vec3& inv_dir,
+            const AABB& aabb,
+            float t_max,
+            float& t)
+        {
+            float t0 = 0.0f, t1 = t_max;
+            for (int k = 0; k < 3; k++)
+            {
+                float tn = (aabb.min[k] - origin[k]) * inv_dir[k];
+                float tf = (aabb.max[k] - origin[k]) * inv_dir[k];
+                if (tn > tf) std::swap(tn, tf);
+                t0 = tn > t0 ? tn : t0;
+                t1 = tf < t1 ? tf : t1;
+            }
+            t = t0;
+            return t0 <= t1;
+        }
+
+#ifdef EENG_SSE
+        /// Slab test for four rays. Returns lane mask of hits.
+        static inline __m128 intersect_ray_packet(
+            const __m128 origin[3],
+            const __m128 inv_dir[3],
+            const AABB& aabb,
+            __m128 t_max,
+            __m128& t_entry)
+        {
+            __m128 t0 = _mm_setzero_ps(), t1 = t_max;
+            for (int k = 0; k < 3; k++)
+            {
+                const __m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.min[k]), origin[k]), inv_dir[k]);
+                const __m128 tf = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.max[k]), origin[k]), inv_dir[k]);
+                t0 = _mm_max_ps(_mm_min_ps(tn, tf), t0);
+                t1 = _mm_min_ps(_mm_max_ps(tn, tf), t1);
+            }
+            t_entry = t0;
+            return _mm_cmple_ps(t0, t1);
+        }
+#endif
+
+        void insert_leaf(int leaf)
+        {
+            if (root == EENG_NULL_INDEX)
+            {
+                root = leaf;
+                nodes[leaf].parent = EENG_NULL_INDEX;
+                return;
+            }
+
+            // Descend towards the sibling with the least increase in surface area
+            const AABB leaf_fat = nodes[leaf].fat;
+            int index = root;
+            while (!nodes[index].is_leaf())
+            {
+                const Node& node = nodes[index];
+                const float area = surface_area(node.fat);
+                const float combined_area = surface_area(merge(node.fat, leaf_fat));
+
+                // Cost of pairing with this node, and cost pushed down to children
+                const float cost = 2.0f * combined_area;
+                const float inheritance_cost = 2.0f * (combined_area - area);
+                auto child_cost = [&](int child)
+                    {
+                        const float merged_area = surface_area(merge(nodes[child].fat, leaf_fat));
+                        if (nodes[child].is_leaf())
+                            return merged_area + inheritance_cost;
+                        return merged_area - surface_area(nodes[child].fat) + inheritance_cost;
+                    };
+                const float cost_left = child_cost(node.left);
+                const float cost_right = child_cost(node.right);
+
+                if (cost < cost_left && cost < cost_right)
+                    break;
+                index = cost_left < cost_right ? node.left : node.right;
+            }
+
+            const int sibling = index;
+            const int old_parent = nodes[sibling].parent;
+            const int new_parent = alloc_node();
+            nodes[new_parent].parent = old_parent;
+            nodes[new_parent].left = sibling;
+            nodes[new_parent].right = leaf;
+            nodes[new_parent].fat = merge(nodes[sibling].fat, leaf_fat);
+            internal_area += surface_area(nodes[new_parent].fat);
+            nodes[new_parent].height = nodes[sibling].height + 1;
+            nodes[new_parent].dirty = nodes[sibling].dirty;
+            nodes[sibling].parent = new_parent;
+            nodes[leaf].parent = new_parent;
+
+            if (old_parent == EENG_NULL_INDEX)
+                root = new_parent;
+            else if (nodes[old_parent].left == sibling)
+                nodes[old_parent].left = new_parent;
+            else
+                nodes[old_parent].right = new_parent;
+
+            refit_upwards(old_parent);
+        }
+
+        void remove_leaf(int leaf)
+        {
+            if (leaf == root)
+            {
+                root = EENG_NULL_INDEX;
+                return;
+            }
+
+            const int parent = nodes[leaf].parent;
+            const int grand_parent = nodes[parent].parent;
+            const int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+            nodes[sibling].parent = grand_parent;
+            if (grand_parent == EENG_NULL_INDEX)
+                root = sibling;
+            else if (nodes[grand_parent].left == parent)
+                nodes[grand_parent].left = sibling;
+            else
+                nodes[grand_parent].right = sibling;
+            internal_area -= surface_area(nodes[parent].fat);
+            free_node(parent);
+
+            refit_upwards(grand_parent);
+        }
+
+        /// Set the bounds of an internal node, keeping internal_area up to date
+        inline void set_internal_fat(Node& node, const AABB& fat)
+        {
+            internal_area += surface_area(fat) - surface_area(node.fat);
+            node.fat = fat;
+        }
+
+        void refit_upwards(int index)
+        {
+            for (; index != EENG_NULL_INDEX; index = nodes[index].parent)
+            {
+                Node& node = nodes[index];
+                set_internal_fat(node, merge(nodes[node.left].fat, nodes[node.right].fat));
+                node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+            }
+        }
+
+        void refit_node(int index)
+        {
+            Node& node = nodes[index];
+            if (node.is_leaf())
+                return;
+            if (nodes[node.left].dirty)
+                refit_node(node.left);
+            if (nodes[node.right].dirty)
+                refit_node(node.right);
+            set_internal_fat(node, merge(nodes[node.left].fat, nodes[node.right].fat));
+            node.dirty = false;
+        }
+
+        /// Build subtree over leaves [begin, end). Leaves are partitioned in place.
+        int build_range(std::vector<int>& leaves, int begin, int end)
+        {
+            if (end - begin == 1)
+                return leaves[begin];
+
+            AABB bounds, centroid_bounds;
+            for (int i = begin; i < end; i++)
+            {
+                const AABB& fat = nodes[leaves[i]].fat;
+                bounds = merge(bounds, fat);
+                centroid_bounds.grow((fat.min + fat.max) * 0.5f);
+            }
+
+            // Split along the axis of largest centroid extent
+            const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+            int axis = 0;
+            if (extent.y > extent[axis]) axis = 1;
+            if (extent.z > extent[axis]) axis = 2;
+
+            int mid = (begin + end) / 2;
+            if (extent[axis] > 0.0f)
+            {
+                const float c_min = centroid_bounds.min[axis];
+                const float bin_scale = SAHBinCount / extent[axis];
+                auto bin_of = [&](int leaf)
+                    {
+                        const AABB& fat = nodes[leaf].fat;
+                        const float c = (fat.min[axis] + fat.max[axis]) * 0.5f;
+                        return std::min(SAHBinCount - 1, int((c - c_min) * bin_scale));
+                    };
+
+                AABB bin_bounds[SAHBinCount];
+                int bin_counts[SAHBinCount] = { 0 };
+                for (int i = begin; i < end; i++)
+                {
+                    const int b = bin_of(leaves[i]);
+                    bin_bounds[b] = merge(bin_bounds[b], nodes[leaves[i]].fat);
+                    bin_counts[b]++;
+                }
+
+                // Sweep from the right to get costs of the right partitions
+                float right_cost[SAHBinCount];
+                AABB acc;
+                int count = 0;
+                for (int b = SAHBinCount - 1; b > 0; b--)
+                {
+                    acc = merge(acc, bin_bounds[b]);
+                    count += bin_counts[b];
+                    right_cost[b] = count ? count * surface_area(acc) : 0.0f;
+                }
+
+                // Sweep from the left and pick the cheapest split
+                float best_cost = std::numeric_limits<float>::max();
+                int best_split = -1;
+                acc.reset();
+                count = 0;
+                for (int b = 0; b < SAHBinCount - 1; b++)
+                {
+                    acc = merge(acc, bin_bounds[b]);
+                    count += bin_counts[b];
+                    const float cost = (count ? count * surface_area(acc) : 0.0f) + right_cost[b + 1];
+                    if (count && count < end - begin && cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_split = b;
+                    }
+                }
+
+                if (best_split >= 0)
+                {
+                    auto it = std::partition(leaves.begin() + begin, leaves.begin() + end,
+                        [&](int leaf) { return bin_of(leaf) <= best_split; });
+                    mid = int(it - leaves.begin());
+                }
+                else
+                {
+                    std::nth_element(leaves.begin() + begin, leaves.begin() + mid, leaves.begin() + end,
+                        [&](int a, int b) { return nodes[a].fat.min[axis] + nodes[a].fat.max[axis] < nodes[b].fat.min[axis] + nodes[b].fat.max[axis]; });
+                }
+            }
+
+            const int index = alloc_node();
+            const int left = build_range(leaves, begin, mid);
+            const int right = build_range(leaves, mid, end);
+            nodes[index].left = left;
+            nodes[index].right = right;
+            nodes[index].fat = bounds;
+            internal_area += surface_area(bounds);
+            nodes[index].height = 1 + std::max(nodes[left].height, nodes[right].height);
+            nodes[left].parent = index;
+            nodes[right].parent = index;
+            return index;
+        }
+
+        template<class F>
+        void for_each_leaf(int index, F&& callback) const
+        {
+            TraversalStack<int> stack;
+            stack.push(index);
+            while (!stack.empty())
+            {
+                const int i = stack.pop();
+                const Node& node = nodes[i];
+                if (node.is_leaf())
+                    callback(i);
+                else
+                {
+                    stack.push(node.right);
+                    stack.push(node.left);
+                }
+            }
+        }
+    };
+} // namespace eeng
+
+#endif
@@ -10,9 +10,20 @@
 #include <SDL.h>
 #include <SDL_opengl.h>
 #include <memory>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
 
 #include "InputManager.hpp"
+#include "GeometryArena.hpp"
+#include "TexturePool.hpp"
+#include "SnapshotBuffer.h"
 #include "Log.hpp"
+#include "Profiler.hpp"
 
 #include "imgui.h"
 #include "imgui_impl_sdl2.h"
@@ -29,10 +40,11 @@ namespace eeng {
         shutdown();
     }
 
-    bool Engine::init(const char* title, int width, int height)
+    bool Engine::init(const char* title, int width, int height, bool headless)
     {
         window_width = width;
         window_height = height;
+        this->headless = headless;
 
         if (!init_sdl(title, width, height))
             return false;
@@ -40,11 +52,16 @@ namespace eeng {
         if (!init_opengl())
             return false;
 
-        if (!init_imgui())
+        // Shared mesh and texture storage lives as long as the GL context
+        eeng::GeometryArena::instance().init();
+        eeng::TexturePool::instance().init();
+
+        // No UI without a window to show it in
+        if (!headless && !init_imgui())
             return false;
 
         // Log some info about the OpenGL context
-        LOG_DEFINES(eeng::Log);
+        LOG_DEFINES(eeng::Log<>);
         {
             int glMinor, glMajor;
             SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &glMinor);
@@ -75,6 +92,7 @@ namespace eeng {
 #endif
 
         input = std::make_shared<eeng::InputManager>();
+        profiler::set_thread_name("Main");
 
         eeng::Log("Engine initialized successfully.");
         return true;
@@ -84,45 +102,301 @@ namespace eeng {
     {
         game->init();
 
+        eeng::Log("Entering main loop...");
+        if (game->threaded_update())
+            run_threaded(*game);
+        else
+            run_single_threaded(*game);
+
+        game->destroy();
+    }
+
+    void Engine::run_single_threaded(GameBase& game)
+    {
+        const uint64_t step_ns = uint64_t(fixed_timestep_s * 1e9);
+        uint64_t prev_ns = profiler::now_ns();
+        uint64_t accumulator_ns = 0;
+        uint64_t ticks = 0;
+
         bool running = true;
-        float time_s = 0.0f, time_ms, deltaTime_s = 0.016f;
+        while (running)
+        {
+            // Clamp long frames (e.g. breakpoints, window drags) to the catch-up cap
+            const uint64_t now_ns = profiler::now_ns();
+            const uint64_t frame_ns = std::min(now_ns - prev_ns, max_updates_per_frame * step_ns);
+            accumulator_ns += frame_ns;
+            prev_ns = now_ns;
 
-        eeng::Log("Entering main loop...");
+            profiler::begin_frame();
+            {
+                EENG_PROFILE_SCOPE("Frame");
+                {
+                    EENG_PROFILE_SCOPE("Events");
+                    process_events(running);
+                }
+                begin_frame();
+
+                updates_last_frame = 0;
+                while (accumulator_ns >= step_ns && updates_last_frame < max_updates_per_frame)
+                {
+                    EENG_PROFILE_SCOPE("Update");
+                    game.update(ticks * fixed_timestep_s, fixed_timestep_s, input);
+                    accumulator_ns -= step_ns;
+                    ticks++;
+                    updates_last_frame++;
+                }
+                // Drop what could not be caught up with
+                if (accumulator_ns >= step_ns)
+                    accumulator_ns %= step_ns;
+
+                {
+                    EENG_PROFILE_SCOPE("Frame update");
+                    game.update_frame(frame_ns * 1e-9f, input);
+                }
+                {
+                    EENG_PROFILE_SCOPE("Render");
+                    const float alpha = float(accumulator_ns) / step_ns;
+                    game.render((ticks + alpha) * fixed_timestep_s, alpha, window_width, window_height);
+                }
+                game.render_ui();
+
+                end_frame();
+                present();
+            }
+            profiler::end_frame();
+        }
+    }
+
+    void Engine::run_threaded(GameBase& game)
+    {
+        const uint64_t step_ns = uint64_t(fixed_timestep_s * 1e9);
+        const uint64_t start_ns = profiler::now_ns();
+        std::atomic<bool> sim_running{ true };
+        std::mutex input_mutex;
+
+        // Tick count and the scheduled time of the last completed tick, published together
+        struct TickState
+        {
+            uint64_t ticks = 0;
+            uint64_t last_tick_ns = 0;
+        };
+        SnapshotBuffer<TickState> tick_state;
+        tick_state.write_buffer() = { 0, start_ns };
+        tick_state.publish();
+
+        // The simulation thread reads a copy of the input, taken at the start of each tick
+        auto sim_input = std::make_shared<eeng::InputManager>();
+
+        std::thread sim_thread([&]()
+            {
+                profiler::set_thread_name("Simulation");
+                uint64_t ticks = 0;
+                uint64_t next_tick_ns = start_ns;
+                while (sim_running.load())
+                {
+                    const uint64_t now_ns = profiler::now_ns();
+                    if (now_ns < next_tick_ns)
+                    {
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(next_tick_ns - now_ns));
+                        continue;
+                    }
+                    // Skip ahead if further behind than the catch-up cap
+                    if (now_ns - next_tick_ns > max_updates_per_frame * step_ns)
+                        next_tick_ns = now_ns;
+
+                    {
+                        std::lock_guard<std::mutex> lock(input_mutex);
+                        sim_input->CopyStateFrom(*input);
+                    }
+                    {
+                        EENG_PROFILE_SCOPE("Update");
+                        game.update(ticks * fixed_timestep_s, fixed_timestep_s, sim_input);
+                    }
+                    ticks++;
+                    tick_state.write_buffer() = { ticks, next_tick_ns };
+                    tick_state.publish();
+                    next_tick_ns += step_ns;
+                }
+            });
+
+        bool running = true;
+        uint64_t ticks_prev_frame = 0;
+        uint64_t prev_ns = profiler::now_ns();
         while (running)
         {
-            const auto now_ms = SDL_GetTicks();
-            const auto now_s = now_ms * 0.001f;
-            deltaTime_s = now_s - time_s;
-            time_ms = now_ms;
-            time_s = now_s;
+            profiler::begin_frame();
+            {
+                EENG_PROFILE_SCOPE("Frame");
+                {
+                    EENG_PROFILE_SCOPE("Events");
+                    std::lock_guard<std::mutex> lock(input_mutex);
+                    process_events(running);
+                }
+                begin_frame();
+
+                // Interpolate from the last published state by the time since its tick
+                const TickState& state = tick_state.acquire();
+                const uint64_t tick_ns = state.last_tick_ns;
+                const uint64_t tick = state.ticks;
+                const uint64_t now_ns = profiler::now_ns();
+                const float alpha = now_ns > tick_ns ? std::min(1.0f, float(now_ns - tick_ns) / step_ns) : 0.0f;
+                updates_last_frame = int(tick - ticks_prev_frame);
+                ticks_prev_frame = tick;
+                {
+                    // Input is only written by this thread, so no lock is needed to read it
+                    EENG_PROFILE_SCOPE("Frame update");
+                    game.update_frame(std::min(now_ns - prev_ns, max_updates_per_frame * step_ns) * 1e-9f, input);
+                    prev_ns = now_ns;
+                }
+                {
+                    EENG_PROFILE_SCOPE("Render");
+                    game.render((tick + alpha) * fixed_timestep_s, alpha, window_width, window_height);
+                }
+                game.render_ui();
 
-            process_events(running);
-            begin_frame();
+                end_frame();
+                present();
+            }
+            profiler::end_frame();
+        }
+
+        sim_running.store(false);
+        sim_thread.join();
+    }
+
+    void Engine::present()
+    {
+        {
+            EENG_PROFILE_SCOPE("Swap");
+            SDL_GL_SwapWindow(window_);
+        }
+        {
+            EENG_PROFILE_SCOPE("Frame pacing");
+            frame_pacer->pace();
+        }
+    }
+
+    void Engine::set_swap_interval(int interval)
+    {
+        swap_interval = interval;
+        if (SDL_GL_SetSwapInterval(interval) != 0 && interval == -1)
+        {
+            eeng::Log("Adaptive v-sync not supported, using v-sync");
+            swap_interval = 1;
+            SDL_GL_SetSwapInterval(swap_interval);
+        }
+    }
+
+    bool Engine::run_headless(std::unique_ptr<GameBase> game, const HeadlessConfig& config)
+    {
+        struct FrameTiming
+        {
+            float events_ms, update_ms, render_ms, present_ms, frame_ms;
+        };
+        auto ms = [](uint64_t t0, uint64_t t1) { return (t1 - t0) * 1e-6f; };
+
+        game->init();
+        SDL_GL_SetSwapInterval(0);
+
+        auto script = config.script;
+        std::stable_sort(script.begin(), script.end(), [](const auto& a, const auto& b) { return a.frame < b.frame; });
+        size_t next_event = 0;
+
+        std::vector<FrameTiming> timings;
+        timings.reserve(config.frame_count);
 
-            game->update(time_s, deltaTime_s, input);
-            game->render(time_s, window_width, window_height);
+        bool running = true;
+        eeng::Log("Running %i headless frames...", config.frame_count);
+        for (int frame = 0; frame < config.frame_count && running; frame++)
+        {
+            const float time_s = frame * config.timestep_s;
 
+            profiler::begin_frame();
+            const uint64_t t0 = profiler::now_ns();
+            {
+                EENG_PROFILE_SCOPE("Events");
+                process_events(running);
+                for (; next_event < script.size() && script[next_event].frame <= frame; next_event++)
+                    input->SetKeyState(script[next_event].key, script[next_event].pressed);
+            }
+            begin_frame();
+
+            const uint64_t t1 = profiler::now_ns();
+            {
+                EENG_PROFILE_SCOPE("Update");
+                game->update(time_s, config.timestep_s, input);
+                game->update_frame(config.timestep_s, input);
+            }
+            const uint64_t t2 = profiler::now_ns();
+            {
+                EENG_PROFILE_SCOPE("Render");
+                game->render(time_s, 0.0f, window_width, window_height);
+            }
             end_frame();
 
-            SDL_GL_SwapWindow(window_);
+            // Wait for the GPU so that frame times include all of its work
+            const uint64_t t3 = profiler::now_ns();
+            {
+                EENG_PROFILE_SCOPE("Swap");
+                SDL_GL_SwapWindow(window_);
+                glFinish();
+            }
+            const uint64_t t4 = profiler::now_ns();
+            profiler::end_frame();
 
-            // Add a delay if frame time was shorter than the target frame time
-            const Uint32 elapsed_ms = SDL_GetTicks() - time_ms;
-            if (elapsed_ms < min_frametime_ms)
-                SDL_Delay(min_frametime_ms - elapsed_ms);
+            timings.push_back({ ms(t0, t1), ms(t1, t2), ms(t2, t3), ms(t3, t4), ms(t0, t4) });
         }
 
         game->destroy();
+
+        // Summary
+        if (timings.size())
+        {
+            std::vector<float> frame_ms;
+            for (const auto& t : timings)
+                frame_ms.push_back(t.frame_ms);
+            float sum_ms = 0.0f;
+            for (float t : frame_ms)
+                sum_ms += t;
+            eeng::Log("Headless run: %i frames, mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms",
+                (int)frame_ms.size(), sum_ms / frame_ms.size(),
+                percentile(frame_ms, 0.5f), percentile(frame_ms, 0.95f), percentile(frame_ms, 0.99f),
+                *std::max_element(frame_ms.begin(), frame_ms.end()));
+        }
+
+        std::ofstream out(config.stats_file);
+        if (!out)
+        {
+            eeng::Log("Failed to write frame stats to %s", config.stats_file.c_str());
+            return false;
+        }
+        out << "frame,time_s,events_ms,update_ms,render_ms,present_ms,frame_ms\n";
+        for (size_t i = 0; i < timings.size(); i++)
+        {
+            const auto& t = timings[i];
+            out << i << ',' << i * config.timestep_s << ',' << t.events_ms << ',' << t.update_ms << ','
+                << t.render_ms << ',' << t.present_ms << ',' << t.frame_ms << '\n';
+        }
+        eeng::Log("Frame stats written to %s", config.stats_file.c_str());
+
+        return running && out;
     }
 
     void Engine::shutdown()
     {
-        ImGui_ImplOpenGL3_Shutdown();
-        ImGui_ImplSDL2_Shutdown();
-        ImGui::DestroyContext();
+        if (ImGui::GetCurrentContext())
+        {
+            ImGui_ImplOpenGL3_Shutdown();
+            ImGui_ImplSDL2_Shutdown();
+            ImGui::DestroyContext();
+        }
 
         if (gl_context_)
+        {
+            eeng::TexturePool::instance().shutdown();
+            eeng::GeometryArena::instance().shutdown();
             SDL_GL_DeleteContext(gl_context_);
+        }
         if (window_)
             SDL_DestroyWindow(window_);
 
@@ -131,7 +405,14 @@ namespace eeng {
 
     bool Engine::init_sdl(const char* title, int width, int height)
     {
-        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0)
+#if defined(__linux__)
+        // Without a display, fall back to SDL's offscreen (EGL) video driver.
+        // Mesa then renders with llvmpipe on machines without a GPU.
+        if (headless && !SDL_getenv("DISPLAY") && !SDL_getenv("WAYLAND_DISPLAY"))
+            SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+#endif
+
+        if (SDL_Init(SDL_INIT_VIDEO | (headless ? 0 : SDL_INIT_AUDIO) | SDL_INIT_GAMECONTROLLER) != 0)
         {
             eeng::Log("SDL_Init failed: %s", SDL_GetError());
             return false;
@@ -150,7 +431,7 @@ namespace eeng {
             SDL_WINDOWPOS_CENTERED,
             SDL_WINDOWPOS_CENTERED,
             width, height,
-            SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+            SDL_WINDOW_OPENGL | (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN));
         if (!window_)
         {
             eeng::Log("Failed to create SDL window: %s", SDL_GetError());
@@ -165,7 +446,11 @@ namespace eeng {
         }
 
         SDL_GL_MakeCurrent(window_, gl_context_);
-        SDL_GL_SetSwapInterval(vsync);
+        set_swap_interval(headless ? 0 : swap_interval);
+
+        // Reads the performance counter frequency, so only after SDL_Init
+        frame_pacer = std::make_unique<FramePacer>();
+        frame_pacer->set_target_fps(60.0f);
 
         return true;
     }
@@ -206,22 +491,24 @@ namespace eeng {
     void Engine::process_events(bool& running)
     {
         SDL_Event event;
+        const bool imgui = ImGui::GetCurrentContext() != nullptr;
         while (SDL_PollEvent(&event))
         {
-            ImGui_ImplSDL2_ProcessEvent(&event);
+            if (imgui)
+                ImGui_ImplSDL2_ProcessEvent(&event);
 
             // Skip mouse events if ImGui is capturing mouse input.
             if ((event.type == SDL_MOUSEMOTION ||
                 event.type == SDL_MOUSEBUTTONDOWN ||
                 event.type == SDL_MOUSEBUTTONUP) &&
-                ImGui::GetIO().WantCaptureMouse)
+                imgui && ImGui::GetIO().WantCaptureMouse)
             {
                 continue;
             }
 
             // Skip keyboard events if ImGui is capturing keyboard input.
             if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) &&
-                ImGui::GetIO().WantCaptureKeyboard)
+                imgui && ImGui::GetIO().WantCaptureKeyboard)
             {
                 continue;
             }
@@ -235,15 +522,23 @@ namespace eeng {
 
     void Engine::begin_frame()
     {
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplSDL2_NewFrame(window_);
-        ImGui::NewFrame();
+        EENG_PROFILE_FUNCTION();
+        eeng::LogSetFrame(frame_count++);
+
+        if (!headless)
+        {
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplSDL2_NewFrame(window_);
+            ImGui::NewFrame();
 
-        ImGui::ShowDemoWindow();
+            ImGui::ShowDemoWindow();
 
-        render_info_UI();
+            render_info_UI();
 
-        eeng::LogDraw("Log");
+            eeng::LogDraw("Log");
+
+            profiler::draw("Profiler");
+        }
 
         // Set up OpenGL state:
 
@@ -284,6 +579,10 @@ namespace eeng {
 
     void Engine::end_frame()
     {
+        if (headless)
+            return;
+        EENG_PROFILE_SCOPE("ImGui");
+        EENG_PROFILE_GPU_SCOPE("ImGui");
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
     }
@@ -305,40 +604,26 @@ namespace eeng {
 
             // Framerate
             ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+            ImGui::Text("%.3f ms last frame", profiler::last_frame_ms());
+            ImGui::Text("%.0f Hz simulation, %i update(s) last frame", 1.0f / fixed_timestep_s, updates_last_frame);
+
+            // Frame time percentiles over recent frames
+            ImGui::Text("Frame p50 %.2f ms, p95 %.2f ms, p99 %.2f ms",
+                frame_pacer->percentile_ms(0.5f),
+                frame_pacer->percentile_ms(0.95f),
+                frame_pacer->percentile_ms(0.99f));
+
+            // Target frame rate, 0 for uncapped
+            float target_fps = frame_pacer->get_target_fps();
+            if (ImGui::SliderFloat("FPS cap##targetfps", &target_fps, 0.0f, 240.0f, target_fps > 0.0f ? "%.0f" : "Uncapped"))
+                frame_pacer->set_target_fps(target_fps);
+
+            // V-sync mode
+            static const char* vsyncModes[] = { "Off", "On", "Adaptive" };
+            int vsyncMode = swap_interval == -1 ? 2 : swap_interval;
+            if (ImGui::Combo("V-Sync", &vsyncMode, vsyncModes, IM_ARRAYSIZE(vsyncModes)))
+                set_swap_interval(vsyncMode == 2 ? -1 : vsyncMode);
 
-            // Combo (drop-down) for fps settings
-            static const char* items[] = { "10", "30", "60", "120", "Uncapped" };
-            static int currentItem = 2;
-            if (ImGui::BeginCombo("FPS cap##targetfps", items[currentItem]))
-            {
-                for (int i = 0; i < IM_ARRAYSIZE(items); i++)
-                {
-                    const bool isSelected = (currentItem == i);
-                    if (ImGui::Selectable(items[i], isSelected))
-                        currentItem = i;
-
-                    if (isSelected)
-                        ImGui::SetItemDefaultFocus();
-                }
-                ImGui::EndCombo();
-            }
-            if (currentItem == 0)
-                min_frametime_ms = 1000.0f / 10;
-            else if (currentItem == 1)
-                min_frametime_ms = 1000.0f / 30;
-            else if (currentItem == 2)
-                min_frametime_ms = 1000.0f / 60;
-            else if (currentItem == 3)
-                min_frametime_ms = 1000.0f / 120;
-            else if (currentItem == 4)
-                min_frametime_ms = 0.0f;
-
-            if (ImGui::Checkbox("V-Sync", &vsync))
-            {
-                SDL_GL_SetSwapInterval(vsync);
-            }
-
-            ImGui::SameLine();
             ImGui::Checkbox("Wireframe rendering", &wireframe_mode);
 
             // if (SOUND_PLAY)
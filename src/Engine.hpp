@@ -6,8 +6,11 @@
 
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 #include "config.h"
 #include "GameBase.h"
+#include "FramePacer.hpp"
 
 struct SDL_Window;              // Forward declaration
 typedef void* SDL_GLContext;    // Forward declaration
@@ -16,6 +19,25 @@ namespace eeng
 {
     class InputManager; // Forward declaration
 
+/**
+ * @brief Settings for a headless run, see Engine::run_headless().
+ */
+struct HeadlessConfig
+{
+    /** Scripted key press or release, applied before the game update of a frame */
+    struct KeyEvent
+    {
+        int frame;
+        InputManager::Key key;
+        bool pressed;
+    };
+
+    int frame_count = 1000;                 ///< Number of frames to run
+    float timestep_s = 1.0f / 60.0f;        ///< Fixed time step passed to the game
+    std::string stats_file = "frame_stats.csv"; ///< Per-frame timings, CSV
+    std::vector<KeyEvent> script;           ///< Scripted input
+};
+
 /**
  * @brief Main engine class handling SDL, OpenGL, ImGui initialization and the main loop.
  */
@@ -33,16 +55,29 @@ public:
      * @param title Window title
      * @param width Window width
      * @param height Window height
+     * @param headless Use a hidden window without ImGui, and an offscreen video driver if no display is available
      * @return True if successful, false otherwise
      */
-    bool init(const char* title, int width, int height);
+    bool init(const char* title, int width, int height, bool headless = false);
 
     /**
      * @brief Start the main loop.
+     * The game is updated with a fixed time step, on a separate thread if
+     * GameBase::threaded_update() says so. GameBase::update_frame() and
+     * rendering run once per frame on the calling thread.
      * @param game Unique pointer to the initial game game
      */
     void run(std::unique_ptr<GameBase> game);
 
+    /**
+     * @brief Run a fixed number of frames with a fixed time step and scripted input,
+     * without frame limiting or v-sync, and write per-frame timings to a file.
+     * @param game Unique pointer to the game
+     * @param config Run settings
+     * @return True if all frames were run and timings were written
+     */
+    bool run_headless(std::unique_ptr<GameBase> game, const HeadlessConfig& config);
+
     /** @brief Clean up and close the engine. */
     void shutdown();
 
@@ -59,9 +94,14 @@ private:
 
     int window_height;    ///< Window height in pixels
     int window_width;     ///< Window width in pixels
-    bool vsync = false;   ///< V-sync enabled state
+    int swap_interval = 0; ///< 0 = no v-sync, 1 = v-sync, -1 = adaptive v-sync
+    bool headless = false; ///< Hidden window, no ImGui and no frame limiting
     bool wireframe_mode = false; ///< Wireframe rendering state
-    float min_frametime_ms = 16.67; ///< Minimum frame duration in milliseconds (default 60 FPS)
+    std::unique_ptr<FramePacer> frame_pacer; ///< Frame rate limiting and frame time statistics, created after SDL_Init
+    float fixed_timestep_s = 1.0f / 60.0f; ///< Simulation time step
+    int max_updates_per_frame = 5; ///< Catch-up cap: more steps than this are dropped
+    int updates_last_frame = 0;   ///< Simulation steps taken during the last frame
+    int frame_count = 0;          ///< Frames begun so far, published to the log
 
     /** Initialize SDL library and window. */
     bool init_sdl(const char* title, int width, int height);
@@ -72,6 +112,18 @@ private:
     /** Initialize ImGui for GUI rendering. */
     bool init_imgui();
 
+    /** Fixed-step updates and interpolated rendering on the calling thread. */
+    void run_single_threaded(GameBase& game);
+
+    /** Fixed-step updates on a simulation thread, interpolated rendering on the calling thread. */
+    void run_threaded(GameBase& game);
+
+    /** Swap buffers and wait out the remaining frame time. */
+    void present();
+
+    /** Set swap interval, falling back to v-sync if adaptive v-sync is unsupported. */
+    void set_swap_interval(int interval);
+
     /** Handle SDL events. */
     void process_events(bool& running);
 
@@ -4,12 +4,19 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <numeric>
 #include <glm/gtc/type_ptr.hpp>
 
 #include "ForwardRenderer.hpp"
 #include "glcommon.h"
+#include "BVH.h"
+#include "GeometryArena.hpp"
+#include "TexturePool.hpp"
+#include "config.h"
 #include "ShaderLoader.h"
 #include "Log.hpp"
+#include "Profiler.hpp"
 
 namespace
 {
@@ -23,6 +30,29 @@ namespace
         buffer << file.rdbuf();
         return buffer.str();
     }
+
+    /// Shader source with #include "file" lines replaced by the file, relative to the including shader
+    std::string shader_file_to_string(const std::string &filename)
+    {
+        const std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+        std::istringstream source(file_to_string(filename));
+        std::string expanded, line;
+        while (std::getline(source, line))
+        {
+            const auto first = line.find_first_not_of(" \t");
+            if (first != std::string::npos && line.compare(first, 8, "#include") == 0)
+            {
+                const auto begin = line.find('"', first);
+                const auto end = line.find('"', begin + 1);
+                if (begin == std::string::npos || end == std::string::npos)
+                    throw std::runtime_error(std::string("Malformed #include in ") + filename);
+                expanded += shader_file_to_string(directory + line.substr(begin + 1, end - begin - 1));
+            }
+            else
+                expanded += line + "\n";
+        }
+        return expanded;
+    }
 }
 
 namespace eeng
@@ -33,9 +63,21 @@ namespace eeng
 
     ForwardRenderer::~ForwardRenderer()
     {
-        EENG_ASSERT(phongShader, "Destrying uninitialized shader program");
-        if (phongShader)
-            glDeleteProgram(phongShader);
+        EENG_ASSERT(phongVariants.initialized(), "Destrying uninitialized shader program");
+        if (skinShader)
+            glDeleteProgram(skinShader);
+        const GLuint indirectBuffers[] = {drawDataBuffer, materialBuffer, drawCommandBuffer, drawIndexBuffer};
+        for (GLuint buffer : indirectBuffers)
+            if (buffer)
+                glDeleteBuffers(1, &buffer);
+        if (boneTexture)
+            glDeleteTextures(1, &boneTexture);
+        if (boneBuffer)
+            glDeleteBuffers(1, &boneBuffer);
+        if (skinnedVAO)
+            glDeleteVertexArrays(1, &skinnedVAO);
+        if (skinnedBuffer)
+            glDeleteBuffers(1, &skinnedBuffer);
     }
 
     void ForwardRenderer::init(const std::string &vertShaderPath,
@@ -44,29 +86,95 @@ namespace eeng
         Log("Compiling shaders %s, %s",
                  vertShaderPath.c_str(),
                  fragShaderPath.c_str());
-        auto vertSource = file_to_string(vertShaderPath);
-        auto fragSource = file_to_string(fragShaderPath);
-        phongShader = createShaderProgram(vertSource.c_str(), fragSource.c_str());
-
-        // Bind shader samplers to texture units
-        glUseProgram(phongShader);
-        for (auto &textureDesc : texturesDescs)
+        auto vertSource = shader_file_to_string(vertShaderPath);
+        auto fragSource = shader_file_to_string(fragShaderPath);
+        phongVariants.init(vertSource, fragSource, variantDefines);
+
+#ifdef EENG_GLVERSION_43
+        // Same shaders with per-draw data and materials read from storage buffers
+        indirectVariants.init(vertSource, fragSource, variantDefines, "#version 430 core\n#define INDIRECT_DRAW\n");
+
+        glGenBuffers(1, &drawDataBuffer);
+        glGenBuffers(1, &materialBuffer);
+        glGenBuffers(1, &drawCommandBuffer);
+        glGenBuffers(1, &drawIndexBuffer);
+#endif
+
+        // With parallel compilation all variants are started up front and compile in the
+        // background, otherwise each is compiled on first use. Cached binaries load either way.
+        if (parallelShaderCompile())
         {
-            glUniform1i(glGetUniformLocation(phongShader, textureDesc.samplerName), textureDesc.textureUnit);
+            for (uint32_t variant = 0; variant < (1u << variantDefines.size()); variant++)
+            {
+                phongVariants.prepare(variant);
+                if (indirectVariants.initialized())
+                    indirectVariants.prepare(variant);
+            }
         }
-        glUseProgram(0);
+        // The variant without defines reports shader errors up front
+        phongVariants.get(0);
+
+        // Bone matrices are read as four RGBA texels each, so the bone count is not bounded by uniform space
+        boneCapacity = 4;
+        glGenBuffers(1, &boneBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, boneBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * boneCapacity, nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &boneTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, boneTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, boneBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
         CheckAndThrowGLErrors();
 
         // placeholder_texture = create_checker_texture();
     }
 
+    void ForwardRenderer::initSkinning(const std::string &feedbackShaderPath,
+                                       const std::string &computeShaderPath)
+    {
+#ifdef EENG_GLVERSION_43
+        Log("Compiling skinning shader %s", computeShaderPath.c_str());
+        auto compSource = shader_file_to_string(computeShaderPath);
+        skinShader = createCachedSingleShaderProgram(GL_COMPUTE_SHADER, compSource.c_str());
+#else
+        Log("Compiling skinning shader %s", feedbackShaderPath.c_str());
+        auto vertSource = shader_file_to_string(feedbackShaderPath);
+        const char *varyings[] = {"skinned_position", "skinned_normal", "skinned_tangent", "skinned_binormal", "skinned_texcoord"};
+        skinShader = createCachedSingleShaderProgram(GL_VERTEX_SHADER, vertSource.c_str(), varyings, numelem(varyings));
+#endif
+
+        // Pre-skinned vertices are numbered from the start of the buffer and indexed from the arena
+        using Location = GeometryArena::Location;
+        glGenBuffers(1, &skinnedBuffer);
+        glGenVertexArrays(1, &skinnedVAO);
+        glBindVertexArray(skinnedVAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, GeometryArena::instance().index_buffer());
+        glEnableVertexAttribArray(Location::PositionLocation);
+        glEnableVertexAttribArray(Location::NormalLocation);
+        glEnableVertexAttribArray(Location::TangentLocation);
+        glEnableVertexAttribArray(Location::BinormalLocation);
+        glEnableVertexAttribArray(Location::TexcoordLocation);
+        glBindVertexArray(0);
+        // Initial capacity
+        allocateSkinned(1024);
+        skinnedCount = 0;
+
+        glUseProgram(skinShader);
+        glUniform1i(glGetUniformLocation(skinShader, "BoneTexture"), boneTextureUnit);
+        glUseProgram(0);
+        CheckAndThrowGLErrors();
+    }
+
     void ForwardRenderer::beginPass(const glm::mat4 &ProjMatrix,
                                     const glm::mat4 &ViewMatrix,
                                     const glm::vec3 &lightPos,
                                     const glm::vec3 &lightColor,
                                     const glm::vec3 &eyePos)
     {
-        EENG_ASSERT(phongShader, "Renderer not initialized");
+        EENG_ASSERT(phongVariants.initialized(), "Renderer not initialized");
+#ifdef EENG_PROFILE
+        gpuTimerActive = profiler::gpu_begin("ForwardRenderer");
+#endif
 
         // GL state
 
@@ -78,6 +186,9 @@ namespace eeng
         glEnable(GL_DEPTH_TEST); // Perform depth test when rasterizing
         glDepthFunc(GL_LESS);    // Depth test pass if z < existing z (closer than existing z)
         glDepthMask(GL_TRUE);    // If depth test passes, write z to z-buffer
+        // Other renderers may have left a VAO bound
+        glBindVertexArray(0);
+        boundVAO = 0;
         glDepthRange(0, 1);      // Z-buffer range is [0,1], where 0 is at z-near and 1 is at z-far
 
         // Define viewport transform = Clip -> Screen space (applied before rasterization)
@@ -102,16 +213,21 @@ namespace eeng
         //     glEnable(GL_CULL_FACE);
         // }
 
-        glUseProgram(phongShader);
+        // Matrices, light and eye position are set on each shader variant when first used in the pass
+        passIndex++;
+        boundProgram = 0;
+        projMatrix = ProjMatrix;
+        viewMatrix = ViewMatrix;
+        passLightPos = lightPos;
+        passLightColor = lightColor;
+        eyePosition = eyePos;
 
-        // Bind matrices
-        const auto ProjViewMatrix = ProjMatrix * ViewMatrix;
-        glUniformMatrix4fv(glGetUniformLocation(phongShader, "ProjViewMatrix"), 1, 0, glm::value_ptr(ProjViewMatrix));
+        // Material textures of all meshes are bound for the whole pass
+        TexturePool::instance().bind(texturePoolUnit);
 
-        // Bind light & eye position
-        glUniform3fv(glGetUniformLocation(phongShader, "lightpos"), 1, glm::value_ptr(lightPos));
-        glUniform3fv(glGetUniformLocation(phongShader, "lightColor"), 1, glm::value_ptr(lightColor));
-        glUniform3fv(glGetUniformLocation(phongShader, "eyepos"), 1, glm::value_ptr(eyePos));
+        // So are the bone palettes of the frame
+        glActiveTexture(GL_TEXTURE0 + boneTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, boneTexture);
 
         // Bind cube map texture
         GLuint cubemapTextureHandle = 0; // <- PLACEHOLDER
@@ -120,101 +236,611 @@ namespace eeng
             // const auto &cubemapTextureDesc = texturesDescs[TextureTypeIndex::Cubemap];
             glActiveTexture(GL_TEXTURE0 + cubemapTextureDesc.textureUnit);
             glBindTexture(GL_TEXTURE_2D, cubemapTextureHandle);
-
-            glUniform1i(glGetUniformLocation(phongShader, cubemapTextureDesc.flagName), 1);
+            // (Set cubemapTextureDesc.flagName per shader variant)
         }
 
         CheckAndThrowGLErrors();
         drawcallCounter = 0;
+        triangleCounter = 0;
+        meshletCounter = 0;
+        culledMeshletCounter = 0;
     }
 
     int ForwardRenderer::endPass()
     {
+        flushIndirect();
+        drawAlphaTested();
+
         glUseProgram(0);
-        glBindVertexArray(0);
+        boundProgram = 0;
+        bindVAO(0);
+        TexturePool::instance().unbind(texturePoolUnit);
 
         // Possibly restore GL state
 
+        if (gpuTimerActive)
+            profiler::gpu_end();
+        gpuTimerActive = false;
+
         return drawcallCounter;
     }
 
-    void ForwardRenderer::renderMesh(const std::shared_ptr<RenderableMesh> mesh,
-                                     const glm::mat4 &WorldMatrix)
+    int ForwardRenderer::getTriangleCount() const
     {
-        // Bind bone matrices
-        if (mesh->boneMatrices.size())
-            glUniformMatrix4fv(glGetUniformLocation(phongShader, "BoneMatrices"),
-                               (GLsizei)mesh->boneMatrices.size(),
-                               0,
-                               glm::value_ptr(mesh->boneMatrices[0]));
+        return triangleCounter;
+    }
 
-        glBindVertexArray(mesh->m_VAO);
+    int ForwardRenderer::getMeshletCount() const
+    {
+        return meshletCounter;
+    }
 
-        for (uint i = 0; i < mesh->m_meshes.size(); i++)
+    int ForwardRenderer::getCulledMeshletCount() const
+    {
+        return culledMeshletCounter;
+    }
+
+    int ForwardRenderer::getShaderVariantCount() const
+    {
+        return (int)(phongVariants.size() + indirectVariants.size());
+    }
+
+    uint32_t ForwardRenderer::materialVariant(const RenderableMesh &mesh, const PhongMaterial &mtl) const
+    {
+        const glm::ivec4 layers = textureLayers(mesh, mtl);
+        uint32_t variant = 0;
+        if (layers.x >= 0)
+            variant |= VariantDiffuse;
+        if (layers.y >= 0)
+            variant |= VariantNormal;
+        if (layers.z >= 0)
+            variant |= VariantSpecular;
+        if (layers.w >= 0)
+            variant |= VariantAlphaTest;
+        return variant;
+    }
+
+    GLuint ForwardRenderer::useVariant(ShaderPermutations &variants, uint32_t variant)
+    {
+        // Textures can be left out while their permutation compiles, alpha testing and skinning cannot
+        const GLuint program = variants.get(variant, VariantDiffuse | VariantNormal | VariantSpecular);
+        auto [passIt, created] = programPasses.try_emplace(program, 0u);
+        if (created)
         {
-            const auto &submesh = mesh->m_meshes[i];
-            const auto &mtl = mesh->m_materials[submesh.mtl_index];
+            // Bind shader samplers to texture units
+            GLint texturePoolUnits[TexturePool::MaxPools];
+            std::iota(texturePoolUnits, texturePoolUnits + TexturePool::MaxPools, (GLint)texturePoolUnit);
+            glProgramUniform1iv(program, glGetUniformLocation(program, "texturePools"), TexturePool::MaxPools, texturePoolUnits);
+            glProgramUniform1i(program, glGetUniformLocation(program, "BoneTexture"), boneTextureUnit);
+        }
+        if (passIt->second != passIndex)
+        {
+            // Bind matrices, light & eye position
+            const auto ProjViewMatrix = projMatrix * viewMatrix;
+            glProgramUniformMatrix4fv(program, glGetUniformLocation(program, "ProjViewMatrix"), 1, 0, glm::value_ptr(ProjViewMatrix));
+            glProgramUniform3fv(program, glGetUniformLocation(program, "lightpos"), 1, glm::value_ptr(passLightPos));
+            glProgramUniform3fv(program, glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(passLightColor));
+            glProgramUniform3fv(program, glGetUniformLocation(program, "eyepos"), 1, glm::value_ptr(eyePosition));
+            passIt->second = passIndex;
+        }
+        if (program != boundProgram)
+            glUseProgram(program);
+        boundProgram = program;
+        return program;
+    }
+
+    unsigned ForwardRenderer::selectLod(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMatrix) const
+    {
+        const auto &submesh = mesh.m_meshes[submeshIndex];
+        if (!lodEnabled || submesh.nbr_lods < 2)
+            return 0;
+
+        // Skinned submeshes have no AABB of their own
+        AABB aabb = mesh.m_mesh_aabbs_pose[submeshIndex];
+        if (!aabb)
+            aabb = mesh.m_model_aabb;
+
+        // Projected height of the bounding sphere relative to the viewport
+        const glm::vec4 sphere = aabb.post_transform(WorldMatrix).getBoundingSphere();
+        const float depth = std::max(-(viewMatrix * glm::vec4(glm::vec3(sphere), 1.0f)).z, 1e-3f);
+        const float screenSize = sphere.w * projMatrix[1][1] / depth;
+
+        unsigned lod = 0;
+        for (float size = lodFullDetailSize; lod + 1 < submesh.nbr_lods && screenSize < size; size *= 0.5f)
+            lod++;
+        return lod;
+    }
+
+    void ForwardRenderer::cullMeshlets(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMeshMatrix)
+    {
+        const auto &submesh = mesh.m_meshes[submeshIndex];
+        const auto &lod = submesh.lods[0];
+        const uintptr_t indexSize = submesh.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        const uintptr_t indexOffset = GeometryArena::instance().index_offset(mesh.m_geometry) + lod.index_offset;
+
+        // Meshlet bounds are in submesh space, so the frustum and eye are brought there instead
+        const Frustum frustum{projMatrix * viewMatrix * WorldMeshMatrix};
+        const glm::vec3 eye = glm::vec3(glm::inverse(WorldMeshMatrix) * glm::vec4(eyePosition, 1.0f));
+        const bool cullBackfacing = glIsEnabled(GL_CULL_FACE); // Not in wireframe mode
+
+        meshletCounts.clear();
+        meshletOffsets.clear();
+        for (unsigned i = submesh.first_meshlet; i < submesh.first_meshlet + submesh.nbr_meshlets; i++)
+        {
+            const auto &meshlet = mesh.m_meshlets[i];
+            if (!frustum.intersects_sphere(meshlet.center, meshlet.radius) || (cullBackfacing && meshopt::is_backfacing(meshlet, eye)))
+            {
+                culledMeshletCounter++;
+                continue;
+            }
+            meshletCounter++;
+            triangleCounter += meshlet.nbr_indices / 3;
+
+            // Consecutive visible meshlets are drawn as one range
+            const uintptr_t offset = indexOffset + meshlet.index_offset * indexSize;
+            if (meshletCounts.size() && (uintptr_t)meshletOffsets.back() + meshletCounts.back() * indexSize == offset)
+                meshletCounts.back() += meshlet.nbr_indices;
+            else
+            {
+                meshletCounts.push_back(meshlet.nbr_indices);
+                meshletOffsets.push_back((const void *)offset);
+            }
+        }
+    }
+
+    void ForwardRenderer::drawMeshlets(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMeshMatrix, GLint baseVertex)
+    {
+        cullMeshlets(mesh, submeshIndex, WorldMeshMatrix);
+        if (meshletCounts.empty())
+            return;
+
+        const auto &submesh = mesh.m_meshes[submeshIndex];
+        meshletBaseVertices.assign(meshletCounts.size(), baseVertex);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES,
+                                      meshletCounts.data(),
+                                      submesh.index_type,
+                                      meshletOffsets.data(),
+                                      (GLsizei)meshletCounts.size(),
+                                      meshletBaseVertices.data());
+        drawcallCounter++;
+    }
+
+    glm::ivec4 ForwardRenderer::textureLayers(const RenderableMesh &mesh, const PhongMaterial &mtl) const
+    {
+        glm::ivec4 layers{-1};
+        for (uint t = 0; t < numelem(materialTextures); t++)
+        {
+            const int textureIndex = mtl.textureIndices[materialTextures[t]];
+            if (textureIndex != NoTexture)
+                layers[t] = mesh.m_textures[textureIndex].m_layer.id();
+        }
+        return layers;
+    }
+
+    glm::mat4 ForwardRenderer::submeshWorldMatrix(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMatrix) const
+    {
+        // Append hierarchical transform to non-skinned meshes that are linked to nodes
+        const auto &submesh = mesh.m_meshes[submeshIndex];
+        if (submesh.node_index != EENG_NULL_INDEX && !submesh.is_skinned)
+            return WorldMatrix * mesh.m_nodetree.get_payload_at(submesh.node_index).global_tfm;
+        return WorldMatrix;
+    }
 
-            if (submesh.node_index != EENG_NULL_INDEX && !submesh.is_skinned)
+    void ForwardRenderer::queueMesh(RenderableMesh &mesh, const glm::mat4 &WorldMatrix, const SkinnedInstance &instance)
+    {
+        // Pre-skinned meshes are drawn as non-skinned
+        const bool preskinned = instance.baseVertex >= 0;
+
+        // Bone palettes of all instances share the bone texture, each from its own offset
+        GLuint boneOffset = 0, skinFlags = 0;
+        if (!preskinned && instance.boneOffset >= 0)
+        {
+            boneOffset = (GLuint)instance.boneOffset;
+            skinFlags = instance.dualQuats ? DrawSkinned | DrawDualQuats : DrawSkinned;
+        }
+        // Pre-skinned vertices are numbered from the start of the instance range, arena vertices from the start of the arena
+        const auto &arena = GeometryArena::instance();
+        const GLuint vao = preskinned ? skinnedVAO : arena.vao();
+        const GLint arenaBaseVertex = preskinned ? instance.baseVertex : arena.base_vertex(mesh.m_geometry);
+        const size_t arenaIndexOffset = arena.index_offset(mesh.m_geometry);
+
+        for (uint i = 0; i < mesh.m_meshes.size(); i++)
+        {
+            const auto &submesh = mesh.m_meshes[i];
+            const auto &mtl = mesh.m_materials[submesh.mtl_index];
+            const auto WorldMeshMatrix = submeshWorldMatrix(mesh, i, WorldMatrix);
+
+            // Materials are stored once per pass
+            auto [mtlIt, newMaterial] = materialIndices.try_emplace(&mtl, (GLuint)materialData.size());
+            if (newMaterial)
+                materialData.push_back({glm::vec4(mtl.Ka, 1.0f), glm::vec4(mtl.Kd, 1.0f), glm::vec4(mtl.Ks, mtl.shininess), textureLayers(mesh, mtl)});
+
+            const GLuint drawFlags = submesh.is_skinned ? skinFlags : 0u;
+            const uint32_t variant = materialVariant(mesh, mtl) | (drawFlags ? VariantSkinned : 0u);
+            const GLuint drawIndex = (GLuint)drawData.size();
+            drawData.push_back({WorldMeshMatrix, mtlIt->second, boneOffset, drawFlags, 0u});
+            drawStates.push_back({(variant & VariantAlphaTest) != 0, variant, vao, submesh.index_type});
+
+            const GLuint indexSize = submesh.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+            const unsigned lodIndex = selectLod(mesh, i, WorldMatrix);
+            if (meshletCulling && lodIndex == 0 && submesh.nbr_meshlets)
             {
-                // Append hierarchical transform to non-skinned meshes that are linked to nodes
-                const auto WorldMeshMatrix = WorldMatrix * mesh->m_nodetree.get_payload_at(submesh.node_index).global_tfm;
-                glUniformMatrix4fv(glGetUniformLocation(phongShader, "WorldMatrix"), 1, 0, glm::value_ptr(WorldMeshMatrix));
+                cullMeshlets(mesh, i, WorldMeshMatrix);
+                for (size_t r = 0; r < meshletCounts.size(); r++)
+                    drawCommands.push_back({(GLuint)meshletCounts[r], 1, GLuint((uintptr_t)meshletOffsets[r] / indexSize), arenaBaseVertex + (GLint)submesh.base_vertex, drawIndex});
             }
             else
-                glUniformMatrix4fv(glGetUniformLocation(phongShader, "WorldMatrix"), 1, 0, glm::value_ptr(WorldMatrix));
-
-            // (Could do view frustum culling (VFC) here using the projection matrix)
-            // (Mesh traversal)
-            // if (submesh.is_skinned)
-            //     submesh.aabb = meshres.src_mesh->m_model_aabb;
-            // else
-            //     submesh.aabb = meshres.src_mesh->m_mesh_aabbs_pose[i];
-            // (VFC)
-            // v4f bs = aabb.post_transform(tfm).get_boundingsphere();
-
-            // Color components
-            glUniform3fv(glGetUniformLocation(phongShader, "Ka"), 1, glm::value_ptr(mtl.Ka));
-            glUniform3fv(glGetUniformLocation(phongShader, "Kd"), 1, glm::value_ptr(mtl.Kd));
-            glUniform3fv(glGetUniformLocation(phongShader, "Ks"), 1, glm::value_ptr(mtl.Ks));
-            glUniform1f(glGetUniformLocation(phongShader, "shininess"), mtl.shininess);
-
-            // Bind textures and texture flags
-            for (auto &textureDesc : texturesDescs)
             {
-                // if (texture.textureTypeIndex == TextureTypeIndex::Cubemap) continue;
-                const int textureIndex = mtl.textureIndices[textureDesc.textureTypeIndex];
-                const bool hasTexture = (textureIndex != NoTexture);
-                if (hasTexture)
+                const auto &lod = submesh.lods[lodIndex];
+                drawCommands.push_back({lod.nbr_indices, 1, GLuint((arenaIndexOffset + lod.index_offset) / indexSize), arenaBaseVertex + (GLint)submesh.base_vertex, drawIndex});
+                triangleCounter += lod.nbr_indices / 3;
+            }
+        }
+    }
+
+    void ForwardRenderer::flushIndirect()
+    {
+#ifdef EENG_GLVERSION_43
+        if (drawCommands.size())
+        {
+            static_assert(sizeof(DrawData) == 80 && sizeof(MaterialData) == 64, "Layouts expected by phong_vert.glsl and phong_frag.glsl");
+            // Draws sharing a state become one multi-draw. Textures are selected per material in the shader.
+            // Opaque draws come first, so alpha-tested draws have more fragments rejected by the depth test.
+            std::stable_sort(drawCommands.begin(), drawCommands.end(), [&](const auto &a, const auto &b)
+                             { return drawStates[a.baseInstance] < drawStates[b.baseInstance]; });
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawData) * drawData.size(), drawData.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MaterialData) * materialData.size(), materialData.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, materialBuffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * drawCommands.size(), drawCommands.data(), GL_STREAM_DRAW);
+
+            uploadFrameBones();
+
+            // Instanced attribute holding 0, 1, 2, ..., so the base instance of a draw selects its draw data
+            if (drawData.size() > drawIndexCapacity)
+            {
+                drawIndexCapacity = std::max<size_t>(drawData.size(), 2 * drawIndexCapacity);
+                std::vector<GLuint> drawIndices(drawIndexCapacity);
+                std::iota(drawIndices.begin(), drawIndices.end(), 0u);
+                glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * drawIndexCapacity, drawIndices.data(), GL_STATIC_DRAW);
+            }
+
+            for (size_t first = 0, last; first < drawCommands.size(); first = last)
+            {
+                const auto &state = drawStates[drawCommands[first].baseInstance];
+                for (last = first + 1; last < drawCommands.size() && drawStates[drawCommands[last].baseInstance] == state; last++)
+                    ;
+
+                useVariant(indirectVariants, state.variant);
+                if (state.vao != boundVAO)
                 {
-                    glActiveTexture(GL_TEXTURE0 + textureDesc.textureUnit);
-                    glBindTexture(GL_TEXTURE_2D, mesh->m_textures[textureIndex].getHandle());
+                    bindVAO(state.vao);
+                    glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+                    glEnableVertexAttribArray(drawIndexLocation);
+                    glVertexAttribIPointer(drawIndexLocation, 1, GL_UNSIGNED_INT, 0, 0);
+                    glVertexAttribDivisor(drawIndexLocation, 1);
                 }
-                glUniform1i(glGetUniformLocation(phongShader, textureDesc.flagName), hasTexture);
+
+                glMultiDrawElementsIndirect(GL_TRIANGLES,
+                                            state.indexType,
+                                            (const void *)(first * sizeof(DrawElementsIndirectCommand)),
+                                            (GLsizei)(last - first),
+                                            0);
+                drawcallCounter++;
             }
 
-            // Skinned flag
-            glUniform1i(glGetUniformLocation(phongShader, "u_is_skinned"), (int)submesh.is_skinned);
+            bindVAO(0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            CheckAndThrowGLErrors();
+        }
+#endif
+        drawData.clear();
+        drawStates.clear();
+        materialData.clear();
+        materialIndices.clear();
+        drawCommands.clear();
+    }
+
+    void ForwardRenderer::bindVAO(GLuint vao)
+    {
+        if (vao != boundVAO)
+            glBindVertexArray(vao);
+        boundVAO = vao;
+    }
 
-            // Render
-            glDrawElementsBaseVertex(GL_TRIANGLES,
-                                     submesh.nbr_indices,
-                                     GL_UNSIGNED_INT,
-                                     (GLvoid *)(sizeof(uint) * submesh.base_index),
-                                     submesh.base_vertex);
-            drawcallCounter++;
+    void ForwardRenderer::beginFrame()
+    {
+        frameBoneData.clear();
+        uploadedBoneTexels = 0;
+        skinnedCount = 0;
+    }
+
+    SkinnedInstance ForwardRenderer::storePose(const RenderableMesh &mesh)
+    {
+        SkinnedInstance instance;
+        instance.boneOffset = (GLint)frameBoneData.size();
+        instance.dualQuats = !mesh.boneDualQuats.empty();
+        // Dual quaternions take half the space of matrices
+        if (instance.dualQuats)
+        {
+            const auto *first = reinterpret_cast<const glm::vec4 *>(glm::value_ptr(mesh.boneDualQuats[0]));
+            frameBoneData.insert(frameBoneData.end(), first, first + 2 * mesh.boneDualQuats.size());
+        }
+        else
+        {
+            const auto *first = reinterpret_cast<const glm::vec4 *>(glm::value_ptr(mesh.boneMatrices[0]));
+            frameBoneData.insert(frameBoneData.end(), first, first + 4 * mesh.boneMatrices.size());
+        }
+        return instance;
+    }
+
+    void ForwardRenderer::uploadFrameBones()
+    {
+        if (uploadedBoneTexels == frameBoneData.size())
+            return;
+
+        // The first upload of a frame respecifies storage, so draws still reading the previous frame do not stall.
+        // Later uploads append, since draws of the frame may not have been made yet.
+        glBindBuffer(GL_TEXTURE_BUFFER, boneBuffer);
+        if (uploadedBoneTexels == 0 || frameBoneData.size() > boneCapacity)
+        {
+            boneCapacity = std::max(frameBoneData.size(), boneCapacity);
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * boneCapacity, nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(glm::vec4) * frameBoneData.size(), frameBoneData.data());
+        }
+        else
+            glBufferSubData(GL_TEXTURE_BUFFER,
+                            sizeof(glm::vec4) * uploadedBoneTexels,
+                            sizeof(glm::vec4) * (frameBoneData.size() - uploadedBoneTexels),
+                            frameBoneData.data() + uploadedBoneTexels);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        uploadedBoneTexels = frameBoneData.size();
+    }
+
+    GLint ForwardRenderer::allocateSkinned(size_t nbrVertices)
+    {
+        const GLint baseVertex = (GLint)skinnedCount;
+        skinnedCount += nbrVertices;
+        if (skinnedCount <= skinnedCapacity)
+            return baseVertex;
+
+        // Grow into a new buffer, keeping the ranges skinned so far in the frame
+        const size_t capacity = std::max(skinnedCount, 2 * skinnedCapacity);
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, SkinnedVertexSize * capacity, nullptr, GL_DYNAMIC_COPY);
+        if (baseVertex)
+        {
+#ifdef EENG_GLVERSION_43
+            // Make compute shader writes visible to the copy
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+#endif
+            glBindBuffer(GL_COPY_READ_BUFFER, skinnedBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, SkinnedVertexSize * baseVertex);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (skinnedBuffer)
+            glDeleteBuffers(1, &skinnedBuffer);
+        skinnedBuffer = buffer;
+        skinnedCapacity = capacity;
+
+        // Interleaved skinned attributes
+        using Location = GeometryArena::Location;
+        GLint boundVAO = 0;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &boundVAO);
+        glBindVertexArray(skinnedVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, skinnedBuffer);
+        glVertexAttribPointer(Location::PositionLocation, 3, GL_FLOAT, GL_FALSE, SkinnedVertexSize, (const GLvoid *)0);
+        glVertexAttribPointer(Location::NormalLocation, 3, GL_FLOAT, GL_FALSE, SkinnedVertexSize, (const GLvoid *)12);
+        glVertexAttribPointer(Location::TangentLocation, 3, GL_FLOAT, GL_FALSE, SkinnedVertexSize, (const GLvoid *)24);
+        glVertexAttribPointer(Location::BinormalLocation, 3, GL_FLOAT, GL_FALSE, SkinnedVertexSize, (const GLvoid *)36);
+        glVertexAttribPointer(Location::TexcoordLocation, 2, GL_FLOAT, GL_FALSE, SkinnedVertexSize, (const GLvoid *)48);
+        glBindVertexArray(boundVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return baseVertex;
+    }
 
-            // Unbind textures
-            for (auto &texture : texturesDescs)
+    SkinnedInstance ForwardRenderer::skinMesh(const std::shared_ptr<RenderableMesh> mesh)
+    {
+        if (mesh->boneMatrices.empty())
+            return {};
+
+        // Renders of the instance read the pose from the bone data of the frame
+        SkinnedInstance instance = storePose(*mesh);
+        if (!skinShader || !preSkinning)
+            return instance;
+
+        GLint currentProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+
+        const auto &arena = GeometryArena::instance();
+        const GLint arenaBaseVertex = arena.base_vertex(mesh->m_geometry);
+        size_t nbrVertices = 0;
+        for (const auto &submesh : mesh->m_meshes)
+            nbrVertices = std::max<size_t>(nbrVertices, submesh.base_vertex + submesh.nbr_vertices);
+        instance.baseVertex = allocateSkinned(nbrVertices);
+
+        glUseProgram(skinShader);
+        uploadFrameBones();
+        glActiveTexture(GL_TEXTURE0 + boneTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, boneTexture);
+        glUniform1i(glGetUniformLocation(skinShader, "u_dq_skinning"), (int)instance.dualQuats);
+        glUniform1i(glGetUniformLocation(skinShader, "u_bone_offset"), instance.boneOffset);
+        const GLint isSkinnedLocation = glGetUniformLocation(skinShader, "u_is_skinned");
+
+        // Non-skinned submeshes are copied as is, so the skinned VAO can draw all submeshes
+#ifdef EENG_GLVERSION_43
+        static_assert(sizeof(RenderableMesh::SkinData) == 9 * sizeof(uint), "Layout expected by skin_comp.glsl");
+        const GeometryArena::Stream inputStreams[] = {
+            GeometryArena::Positions,
+            GeometryArena::Normals,
+            GeometryArena::Tangents,
+            GeometryArena::Binormals,
+            GeometryArena::Skin,
+            GeometryArena::Texcoords};
+        for (uint i = 0; i < numelem(inputStreams); i++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, arena.buffer(inputStreams[i]));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, numelem(inputStreams), skinnedBuffer);
+        glUniform1ui(glGetUniformLocation(skinShader, "u_arena_base_vertex"), arenaBaseVertex);
+        glUniform1ui(glGetUniformLocation(skinShader, "u_output_base_vertex"), instance.baseVertex);
+
+        for (const auto &submesh : mesh->m_meshes)
+        {
+            glUniform1i(isSkinnedLocation, (int)submesh.is_skinned);
+            glUniform1ui(glGetUniformLocation(skinShader, "u_base_vertex"), submesh.base_vertex);
+            glUniform1ui(glGetUniformLocation(skinShader, "u_nbr_vertices"), submesh.nbr_vertices);
+            glDispatchCompute((submesh.nbr_vertices + 63) / 64, 1, 1);
+        }
+        // Make the results visible to vertex fetching
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+#else
+        glEnable(GL_RASTERIZER_DISCARD);
+        bindVAO(arena.vao());
+        for (const auto &submesh : mesh->m_meshes)
+        {
+            glUniform1i(isSkinnedLocation, (int)submesh.is_skinned);
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER,
+                              0,
+                              skinnedBuffer,
+                              SkinnedVertexSize * (instance.baseVertex + submesh.base_vertex),
+                              SkinnedVertexSize * submesh.nbr_vertices);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, arenaBaseVertex + submesh.base_vertex, submesh.nbr_vertices);
+            glEndTransformFeedback();
+        }
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        bindVAO(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+#endif
+
+        glUseProgram(currentProgram);
+        CheckAndThrowGLErrors();
+        return instance;
+    }
+
+    void ForwardRenderer::renderMesh(const std::shared_ptr<RenderableMesh> mesh,
+                                     const glm::mat4 &WorldMatrix,
+                                     SkinnedInstance instance)
+    {
+        // Meshes not posed by skinMesh are drawn in their current pose
+        if (instance.boneOffset < 0 && mesh->boneMatrices.size())
+            instance = storePose(*mesh);
+
+        if (indirectVariants.initialized() && indirectDraws)
+        {
+            queueMesh(*mesh, WorldMatrix, instance);
+            return;
+        }
+
+        // Pre-skinned meshes are drawn as non-skinned
+        if (instance.baseVertex < 0 && instance.boneOffset >= 0)
+            uploadFrameBones();
+
+        for (uint i = 0; i < mesh->m_meshes.size(); i++)
+        {
+            const auto &submesh = mesh->m_meshes[i];
+            const auto &mtl = mesh->m_materials[submesh.mtl_index];
+
+            // Alpha-tested submeshes are drawn after all opaque submeshes, so that opaque
+            // variants keep early depth testing and more alpha-tested fragments are rejected.
+            // The instance keeps the pose, since the mesh may be animated again before the draw.
+            const uint32_t variant = materialVariant(*mesh, mtl);
+            if (variant & VariantAlphaTest)
             {
-                glActiveTexture(GL_TEXTURE0 + texture.textureUnit);
-                glBindTexture(GL_TEXTURE_2D, 0);
+                const bool skinned = submesh.is_skinned && instance.baseVertex < 0 && instance.boneOffset >= 0;
+                alphaTestedDraws.push_back({mesh, i, WorldMatrix, instance, variant | (skinned ? VariantSkinned : 0u)});
+                continue;
             }
+            drawSubmesh(*mesh, i, WorldMatrix, instance);
+        }
+    }
 
-            CheckAndThrowGLErrors();
+    void ForwardRenderer::drawAlphaTested()
+    {
+        if (alphaTestedDraws.empty())
+            return;
+
+        // Grouped by shader variant and VAO, otherwise in submission order
+        std::stable_sort(alphaTestedDraws.begin(), alphaTestedDraws.end(), [](const auto &a, const auto &b)
+                         { return std::make_pair(a.variant, a.instance.baseVertex >= 0) < std::make_pair(b.variant, b.instance.baseVertex >= 0); });
+
+        uploadFrameBones();
+        for (const auto &draw : alphaTestedDraws)
+            drawSubmesh(*draw.mesh, draw.submeshIndex, draw.WorldMatrix, draw.instance);
+
+        alphaTestedDraws.clear();
+    }
+
+    void ForwardRenderer::drawSubmesh(RenderableMesh &mesh, uint submeshIndex, const glm::mat4 &WorldMatrix, const SkinnedInstance &instance)
+    {
+        const auto &submesh = mesh.m_meshes[submeshIndex];
+        const auto &mtl = mesh.m_materials[submesh.mtl_index];
+        const bool preskinned = instance.baseVertex >= 0;
+        const bool skinned = submesh.is_skinned && !preskinned && instance.boneOffset >= 0;
+
+        // Shader variant of the material
+        const GLuint program = useVariant(phongVariants, materialVariant(mesh, mtl) | (skinned ? VariantSkinned : 0u));
+
+        // Models share the arena VAO, so it stays bound between meshes.
+        // Pre-skinned vertices are numbered from the start of the instance range, arena vertices from the start of the arena.
+        const auto &arena = GeometryArena::instance();
+        bindVAO(preskinned ? skinnedVAO : arena.vao());
+        const GLint arenaBaseVertex = preskinned ? instance.baseVertex : arena.base_vertex(mesh.m_geometry);
+        const uintptr_t arenaIndexOffset = arena.index_offset(mesh.m_geometry);
+
+        const auto WorldMeshMatrix = submeshWorldMatrix(mesh, submeshIndex, WorldMatrix);
+        glUniformMatrix4fv(glGetUniformLocation(program, "WorldMatrix"), 1, 0, glm::value_ptr(WorldMeshMatrix));
+
+        // (Could do view frustum culling (VFC) here using the projection matrix)
+        // (Mesh traversal)
+        // if (submesh.is_skinned)
+        //     submesh.aabb = meshres.src_mesh->m_model_aabb;
+        // else
+        //     submesh.aabb = meshres.src_mesh->m_mesh_aabbs_pose[i];
+        // (VFC)
+        // v4f bs = aabb.post_transform(tfm).get_boundingsphere();
+
+        // Color components
+        glUniform3fv(glGetUniformLocation(program, "Ka"), 1, glm::value_ptr(mtl.Ka));
+        glUniform3fv(glGetUniformLocation(program, "Kd"), 1, glm::value_ptr(mtl.Kd));
+        glUniform3fv(glGetUniformLocation(program, "Ks"), 1, glm::value_ptr(mtl.Ks));
+        glUniform1f(glGetUniformLocation(program, "shininess"), mtl.shininess);
+
+        // Texture layers, the texture arrays are bound for the pass
+        glUniform4iv(glGetUniformLocation(program, "textureLayers"), 1, glm::value_ptr(textureLayers(mesh, mtl)));
+
+        // Skinning mode and bones
+        if (skinned)
+        {
+            glUniform1i(glGetUniformLocation(program, "u_dq_skinning"), (int)instance.dualQuats);
+            glUniform1i(glGetUniformLocation(program, "u_bone_offset"), instance.boneOffset);
         }
 
-        glBindVertexArray(0);
+        // Render
+        const unsigned lodIndex = selectLod(mesh, submeshIndex, WorldMatrix);
+        if (meshletCulling && lodIndex == 0 && submesh.nbr_meshlets)
+            drawMeshlets(mesh, submeshIndex, WorldMeshMatrix, arenaBaseVertex + submesh.base_vertex);
+        else
+        {
+            const auto &lod = submesh.lods[lodIndex];
+            glDrawElementsBaseVertex(GL_TRIANGLES,
+                                     lod.nbr_indices,
+                                     submesh.index_type,
+                                     (GLvoid *)(arenaIndexOffset + lod.index_offset),
+                                     arenaBaseVertex + submesh.base_vertex);
+            drawcallCounter++;
+            triangleCounter += lod.nbr_indices / 3;
+        }
+
+        CheckAndThrowGLErrors();
     }
 
 } // namespace eeng
\ No newline at end of file
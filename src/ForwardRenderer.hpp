@@ -4,17 +4,149 @@
 #ifndef ForwardRenderer_hpp
 #define ForwardRenderer_hpp
 
+#include <vector>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include "glcommon.h"
+#include "ShaderLoader.h"
 #include "RenderableMesh.hpp"
 
 namespace eeng
 {
+    /// Pose of a mesh instance for the frame, see ForwardRenderer::skinMesh
+    struct SkinnedInstance
+    {
+        GLint baseVertex = -1; // First pre-skinned vertex, -1 if not pre-skinned
+        GLint boneOffset = -1; // First bone texel, -1 if no pose is stored
+        bool dualQuats = false;
+    };
+
     class ForwardRenderer
     {
-        GLuint phongShader = 0;
+        ShaderPermutations phongVariants;
+        ShaderPermutations indirectVariants; // Empty unless GL 4.3
+        GLuint skinShader = 0;
         GLuint placeholder_texture = 0;
+        GLuint boneBuffer = 0;
+        GLuint boneTexture = 0;
+        size_t boneCapacity = 0; // Texels
+        const GLuint boneTextureUnit = 5;
+        const GLuint texturePoolUnit = 6; // First of TexturePool::MaxPools units
+        const GLuint drawIndexLocation = 7; // Follows the vertex attributes of RenderableMesh
         int drawcallCounter;
+        int triangleCounter = 0;
+        int meshletCounter = 0;
+        int culledMeshletCounter = 0;
+        bool gpuTimerActive = false;
+        glm::mat4 projMatrix{1.0f}, viewMatrix{1.0f};
+        glm::vec3 eyePosition{0.0f}, passLightPos{0.0f}, passLightColor{0.0f};
+        GLuint boundVAO = 0;     // Between beginPass and endPass
+        GLuint boundProgram = 0; // Between beginPass and endPass
+
+        /// Shader permutation defines, see phong_vert.glsl and phong_frag.glsl
+        enum ShaderVariant : uint32_t
+        {
+            VariantDiffuse = 1,
+            VariantNormal = 2,
+            VariantSpecular = 4,
+            VariantAlphaTest = 8,
+            VariantSkinned = 16
+        };
+        const std::vector<std::string> variantDefines{
+            "DIFFUSE_TEXTURE",
+            "NORMAL_TEXTURE",
+            "SPECULAR_TEXTURE",
+            "ALPHA_TEST",
+            "SKINNING"};
+
+        // Pass the pass uniforms of each program were last set in, and the current pass
+        std::unordered_map<GLuint, unsigned> programPasses;
+        unsigned passIndex = 0;
+
+        // Bone palettes stored during the frame, each read from its own first texel.
+        // Texels up to uploadedBoneTexels are in boneBuffer.
+        std::vector<glm::vec4> frameBoneData;
+        size_t uploadedBoneTexels = 0;
+
+        // Pre-skinned vertices of the frame, one range per skinned instance
+        static constexpr GLsizei SkinnedVertexSize = 14 * sizeof(float); // Position, normal, tangent, binormal, texcoord
+        GLuint skinnedBuffer = 0;
+        GLuint skinnedVAO = 0;
+        size_t skinnedCapacity = 0; // Vertices
+        size_t skinnedCount = 0;    // Vertices
+
+        /// Alpha-tested submesh drawn without indirect draws, after the opaque submeshes.
+        /// Pre-skinned instances read their own range of the skinned buffer and others their own
+        /// bone palette, so the draws hold whatever pose the mesh has when they are made.
+        struct AlphaTestedDraw
+        {
+            std::shared_ptr<RenderableMesh> mesh;
+            uint submeshIndex;
+            glm::mat4 WorldMatrix;
+            SkinnedInstance instance;
+            uint32_t variant; // Sort key, with VariantSkinned
+        };
+        std::vector<AlphaTestedDraw> alphaTestedDraws;
+
+        // Draw ranges of visible meshlets, reused between submeshes
+        std::vector<GLsizei> meshletCounts;
+        std::vector<const void *> meshletOffsets;
+        std::vector<GLint> meshletBaseVertices;
+
+        /// Per-draw data of indirect draws, read by phong_vert.glsl (INDIRECT_DRAW)
+        struct DrawData
+        {
+            glm::mat4 world;
+            GLuint materialIndex;
+            GLuint boneOffset; // First bone texel
+            GLuint flags;      // DrawSkinned, DrawDualQuats
+            GLuint pad;
+        };
+        enum DrawFlags : GLuint
+        {
+            DrawSkinned = 1,
+            DrawDualQuats = 2
+        };
+
+        /// Per-material data of indirect draws, read by phong_frag.glsl (INDIRECT_DRAW)
+        struct MaterialData
+        {
+            glm::vec4 Ka, Kd, Ks; // Shininess in Ks.w
+            glm::ivec4 textures;  // See textureLayers
+        };
+
+        /// Layout of GL_DRAW_INDIRECT_BUFFER entries
+        struct DrawElementsIndirectCommand
+        {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance; // Draw index
+        };
+
+        /// State that cannot change within a multi-draw, per draw.
+        /// Ordered so that opaque draws come first.
+        struct DrawState
+        {
+            bool alphaTested;
+            uint32_t variant;
+            GLuint vao;
+            GLenum indexType;
+            auto operator<=>(const DrawState &) const = default;
+        };
+
+        // Indirect draws queued during a pass
+        std::vector<DrawData> drawData;
+        std::vector<DrawState> drawStates;
+        std::vector<MaterialData> materialData;
+        std::unordered_map<const PhongMaterial *, GLuint> materialIndices;
+        std::vector<DrawElementsIndirectCommand> drawCommands;
+        GLuint drawDataBuffer = 0;
+        GLuint materialBuffer = 0;
+        GLuint drawCommandBuffer = 0;
+        GLuint drawIndexBuffer = 0;
+        size_t drawIndexCapacity = 0;
 
         struct TextureDesc
         {
@@ -33,25 +165,62 @@ namespace eeng
             Cubemap
         };
 
-        TextureDesc texturesDescs[4] = {
-            {PhongMaterial::TextureTypeIndex::Diffuse, 0, "diffuseTexture", "has_diffuseTexture"},
-            {PhongMaterial::TextureTypeIndex::Normal, 1, "normalTexture", "has_normalTexture"},
-            {PhongMaterial::TextureTypeIndex::Specular, 2, "specularTexture", "has_specularTexture"},
-            {PhongMaterial::TextureTypeIndex::Opacity, 3, "opacityTexture", "has_opacityTexture"}};
+        /// Material textures in the order of the textureLayers components of phong_frag.glsl
+        PhongMaterial::TextureTypeIndex materialTextures[4] = {
+            PhongMaterial::TextureTypeIndex::Diffuse,
+            PhongMaterial::TextureTypeIndex::Normal,
+            PhongMaterial::TextureTypeIndex::Specular,
+            PhongMaterial::TextureTypeIndex::Opacity};
 
         TextureDesc cubemapTextureDesc{PhongMaterial::TextureTypeIndex::Cubemap, 4, "cubeTexture", "has_cubemap"};
 
     public:
+        /// Level of detail selection. Submeshes are drawn at full detail down to a projected
+        /// height of lodFullDetailSize (fraction of the viewport), then one level coarser per halving.
+        bool lodEnabled = true;
+        float lodFullDetailSize = 0.25f;
+
+        /// Cull meshlets of full detail submeshes against the frustum and by facing, see xi_build_meshlets
+        bool meshletCulling = true;
+
+        /// On GL 4.3, queue submeshes and draw them at the end of the pass with a few
+        /// glMultiDrawElementsIndirect calls, one per shader variant, VAO and index type
+        bool indirectDraws = true;
+
+        /// Skin meshes once per frame in skinMesh, if initSkinning was called, instead of in every draw
+        bool preSkinning = true;
+
         ForwardRenderer();
 
         ~ForwardRenderer();
 
         /// @brief Initialize renderer
+        /// Shader variants are compiled with the defines of a material when first drawn.
+        /// On GL 4.3 they are also compiled with INDIRECT_DRAW defined, for indirect draws.
         /// @param vertShaderPath
         /// @param fragShaderPath
         void init(const std::string &vertShaderPath,
                   const std::string &fragShaderPath);
 
+        /// @brief Initialize the optional pre-skinning stage
+        /// Uses a compute shader on GL 4.3 and transform feedback on GL 4.1.
+        /// @param feedbackShaderPath Vertex shader for transform feedback
+        /// @param computeShaderPath Compute shader
+        void initSkinning(const std::string &feedbackShaderPath,
+                          const std::string &computeShaderPath);
+
+        /// @brief Start of a frame
+        /// Releases the poses and pre-skinned vertices stored by skinMesh during the previous frame.
+        void beginFrame();
+
+        /// @brief Store the current pose of a mesh for the frame, and skin the mesh into a range of its own
+        /// The returned instance is passed to renderMesh, in any pass of the frame, so that several
+        /// instances of a mesh can be drawn in different poses. Meant to be called for all animated
+        /// meshes before the passes of the frame, but draws already queued in a pass are not affected.
+        /// @param mesh Mesh to skin. Vertices are not skinned unless preSkinning is set and initialized.
+        /// @return Instance to draw, empty if the mesh has no bones
+        SkinnedInstance skinMesh(const std::shared_ptr<RenderableMesh> mesh);
+
         /// @brief Start of a rendering pass and set common uniforms
         /// @param ProjMatrix
         /// @param ViewMatrix
@@ -64,15 +233,96 @@ namespace eeng
                        const glm::vec3 &lightColor,
                        const glm::vec3 &eyePos);
 
-        /// @brief Ends pass and resets GL state
+        /// @brief Ends pass and resets GL state. Queued indirect draws and alpha-tested submeshes are drawn here.
         /// @return Number of drawcalls made during pass
         int endPass();
 
+        /// @brief Number of triangles drawn during the current or last pass
+        int getTriangleCount() const;
+
+        /// @brief Number of meshlets drawn during the current or last pass
+        int getMeshletCount() const;
+
+        /// @brief Number of meshlets culled during the current or last pass
+        int getCulledMeshletCount() const;
+
+        /// @brief Number of shader variants compiled so far
+        int getShaderVariantCount() const;
+
         /// @brief Render an instance of a mesh
+        /// Submeshes with opacity textures are drawn after the opaque submeshes of the pass.
         /// @param mesh Mesh to render
         /// @param WorldMatrix Instance world transform
+        /// @param instance Pose from skinMesh. If empty, skinned meshes are drawn in their current pose.
         void renderMesh(const std::shared_ptr<RenderableMesh> mesh,
-                        const glm::mat4 &WorldMatrix);
+                        const glm::mat4 &WorldMatrix,
+                        SkinnedInstance instance = {});
+
+    private:
+        /// @brief Append the bone palette of a mesh to the bone data of the frame
+        /// Dual quaternions are stored if the mesh has them, otherwise matrices.
+        /// @param mesh Mesh with bones
+        SkinnedInstance storePose(const RenderableMesh &mesh);
+
+        /// @brief Upload bone data stored since the last upload to the bone texture buffer
+        void uploadFrameBones();
+
+        /// @brief Allocate a range of pre-skinned vertices for the frame
+        /// @return First vertex of the range
+        GLint allocateSkinned(size_t nbrVertices);
+
+        /// @brief Shader variant of a material, without VariantSkinned
+        uint32_t materialVariant(const RenderableMesh &mesh, const PhongMaterial &mtl) const;
+
+        /// @brief Use a shader variant, compiling it if needed
+        /// Sets the pass uniforms of the program when it is first used in a pass.
+        /// @return The program
+        GLuint useVariant(ShaderPermutations &variants, uint32_t variant);
+
+        /// @brief Draw a submesh without indirect draws
+        /// @param instance Pose of skinned meshes
+        void drawSubmesh(RenderableMesh &mesh, uint submeshIndex, const glm::mat4 &WorldMatrix, const SkinnedInstance &instance);
+
+        /// @brief Draw and clear the alpha-tested submeshes of renderMesh
+        void drawAlphaTested();
+
+        /// @brief Level of detail of a submesh from its projected size
+        /// @param mesh Mesh
+        /// @param submeshIndex Submesh
+        /// @param WorldMatrix Instance world transform
+        unsigned selectLod(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMatrix) const;
+
+        /// @brief Draw the meshlets of a submesh that pass culling, with one multi-draw call
+        /// @param mesh Mesh
+        /// @param submeshIndex Submesh with meshlets
+        /// @param WorldMeshMatrix Submesh world transform
+        /// @param baseVertex Base vertex of the submesh in the bound VAO
+        void drawMeshlets(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMeshMatrix, GLint baseVertex);
+
+        /// @brief Index ranges of the meshlets of a submesh that pass culling, into meshletCounts and meshletOffsets
+        /// Consecutive meshlets are merged into one range.
+        /// @param mesh Mesh
+        /// @param submeshIndex Submesh with meshlets
+        /// @param WorldMeshMatrix Submesh world transform
+        void cullMeshlets(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMeshMatrix);
+
+        /// @brief TexturePool layer ids of the textures of a material, -1 for textures it does not have
+        glm::ivec4 textureLayers(const RenderableMesh &mesh, const PhongMaterial &mtl) const;
+
+        /// @brief Submesh world transform, with the node transform of non-skinned submeshes
+        glm::mat4 submeshWorldMatrix(const RenderableMesh &mesh, size_t submeshIndex, const glm::mat4 &WorldMatrix) const;
+
+        /// @brief Queue the submeshes of an instance as indirect draws
+        /// @param mesh Mesh to render
+        /// @param WorldMatrix Instance world transform
+        /// @param instance Pose of skinned meshes
+        void queueMesh(RenderableMesh &mesh, const glm::mat4 &WorldMatrix, const SkinnedInstance &instance);
+
+        /// @brief Draw and clear queued indirect draws
+        void flushIndirect();
+
+        /// @brief Bind a VAO unless it is already bound
+        void bindVAO(GLuint vao);
     };
 
 using ForwardRendererPtr = std::shared_ptr<ForwardRenderer>;
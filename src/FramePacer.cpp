@@ -0,0 +1,107 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include <cmath>
+#include <SDL.h>
+#include "config.h"
+#include "FramePacer.hpp"
+#ifdef EENG_SSE
+#include <immintrin.h>
+#endif
+
+namespace eeng {
+
+    float percentile(std::vector<float>& frame_ms, float p)
+    {
+        const size_t n = frame_ms.size();
+        if (!n)
+            return 0.0f;
+        const size_t k = std::min(n - 1, size_t(p * (n - 1) + 0.5f));
+        std::nth_element(frame_ms.begin(), frame_ms.begin() + k, frame_ms.end());
+        return frame_ms[k];
+    }
+
+    FramePacer::FramePacer()
+        : ticks_per_s(double(SDL_GetPerformanceFrequency())), frame_ms(History, 0.0f)
+    {
+    }
+
+    void FramePacer::set_target_fps(float fps)
+    {
+        target_fps = std::max(0.0f, fps);
+        period_ticks = target_fps > 0.0f ? uint64_t(ticks_per_s / target_fps) : 0;
+        deadline = 0; // Restart pacing from the next frame
+    }
+
+    float FramePacer::get_target_fps() const
+    {
+        return target_fps;
+    }
+
+    void FramePacer::pace()
+    {
+        if (period_ticks)
+        {
+            const uint64_t now = SDL_GetPerformanceCounter();
+
+            // Deadlines advance by whole periods, so waits do not accumulate drift.
+            // When more than a period late, restart from now instead of catching up.
+            deadline += period_ticks;
+            if (deadline + period_ticks < now || deadline > now + period_ticks)
+                deadline = now + period_ticks;
+            wait_until(deadline);
+        }
+
+        const uint64_t now = SDL_GetPerformanceCounter();
+        if (prev_frame)
+            frame_ms[frame_count++ % History] = float((now - prev_frame) * 1000.0 / ticks_per_s);
+        prev_frame = now;
+    }
+
+    float FramePacer::last_frame_ms() const
+    {
+        return frame_count ? frame_ms[(frame_count - 1) % History] : 0.0f;
+    }
+
+    float FramePacer::percentile_ms(float p) const
+    {
+        const size_t n = size_t(std::min<uint64_t>(frame_count, History));
+        std::vector<float> recent(frame_ms.begin(), frame_ms.begin() + n);
+        return percentile(recent, p);
+    }
+
+    void FramePacer::wait_until(uint64_t counter)
+    {
+        // Sleep while there is time left for another sleep, as estimated from earlier sleeps
+        for (;;)
+        {
+            const uint64_t now = SDL_GetPerformanceCounter();
+            if (now >= counter || (counter - now) / ticks_per_s <= sleep_estimate_s)
+                break;
+
+            SDL_Delay(1);
+            const double observed_s = (SDL_GetPerformanceCounter() - now) / ticks_per_s;
+
+            // Welford's running mean and variance. Restarted now and then to follow changes in timer behavior.
+            if (sleep_count >= 1000)
+            {
+                sleep_count = 1;
+                sleep_m2 = 0.0;
+            }
+            sleep_count++;
+            const double delta = observed_s - sleep_mean_s;
+            sleep_mean_s += delta / sleep_count;
+            sleep_m2 += delta * (observed_s - sleep_mean_s);
+            sleep_estimate_s = sleep_mean_s + std::sqrt(sleep_m2 / (sleep_count - 1));
+        }
+
+        // Spin for the rest
+        while (SDL_GetPerformanceCounter() < counter)
+        {
+#ifdef EENG_SSE
+            _mm_pause();
+#endif
+        }
+    }
+
+} // namespace eeng
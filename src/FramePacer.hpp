@@ -0,0 +1,66 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef FramePacer_hpp
+#define FramePacer_hpp
+
+#include <cstdint>
+#include <vector>
+
+namespace eeng {
+
+    /// @brief Percentile of a set of frame times, by nearest rank
+    /// @param frame_ms Frame times, reordered by the call
+    /// @param p Percentile in [0, 1], e.g. 0.99
+    /// @return Frame time in milliseconds, 0 if there are none
+    float percentile(std::vector<float>& frame_ms, float p);
+
+    /// @brief Paces frames to a target rate and keeps a history of frame times.
+    /// Waits sleep in 1 ms steps while the expected oversleep leaves a margin,
+    /// then spin on the performance counter for the rest.
+    class FramePacer
+    {
+    public:
+        /// Reads the performance counter frequency, so SDL must be initialized
+        FramePacer();
+
+        /// @brief Set target frame rate
+        /// @param fps Frames per second, 0 for uncapped
+        void set_target_fps(float fps);
+
+        float get_target_fps() const;
+
+        /// @brief Wait until the next frame deadline and record the frame time.
+        /// Call once per frame, after presenting.
+        void pace();
+
+        /// @brief Duration of the last frame in milliseconds, measured between calls to pace()
+        float last_frame_ms() const;
+
+        /// @brief Frame time percentile over recent frames, see percentile()
+        /// @param p Percentile in [0, 1], e.g. 0.99
+        /// @return Frame time in milliseconds
+        float percentile_ms(float p) const;
+
+    private:
+        static constexpr int History = 512;
+
+        double ticks_per_s;
+        float target_fps = 0.0f;
+        uint64_t period_ticks = 0;
+        uint64_t deadline = 0;      // Next frame deadline in performance counter ticks
+        uint64_t prev_frame = 0;    // Counter at the previous call to pace()
+
+        // Observed duration of 1 ms sleeps (running mean and variance)
+        double sleep_estimate_s = 0.002;
+        double sleep_mean_s = 0.001, sleep_m2 = 0.0;
+        int64_t sleep_count = 1;
+
+        std::vector<float> frame_ms;
+        uint64_t frame_count = 0;
+
+        void wait_until(uint64_t counter);
+    };
+
+} // namespace eeng
+
+#endif /* FramePacer_hpp */
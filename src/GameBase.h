@@ -42,6 +42,21 @@ public:
         float deltaTime_s,
         InputManagerPtr input) = 0;
 
+    /**
+     * @brief Per-frame update of view state, such as the camera and picking.
+     *
+     * Called by the engine once per frame on the main thread, before render(),
+     * whereas update() runs at the fixed simulation rate. The default does nothing.
+     *
+     * @param deltaTime_s The time elapsed in seconds since the last frame.
+     * @param input Pointer to the input manager handling user input.
+     */
+    virtual void update_frame(
+        float deltaTime_s,
+        InputManagerPtr input)
+    {
+    }
+
     /**
      * @brief Render the game game.
      *
@@ -56,6 +71,48 @@ public:
         int windowWidth,
         int windowHeight) = 0;
 
+    /**
+     * @brief Render the game, interpolated between simulation steps.
+     *
+     * Called by the engine once per frame. The default implementation ignores alpha.
+     *
+     * @param time_s The current simulation time in seconds, including alpha.
+     * @param alpha Fraction of a time step passed since the last update, in [0, 1].
+     * @param screenWidth The width of the screen in pixels.
+     * @param screenHeight The height of the screen in pixels.
+     */
+    virtual void render(
+        float time_s,
+        float alpha,
+        int windowWidth,
+        int windowHeight)
+    {
+        render(time_s, windowWidth, windowHeight);
+    }
+
+    /**
+     * @brief Draw the game's ImGui windows.
+     *
+     * Called by the engine once per frame, after render(). Headless runs have no
+     * ImGui context and never call it, so games should not use ImGui elsewhere.
+     */
+    virtual void render_ui()
+    {
+    }
+
+    /**
+     * @brief Whether update() may run on a simulation thread, concurrently with render().
+     *
+     * Such games hand state over to render() via a SnapshotBuffer or similar,
+     * and should not use ImGui or OpenGL from update().
+     *
+     * @return false by default.
+     */
+    virtual bool threaded_update() const
+    {
+        return false;
+    }
+
     /**
      * @brief Clean up game resources.
      *
@@ -0,0 +1,261 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include "GeometryArena.hpp"
+#include "config.h"
+
+namespace eeng {
+
+    namespace
+    {
+        constexpr size_t InitialVertexCapacity = 1 << 16;
+        constexpr size_t InitialIndexCapacity = 1 << 18;
+    }
+
+    GeometryArena& GeometryArena::instance()
+    {
+        static GeometryArena arena;
+        return arena;
+    }
+
+    void GeometryArena::init()
+    {
+        EENG_ASSERT(!initialized(), "Geometry arena already initialized");
+        glGenVertexArrays(1, &m_vao);
+        glGenBuffers(StreamCount, m_buffers);
+        glGenBuffers(1, &m_index_buffer);
+        grow_vertices(InitialVertexCapacity);
+        grow_indices(InitialIndexCapacity);
+
+        glBindVertexArray(m_vao);
+        const struct { Stream stream; GLuint location; GLint size; } float_attributes[] = {
+            { Positions, PositionLocation, 3 },
+            { Texcoords, TexcoordLocation, 2 },
+            { Normals, NormalLocation, 3 },
+            { Tangents, TangentLocation, 3 },
+            { Binormals, BinormalLocation, 3 } };
+        for (const auto& attribute : float_attributes)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, m_buffers[attribute.stream]);
+            glEnableVertexAttribArray(attribute.location);
+            glVertexAttribPointer(attribute.location, attribute.size, GL_FLOAT, GL_FALSE, 0, 0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, m_buffers[Skin]);
+        glEnableVertexAttribArray(BoneIndexLocation);
+        glVertexAttribIPointer(BoneIndexLocation, 4, GL_UNSIGNED_INT, StreamStrides[Skin], (const GLvoid*)0);
+        glEnableVertexAttribArray(BoneWeightLocation);
+        glVertexAttribPointer(BoneWeightLocation, 4, GL_FLOAT, GL_FALSE, StreamStrides[Skin], (const GLvoid*)16);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        CheckAndThrowGLErrors();
+    }
+
+    void GeometryArena::shutdown()
+    {
+        if (!initialized())
+            return;
+        glDeleteBuffers(StreamCount, m_buffers);
+        glDeleteBuffers(1, &m_index_buffer);
+        glDeleteVertexArrays(1, &m_vao);
+        std::fill(std::begin(m_buffers), std::end(m_buffers), 0u);
+        m_index_buffer = 0;
+        m_vao = 0;
+        m_vertices = RangeAllocator();
+        m_indices = RangeAllocator();
+        m_allocations.clear();
+        m_free_handles.clear();
+    }
+
+    GeometryArena::Handle GeometryArena::allocate(size_t nbr_vertices, size_t index_bytes)
+    {
+        EENG_ASSERT(initialized(), "Geometry arena not initialized");
+        Allocation allocation;
+        allocation.nbr_vertices = nbr_vertices;
+        allocation.index_bytes = (index_bytes + 3) & ~size_t(3); // Aligned for both index types
+
+        // Grow by at least the request, so the added space alone fits it
+        if (nbr_vertices)
+        {
+            allocation.vertex_offset = m_vertices.allocate(nbr_vertices);
+            if (allocation.vertex_offset == RangeAllocator::NoRange)
+            {
+                grow_vertices(std::max(2 * m_vertices.capacity(), m_vertices.capacity() + nbr_vertices));
+                allocation.vertex_offset = m_vertices.allocate(nbr_vertices);
+            }
+        }
+        if (allocation.index_bytes)
+        {
+            allocation.index_offset = m_indices.allocate(allocation.index_bytes);
+            if (allocation.index_offset == RangeAllocator::NoRange)
+            {
+                grow_indices(std::max(2 * m_indices.capacity(), m_indices.capacity() + allocation.index_bytes));
+                allocation.index_offset = m_indices.allocate(allocation.index_bytes);
+            }
+        }
+
+        Handle handle;
+        if (m_free_handles.size())
+        {
+            handle = m_free_handles.back();
+            m_free_handles.pop_back();
+            m_allocations[handle] = allocation;
+        }
+        else
+        {
+            handle = (Handle)m_allocations.size();
+            m_allocations.push_back(allocation);
+        }
+        return handle;
+    }
+
+    void GeometryArena::free(Handle handle)
+    {
+        if (!initialized())
+            return;
+        EENG_ASSERT(handle >= 0 && handle < (Handle)m_allocations.size(), "Invalid geometry handle {0}", handle);
+        auto& allocation = m_allocations[handle];
+        if (allocation.vertex_offset != RangeAllocator::NoRange)
+            m_vertices.free(allocation.vertex_offset);
+        if (allocation.index_offset != RangeAllocator::NoRange)
+            m_indices.free(allocation.index_offset);
+        allocation = Allocation{};
+        m_free_handles.push_back(handle);
+
+        // Defragment, so the free space is one range at the end
+        const auto vertex_moves = m_vertices.compact();
+        const auto index_moves = m_indices.compact();
+        for (int s = 0; s < StreamCount; s++)
+            move_ranges(m_buffers[s], vertex_moves, StreamStrides[s], m_vertices.used() * StreamStrides[s]);
+        move_ranges(m_index_buffer, index_moves, 1, m_indices.used());
+
+        // Moves are sorted by source offset
+        auto relocate = [](size_t& offset, const std::vector<RangeAllocator::Move>& moves)
+        {
+            auto it = std::lower_bound(moves.begin(), moves.end(), offset,
+                [](const RangeAllocator::Move& move, size_t from) { return move.from < from; });
+            if (it != moves.end() && it->from == offset)
+                offset = it->to;
+        };
+        for (auto& a : m_allocations)
+        {
+            if (a.vertex_offset != RangeAllocator::NoRange)
+                relocate(a.vertex_offset, vertex_moves);
+            if (a.index_offset != RangeAllocator::NoRange)
+                relocate(a.index_offset, index_moves);
+        }
+        CheckAndThrowGLErrors();
+    }
+
+    void GeometryArena::upload(Handle handle, Stream stream, const void* data)
+    {
+        const auto& allocation = m_allocations[handle];
+        if (!allocation.nbr_vertices)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffers[stream]);
+        glBufferSubData(GL_COPY_WRITE_BUFFER,
+            allocation.vertex_offset * StreamStrides[stream],
+            allocation.nbr_vertices * StreamStrides[stream],
+            data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void GeometryArena::upload_indices(Handle handle, const void* data)
+    {
+        const auto& allocation = m_allocations[handle];
+        if (!allocation.index_bytes)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_index_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.index_offset, allocation.index_bytes, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    GLint GeometryArena::base_vertex(Handle handle) const
+    {
+        const auto& allocation = m_allocations[handle];
+        return allocation.nbr_vertices ? (GLint)allocation.vertex_offset : 0;
+    }
+
+    size_t GeometryArena::index_offset(Handle handle) const
+    {
+        const auto& allocation = m_allocations[handle];
+        return allocation.index_bytes ? allocation.index_offset : 0;
+    }
+
+    void GeometryArena::resize_buffer(GLuint buffer, size_t keep_bytes, size_t new_bytes)
+    {
+        // Storage is respecified for the same buffer object, through a temporary copy of its contents
+        GLuint temp = 0;
+        if (keep_bytes)
+        {
+            glGenBuffers(1, &temp);
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+            glBufferData(GL_COPY_WRITE_BUFFER, keep_bytes, nullptr, GL_STREAM_COPY);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keep_bytes);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, new_bytes, nullptr, GL_STATIC_DRAW);
+
+        if (temp)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, temp);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keep_bytes);
+            glDeleteBuffers(1, &temp);
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void GeometryArena::move_ranges(GLuint buffer, const std::vector<RangeAllocator::Move>& moves, size_t unit_bytes, size_t used_bytes)
+    {
+        if (moves.empty())
+            return;
+
+        // Ranges may overlap their destinations, so they go through a temporary buffer
+        size_t temp_bytes = 0;
+        for (const auto& move : moves)
+            temp_bytes += move.size * unit_bytes;
+        GLuint temp = 0;
+        glGenBuffers(1, &temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+        glBufferData(GL_COPY_WRITE_BUFFER, temp_bytes, nullptr, GL_STREAM_COPY);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        size_t temp_offset = 0;
+        for (const auto& move : moves)
+        {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, move.from * unit_bytes, temp_offset, move.size * unit_bytes);
+            temp_offset += move.size * unit_bytes;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        temp_offset = 0;
+        for (const auto& move : moves)
+        {
+            EENG_ASSERT((move.to + move.size) * unit_bytes <= used_bytes, "Range moved past the used space");
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, temp_offset, move.to * unit_bytes, move.size * unit_bytes);
+            temp_offset += move.size * unit_bytes;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &temp);
+    }
+
+    void GeometryArena::grow_vertices(size_t capacity)
+    {
+        for (int s = 0; s < StreamCount; s++)
+            resize_buffer(m_buffers[s], m_vertices.capacity() * StreamStrides[s], capacity * StreamStrides[s]);
+        m_vertices.grow(capacity);
+    }
+
+    void GeometryArena::grow_indices(size_t capacity)
+    {
+        resize_buffer(m_index_buffer, m_indices.capacity(), capacity);
+        m_indices.grow(capacity);
+    }
+
+} // namespace eeng
@@ -0,0 +1,130 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef GeometryArena_hpp
+#define GeometryArena_hpp
+
+#include <vector>
+#include "glcommon.h"
+#include "RangeAllocator.hpp"
+
+namespace eeng {
+
+    /// @brief Vertex and index buffers shared by all RenderableMesh instances, drawn through one VAO.
+    /// Meshes allocate a vertex range and an index range. Draws add the vertex range start to
+    /// their base vertex and the index range start to their index offset, both of which change
+    /// when the arena is compacted, so they are looked up at draw time.
+    ///
+    /// Buffers grow by respecifying storage of the same buffer objects, so VAOs that refer to them stay valid.
+    class GeometryArena
+    {
+    public:
+        /// Vertex attribute streams, one buffer each
+        enum Stream
+        {
+            Positions,
+            Texcoords,
+            Normals,
+            Tangents,
+            Binormals,
+            Skin,
+            StreamCount
+        };
+
+        /// Vertex attribute locations used by the shaders
+        enum Location : GLuint
+        {
+            PositionLocation = 0,
+            TexcoordLocation = 1,
+            NormalLocation = 2,
+            TangentLocation = 3,
+            BinormalLocation = 4,
+            BoneIndexLocation = 5,
+            BoneWeightLocation = 6
+        };
+
+        using Handle = int;
+        static constexpr Handle NoHandle = -1;
+
+        /// @brief The process-wide arena. Holds no GL objects outside init() and shutdown().
+        static GeometryArena& instance();
+
+        /// @brief Create the buffers and VAO. Call once a GL context is current.
+        void init();
+
+        /// @brief Delete the buffers and VAO and drop all allocations. Call before the GL context is destroyed.
+        /// Handles freed afterwards are ignored, so meshes may outlive the context.
+        void shutdown();
+
+        bool initialized() const { return m_vao != 0; }
+
+        /// @brief Allocate vertices and indices
+        /// @param nbr_vertices Vertices of all streams
+        /// @param index_bytes Index data size, rounded up to a multiple of four
+        Handle allocate(size_t nbr_vertices, size_t index_bytes);
+
+        /// @brief Free an allocation and compact the arena. Ignored after shutdown().
+        void free(Handle handle);
+
+        /// @brief Copy vertex data of one stream
+        /// @param data Tightly packed, one element per allocated vertex
+        void upload(Handle handle, Stream stream, const void* data);
+
+        /// @brief Copy index data
+        /// @param data Index data of the allocated size
+        void upload_indices(Handle handle, const void* data);
+
+        /// @brief First vertex of an allocation
+        GLint base_vertex(Handle handle) const;
+
+        /// @brief Byte offset of the indices of an allocation
+        size_t index_offset(Handle handle) const;
+
+        /// @brief VAO with all streams and the index buffer
+        GLuint vao() const { return m_vao; }
+        GLuint buffer(Stream stream) const { return m_buffers[stream]; }
+        GLuint index_buffer() const { return m_index_buffer; }
+
+        static constexpr GLsizei stream_stride(Stream stream) { return StreamStrides[stream]; }
+
+        size_t vertex_capacity() const { return m_vertices.capacity(); }
+        size_t vertices_used() const { return m_vertices.used(); }
+        size_t index_capacity() const { return m_indices.capacity(); }
+        size_t index_bytes_used() const { return m_indices.used(); }
+
+    private:
+        static constexpr GLsizei StreamStrides[StreamCount] = { 12, 8, 12, 12, 12, 36 };
+
+        struct Allocation
+        {
+            size_t vertex_offset = RangeAllocator::NoRange;
+            size_t nbr_vertices = 0;
+            size_t index_offset = RangeAllocator::NoRange;
+            size_t index_bytes = 0;
+        };
+
+        GLuint m_vao = 0;
+        GLuint m_buffers[StreamCount] = { 0 };
+        GLuint m_index_buffer = 0;
+        RangeAllocator m_vertices;  // In vertices
+        RangeAllocator m_indices;   // In bytes
+        std::vector<Allocation> m_allocations;
+        std::vector<Handle> m_free_handles;
+
+        GeometryArena() = default;
+        ~GeometryArena() = default;
+        GeometryArena(const GeometryArena&) = delete;
+        GeometryArena& operator=(const GeometryArena&) = delete;
+
+        /// Respecify a buffer with a new size, keeping the first keep_bytes bytes
+        void resize_buffer(GLuint buffer, size_t keep_bytes, size_t new_bytes);
+
+        /// Apply moves from RangeAllocator::compact to a buffer
+        void move_ranges(GLuint buffer, const std::vector<RangeAllocator::Move>& moves, size_t unit_bytes, size_t used_bytes);
+
+        void grow_vertices(size_t capacity);
+        void grow_indices(size_t capacity);
+    };
+
+} // namespace eeng
+
+#endif /* GeometryArena_hpp */
@@ -12,6 +12,7 @@ struct eeng::InputManager::Impl
 
     MouseState mouseState;
     ControllerMap controllers;
+    bool ownsControllers = true;
 
     Impl() 
     {
@@ -57,6 +58,8 @@ struct eeng::InputManager::Impl
 
     ~Impl() 
     {
+        if (!ownsControllers)
+            return;
         for (auto& [id, state] : controllers) 
         {
             SDL_GameControllerClose(SDL_GameControllerFromInstanceID(id));
@@ -161,6 +164,19 @@ void eeng::InputManager::Update()
 
 }
 
+void eeng::InputManager::SetKeyState(Key key, bool pressed)
+{
+    pImpl->keyStates[key] = pressed;
+}
+
+void eeng::InputManager::CopyStateFrom(const InputManager& other)
+{
+    pImpl->keyStates = other.pImpl->keyStates;
+    pImpl->mouseState = other.pImpl->mouseState;
+    pImpl->controllers = other.pImpl->controllers;
+    pImpl->ownsControllers = false;
+}
+
 bool eeng::InputManager::IsKeyPressed(Key key) const 
 {
     auto it = pImpl->keyStates.find(key);
@@ -47,6 +47,13 @@ namespace eeng {
         void HandleEvent(const void* event);
         void Update();
 
+        // Set key state directly, e.g. from scripted input
+        void SetKeyState(Key key, bool pressed);
+
+        // Copy key, mouse and controller states, e.g. to hand input to another thread.
+        // Controllers stay owned by the source.
+        void CopyStateFrom(const InputManager& other);
+
         // Query functions
         bool IsKeyPressed(Key key) const;
         bool IsMouseButtonDown(int button) const;
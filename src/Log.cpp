@@ -2,44 +2,349 @@
 // Licensed under the MIT License. See LICENSE file for details.
 
 #include <iostream>
+#include <fstream>
 #include <cstdarg>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
 #include "Log.hpp"
 #include "config.h"
 
 namespace {
-    std::string formatString(const char* fmt, va_list args)
+
+    /// Bounded multi-producer, single-consumer queue (after D. Vyukov's bounded MPMC queue).
+    /// Each slot carries a sequence number that tells whose turn it is,
+    /// so producers only contend on a single compare-and-swap.
+    template<class T, size_t Capacity>
+    class BoundedQueue
     {
-        va_list args_copy;
-        va_copy(args_copy, args);
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        struct Slot
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
 
-        int length = vsnprintf(NULL, 0, fmt, args_copy);
-        char* buffer = new char[length + 1];
-        vsnprintf(buffer, length + 1, fmt, args);
-        va_end(args_copy);
+        std::unique_ptr<Slot[]> slots;
+        alignas(64) std::atomic<size_t> enqueue_pos{ 0 };
+        alignas(64) size_t dequeue_pos = 0;
+
+    public:
+        BoundedQueue() : slots(new Slot[Capacity])
+        {
+            for (size_t i = 0; i < Capacity; i++)
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
 
-        std::string formattedString(buffer);
-        delete[] buffer;
+        /// @return False if the queue is full
+        template<class U>
+        bool try_push(U&& value)
+        {
+            Slot* slot;
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                slot = &slots[pos & (Capacity - 1)];
+                const size_t seq = slot->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+            slot->value = std::forward<U>(value);
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
 
-        return formattedString;
+        /// @brief Consumer thread only
+        /// @return False if the queue is empty
+        bool try_pop(T& value)
+        {
+            Slot& slot = slots[dequeue_pos & (Capacity - 1)];
+            const size_t seq = slot.sequence.load(std::memory_order_acquire);
+            if (intptr_t(seq) - intptr_t(dequeue_pos + 1) < 0)
+                return false;
+            value = std::move(slot.value);
+            slot.sequence.store(dequeue_pos + Capacity, std::memory_order_release);
+            dequeue_pos++;
+            return true;
+        }
+    };
+
+    struct StreamChunk
+    {
+        std::shared_ptr<std::ostream> stream;
+        std::string text;
+    };
+
+    const char* level_prefix(eeng::LogLevel level)
+    {
+        switch (level)
+        {
+        case eeng::LogLevel::Trace: return "Trace: ";
+        case eeng::LogLevel::Debug: return "Debug: ";
+        case eeng::LogLevel::Warning: return "Warning: ";
+        case eeng::LogLevel::Error: return "Error: ";
+        default: return "";
+        }
     }
-}
 
-void eeng::Log(const char* fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string formattedString = formatString(fmt, args);
-    va_end(args);
+    /// Queues and the writer thread that formats records and writes them to the sinks:
+    /// the log window (handed over to the main thread), an optional file, and stdout if enabled.
+    class LogBackend
+    {
+    public:
+        static LogBackend& instance()
+        {
+            static LogBackend backend;
+            return backend;
+        }
+
+        void push(const eeng::internal::LogRecord& record)
+        {
+            if (records.try_push(record))
+            {
+                submitted.fetch_add(1, std::memory_order_release);
+                wake_writer();
+            }
+            else
+                dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void push(StreamChunk&& chunk)
+        {
+            // Stream writes are not dropped; wait for the writer to make room
+            while (!chunks.try_push(std::move(chunk)))
+            {
+                wake_writer();
+                std::this_thread::yield();
+            }
+            submitted.fetch_add(1, std::memory_order_release);
+            wake_writer();
+        }
+
+        void flush()
+        {
+            const uint64_t target = submitted.load(std::memory_order_acquire);
+            wake_writer();
+            for (uint64_t done = processed.load(std::memory_order_acquire); done < target; done = processed.load(std::memory_order_acquire))
+                processed.wait(done);
+        }
+
+        void set_file(const std::string& filename)
+        {
+            std::lock_guard<std::mutex> lock(file_mutex);
+            file.close();
+            if (!filename.empty())
+                file.open(filename, std::ios::out);
+        }
+
+        /// @brief Take entries written since the last call
+        void take_window_entries(std::vector<eeng::internal::LogEntry>& entries)
+        {
+            std::lock_guard<std::mutex> lock(window_mutex);
+            entries.swap(window_entries);
+        }
 
+    private:
+        BoundedQueue<eeng::internal::LogRecord, 4096> records;
+        BoundedQueue<StreamChunk, 256> chunks;
+        std::atomic<uint64_t> submitted{ 0 }, processed{ 0 }, dropped{ 0 };
+        std::atomic<uint32_t> wake{ 0 };
+        std::atomic<bool> stop{ false };
+
+        std::mutex window_mutex;
+        std::vector<eeng::internal::LogEntry> window_entries;
+        std::mutex file_mutex;
+        std::ofstream file;
+        std::vector<std::shared_ptr<std::ostream>> dirty_streams; // Written to since last idle
+
+        std::thread writer;
+
+        LogBackend()
+        {
+            writer = std::thread([this]() { run(); });
+        }
+
+        ~LogBackend()
+        {
+            stop.store(true);
+            wake_writer();
+            writer.join();
+        }
+
+        void wake_writer()
+        {
+            wake.fetch_add(1, std::memory_order_release);
+            wake.notify_one();
+        }
+
+        void run()
+        {
+            std::vector<eeng::internal::LogEntry> lines;
+            for (;;)
+            {
+                const uint32_t wake_count = wake.load(std::memory_order_acquire);
+                const bool wrote = drain(lines);
+                if (wrote)
+                    continue;
+
+                // Idle: flush once, then sleep until woken
+                for (auto& stream : dirty_streams)
+                    stream->flush();
+                dirty_streams.clear();
+                {
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    if (file.is_open())
+                        file.flush();
+                }
+#ifdef EENG_PRINT_LOG_TO_COUT
+                std::cout.flush();
+#endif
+                if (stop.load())
+                    break;
+                wake.wait(wake_count);
+            }
+        }
+
+        bool drain(std::vector<eeng::internal::LogEntry>& lines)
+        {
+            uint64_t count = 0;
+
+            if (const uint64_t nbr_dropped = dropped.exchange(0, std::memory_order_relaxed))
+                lines.push_back({ eeng::LogLevel::Warning, 0, nullptr, "[" + std::to_string(nbr_dropped) + " log messages dropped]\n" });
+
+            eeng::internal::LogRecord record;
+            char buffer[1024];
+            while (count < 256 && records.try_pop(record))
+            {
+                const int len = record.formatter(buffer, sizeof(buffer), record.fmt, record.payload);
+                std::string message;
+                if (len >= int(sizeof(buffer)))
+                {
+                    message.resize(len + 1);
+                    record.formatter(message.data(), message.size(), record.fmt, record.payload);
+                    message.resize(len);
+                }
+                else if (len > 0)
+                    message = buffer;
+
+                std::string line = "[frame#" + std::to_string(record.frame) + "] ";
+                if (record.category)
+                    line = line + "[" + record.category + "] ";
+                lines.push_back({ record.level, record.frame, record.category, line + level_prefix(record.level) + message + "\n" });
+                count++;
+            }
+
+            StreamChunk chunk;
+            while (chunks.try_pop(chunk))
+            {
+                *chunk.stream << chunk.text;
+                if (std::find(dirty_streams.begin(), dirty_streams.end(), chunk.stream) == dirty_streams.end())
+                    dirty_streams.push_back(chunk.stream);
+                chunk = StreamChunk{};
+                count++;
+            }
+
+            if (lines.size())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    if (file.is_open())
+                        for (const auto& line : lines)
+                            file << line.text;
+                }
 #ifdef EENG_PRINT_LOG_TO_COUT
-    std::cout << formattedString << std::endl;
+                for (const auto& line : lines)
+                    std::cout << line.text;
 #endif
-    internal::LogSingleton::instance().AddLog("[frame#%i] %s\n", ImGui::GetFrameCount(), formattedString.c_str());
+                // Entries are only taken by LogDraw, which headless runs never call, so only as many
+                // as the log window holds are kept
+                std::lock_guard<std::mutex> lock(window_mutex);
+                for (auto& line : lines)
+                    window_entries.push_back(std::move(line));
+                lines.clear();
+                constexpr size_t MaxWindowEntries = eeng::internal::ImGuiLogWidget::Capacity;
+                if (window_entries.size() > MaxWindowEntries)
+                    window_entries.erase(window_entries.begin(), window_entries.end() - MaxWindowEntries);
+            }
+
+            if (count)
+            {
+                processed.fetch_add(count, std::memory_order_release);
+                processed.notify_all();
+            }
+            return count > 0;
+        }
+    };
+}
+
+std::atomic<int> eeng::internal::g_log_level{ 0 };
+
+namespace {
+    std::atomic<int> g_log_frame{ 0 };
+}
+
+void eeng::internal::LogPush(const LogRecord& record)
+{
+    LogBackend::instance().push(record);
+}
+
+int eeng::internal::LogFrame()
+{
+    return g_log_frame.load(std::memory_order_relaxed);
+}
+
+void eeng::internal::LogWriteStream(std::shared_ptr<std::ostream> stream, std::string&& text)
+{
+    LogBackend::instance().push(StreamChunk{ std::move(stream), std::move(text) });
+}
+
+void eeng::SetLogLevel(LogLevel level)
+{
+    internal::g_log_level.store(int(level), std::memory_order_relaxed);
+}
+
+eeng::LogLevel eeng::GetLogLevel()
+{
+    return LogLevel(internal::g_log_level.load(std::memory_order_relaxed));
+}
+
+void eeng::LogSetFrame(int frame)
+{
+    g_log_frame.store(frame, std::memory_order_relaxed);
+}
+
+void eeng::LogToFile(const std::string& filename)
+{
+    LogBackend::instance().set_file(filename);
+}
+
+void eeng::LogFlush()
+{
+    LogBackend::instance().flush();
 }
 
 void eeng::LogDraw(const char* label, bool* p_open)
 {
-    internal::LogSingleton::instance().Draw(label, p_open);
+    // Move entries from the writer thread into the window
+    static std::vector<internal::LogEntry> entries;
+    LogBackend::instance().take_window_entries(entries);
+    auto& widget = internal::LogSingleton::instance();
+    for (auto& entry : entries)
+        widget.Add(std::move(entry));
+    entries.clear();
+
+    widget.Draw(label, p_open);
 }
 
 void eeng::LogClear()
@@ -51,58 +356,59 @@ eeng::internal::ImGuiLogWidget::ImGuiLogWidget()
 {
     AutoScroll = true;
     ScrollToBottom = false;
+    Entries.resize(Capacity);
     Clear();
 }
 
 void eeng::internal::ImGuiLogWidget::Clear()
 {
-    Buf.clear();
-    LineOffsets.clear();
-    LineOffsets.push_back(0);
+    BeginSeq = EndSeq;
+    Matches.clear();
+    ScannedSeq = EndSeq;
 }
 
-void eeng::internal::ImGuiLogWidget::AddLog(const char* fmt, ...)
+void eeng::internal::ImGuiLogWidget::Add(LogEntry&& entry)
 {
-    int old_size = Buf.size();
-    va_list args;
-    va_start(args, fmt);
-    Buf.appendfv(fmt, args);
-    va_end(args);
-    for (int new_size = Buf.size(); old_size < new_size; old_size++)
-        if (Buf[old_size] == '\n')
-            LineOffsets.push_back(old_size + 1);
+    // Oldest entry is overwritten when full
+    if (EndSeq - BeginSeq == Capacity)
+        BeginSeq++;
+    if (entry.category &&
+        std::find(Categories.begin(), Categories.end(), entry.category) == Categories.end())
+        Categories.push_back(entry.category);
+    Entries[EndSeq % Capacity] = std::move(entry);
+    EndSeq++;
+
     if (AutoScroll)
         ScrollToBottom = true;
 }
 
-void eeng::internal::ImGuiLogWidget::Draw(const char* title, bool* p_open)
+bool eeng::internal::ImGuiLogWidget::PassFilter(const LogEntry& entry) const
 {
-#if 1
-    if (!ImGui::Begin(title, p_open))
-    {
-        ImGui::End();
-        return;
-    }
-#else
-    // Fixate to top-right corner
+    if (int(entry.level) < MinLevel)
+        return false;
+    if (CategoryIndex > 0 && (!entry.category || Categories[CategoryIndex - 1] != entry.category))
+        return false;
+    return Filter.PassFilter(entry.text.c_str(), entry.text.c_str() + entry.text.size());
+}
 
-    ImGuiIO& io = ImGui::GetIO();
-    const float DISTANCE = 10.0f;
-    static int corner = 1;
-    if (corner != -1)
-    {
-        ImVec2 window_pos = ImVec2((corner & 1) ? io.DisplaySize.x - DISTANCE : DISTANCE, (corner & 2) ? io.DisplaySize.y - DISTANCE : DISTANCE);
-        ImVec2 window_pos_pivot = ImVec2((corner & 1) ? 1.0f : 0.0f, (corner & 2) ? 1.0f : 0.0f);
-        ImGui::SetNextWindowPos(window_pos, ImGuiCond_Always, window_pos_pivot);
-    }
+void eeng::internal::ImGuiLogWidget::UpdateMatches()
+{
+    // Forget evicted entries, then filter new ones only
+    while (Matches.size() && Matches.front() < BeginSeq)
+        Matches.pop_front();
+    for (uint64_t seq = std::max(ScannedSeq, BeginSeq); seq < EndSeq; seq++)
+        if (PassFilter(Entries[seq % Capacity]))
+            Matches.push_back(seq);
+    ScannedSeq = EndSeq;
+}
 
-    ImGui::SetNextWindowBgAlpha(0.35f); // Transparent background
-    if (!ImGui::Begin(title, p_open, (corner != -1 ? ImGuiWindowFlags_NoMove : 0) | ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
+void eeng::internal::ImGuiLogWidget::Draw(const char* title, bool* p_open)
+{
+    if (!ImGui::Begin(title, p_open))
     {
         ImGui::End();
         return;
     }
-#endif
 
     // Options menu
     if (ImGui::BeginPopup("Options"))
@@ -120,58 +426,75 @@ void eeng::internal::ImGuiLogWidget::Draw(const char* title, bool* p_open)
     bool clear = ImGui::Button("Clear");
     ImGui::SameLine();
     bool copy = ImGui::Button("Copy");
-    ImGui::SameLine();
-    Filter.Draw("Filter", -100.0f);
 
-    ImGui::Separator();
-    ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+    // Filters. Any change restarts filtering from the oldest entry.
+    bool filter_changed = false;
+    static const char* levels[] = { "Trace", "Debug", "Info", "Warning", "Error" };
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(90.0f);
+    filter_changed |= ImGui::Combo("##level", &MinLevel, levels, IM_ARRAYSIZE(levels));
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(110.0f);
+    if (ImGui::BeginCombo("##category", CategoryIndex ? Categories[CategoryIndex - 1].c_str() : "All categories"))
+    {
+        for (int i = 0; i <= (int)Categories.size(); i++)
+        {
+            if (ImGui::Selectable(i ? Categories[i - 1].c_str() : "All categories", CategoryIndex == i))
+            {
+                filter_changed |= (CategoryIndex != i);
+                CategoryIndex = i;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    ImGui::SameLine();
+    filter_changed |= Filter.Draw("Filter", -100.0f);
 
     if (clear)
         Clear();
+    if (filter_changed)
+    {
+        Matches.clear();
+        ScannedSeq = BeginSeq;
+    }
+    UpdateMatches();
+
     if (copy)
-        ImGui::LogToClipboard();
+    {
+        std::string text;
+        for (uint64_t seq : Matches)
+            text += Entries[seq % Capacity].text;
+        ImGui::SetClipboardText(text.c_str());
+    }
+
+    ImGui::Separator();
+    ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
 
+    // Only visible matches are drawn
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-    const char* buf = Buf.begin();
-    const char* buf_end = Buf.end();
-    if (Filter.IsActive())
+    ImGuiListClipper clipper;
+    clipper.Begin((int)Matches.size());
+    while (clipper.Step())
     {
-        // In this example we don't use the clipper when Filter is enabled.
-        // This is because we don't have a random access on the result on our filter.
-        // A real application processing logs with ten of thousands of entries may want to store the result of search/filter.
-        // especially if the filtering function is not trivial (e.g. reg-exp).
-        for (int line_no = 0; line_no < LineOffsets.Size; line_no++)
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
         {
-            const char* line_start = buf + LineOffsets[line_no];
-            const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-            if (Filter.PassFilter(line_start, line_end))
-                ImGui::TextUnformatted(line_start, line_end);
-        }
-    }
-    else
-    {
-        // The simplest and easy way to display the entire buffer:
-        //   ImGui::TextUnformatted(buf_begin, buf_end);
-        // And it'll just work. TextUnformatted() has specialization for large blob of text and will fast-forward to skip non-visible lines.
-        // Here we instead demonstrate using the clipper to only process lines that are within the visible area.
-        // If you have tens of thousands of items and their processing cost is non-negligible, coarse clipping them on your side is recommended.
-        // Using ImGuiListClipper requires A) random access into your data, and B) items all being the  same height,
-        // both of which we can handle since we an array pointing to the beginning of each line of text.
-        // When using the filter (in the block of code above) we don't have random access into the data to display anymore, which is why we don't use the clipper.
-        // Storing or skimming through the search result would make it possible (and would be recommended if you want to search through tens of thousands of entries)
-        ImGuiListClipper clipper;
-        clipper.Begin(LineOffsets.Size);
-        while (clipper.Step())
-        {
-            for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
+            const auto& entry = Entries[Matches[i] % Capacity];
+            const bool colored = entry.level != LogLevel::Info;
+            if (colored)
             {
-                const char* line_start = buf + LineOffsets[line_no];
-                const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-                ImGui::TextUnformatted(line_start, line_end);
+                const ImVec4 color =
+                    entry.level == LogLevel::Error ? ImVec4(1.0f, 0.4f, 0.4f, 1.0f) :
+                    entry.level == LogLevel::Warning ? ImVec4(1.0f, 0.8f, 0.3f, 1.0f) :
+                    ImVec4(0.6f, 0.6f, 0.6f, 1.0f);
+                ImGui::PushStyleColor(ImGuiCol_Text, color);
             }
+            // Lines end with a newline, which is not drawn
+            ImGui::TextUnformatted(entry.text.c_str(), entry.text.c_str() + entry.text.size() - (entry.text.size() && entry.text.back() == '\n'));
+            if (colored)
+                ImGui::PopStyleColor();
         }
-        clipper.End();
     }
+    clipper.End();
     ImGui::PopStyleVar();
 
     if (ScrollToBottom)
@@ -180,4 +503,3 @@ void eeng::internal::ImGuiLogWidget::Draw(const char* title, bool* p_open)
     ImGui::EndChild();
     ImGui::End();
 }
-
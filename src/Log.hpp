@@ -5,32 +5,247 @@
 #define Log_hpp
 
 #include <memory>
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <type_traits>
 #include "imgui.h"
+#include "config.h"
 
 namespace eeng {
 
-    /// @brief 
-    /// @param fmt 
-    /// @param  
-    void Log(const char* fmt, ...);
+    /// @brief Log severity, in increasing order
+    enum class LogLevel : int { Trace = 0, Debug, Info, Warning, Error };
 
-    /// @brief 
-    /// @param label 
-    /// @param p_open 
+    namespace internal {
+
+        constexpr size_t LogPayloadSize = 200;
+
+        using LogFormatter = int (*)(char* out, size_t size, const char* fmt, const unsigned char* payload);
+
+        /// @brief Log message with unformatted arguments
+        struct LogRecord
+        {
+            LogFormatter formatter;
+            const char* fmt;
+            const char* category;
+            int frame;
+            LogLevel level;
+            alignas(8) unsigned char payload[LogPayloadSize];
+        };
+
+        template<class T>
+        constexpr bool is_log_string_v =
+            std::is_same_v<std::decay_t<T>, const char*> ||
+            std::is_same_v<std::decay_t<T>, char*> ||
+            std::is_same_v<std::decay_t<T>, std::string>;
+
+        /// Strings are copied into the record, other arguments are stored by value
+        template<class T>
+        using log_stored_t = std::conditional_t<is_log_string_v<T>, const char*, std::decay_t<T>>;
+
+        /// Argument as passed to snprintf: strings as non-null C strings, other arguments as they are
+        template<class T>
+        inline auto log_printf_arg(const T& arg)
+        {
+            if constexpr (std::is_same_v<std::decay_t<T>, std::string>) return arg.c_str();
+            else if constexpr (std::is_array_v<T>) return static_cast<const char*>(arg); // Never null
+            else if constexpr (is_log_string_v<T>) return arg ? static_cast<const char*>(arg) : "(null)";
+            else return arg;
+        }
+
+        template<class T>
+        inline bool log_encode(unsigned char*& p, const unsigned char* end, const T& arg)
+        {
+            if constexpr (is_log_string_v<T>)
+            {
+                const char* str = log_printf_arg(arg);
+                const size_t len = strlen(str) + 1;
+                if (size_t(end - p) < len) return false;
+                memcpy(p, str, len);
+                p += len;
+            }
+            else
+            {
+                static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>,
+                    "Log arguments must be strings, numbers, enums or pointers");
+                if (size_t(end - p) < sizeof(T)) return false;
+                memcpy(p, &arg, sizeof(T));
+                p += sizeof(T);
+            }
+            return true;
+        }
+
+        template<class T>
+        inline log_stored_t<T> log_decode(const unsigned char*& p)
+        {
+            if constexpr (is_log_string_v<T>)
+            {
+                const char* str = reinterpret_cast<const char*>(p);
+                p += strlen(str) + 1;
+                return str;
+            }
+            else
+            {
+                std::decay_t<T> arg;
+                memcpy(&arg, p, sizeof(arg));
+                p += sizeof(arg);
+                return arg;
+            }
+        }
+
+        /// Formats a record on the writer thread
+        template<class... Args>
+        int log_format(char* out, size_t size, const char* fmt, const unsigned char* payload)
+        {
+            const unsigned char* p = payload;
+            // Braced initialization decodes arguments in order
+            std::tuple<log_stored_t<Args>...> args{ log_decode<Args>(p)... };
+            (void)p;
+            return std::apply([&](const auto&... a) { return snprintf(out, size, fmt, a...); }, args);
+        }
+
+        /// Record formatted on the calling thread, used when arguments do not fit the payload
+        inline int log_format_preformatted(char* out, size_t size, const char*, const unsigned char* payload)
+        {
+            return snprintf(out, size, "%s", reinterpret_cast<const char*>(payload));
+        }
+
+        /// @brief Queue a record for the writer thread. Drops the record if the queue is full.
+        void LogPush(const LogRecord& record);
+
+        /// @brief Current frame number, as published by LogSetFrame(), for tagging records
+        int LogFrame();
+
+        /// @brief Queue a write of text to a stream. The stream is then only written to from the writer thread.
+        void LogWriteStream(std::shared_ptr<std::ostream> stream, std::string&& text);
+
+        extern std::atomic<int> g_log_level;
+
+    } // namespace internal
+
+    /// @brief Set runtime severity threshold. Messages below it are discarded.
+    void SetLogLevel(LogLevel level);
+
+    LogLevel GetLogLevel();
+
+    /// @brief Publish the current frame number, shown with messages logged from now on.
+    /// Call once per frame from the main thread.
+    void LogSetFrame(int frame);
+
+    /// @brief Log a message at a given severity.
+    /// Arguments are copied and formatted later on a writer thread, so the format string
+    /// must outlive the program (e.g. a literal). Safe to call from any thread.
+    /// Levels below EENG_LOG_MIN_LEVEL compile to nothing.
+    /// @param category Category shown and filtered on in the log window, may be null. Must outlive the program.
+    /// @param fmt printf-style format string
+    template<LogLevel Level, class... Args>
+    inline void LogAtCategory(const char* category, const char* fmt, const Args&... args)
+    {
+        if constexpr (int(Level) >= EENG_LOG_MIN_LEVEL)
+        {
+            if (int(Level) < internal::g_log_level.load(std::memory_order_relaxed))
+                return;
+
+            internal::LogRecord record;
+            record.fmt = fmt;
+            record.category = category;
+            record.frame = internal::LogFrame();
+            record.level = Level;
+            unsigned char* p = record.payload;
+            const unsigned char* end = record.payload + internal::LogPayloadSize;
+            if ((internal::log_encode(p, end, args) && ...))
+                record.formatter = &internal::log_format<Args...>;
+            else
+            {
+                snprintf(reinterpret_cast<char*>(record.payload), internal::LogPayloadSize, fmt, internal::log_printf_arg(args)...);
+                record.formatter = &internal::log_format_preformatted;
+            }
+            internal::LogPush(record);
+        }
+    }
+
+    /// @brief Log a message at a given severity, without category
+    template<LogLevel Level, class... Args>
+    inline void LogAt(const char* fmt, const Args&... args)
+    {
+        LogAtCategory<Level>(nullptr, fmt, args...);
+    }
+
+    /// @brief Log a message at Info level
+    template<class... Args>
+    inline void Log(const char* fmt, const Args&... args)
+    {
+        LogAt<LogLevel::Info>(fmt, args...);
+    }
+
+    template<class... Args>
+    inline void LogDebug(const char* fmt, const Args&... args)
+    {
+        LogAt<LogLevel::Debug>(fmt, args...);
+    }
+
+    template<class... Args>
+    inline void LogWarning(const char* fmt, const Args&... args)
+    {
+        LogAt<LogLevel::Warning>(fmt, args...);
+    }
+
+    template<class... Args>
+    inline void LogError(const char* fmt, const Args&... args)
+    {
+        LogAt<LogLevel::Error>(fmt, args...);
+    }
+
+    /// @brief Also write messages to a file, in addition to the log window
+    /// @param filename File to write, or empty to stop writing to file
+    void LogToFile(const std::string& filename);
+
+    /// @brief Block until all messages logged so far are written
+    void LogFlush();
+
+    /// @brief Draw the log window. Call from the main thread.
+    /// @param label Window label
+    /// @param p_open Window open state
     void LogDraw(const char* label, bool* p_open = nullptr);
 
-    /// @brief 
+    /// @brief Clear the log window
     void LogClear();
 
     namespace internal {
 
-        /// @brief ImGui log widget
-        ///  Adapted from imgui_demo.cpp
+        /// @brief Formatted log line, as shown in the log window
+        struct LogEntry
+        {
+            LogLevel level;
+            int frame;
+            const char* category;   // May be null
+            std::string text;       // Full line, including frame and level prefix
+        };
+
+        /// @brief ImGui log widget over a fixed-capacity ring of entries.
+        /// Matches of the current filter are cached and extended with new entries only,
+        /// so the cost per frame does not grow with session length.
         struct ImGuiLogWidget
         {
-            ImGuiTextBuffer Buf;
+            static constexpr size_t Capacity = 8192;
+
+            std::vector<LogEntry> Entries;      // Ring, entry with sequence number s at s % Capacity
+            uint64_t BeginSeq = 0, EndSeq = 0;  // Sequence numbers of entries in the ring
+
             ImGuiTextFilter Filter;
-            ImVector<int> LineOffsets;
+            int MinLevel = 0;
+            int CategoryIndex = 0;              // 0 for all categories, otherwise Categories[i - 1]
+            std::vector<std::string> Categories;
+            std::deque<uint64_t> Matches;       // Sequence numbers of entries that pass the filter
+            uint64_t ScannedSeq = 0;            // Entries before this have been filtered
+
             bool AutoScroll;
             bool ScrollToBottom;
 
@@ -38,9 +253,14 @@ namespace eeng {
 
             void Clear();
 
-            void AddLog(const char* fmt, ...) IM_FMTARGS(2);
+            void Add(LogEntry&& entry);
 
             void Draw(const char* title, bool* p_open = NULL);
+
+        private:
+            bool PassFilter(const LogEntry& entry) const;
+
+            void UpdateMatches();
         };
 
         class LogSingleton
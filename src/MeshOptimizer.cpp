@@ -0,0 +1,672 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include "MeshOptimizer.hpp"
+
+namespace eeng::meshopt {
+
+    namespace
+    {
+        /// Sum of weighted squared distances to planes, as a symmetric 4x4 matrix
+        struct Quadric
+        {
+            double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+            double a11 = 0, a12 = 0, a13 = 0;
+            double a22 = 0, a23 = 0;
+            double a33 = 0;
+            double weight = 0;
+
+            /// Plane n.p + d = 0 with unit normal n
+            void add_plane(const glm::vec3& n, float d, double w)
+            {
+                a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+                a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+                a22 += w * n.z * n.z; a23 += w * n.z * d;
+                a33 += w * d * d;
+                weight += w;
+            }
+
+            void add(const Quadric& q)
+            {
+                a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+                a11 += q.a11; a12 += q.a12; a13 += q.a13;
+                a22 += q.a22; a23 += q.a23;
+                a33 += q.a33;
+                weight += q.weight;
+            }
+
+            /// Weighted mean squared distance to the planes
+            double error(const glm::vec3& p) const
+            {
+                const double x = p.x, y = p.y, z = p.z;
+                const double e =
+                    a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+                    a11 * y * y + 2 * a12 * y * z + 2 * a13 * y +
+                    a22 * z * z + 2 * a23 * z +
+                    a33;
+                return weight > 0 ? std::abs(e) / weight : 0;
+            }
+        };
+
+        inline uint64_t edge_key(unsigned a, unsigned b)
+        {
+            return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+        }
+    }
+
+    VertexCacheStats analyze_vertex_cache(
+        const unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        unsigned cache_size)
+    {
+        // A vertex is cached if fewer than cache_size vertices were added after it
+        std::vector<unsigned> cache_time(nbr_vertices, 0);
+        unsigned timestamp = cache_size + 1;
+        size_t misses = 0;
+        for (size_t i = 0; i < nbr_indices; i++)
+        {
+            const unsigned v = indices[i];
+            if (timestamp - cache_time[v] > cache_size)
+            {
+                cache_time[v] = timestamp++;
+                misses++;
+            }
+        }
+
+        VertexCacheStats stats;
+        if (nbr_indices >= 3)
+            stats.acmr = float(misses) / (nbr_indices / 3);
+        if (nbr_vertices)
+            stats.atvr = float(misses) / nbr_vertices;
+        return stats;
+    }
+
+    void optimize_vertex_cache(
+        unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        std::vector<unsigned>& cluster_offsets,
+        unsigned cache_size)
+    {
+        cluster_offsets.assign(1, 0);
+        const size_t nbr_triangles = nbr_indices / 3;
+        if (!nbr_triangles)
+            return;
+
+        // Triangles adjacent to each vertex
+        std::vector<unsigned> adj_offsets(nbr_vertices + 1, 0);
+        for (size_t i = 0; i < nbr_indices; i++)
+            adj_offsets[indices[i] + 1]++;
+        for (size_t v = 0; v < nbr_vertices; v++)
+            adj_offsets[v + 1] += adj_offsets[v];
+        std::vector<unsigned> adj(nbr_indices);
+        std::vector<unsigned> adj_fill(adj_offsets.begin(), adj_offsets.end() - 1);
+        for (size_t i = 0; i < nbr_indices; i++)
+            adj[adj_fill[indices[i]]++] = unsigned(i / 3);
+
+        // Number of triangles not yet emitted per vertex
+        std::vector<unsigned> live(nbr_vertices);
+        for (size_t v = 0; v < nbr_vertices; v++)
+            live[v] = adj_offsets[v + 1] - adj_offsets[v];
+
+        std::vector<unsigned> cache_time(nbr_vertices, 0);
+        std::vector<bool> emitted(nbr_triangles, false);
+        std::vector<unsigned> dead_end, candidates, output;
+        dead_end.reserve(nbr_indices);
+        output.reserve(nbr_indices);
+        unsigned timestamp = cache_size + 1;
+        size_t cursor = 1;
+        int64_t fanning = 0;
+
+        while (fanning >= 0)
+        {
+            // Emit all remaining triangles around the fanning vertex
+            candidates.clear();
+            for (unsigned a = adj_offsets[fanning]; a < adj_offsets[fanning + 1]; a++)
+            {
+                const unsigned t = adj[a];
+                if (emitted[t])
+                    continue;
+                for (int k = 0; k < 3; k++)
+                {
+                    const unsigned v = indices[3 * t + k];
+                    output.push_back(v);
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (timestamp - cache_time[v] > cache_size)
+                        cache_time[v] = timestamp++;
+                }
+                emitted[t] = true;
+            }
+
+            // Next fanning vertex: the oldest candidate that stays in cache while its triangles are emitted
+            int64_t best = -1;
+            int64_t best_priority = -1;
+            for (unsigned v : candidates)
+            {
+                if (!live[v])
+                    continue;
+                int64_t priority = 0;
+                if (timestamp - cache_time[v] + 2 * live[v] <= cache_size)
+                    priority = timestamp - cache_time[v];
+                if (priority > best_priority)
+                {
+                    best = v;
+                    best_priority = priority;
+                }
+            }
+
+            if (best < 0)
+            {
+                // Dead end: resume from recently used vertices, then in input order
+                while (best < 0 && !dead_end.empty())
+                {
+                    const unsigned v = dead_end.back();
+                    dead_end.pop_back();
+                    if (live[v])
+                        best = v;
+                }
+                while (best < 0 && cursor < nbr_vertices)
+                {
+                    if (live[cursor])
+                        best = cursor;
+                    cursor++;
+                }
+
+                // Resuming from an uncached vertex starts a new cluster
+                if (best >= 0 && timestamp - cache_time[best] > cache_size)
+                    cluster_offsets.push_back(unsigned(output.size()));
+            }
+            fanning = best;
+        }
+
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    void optimize_overdraw(
+        unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        const std::vector<unsigned>& cluster_offsets)
+    {
+        const size_t nbr_clusters = cluster_offsets.size();
+        if (nbr_clusters < 2)
+            return;
+
+        struct Cluster
+        {
+            unsigned begin, end;
+            glm::vec3 centroid{ 0.0f };
+            glm::vec3 normal{ 0.0f };
+            float area = 0.0f;
+            float sort_key = 0.0f;
+        };
+        std::vector<Cluster> clusters(nbr_clusters);
+
+        // Area weighted centroid and average normal per cluster
+        glm::vec3 mesh_centroid{ 0.0f };
+        float mesh_area = 0.0f;
+        for (size_t c = 0; c < nbr_clusters; c++)
+        {
+            auto& cluster = clusters[c];
+            cluster.begin = cluster_offsets[c];
+            cluster.end = c + 1 < nbr_clusters ? cluster_offsets[c + 1] : unsigned(nbr_indices);
+            for (unsigned i = cluster.begin; i < cluster.end; i += 3)
+            {
+                const glm::vec3& p0 = positions[indices[i]];
+                const glm::vec3& p1 = positions[indices[i + 1]];
+                const glm::vec3& p2 = positions[indices[i + 2]];
+                const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                const float area = glm::length(n);
+                cluster.centroid += (p0 + p1 + p2) * (area / 3.0f);
+                cluster.normal += n;
+                cluster.area += area;
+            }
+            mesh_centroid += cluster.centroid;
+            mesh_area += cluster.area;
+            if (cluster.area > 0.0f)
+                cluster.centroid /= cluster.area;
+        }
+        if (mesh_area > 0.0f)
+            mesh_centroid /= mesh_area;
+
+        // Clusters far out along their normal are likely to occlude others
+        for (auto& cluster : clusters)
+        {
+            const float normal_length = glm::length(cluster.normal);
+            if (normal_length > 0.0f)
+                cluster.sort_key = glm::dot(cluster.centroid - mesh_centroid, cluster.normal / normal_length);
+        }
+        std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b)
+            {
+                return a.sort_key > b.sort_key;
+            });
+
+        std::vector<unsigned> output;
+        output.reserve(nbr_indices);
+        for (auto& cluster : clusters)
+            output.insert(output.end(), indices + cluster.begin, indices + cluster.end);
+        std::copy(output.begin(), output.end(), indices);
+    }
+
+    void optimize_vertex_fetch(
+        unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        std::vector<unsigned>& remap)
+    {
+        constexpr unsigned Unused = ~0u;
+        remap.assign(nbr_vertices, Unused);
+        unsigned next = 0;
+        for (size_t i = 0; i < nbr_indices; i++)
+        {
+            unsigned& new_index = remap[indices[i]];
+            if (new_index == Unused)
+                new_index = next++;
+            indices[i] = new_index;
+        }
+        for (auto& new_index : remap)
+        {
+            if (new_index == Unused)
+                new_index = next++;
+        }
+    }
+
+    size_t simplify(
+        unsigned* destination,
+        const unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        size_t nbr_vertices,
+        size_t target_nbr_indices,
+        float max_error,
+        const unsigned* vertex_groups)
+    {
+        std::vector<unsigned> result(indices, indices + nbr_indices);
+
+        // Vertices with identical positions form a position group, with one vertex (wedge) per set of attributes
+        std::vector<unsigned> group(nbr_vertices), group_wedges(nbr_vertices), group_offsets, group_rep;
+        std::iota(group_wedges.begin(), group_wedges.end(), 0);
+        std::sort(group_wedges.begin(), group_wedges.end(), [&](unsigned a, unsigned b)
+            {
+                const glm::vec3& pa = positions[a];
+                const glm::vec3& pb = positions[b];
+                return pa.x != pb.x ? pa.x < pb.x : (pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z);
+            });
+        for (unsigned i = 0; i < nbr_vertices; i++)
+        {
+            const unsigned v = group_wedges[i];
+            if (!i || positions[v] != positions[group_wedges[i - 1]])
+            {
+                group_offsets.push_back(i);
+                group_rep.push_back(v);
+            }
+            group[v] = unsigned(group_rep.size() - 1);
+        }
+        const size_t nbr_groups = group_rep.size();
+        group_offsets.push_back(unsigned(nbr_vertices));
+
+        // Edges between groups: border edges have one triangle, non-manifold edges more than two
+        enum Kind : uint8_t { Manifold, Border, Locked };
+        std::vector<uint8_t> kind(nbr_groups, Manifold);
+        std::vector<uint64_t> edges, border_edges;
+        for (size_t i = 0; i < result.size(); i += 3)
+            for (int k = 0; k < 3; k++)
+            {
+                const unsigned a = group[result[i + k]], b = group[result[i + (k + 1) % 3]];
+                if (a != b)
+                    edges.push_back(edge_key(a, b));
+            }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size();)
+        {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i])
+                j++;
+            const unsigned a = unsigned(edges[i] >> 32), b = unsigned(edges[i] & 0xffffffff);
+            if (j - i == 1)
+            {
+                border_edges.push_back(edges[i]);
+                kind[a] = std::max<uint8_t>(kind[a], Border);
+                kind[b] = std::max<uint8_t>(kind[b], Border);
+            }
+            else if (j - i > 2)
+                kind[a] = kind[b] = Locked;
+            i = j;
+        }
+
+        // Quadrics of triangle planes, weighted by area, and of planes perpendicular to borders
+        std::vector<Quadric> quadrics(nbr_groups);
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            const unsigned g[3] = { group[result[i]], group[result[i + 1]], group[result[i + 2]] };
+            const glm::vec3& p0 = positions[result[i]];
+            const glm::vec3 n = glm::cross(positions[result[i + 1]] - p0, positions[result[i + 2]] - p0);
+            const float length = glm::length(n);
+            if (length <= 0.0f)
+                continue;
+            const glm::vec3 normal = n / length;
+            for (int k = 0; k < 3; k++)
+                quadrics[g[k]].add_plane(normal, -glm::dot(normal, p0), length * 0.5);
+
+            for (int k = 0; k < 3; k++)
+            {
+                const unsigned a = g[k], b = g[(k + 1) % 3];
+                if (a == b || !std::binary_search(border_edges.begin(), border_edges.end(), edge_key(a, b)))
+                    continue;
+                const glm::vec3& pa = positions[result[i + k]];
+                const glm::vec3 edge = positions[result[i + (k + 1) % 3]] - pa;
+                const glm::vec3 bn = glm::cross(edge, normal);
+                const float bn_length = glm::length(bn);
+                if (bn_length <= 0.0f)
+                    continue;
+                const glm::vec3 border_normal = bn / bn_length;
+                const double border_weight = 10.0 * glm::dot(edge, edge);
+                quadrics[a].add_plane(border_normal, -glm::dot(border_normal, pa), border_weight);
+                quadrics[b].add_plane(border_normal, -glm::dot(border_normal, pa), border_weight);
+            }
+        }
+
+        struct Candidate
+        {
+            unsigned from, to;
+            double error;
+        };
+        std::vector<Candidate> candidates;
+        std::vector<unsigned> tri_offsets, tris, remap;
+        std::vector<std::pair<unsigned, unsigned>> wedge_targets;
+        std::vector<uint8_t> locked;
+        const double max_error2 = double(max_error) * max_error;
+
+        // Collapse a group onto another if every wedge reaches a wedge of the target along an edge,
+        // and no remaining triangle flips
+        auto find_wedge_targets = [&](unsigned from, unsigned to)
+        {
+            wedge_targets.clear();
+            const glm::vec3& to_pos = positions[group_rep[to]];
+            for (unsigned w = group_offsets[from]; w < group_offsets[from + 1]; w++)
+            {
+                const unsigned wedge = group_wedges[w];
+                unsigned target = ~0u;
+                for (unsigned a = tri_offsets[wedge]; a < tri_offsets[wedge + 1]; a++)
+                {
+                    const unsigned* t = &result[3 * tris[a]];
+                    int k_to = -1, k_from = 0;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        if (group[t[k]] == to) k_to = k;
+                        if (t[k] == wedge) k_from = k;
+                    }
+                    if (k_to >= 0)
+                    {
+                        target = t[k_to];
+                        continue;
+                    }
+                    const glm::vec3& p1 = positions[t[(k_from + 1) % 3]];
+                    const glm::vec3& p2 = positions[t[(k_from + 2) % 3]];
+                    const glm::vec3 n_old = glm::cross(p1 - positions[wedge], p2 - positions[wedge]);
+                    const glm::vec3 n_new = glm::cross(p1 - to_pos, p2 - to_pos);
+                    if (glm::dot(n_old, n_new) <= 0.0f)
+                        return false;
+                }
+                if (tri_offsets[wedge] == tri_offsets[wedge + 1])
+                    continue;
+                if (target == ~0u)
+                    return false;
+                wedge_targets.push_back({ wedge, target });
+            }
+            return !wedge_targets.empty();
+        };
+
+        while (result.size() > target_nbr_indices)
+        {
+            // Triangles around each wedge
+            tri_offsets.assign(nbr_vertices + 1, 0);
+            for (auto i : result)
+                tri_offsets[i + 1]++;
+            for (size_t v = 0; v < nbr_vertices; v++)
+                tri_offsets[v + 1] += tri_offsets[v];
+            tris.resize(result.size());
+            std::vector<unsigned> tri_fill(tri_offsets.begin(), tri_offsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++)
+                tris[tri_fill[result[i]]++] = unsigned(i / 3);
+
+            // Collapses within the error bound, cheapest first
+            candidates.clear();
+            for (size_t i = 0; i < result.size(); i += 3)
+                for (int k = 0; k < 3; k++)
+                {
+                    const unsigned a = group[result[i + k]], b = group[result[i + (k + 1) % 3]];
+                    if (a == b)
+                        continue;
+                    for (auto [from, to] : { std::pair{ a, b }, std::pair{ b, a } })
+                    {
+                        if (kind[from] == Locked)
+                            continue;
+                        if (vertex_groups && vertex_groups[group_rep[from]] != vertex_groups[group_rep[to]])
+                            continue;
+                        if (kind[from] == Border &&
+                            (kind[to] == Manifold || !std::binary_search(border_edges.begin(), border_edges.end(), edge_key(from, to))))
+                            continue;
+                        const double error = quadrics[from].error(positions[group_rep[to]]);
+                        if (error <= max_error2)
+                            candidates.push_back({ from, to, error });
+                    }
+                }
+            if (candidates.empty())
+                break;
+            std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.error < b.error; });
+
+            // Collapse groups whose neighborhoods are untouched in this pass
+            locked.assign(nbr_groups, 0);
+            remap.resize(nbr_vertices);
+            std::iota(remap.begin(), remap.end(), 0);
+            size_t nbr_removed = 0;
+            for (const auto& c : candidates)
+            {
+                if (result.size() - nbr_removed <= target_nbr_indices)
+                    break;
+                if (locked[c.from] || locked[c.to] || !find_wedge_targets(c.from, c.to))
+                    continue;
+
+                for (auto [wedge, target] : wedge_targets)
+                {
+                    remap[wedge] = target;
+                    for (unsigned a = tri_offsets[wedge]; a < tri_offsets[wedge + 1]; a++)
+                    {
+                        const unsigned* t = &result[3 * tris[a]];
+                        bool removed = false;
+                        for (int k = 0; k < 3; k++)
+                        {
+                            locked[group[t[k]]] = 1;
+                            removed |= group[t[k]] == c.to;
+                        }
+                        if (removed)
+                            nbr_removed += 3;
+                    }
+                }
+                quadrics[c.to].add(quadrics[c.from]);
+            }
+            if (!nbr_removed)
+                break;
+
+            // Apply collapses and drop degenerate triangles
+            size_t size = 0;
+            for (size_t i = 0; i < result.size(); i += 3)
+            {
+                const unsigned a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+                if (group[a] == group[b] || group[b] == group[c] || group[c] == group[a])
+                    continue;
+                result[size++] = a;
+                result[size++] = b;
+                result[size++] = c;
+            }
+            result.resize(size);
+        }
+
+        std::copy(result.begin(), result.end(), destination);
+        return result.size();
+    }
+
+    void build_meshlets(
+        unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        size_t nbr_vertices,
+        std::vector<Meshlet>& meshlets,
+        unsigned max_vertices,
+        unsigned max_triangles)
+    {
+        meshlets.clear();
+        const size_t nbr_triangles = nbr_indices / 3;
+        if (!nbr_triangles)
+            return;
+        max_vertices = std::max(max_vertices, 3u);
+        max_triangles = std::max(max_triangles, 1u);
+
+        // Triangles adjacent to each vertex
+        std::vector<unsigned> adj_offsets(nbr_vertices + 1, 0);
+        for (size_t i = 0; i < nbr_indices; i++)
+            adj_offsets[indices[i] + 1]++;
+        for (size_t v = 0; v < nbr_vertices; v++)
+            adj_offsets[v + 1] += adj_offsets[v];
+        std::vector<unsigned> adj(nbr_indices);
+        std::vector<unsigned> adj_fill(adj_offsets.begin(), adj_offsets.end() - 1);
+        for (size_t i = 0; i < nbr_indices; i++)
+            adj[adj_fill[indices[i]]++] = unsigned(i / 3);
+
+        std::vector<unsigned> vertex_meshlet(nbr_vertices, ~0u); // Meshlet a vertex was last added to
+        std::vector<bool> emitted(nbr_triangles, false);
+        std::vector<unsigned> output, meshlet_vertices;
+        output.reserve(nbr_indices);
+        meshlet_vertices.reserve(max_vertices);
+        unsigned meshlet_triangles = 0;
+        size_t cursor = 0;
+
+        auto new_vertices = [&](size_t t)
+        {
+            const unsigned current = unsigned(meshlets.size());
+            return unsigned(vertex_meshlet[indices[3 * t + 0]] != current) +
+                unsigned(vertex_meshlet[indices[3 * t + 1]] != current) +
+                unsigned(vertex_meshlet[indices[3 * t + 2]] != current);
+        };
+        auto finish_meshlet = [&]()
+        {
+            Meshlet meshlet;
+            meshlet.index_offset = unsigned(output.size() - meshlet_triangles * 3);
+            meshlet.nbr_indices = meshlet_triangles * 3;
+            meshlets.push_back(meshlet);
+            meshlet_vertices.clear();
+            meshlet_triangles = 0;
+        };
+
+        while (true)
+        {
+            // Grow the meshlet with the neighboring triangle that adds the fewest vertices
+            size_t best = nbr_triangles;
+            unsigned best_new = 4;
+            for (size_t i = 0; i < meshlet_vertices.size() && best_new; i++)
+            {
+                const unsigned v = meshlet_vertices[i];
+                for (unsigned a = adj_offsets[v]; a < adj_offsets[v + 1]; a++)
+                {
+                    const unsigned t = adj[a];
+                    if (emitted[t])
+                        continue;
+                    const unsigned n = new_vertices(t);
+                    if (n < best_new && meshlet_vertices.size() + n <= max_vertices)
+                    {
+                        best = t;
+                        best_new = n;
+                        if (!n)
+                            break;
+                    }
+                }
+            }
+
+            // Without neighbors, continue with the next triangle in order
+            if (best == nbr_triangles)
+            {
+                while (cursor < nbr_triangles && emitted[cursor])
+                    cursor++;
+                if (cursor == nbr_triangles)
+                    break;
+                if (meshlet_vertices.size() + new_vertices(cursor) > max_vertices)
+                {
+                    finish_meshlet();
+                    continue;
+                }
+                best = cursor;
+            }
+
+            const unsigned current = unsigned(meshlets.size());
+            for (unsigned k = 0; k < 3; k++)
+            {
+                const unsigned v = indices[3 * best + k];
+                if (vertex_meshlet[v] != current)
+                {
+                    vertex_meshlet[v] = current;
+                    meshlet_vertices.push_back(v);
+                }
+                output.push_back(v);
+            }
+            emitted[best] = true;
+            if (++meshlet_triangles == max_triangles)
+                finish_meshlet();
+        }
+        if (meshlet_triangles)
+            finish_meshlet();
+        std::copy(output.begin(), output.end(), indices);
+
+        // Bounding sphere around the box center, and the cone of triangle normals
+        std::vector<glm::vec3> normals;
+        for (auto& meshlet : meshlets)
+        {
+            const unsigned* first = indices + meshlet.index_offset;
+            const unsigned* last = first + meshlet.nbr_indices;
+
+            glm::vec3 min{ positions[*first] }, max{ positions[*first] };
+            for (const unsigned* i = first; i < last; i++)
+            {
+                min = glm::min(min, positions[*i]);
+                max = glm::max(max, positions[*i]);
+            }
+            meshlet.center = (min + max) * 0.5f;
+            float radius2 = 0.0f;
+            for (const unsigned* i = first; i < last; i++)
+            {
+                const glm::vec3 d = positions[*i] - meshlet.center;
+                radius2 = std::max(radius2, glm::dot(d, d));
+            }
+            meshlet.radius = std::sqrt(radius2);
+
+            normals.clear();
+            glm::vec3 axis{ 0.0f };
+            for (const unsigned* i = first; i < last; i += 3)
+            {
+                const glm::vec3 n = glm::cross(positions[i[1]] - positions[i[0]], positions[i[2]] - positions[i[0]]);
+                const float length = glm::length(n);
+                if (length <= 0.0f)
+                    continue;
+                normals.push_back(n / length);
+                axis += normals.back();
+            }
+            const float axis_length = glm::length(axis);
+            if (axis_length <= 0.0f)
+                continue;
+            meshlet.cone_axis = axis / axis_length;
+
+            // Cones wider than about 84 degrees cull too rarely to be worth testing
+            float min_dot = 1.0f;
+            for (const auto& n : normals)
+                min_dot = std::min(min_dot, glm::dot(n, meshlet.cone_axis));
+            meshlet.cone_cutoff = min_dot <= 0.1f ? 1.0f : std::sqrt(1.0f - min_dot * min_dot);
+        }
+    }
+
+} // namespace eeng::meshopt
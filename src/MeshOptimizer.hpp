@@ -0,0 +1,144 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/// Reordering of indexed triangle lists for vertex cache, overdraw and vertex fetch.
+/// Meant to run once on static geometry at import time, one submesh at a time.
+/// Indices are local to the vertex range they refer to.
+namespace eeng::meshopt {
+
+    struct VertexCacheStats
+    {
+        float acmr = 0.0f;  ///< Average cache miss ratio, vertex transforms per triangle (0.5 - 3)
+        float atvr = 0.0f;  ///< Average transform to vertex ratio, vertex transforms per vertex (1 - 6)
+    };
+
+    /// @brief Simulate a FIFO post-transform cache
+    /// @param indices Triangle list
+    /// @param nbr_indices Number of indices
+    /// @param nbr_vertices Number of vertices referenced
+    /// @param cache_size Cache entries
+    VertexCacheStats analyze_vertex_cache(
+        const unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        unsigned cache_size = 16);
+
+    /// @brief Reorder triangles for vertex cache locality (Tipsify, Sander et al. 2007)
+    /// @param indices Triangle list, reordered in place
+    /// @param nbr_indices Number of indices
+    /// @param nbr_vertices Number of vertices referenced
+    /// @param cluster_offsets Output index offsets where the cache was flushed, starting with 0.
+    ///                        Clusters can be reordered with little effect on cache efficiency.
+    /// @param cache_size Cache entries
+    void optimize_vertex_cache(
+        unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        std::vector<unsigned>& cluster_offsets,
+        unsigned cache_size = 16);
+
+    /// @brief Reorder clusters so that outward facing clusters are drawn first
+    /// @param indices Triangle list, reordered in place
+    /// @param nbr_indices Number of indices
+    /// @param positions Vertex positions
+    /// @param cluster_offsets Clusters from optimize_vertex_cache
+    void optimize_overdraw(
+        unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        const std::vector<unsigned>& cluster_offsets);
+
+    /// @brief Number vertices in order of first use and rewrite indices accordingly.
+    /// Vertices that are not referenced are placed last.
+    /// @param indices Triangle list, rewritten in place
+    /// @param nbr_indices Number of indices
+    /// @param nbr_vertices Number of vertices
+    /// @param remap Output new index per old vertex index, to use with remap_vertices
+    void optimize_vertex_fetch(
+        unsigned* indices,
+        size_t nbr_indices,
+        size_t nbr_vertices,
+        std::vector<unsigned>& remap);
+
+    /// @brief Reduce the number of triangles by edge collapse, guided by quadric error metrics.
+    /// Vertices are collapsed onto other existing vertices, so the result indexes the same vertex buffer.
+    /// Vertices sharing a position but not attributes (seams) are collapsed together, each along an edge
+    /// to a vertex with matching attributes. Borders are only collapsed along themselves.
+    /// @param destination Output triangle list, at least nbr_indices large. May equal indices.
+    /// @param indices Triangle list
+    /// @param nbr_indices Number of indices
+    /// @param positions Vertex positions
+    /// @param nbr_vertices Number of vertices
+    /// @param target_nbr_indices Stop when the triangle list is this small
+    /// @param max_error Largest allowed deviation from the surface, in position units
+    /// @param vertex_groups Optional group per vertex, e.g. dominant bone. Vertices only collapse within groups.
+    /// @return Number of indices written to destination
+    size_t simplify(
+        unsigned* destination,
+        const unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        size_t nbr_vertices,
+        size_t target_nbr_indices,
+        float max_error,
+        const unsigned* vertex_groups = nullptr);
+
+    /// @brief A cluster of triangles with bounds for culling, see build_meshlets
+    struct Meshlet
+    {
+        unsigned index_offset = 0;      ///< First index of the cluster in the reordered triangle list
+        unsigned nbr_indices = 0;
+        glm::vec3 center{ 0.0f };       ///< Bounding sphere
+        float radius = 0.0f;
+        glm::vec3 cone_axis{ 0.0f };    ///< Average triangle normal
+        float cone_cutoff = 1.0f;       ///< Sine of the normal cone half-angle, 1 if the cone is too wide to cull
+    };
+
+    /// @brief Split a triangle list into clusters of neighboring triangles.
+    /// Triangles are reordered so that each cluster is a contiguous index range,
+    /// and clusters are formed in the existing triangle order, so optimize_vertex_cache first.
+    /// @param indices Triangle list, reordered in place
+    /// @param nbr_indices Number of indices
+    /// @param positions Vertex positions
+    /// @param nbr_vertices Number of vertices
+    /// @param meshlets Output clusters
+    /// @param max_vertices Most unique vertices per cluster
+    /// @param max_triangles Most triangles per cluster
+    void build_meshlets(
+        unsigned* indices,
+        size_t nbr_indices,
+        const glm::vec3* positions,
+        size_t nbr_vertices,
+        std::vector<Meshlet>& meshlets,
+        unsigned max_vertices = 64,
+        unsigned max_triangles = 124);
+
+    /// @brief Whether all triangles of a cluster face away from a camera
+    /// @param meshlet Cluster
+    /// @param camera_position Camera position in the space of the cluster
+    inline bool is_backfacing(const Meshlet& meshlet, const glm::vec3& camera_position)
+    {
+        const glm::vec3 d = meshlet.center - camera_position;
+        return glm::dot(d, meshlet.cone_axis) > meshlet.cone_cutoff * glm::length(d) + meshlet.radius;
+    }
+
+    /// @brief Move vertex attributes to their remapped positions
+    /// @param vertices Attribute array, reordered in place
+    /// @param remap Remap table from optimize_vertex_fetch
+    /// @param scratch Temporary storage
+    template<class T>
+    void remap_vertices(T* vertices, const std::vector<unsigned>& remap, std::vector<T>& scratch)
+    {
+        scratch.assign(vertices, vertices + remap.size());
+        for (size_t i = 0; i < remap.size(); i++)
+            vertices[remap[i]] = scratch[i];
+    }
+
+} // namespace eeng::meshopt
+
+#endif /* MeshOptimizer_hpp */
@@ -0,0 +1,488 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <atomic>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <cfloat>
+#include "glcommon.h"
+#include "imgui.h"
+#include "Profiler.hpp"
+#include "Log.hpp"
+
+namespace {
+
+    struct CpuEvent
+    {
+        const char* name;
+        uint64_t start_ns;
+        uint64_t end_ns;
+        uint32_t depth;
+    };
+
+    /// Ring buffer of CPU events, written by one thread only.
+    /// Each slot carries a sequence number that is odd while the writer updates it and
+    /// 2 * (index + 1) once event number index is stored, so readers can detect torn or
+    /// overwritten slots and skip them (a seqlock per slot).
+    struct ThreadBuffer
+    {
+        static constexpr uint64_t Capacity = 1 << 14;
+
+        struct Slot
+        {
+            std::atomic<uint64_t> seq{ 0 };
+            std::atomic<const char*> name{ nullptr };
+            std::atomic<uint64_t> start_ns{ 0 }, end_ns{ 0 };
+            std::atomic<uint32_t> depth{ 0 };
+        };
+
+        std::array<Slot, Capacity> slots;
+        std::atomic<uint64_t> head{ 0 };    // Total number of events written
+        uint32_t depth = 0;                 // Current scope depth (owner thread only)
+        uint32_t thread_index = 0;
+        std::string thread_name;            // Guarded by the registry mutex
+
+        void push(const CpuEvent& event)
+        {
+            const uint64_t h = head.load(std::memory_order_relaxed);
+            auto& slot = slots[h & (Capacity - 1)];
+            slot.seq.store(2 * h + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.name.store(event.name, std::memory_order_relaxed);
+            slot.start_ns.store(event.start_ns, std::memory_order_relaxed);
+            slot.end_ns.store(event.end_ns, std::memory_order_relaxed);
+            slot.depth.store(event.depth, std::memory_order_relaxed);
+            slot.seq.store(2 * (h + 1), std::memory_order_release);
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        /// Read event number index
+        /// @return False if the slot is being written or holds another event
+        bool read(uint64_t index, CpuEvent& event) const
+        {
+            const auto& slot = slots[index & (Capacity - 1)];
+            const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq != 2 * (index + 1))
+                return false;
+            event.name = slot.name.load(std::memory_order_relaxed);
+            event.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+            event.end_ns = slot.end_ns.load(std::memory_order_relaxed);
+            event.depth = slot.depth.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return slot.seq.load(std::memory_order_relaxed) == seq;
+        }
+
+        /// Copy events that ended at or after min_end_ns, oldest first.
+        /// Events are pushed when scopes end, so end times are increasing.
+        /// Stops at the first event the writer has overwritten meanwhile.
+        void snapshot(std::vector<CpuEvent>& out, uint64_t min_end_ns) const
+        {
+            const uint64_t h = head.load(std::memory_order_acquire);
+            const uint64_t first = h > Capacity ? h - Capacity : 0;
+            const size_t ofs = out.size();
+            CpuEvent event;
+            for (uint64_t i = h; i > first && read(i - 1, event) && event.end_ns >= min_end_ns; i--)
+                out.push_back(event);
+            std::reverse(out.begin() + ofs, out.end());
+        }
+    };
+
+    struct FrameMarker
+    {
+        uint64_t start_ns = 0, end_ns = 0;
+    };
+
+    struct GpuQuery
+    {
+        GLuint query = 0;
+        const char* name = nullptr;
+        uint64_t cpu_start_ns = 0;
+    };
+
+    struct GpuSample
+    {
+        const char* name;
+        uint64_t cpu_start_ns;
+        uint64_t duration_ns;
+    };
+
+    constexpr int FrameHistory = 256;
+    constexpr size_t GpuMaxPending = 64;  // GPU scopes waiting for their results
+    constexpr int GpuHistory = 1024;
+
+    struct ThreadFlame
+    {
+        std::string name;
+        std::vector<CpuEvent> events;
+    };
+
+    /// Profiler state. Everything except the thread registry is accessed from the main thread only.
+    struct State
+    {
+        std::atomic<bool> enabled{ true };
+
+        std::mutex registry_mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+        std::array<FrameMarker, FrameHistory> frames;
+        uint64_t frame_count = 0;
+        uint64_t frame_start_ns = 0;
+
+        std::vector<GpuQuery> gpu_pending;  // Ended scopes in issue order
+        std::vector<GLuint> gpu_free_queries;
+        GpuQuery gpu_current;
+        bool gpu_active = false;
+        std::vector<GpuSample> gpu_samples = std::vector<GpuSample>(GpuHistory);
+        uint64_t gpu_sample_count = 0;
+        std::vector<std::pair<const char*, float>> gpu_latest_ms;
+
+        // Panel
+        bool paused = false;
+        FrameMarker flame_frame;
+        std::vector<ThreadFlame> flame_threads;
+    };
+
+    State& state()
+    {
+        static State s;
+        return s;
+    }
+
+    ThreadBuffer& thread_buffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer)
+        {
+            auto& s = state();
+            std::lock_guard<std::mutex> lock(s.registry_mutex);
+            s.buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = s.buffers.back().get();
+            buffer->thread_index = uint32_t(s.buffers.size() - 1);
+            buffer->thread_name = "Thread " + std::to_string(buffer->thread_index);
+        }
+        return *buffer;
+    }
+
+    /// Snapshot of all thread buffers: name and events ending at or after min_end_ns
+    std::vector<ThreadFlame> snapshot_threads(uint64_t min_end_ns)
+    {
+        auto& s = state();
+        std::vector<std::pair<ThreadBuffer*, std::string>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(s.registry_mutex);
+            for (auto& buffer : s.buffers)
+                buffers.emplace_back(buffer.get(), buffer->thread_name);
+        }
+
+        std::vector<ThreadFlame> threads(buffers.size());
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            threads[i].name = buffers[i].second;
+            buffers[i].first->snapshot(threads[i].events, min_end_ns);
+        }
+        return threads;
+    }
+
+    /// Read back finished GPU queries. Results become available in issue order,
+    /// so the first unavailable query and those after it stay pending until the next frame.
+    void collect_gpu_queries()
+    {
+        auto& s = state();
+        size_t nbr_done = 0;
+        for (; nbr_done < s.gpu_pending.size(); nbr_done++)
+        {
+            const auto& q = s.gpu_pending[nbr_done];
+            GLint available = 0;
+            glGetQueryObjectiv(q.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 duration_ns = 0;
+            glGetQueryObjectui64v(q.query, GL_QUERY_RESULT, &duration_ns);
+            s.gpu_samples[s.gpu_sample_count++ % GpuHistory] = { q.name, q.cpu_start_ns, duration_ns };
+            s.gpu_free_queries.push_back(q.query);
+
+            auto it = std::find_if(s.gpu_latest_ms.begin(), s.gpu_latest_ms.end(),
+                [&](const auto& p) { return p.first == q.name; });
+            if (it == s.gpu_latest_ms.end())
+                s.gpu_latest_ms.emplace_back(q.name, duration_ns * 1e-6f);
+            else
+                it->second = duration_ns * 1e-6f;
+        }
+        s.gpu_pending.erase(s.gpu_pending.begin(), s.gpu_pending.begin() + nbr_done);
+    }
+
+    std::string json_escape(const char* str)
+    {
+        std::string out;
+        for (const char* c = str; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                out += '\\';
+            if ((unsigned char)*c >= 0x20)
+                out += *c;
+        }
+        return out;
+    }
+}
+
+namespace eeng::profiler {
+
+    uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void begin_frame()
+    {
+        state().frame_start_ns = now_ns();
+    }
+
+    void end_frame()
+    {
+        auto& s = state();
+        EENG_ASSERT(!s.gpu_active, "GPU scope still open at end of frame");
+
+        s.frames[s.frame_count++ % FrameHistory] = { s.frame_start_ns, now_ns() };
+
+        collect_gpu_queries();
+    }
+
+    void set_enabled(bool enabled)
+    {
+        state().enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool is_enabled()
+    {
+        return state().enabled.load(std::memory_order_relaxed);
+    }
+
+    void set_thread_name(const char* name)
+    {
+        auto& buffer = thread_buffer();
+        std::lock_guard<std::mutex> lock(state().registry_mutex);
+        buffer.thread_name = name;
+    }
+
+    float last_frame_ms()
+    {
+        const auto& s = state();
+        if (!s.frame_count)
+            return 0.0f;
+        const auto& frame = s.frames[(s.frame_count - 1) % FrameHistory];
+        return (frame.end_ns - frame.start_ns) * 1e-6f;
+    }
+
+    bool gpu_begin(const char* name)
+    {
+        auto& s = state();
+        if (!is_enabled() || s.gpu_active || s.gpu_pending.size() >= GpuMaxPending)
+            return false;
+
+        auto& q = s.gpu_current;
+        if (s.gpu_free_queries.empty())
+            glGenQueries(1, &q.query);
+        else
+        {
+            q.query = s.gpu_free_queries.back();
+            s.gpu_free_queries.pop_back();
+        }
+        q.name = name;
+        q.cpu_start_ns = now_ns();
+        glBeginQuery(GL_TIME_ELAPSED, q.query);
+        s.gpu_active = true;
+        return true;
+    }
+
+    void gpu_end()
+    {
+        auto& s = state();
+        EENG_ASSERT(s.gpu_active, "No GPU scope open");
+        glEndQuery(GL_TIME_ELAPSED);
+        s.gpu_pending.push_back(s.gpu_current);
+        s.gpu_active = false;
+    }
+
+    CpuScope::CpuScope(const char* name)
+        : name(nullptr), start_ns(0)
+    {
+        if (!is_enabled())
+            return;
+        thread_buffer().depth++;
+        this->name = name;
+        start_ns = now_ns();
+    }
+
+    CpuScope::~CpuScope()
+    {
+        if (!name)
+            return;
+        const uint64_t end_ns = now_ns();
+        auto& buffer = thread_buffer();
+        buffer.depth--;
+        buffer.push({ name, start_ns, end_ns, buffer.depth });
+    }
+
+    void draw(const char* label, bool* p_open)
+    {
+        auto& s = state();
+        if (!ImGui::Begin(label, p_open))
+        {
+            ImGui::End();
+            return;
+        }
+
+        bool enabled = is_enabled();
+        if (ImGui::Checkbox("Record", &enabled))
+            set_enabled(enabled);
+        ImGui::SameLine();
+        ImGui::Checkbox("Pause", &s.paused);
+        ImGui::SameLine();
+        if (ImGui::Button("Export trace"))
+        {
+            const char* filename = "profile_trace.json";
+            if (export_chrome_trace(filename))
+                eeng::Log("Profiler trace exported to %s", filename);
+            else
+                eeng::Log("Failed to export profiler trace to %s", filename);
+        }
+
+        // Frame times, oldest first
+        {
+            float frame_ms[FrameHistory];
+            const int n = int(std::min<uint64_t>(s.frame_count, FrameHistory));
+            for (int i = 0; i < n; i++)
+            {
+                const auto& frame = s.frames[(s.frame_count - n + i) % FrameHistory];
+                frame_ms[i] = (frame.end_ns - frame.start_ns) * 1e-6f;
+            }
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%.3f ms/frame", last_frame_ms());
+            ImGui::PlotLines("##frametimes", frame_ms, n, 0, overlay, 0.0f, FLT_MAX, ImVec2(-1.0f, 50.0f));
+        }
+
+        // GPU scopes
+        for (const auto& [name, ms] : s.gpu_latest_ms)
+            ImGui::Text("GPU %s: %.3f ms", name, ms);
+
+        // Flame graph of the last completed frame
+        if (!s.paused && s.frame_count)
+        {
+            s.flame_frame = s.frames[(s.frame_count - 1) % FrameHistory];
+            s.flame_threads = snapshot_threads(s.flame_frame.start_ns);
+        }
+        const uint64_t frame_start = s.flame_frame.start_ns, frame_end = s.flame_frame.end_ns;
+        if (frame_end > frame_start)
+        {
+            ImDrawList* draw_list = ImGui::GetWindowDrawList();
+            const float row_height = ImGui::GetTextLineHeightWithSpacing();
+            const float width = ImGui::GetContentRegionAvail().x;
+            const double scale = width / double(frame_end - frame_start);
+
+            for (const auto& thread : s.flame_threads)
+            {
+                uint32_t max_depth = 0;
+                bool any = false;
+                for (const auto& e : thread.events)
+                {
+                    if (e.start_ns > frame_end)
+                        continue;
+                    max_depth = std::max(max_depth, e.depth);
+                    any = true;
+                }
+                if (!any)
+                    continue;
+
+                ImGui::TextUnformatted(thread.name.c_str());
+                const ImVec2 origin = ImGui::GetCursorScreenPos();
+                for (const auto& e : thread.events)
+                {
+                    if (e.start_ns > frame_end)
+                        continue;
+                    const float x0 = origin.x + float((std::max(e.start_ns, frame_start) - frame_start) * scale);
+                    const float x1 = origin.x + float((std::min(e.end_ns, frame_end) - frame_start) * scale);
+                    const float y0 = origin.y + e.depth * row_height;
+                    const ImVec2 p0{ x0, y0 }, p1{ std::max(x1, x0 + 1.0f), y0 + row_height - 1.0f };
+
+                    const float hue = (std::hash<const void*>{}(e.name) % 64) / 64.0f;
+                    draw_list->AddRectFilled(p0, p1, ImColor::HSV(hue, 0.5f, 0.7f));
+                    draw_list->PushClipRect(p0, p1, true);
+                    draw_list->AddText({ x0 + 2.0f, y0 }, IM_COL32_WHITE, e.name);
+                    draw_list->PopClipRect();
+
+                    if (ImGui::IsMouseHoveringRect(p0, p1))
+                        ImGui::SetTooltip("%s\n%.3f ms", e.name, (e.end_ns - e.start_ns) * 1e-6f);
+                }
+                ImGui::Dummy(ImVec2(width, (max_depth + 1) * row_height));
+            }
+        }
+
+        ImGui::End();
+    }
+
+    bool export_chrome_trace(const std::string& filename)
+    {
+        std::ofstream out(filename);
+        if (!out)
+            return false;
+
+        const auto threads = snapshot_threads(0);
+        const auto& s = state();
+
+        // Time stamps relative to the earliest event, in microseconds
+        uint64_t t0 = std::numeric_limits<uint64_t>::max();
+        for (const auto& thread : threads)
+            for (const auto& e : thread.events)
+                t0 = std::min(t0, e.start_ns);
+        const uint64_t nbr_gpu = std::min<uint64_t>(s.gpu_sample_count, GpuHistory);
+        for (uint64_t i = s.gpu_sample_count - nbr_gpu; i < s.gpu_sample_count; i++)
+            t0 = std::min(t0, s.gpu_samples[i % GpuHistory].cpu_start_ns);
+        auto us = [&](uint64_t ns) { return (ns - t0) * 1e-3; };
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto separator = [&]() { if (!first) out << ",\n"; first = false; };
+
+        for (size_t tid = 0; tid < threads.size(); tid++)
+        {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                << ",\"args\":{\"name\":\"" << json_escape(threads[tid].name.c_str()) << "\"}}";
+            for (const auto& e : threads[tid].events)
+            {
+                separator();
+                out << "{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":" << us(e.start_ns)
+                    << ",\"dur\":" << (e.end_ns - e.start_ns) * 1e-3 << ",\"pid\":1,\"tid\":" << tid << "}";
+            }
+        }
+
+        // GPU durations are placed at the CPU time their scope was opened
+        if (nbr_gpu)
+        {
+            const size_t gpu_tid = threads.size();
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << gpu_tid << ",\"args\":{\"name\":\"GPU\"}}";
+            for (uint64_t i = s.gpu_sample_count - nbr_gpu; i < s.gpu_sample_count; i++)
+            {
+                const auto& sample = s.gpu_samples[i % GpuHistory];
+                separator();
+                out << "{\"name\":\"" << json_escape(sample.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"ts\":" << us(sample.cpu_start_ns)
+                    << ",\"dur\":" << sample.duration_ns * 1e-3 << ",\"pid\":1,\"tid\":" << gpu_tid << "}";
+            }
+        }
+
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return bool(out);
+    }
+
+} // namespace eeng::profiler
@@ -0,0 +1,93 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <cstdint>
+#include <string>
+#include "config.h"
+
+/// Profiling macros. Scope names must be string literals or otherwise outlive the profiler.
+/// CPU scopes nest. GPU scopes use GL_TIME_ELAPSED queries, which cannot nest,
+/// so a GPU scope opened inside another one is ignored.
+/// Each thread that records CPU scopes gets a ring buffer that lives until program exit,
+/// so scopes are meant for long-lived threads rather than short-lived workers.
+#ifdef EENG_PROFILE
+#define EENG_PROFILE_CONCAT_(a, b) a##b
+#define EENG_PROFILE_CONCAT(a, b) EENG_PROFILE_CONCAT_(a, b)
+#define EENG_PROFILE_SCOPE(name) eeng::profiler::CpuScope EENG_PROFILE_CONCAT(eeng_profile_scope_, __LINE__){ name }
+#define EENG_PROFILE_FUNCTION() EENG_PROFILE_SCOPE(__func__)
+#define EENG_PROFILE_GPU_SCOPE(name) eeng::profiler::GpuScope EENG_PROFILE_CONCAT(eeng_profile_gpu_scope_, __LINE__){ name }
+#else
+#define EENG_PROFILE_SCOPE(name)
+#define EENG_PROFILE_FUNCTION()
+#define EENG_PROFILE_GPU_SCOPE(name)
+#endif
+
+namespace eeng::profiler {
+
+    /// @brief High-resolution time stamp in nanoseconds
+    uint64_t now_ns();
+
+    /// @brief Mark start of a frame. Call from the main thread.
+    void begin_frame();
+
+    /// @brief Mark end of a frame and collect finished GPU queries. Call from the main thread.
+    void end_frame();
+
+    /// @brief Enable or disable recording at runtime
+    void set_enabled(bool enabled);
+
+    bool is_enabled();
+
+    /// @brief Name the calling thread, as shown in the panel and in trace exports
+    void set_thread_name(const char* name);
+
+    /// @brief Duration of the last completed frame in milliseconds
+    float last_frame_ms();
+
+    /// @brief Begin a GPU timer scope
+    /// @return False if the scope was ignored, in which case gpu_end should not be called
+    bool gpu_begin(const char* name);
+
+    /// @brief End the current GPU timer scope
+    void gpu_end();
+
+    /// @brief Draw the profiler panel with a flame graph of the last frame
+    /// @param label Window label
+    /// @param p_open Window open state
+    void draw(const char* label, bool* p_open = nullptr);
+
+    /// @brief Export recorded events in Chrome trace format (chrome://tracing, Perfetto)
+    /// @param filename Output JSON file
+    /// @return True if the file was written
+    bool export_chrome_trace(const std::string& filename);
+
+    /// @brief Records a CPU event for its lifetime
+    struct CpuScope
+    {
+        const char* name;
+        uint64_t start_ns;
+
+        explicit CpuScope(const char* name);
+        ~CpuScope();
+
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+    };
+
+    /// @brief Records a GPU event for its lifetime
+    struct GpuScope
+    {
+        bool active;
+
+        explicit GpuScope(const char* name) : active(gpu_begin(name)) {}
+        ~GpuScope() { if (active) gpu_end(); }
+
+        GpuScope(const GpuScope&) = delete;
+        GpuScope& operator=(const GpuScope&) = delete;
+    };
+
+} // namespace eeng::profiler
+
+#endif /* Profiler_hpp */
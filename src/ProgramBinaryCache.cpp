@@ -0,0 +1,136 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+#include "ProgramBinaryCache.hpp"
+#include "Log.hpp"
+
+namespace eeng {
+
+    namespace
+    {
+        constexpr uint32_t FileMagic = 0x42505045; // "EPPB"
+
+        struct FileHeader
+        {
+            uint32_t magic;
+            uint32_t format;
+            uint32_t length;
+        };
+
+        /// FNV-1a, which unlike std::hash is the same in every build
+        uint64_t fnv1a(uint64_t hash, std::string_view data)
+        {
+            for (unsigned char c : data)
+            {
+                hash ^= c;
+                hash *= 0x100000001b3ull;
+            }
+            return hash;
+        }
+
+        std::string_view gl_string(GLenum name)
+        {
+            const GLubyte* str = glGetString(name);
+            return str ? reinterpret_cast<const char*>(str) : "";
+        }
+    }
+
+    ProgramBinaryCache& ProgramBinaryCache::instance()
+    {
+        static ProgramBinaryCache cache;
+        return cache;
+    }
+
+    ProgramBinaryCache::ProgramBinaryCache()
+    {
+        m_driver = std::string(gl_string(GL_VENDOR)) + "|" + std::string(gl_string(GL_RENDERER)) + "|" + std::string(gl_string(GL_VERSION));
+        GLint nbr_formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nbr_formats);
+        m_supported = nbr_formats > 0;
+    }
+
+    std::string ProgramBinaryCache::key(std::initializer_list<std::string_view> parts)
+    {
+        // Parts are separated, so that moving text between them changes the key
+        uint64_t hash = fnv1a(0xcbf29ce484222325ull, m_driver);
+        for (auto part : parts)
+            hash = fnv1a(fnv1a(hash, part), std::string_view("\0", 1));
+
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+        return hex;
+    }
+
+    GLuint ProgramBinaryCache::load(const std::string& key)
+    {
+        if (!enabled || !m_supported)
+            return 0;
+
+        // The length is checked against the file size before allocating, so a truncated or corrupt file is a miss
+        const std::string file_path = path(key);
+        std::error_code error;
+        const auto file_size = std::filesystem::file_size(file_path, error);
+        std::ifstream file(file_path, std::ios::binary);
+        FileHeader header{};
+        if (error || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != FileMagic ||
+            header.length == 0 || header.length != file_size - sizeof(header))
+        {
+            m_misses++;
+            return 0;
+        }
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+        {
+            m_misses++;
+            return 0;
+        }
+
+        // Drivers reject binaries of other versions, in which case the program is not linked
+        CheckAndThrowGLErrors();
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (glGetError() != GL_NO_ERROR || !linked)
+        {
+            glDeleteProgram(program);
+            m_misses++;
+            return 0;
+        }
+        m_hits++;
+        return program;
+    }
+
+    void ProgramBinaryCache::store(const std::string& key, GLuint program)
+    {
+        if (!enabled || !m_supported)
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, &length, &format, binary.data());
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        std::ofstream file(path(key), std::ios::binary);
+        const FileHeader header{ FileMagic, format, (uint32_t)length };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), length);
+        if (!file)
+            LogWarning("Cannot write program binary %s", path(key).c_str());
+    }
+
+    std::string ProgramBinaryCache::path(const std::string& key) const
+    {
+        return directory + "/" + key + ".bin";
+    }
+
+} // namespace eeng
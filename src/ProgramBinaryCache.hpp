@@ -0,0 +1,56 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef ProgramBinaryCache_hpp
+#define ProgramBinaryCache_hpp
+
+#include <string>
+#include <string_view>
+#include <initializer_list>
+#include "glcommon.h"
+
+namespace eeng {
+
+    /// @brief Linked program binaries stored on disk, so shaders are compiled once per driver.
+    /// Binaries are keyed by a hash of the shader sources, including their defines, and of the
+    /// GL vendor, renderer and version. A missing, corrupt or rejected binary is a miss, and the
+    /// caller compiles the program from source as usual.
+    class ProgramBinaryCache
+    {
+    public:
+        /// Directory of the binaries, created on first store
+        std::string directory = "shadercache";
+        bool enabled = true;
+
+        /// @brief The cache of the current GL context
+        static ProgramBinaryCache& instance();
+
+        /// @brief Key of a program
+        /// @param parts Shader sources and anything else the linked program depends on
+        std::string key(std::initializer_list<std::string_view> parts);
+
+        /// @brief Create a program from a stored binary
+        /// @return The linked program, or 0 on a miss
+        GLuint load(const std::string& key);
+
+        /// @brief Store the binary of a linked program
+        /// The program should be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+        void store(const std::string& key, GLuint program);
+
+        int hits() const { return m_hits; }
+        int misses() const { return m_misses; }
+
+    private:
+        std::string m_driver;       // Vendor, renderer and version
+        bool m_supported = false;   // Any binary formats
+        int m_hits = 0, m_misses = 0;
+
+        ProgramBinaryCache();
+        ProgramBinaryCache(const ProgramBinaryCache&) = delete;
+        ProgramBinaryCache& operator=(const ProgramBinaryCache&) = delete;
+
+        std::string path(const std::string& key) const;
+    };
+
+} // namespace eeng
+
+#endif /* ProgramBinaryCache_hpp */
@@ -0,0 +1,105 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include "RangeAllocator.hpp"
+#include "config.h"
+
+namespace eeng {
+
+    RangeAllocator::RangeAllocator(size_t capacity)
+    {
+        grow(capacity);
+    }
+
+    size_t RangeAllocator::allocate(size_t size)
+    {
+        EENG_ASSERT(size, "Allocating an empty range");
+        for (auto it = m_free.begin(); it != m_free.end(); ++it)
+        {
+            if (it->second < size)
+                continue;
+
+            const size_t offset = it->first;
+            const size_t remaining = it->second - size;
+            m_free.erase(it);
+            if (remaining)
+                m_free.emplace(offset + size, remaining);
+            m_allocated.emplace(offset, size);
+            m_used += size;
+            return offset;
+        }
+        return NoRange;
+    }
+
+    void RangeAllocator::free(size_t offset)
+    {
+        auto it = m_allocated.find(offset);
+        EENG_ASSERT(it != m_allocated.end(), "Freeing unallocated range at {0}", offset);
+        if (it == m_allocated.end())
+            return;
+
+        const size_t size = it->second;
+        m_allocated.erase(it);
+        m_used -= size;
+        insert_free(offset, size);
+    }
+
+    void RangeAllocator::grow(size_t capacity)
+    {
+        if (capacity <= m_capacity)
+            return;
+        const size_t offset = m_capacity;
+        m_capacity = capacity;
+        insert_free(offset, capacity - offset);
+    }
+
+    std::vector<RangeAllocator::Move> RangeAllocator::compact()
+    {
+        std::vector<Move> moves;
+        std::map<size_t, size_t> packed;
+        size_t offset = 0;
+        for (const auto& [from, size] : m_allocated)
+        {
+            if (from != offset)
+                moves.push_back({ from, offset, size });
+            packed.emplace_hint(packed.end(), offset, size);
+            offset += size;
+        }
+        m_allocated = std::move(packed);
+
+        m_free.clear();
+        if (offset < m_capacity)
+            m_free.emplace(offset, m_capacity - offset);
+        return moves;
+    }
+
+    size_t RangeAllocator::largest_free() const
+    {
+        size_t largest = 0;
+        for (const auto& [offset, size] : m_free)
+            largest = std::max(largest, size);
+        return largest;
+    }
+
+    void RangeAllocator::insert_free(size_t offset, size_t size)
+    {
+        // Merge with the free neighbors
+        auto next = m_free.lower_bound(offset);
+        if (next != m_free.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = m_free.erase(next);
+        }
+        if (next != m_free.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset)
+            {
+                prev->second += size;
+                return;
+            }
+        }
+        m_free.emplace_hint(next, offset, size);
+    }
+
+} // namespace eeng
@@ -0,0 +1,63 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef RangeAllocator_hpp
+#define RangeAllocator_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace eeng {
+
+    /// @brief First-fit sub-allocator of ranges within a linear capacity, e.g. elements of a GPU buffer.
+    /// Free ranges are coalesced with their neighbors when freed. Only offsets are managed, not memory.
+    class RangeAllocator
+    {
+    public:
+        static constexpr size_t NoRange = SIZE_MAX;
+
+        /// A range moved by compact()
+        struct Move
+        {
+            size_t from;
+            size_t to;
+            size_t size;
+        };
+
+        explicit RangeAllocator(size_t capacity = 0);
+
+        /// @brief Allocate a range
+        /// @param size Range size, greater than zero
+        /// @return Offset of the range, or NoRange if no free range is large enough
+        size_t allocate(size_t size);
+
+        /// @brief Free a range returned by allocate
+        void free(size_t offset);
+
+        /// @brief Extend the capacity. The added space joins a free range at the end.
+        void grow(size_t capacity);
+
+        /// @brief Pack all allocated ranges at the start, in order, leaving one free range at the end
+        /// @return Ranges that moved, in increasing offset order, so copying them in order never overwrites a later source
+        std::vector<Move> compact();
+
+        size_t capacity() const { return m_capacity; }
+        size_t used() const { return m_used; }
+        size_t nbr_allocations() const { return m_allocated.size(); }
+
+        /// @brief Size of the largest free range
+        size_t largest_free() const;
+
+    private:
+        std::map<size_t, size_t> m_allocated;   // Offset to size
+        std::map<size_t, size_t> m_free;        // Offset to size, never adjacent
+        size_t m_capacity = 0;
+        size_t m_used = 0;
+
+        void insert_free(size_t offset, size_t size);
+    };
+
+} // namespace eeng
+
+#endif /* RangeAllocator_hpp */
@@ -3,16 +3,32 @@
 
 #include "RenderableMesh.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <glm/gtx/dual_quaternion.hpp>
+#include <glm/gtx/matrix_decompose.hpp>
 #include <assimp/version.h>
 
 #include "ShaderLoader.h"
+#include "MeshOptimizer.hpp"
+#include "Profiler.hpp"
 #include "parseutil.h"
 
 namespace eeng
 {
     namespace
     {
+        static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "aiVector3D and glm::vec3 layouts differ");
+
+        /// Milliseconds since a time stamp, which is then moved to now
+        inline double lap_ms(uint64_t& stamp_ns)
+        {
+            const uint64_t now_ns = profiler::now_ns();
+            const double ms = (now_ns - stamp_ns) * 1e-6;
+            stamp_ns = now_ns;
+            return ms;
+        }
+
         inline glm::vec3 aivec_to_glmvec(const aiVector3D& vec)
         {
             return glm::vec3(vec.x, vec.y, vec.z);
@@ -67,6 +83,16 @@ namespace eeng
             return transformMatrix;
         }
 
+        inline glm::dualquat mat4ToDualquat(const glm::mat4& M)
+        {
+            // Remove scale before extracting the rotation
+            const glm::mat3 R(
+                glm::normalize(glm::vec3(M[0])),
+                glm::normalize(glm::vec3(M[1])),
+                glm::normalize(glm::vec3(M[2])));
+            return glm::dualquat(glm::quat_cast(R), glm::vec3(M[3]));
+        }
+
         void dump_tree_to_stream(
             const VecTree<SkeletonNode>& tree,
             logstreamer_t&& outstream)
@@ -112,9 +138,9 @@ namespace eeng
     {
     }
 
-    void RenderableMesh::load(const std::string& file, bool append_animations)
+    void RenderableMesh::load(const std::string& file, bool append_animations, unsigned extra_xiflags)
     {
-        unsigned xiflags = (append_animations ? xi_load_animations : (xi_load_meshes | xi_load_animations));
+        unsigned xiflags = (append_animations ? xi_load_animations : (xi_load_meshes | xi_load_animations | extra_xiflags));
 
         unsigned aiflags;
         //    aiflags |= aiProcess_Triangulate;
@@ -180,7 +206,10 @@ namespace eeng
         log << priority(PRTVERBOSE) << "Format " << fileext << " supported: " << (ext_supported ? "YES" : "NO") << std::endl;
 
         // Load
+        const uint64_t load_start_ns = profiler::now_ns();
+        uint64_t stage_ns = load_start_ns;
         const aiScene* aiscene = aiimporter.ReadFile(file, aiflags);
+        const double import_ms = lap_ms(stage_ns);
 
         if (!aiscene)
             throw std::runtime_error(aiimporter.GetErrorString());
@@ -200,26 +229,32 @@ namespace eeng
             return;
         }
 
-        glGenVertexArrays(1, &m_VAO);
-        glBindVertexArray(m_VAO);
-        glGenBuffers(numelem(m_Buffers), m_Buffers);
-        loadScene(aiscene, filepath);
-        glBindVertexArray(0);
+        loadScene(aiscene, filepath, xiflags);
+        const double scene_ms = lap_ms(stage_ns);
 
         loadNodes(aiscene->mRootNode);
+        const double nodes_ms = lap_ms(stage_ns);
 
         //m_nodetree.print_to_stream(logstreamer_t{ filepath + filename + "_nodetree.txt", PRTVERBOSE });
         dump_tree_to_stream(m_nodetree, logstreamer_t{ filepath + filename + "_nodetree.txt", PRTVERBOSE });
         // m_nodetree.debug_print({filepath + filename + "_nodetree.txt", PRTVERBOSE});
 
         loadAnimations(aiscene);
-
+        compute_bind_pose();
+        const double animations_ms = lap_ms(stage_ns);
 
         // Traverse the hierarchy.
         // Animated meshes must be traversed before each frame.
         animate(-1, 0.0f);
 
         mSceneAABB = measureScene(aiscene); // Only captures bind pose.
+
+        log << priority(PRTSTRICT) << "Load times (ms):"
+            << " import " << import_ms
+            << ", scene " << scene_ms
+            << ", nodes " << nodes_ms
+            << ", animations " << animations_ms
+            << ", total " << (profiler::now_ns() - load_start_ns) * 1e-6 << std::endl;
     }
 
     void RenderableMesh::removeTranslationKeys(const std::string& node_name)
@@ -238,7 +273,7 @@ namespace eeng
         }
     }
 
-    bool RenderableMesh::loadScene(const aiScene* aiscene, const std::string& filename)
+    bool RenderableMesh::loadScene(const aiScene* aiscene, const std::string& filename, unsigned xiflags)
     {
         unsigned scene_nbr_meshes = aiscene->mNumMeshes;
         unsigned scene_nbr_mtl = aiscene->mNumMaterials;
@@ -274,14 +309,6 @@ namespace eeng
         m_meshes.resize(scene_nbr_meshes);
         m_materials.resize(scene_nbr_mtl);
 
-        std::vector<glm::vec3> scene_positions;
-        std::vector<glm::vec3> scene_normals;
-        std::vector<glm::vec3> scene_tangents;
-        std::vector<glm::vec3> scene_binormals;
-        std::vector<glm::vec2> scene_texcoords;
-        std::vector<SkinData> scene_skinweights;
-        std::vector<uint> scene_indices;
-
         // Count vertices and indices of the whole scene
         for (unsigned i = 0; i < m_meshes.size(); i++)
         {
@@ -296,35 +323,36 @@ namespace eeng
             m_meshes[i].nbr_vertices = mesh_nbr_vertices;
             m_meshes[i].mtl_index = mesh_mtl_index;
             m_meshes[i].is_skinned = (bool)mesh_nbr_bones;
+            m_meshes[i].lods[0] = { scene_nbr_indices, mesh_nbr_indices };
             // m_meshes[i].node_index <- set while loading node tree
 
             scene_nbr_vertices += mesh_nbr_vertices;
             scene_nbr_indices += mesh_nbr_indices;
         }
 
-        // Reserve space in the vectors for the vertex attributes and indices
-        scene_positions.reserve(scene_nbr_vertices);
-        scene_normals.reserve(scene_nbr_vertices);
-        scene_tangents.reserve(scene_nbr_vertices);
-        scene_binormals.reserve(scene_nbr_vertices);
-        scene_texcoords.reserve(scene_nbr_vertices);
-        scene_skinweights.resize(scene_nbr_vertices);
-        scene_indices.reserve(scene_nbr_indices);
+        // Allocate space for the vertex attributes and indices of all meshes
+        uint64_t stage_ns = profiler::now_ns();
+        SceneStaging staging;
+        staging.allocate(scene_nbr_vertices, scene_nbr_indices);
+        const double allocate_ms = lap_ms(stage_ns);
 
         // Initialize the meshes in the scene one by one
         for (uint i = 0; i < m_meshes.size(); i++)
         {
             const aiMesh* paiMesh = aiscene->mMeshes[i];
-            loadMesh(i,
-                paiMesh,
-                scene_positions,
-                scene_normals,
-                scene_tangents,
-                scene_binormals,
-                scene_texcoords,
-                scene_skinweights,
-                scene_indices);
+            loadMesh(i, paiMesh, staging);
         }
+        const double copy_ms = lap_ms(stage_ns);
+
+        if (xiflags & xi_optimize_meshes)
+            optimizeMeshes(staging);
+        const double optimize_ms = lap_ms(stage_ns);
+        if (xiflags & xi_generate_lods)
+            generateLods(staging);
+        const double lods_ms = lap_ms(stage_ns);
+        if (xiflags & xi_build_meshlets)
+            buildMeshlets(staging);
+        const double meshlets_ms = lap_ms(stage_ns);
 
         log << priority(PRTSTRICT);
         log << "Scene total vertices " << scene_nbr_vertices << ", triangles " << scene_nbr_indices / 3 << std::endl;
@@ -349,79 +377,73 @@ namespace eeng
                 {
                     for (int k = 0; k < BonesPerVertex; k++)
                     {
-                        if (scene_skinweights[j].bone_weights[k] > 0)
-                            m_bone_aabbs_bind[scene_skinweights[j].bone_indices[k]].grow(scene_positions[j]);
+                        if (staging.skindata[j].bone_weights[k] > 0)
+                            m_bone_aabbs_bind[staging.skindata[j].bone_indices[k]].grow(staging.positions[j]);
                     }
                 }
             }
             else // if ( m_meshes[i].node_index != EENG_NULL_INDEX )
             {
                 for (int j = mesh.base_vertex; j < mesh.base_vertex + mesh.nbr_vertices; j++)
-                    m_mesh_aabbs_bind[i].grow(scene_positions[j]);
+                    m_mesh_aabbs_bind[i].grow(staging.positions[j]);
             }
         }
+        m_bone_aabbs_bind_soa.assign(m_bone_aabbs_bind);
+        m_mesh_aabbs_bind_soa.assign(m_mesh_aabbs_bind);
+        m_mesh_pose_tfms.resize(m_meshes.size());
 
 #endif
+        const double aabbs_ms = lap_ms(stage_ns);
         loadMaterials(aiscene, filename);
-
-        // Load GL buffers
-#define POSITION_LOCATION 0
-#define TEXCOORD_LOCATION 1
-#define NORMAL_LOCATION 2
-#define TANGENT_LOCATION 3
-#define BINORMAL_LOCATION 4
-#define BONE_INDEX_LOCATION 5
-#define BONE_WEIGHT_LOCATION 6
-
-        // Generate and populate the buffers with vertex attributes and the indices
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[PositionBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_positions[0]) * scene_positions.size(), &scene_positions[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(POSITION_LOCATION);
-        glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TexturecoordBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_texcoords[0]) * scene_texcoords.size(), &scene_texcoords[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(TEXCOORD_LOCATION);
-        glVertexAttribPointer(TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[NormalBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_normals[0]) * scene_normals.size(), &scene_normals[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(NORMAL_LOCATION);
-        glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TangentBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_tangents[0]) * scene_tangents.size(), &scene_tangents[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(TANGENT_LOCATION);
-        glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BinormalBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_binormals[0]) * scene_binormals.size(), &scene_binormals[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(BINORMAL_LOCATION);
-        glVertexAttribPointer(BINORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BoneBuffer]);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(scene_skinweights[0]) * scene_skinweights.size(), &scene_skinweights[0], GL_STATIC_DRAW);
-        glEnableVertexAttribArray(BONE_INDEX_LOCATION);
-        glVertexAttribIPointer(BONE_INDEX_LOCATION, 4, GL_UNSIGNED_INT, sizeof(SkinData), (const GLvoid*)0);
-        glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);
-        glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(SkinData), (const GLvoid*)16);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[IndexBuffer]);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(scene_indices[0]) * scene_indices.size(), &scene_indices[0], GL_STATIC_DRAW);
+        const double materials_ms = lap_ms(stage_ns);
+
+        // Copy vertex attributes and indices to the shared arena
+        static_assert(sizeof(SkinData) == GeometryArena::stream_stride(GeometryArena::Skin), "Skin stream layout");
+        std::vector<uint8_t> index_data;
+        packIndices(staging, index_data);
+        auto& arena = GeometryArena::instance();
+        m_geometry = arena.allocate(staging.nbr_vertices, index_data.size());
+        arena.upload(m_geometry, GeometryArena::Positions, staging.positions);
+        arena.upload(m_geometry, GeometryArena::Texcoords, staging.texcoords);
+        arena.upload(m_geometry, GeometryArena::Normals, staging.normals);
+        arena.upload(m_geometry, GeometryArena::Tangents, staging.tangents);
+        arena.upload(m_geometry, GeometryArena::Binormals, staging.binormals);
+        arena.upload(m_geometry, GeometryArena::Skin, staging.skindata.data());
+        index_data.resize((index_data.size() + 3) & ~size_t(3)); // Allocated size
+        arena.upload_indices(m_geometry, index_data.data());
 
         CheckAndThrowGLErrors();
+        const double upload_ms = lap_ms(stage_ns);
+
+        log << priority(PRTSTRICT) << "Scene load times (ms):"
+            << " allocate " << allocate_ms
+            << ", copy " << copy_ms
+            << ", optimize " << optimize_ms
+            << ", LODs " << lods_ms
+            << ", meshlets " << meshlets_ms
+            << ", AABBs " << aabbs_ms
+            << ", materials " << materials_ms
+            << ", upload " << upload_ms << std::endl;
         return true;
     }
 
+    void RenderableMesh::SceneStaging::allocate(size_t nbr_vertices, size_t nbr_indices)
+    {
+        // Four vec3 attributes and one vec2 attribute per vertex
+        this->nbr_vertices = nbr_vertices;
+        vertex_data.assign(nbr_vertices * (4 * 3 + 2), 0.0f);
+        positions = reinterpret_cast<glm::vec3*>(vertex_data.data());
+        normals = positions + nbr_vertices;
+        tangents = normals + nbr_vertices;
+        binormals = tangents + nbr_vertices;
+        texcoords = reinterpret_cast<glm::vec2*>(binormals + nbr_vertices);
+        skindata.assign(nbr_vertices, SkinData{});
+        indices.resize(nbr_indices);
+    }
+
     void RenderableMesh::loadMesh(uint meshindex,
         const aiMesh* aimesh,
-        std::vector<glm::vec3>& scene_positions,
-        std::vector<glm::vec3>& scene_normals,
-        std::vector<glm::vec3>& scene_tangents,
-        std::vector<glm::vec3>& scene_binormals,
-        std::vector<glm::vec2>& scene_texcoords,
-        std::vector<SkinData>& scene_skindata,
-        std::vector<unsigned int>& scene_indices)
+        SceneStaging& staging)
     {
         log << priority(PRTVERBOSE);
         log << "Loading mesh " << aimesh->mName.C_Str() << std::endl;
@@ -433,34 +455,176 @@ namespace eeng
         log << "\thas tangents and bitangents: " << (aimesh->HasTangentsAndBitangents() ? "YES" : "NO") << std::endl;
         log << "\thas vertex colors: " << (aimesh->HasVertexColors(0) ? "YES" : "NO") << std::endl;
 
-        // Populate the vertex attribute vectors
-        const aiVector3D v3zero(0.0f, 0.0f, 0.0f);
-        for (uint i = 0; i < aimesh->mNumVertices; i++)
+        // Copy vertex attributes in bulk. Missing attributes stay zero.
+        const auto& mesh = m_meshes[meshindex];
+        const size_t nbr_vertices = aimesh->mNumVertices;
+        const size_t attrib_size = nbr_vertices * sizeof(glm::vec3);
+        std::memcpy(staging.positions + mesh.base_vertex, aimesh->mVertices, attrib_size);
+        if (aimesh->HasNormals())
+            std::memcpy(staging.normals + mesh.base_vertex, aimesh->mNormals, attrib_size);
+        if (aimesh->HasTangentsAndBitangents())
+        {
+            std::memcpy(staging.tangents + mesh.base_vertex, aimesh->mTangents, attrib_size);
+            std::memcpy(staging.binormals + mesh.base_vertex, aimesh->mBitangents, attrib_size);
+        }
+        if (aimesh->HasTextureCoords(0))
         {
-            const aiVector3D* pPos = &(aimesh->mVertices[i]);
-            const aiVector3D* pNormal = (aimesh->HasNormals() ? &(aimesh->mNormals[i]) : &v3zero);
-            const aiVector3D* pTangent = (aimesh->HasTangentsAndBitangents() ? &(aimesh->mTangents[i]) : &v3zero);
-            const aiVector3D* pBinormal = (aimesh->HasTangentsAndBitangents() ? &(aimesh->mBitangents[i]) : &v3zero);
-            const aiVector3D* pTexCoord = (aimesh->HasTextureCoords(0) ? &(aimesh->mTextureCoords[0][i]) : &v3zero);
-
-            scene_positions.push_back({ pPos->x, pPos->y, pPos->z });
-            scene_normals.push_back({ pNormal->x, pNormal->y, pNormal->z });
-            scene_tangents.push_back({ pTangent->x, pTangent->y, pTangent->z });
-            scene_binormals.push_back({ pBinormal->x, pBinormal->y, pBinormal->z });
-            scene_texcoords.push_back({ pTexCoord->x, pTexCoord->y });
+            // Texture coordinates are stored as 3D by Assimp
+            const aiVector3D* src = aimesh->mTextureCoords[0];
+            glm::vec2* dst = staging.texcoords + mesh.base_vertex;
+            for (size_t i = 0; i < nbr_vertices; i++)
+                dst[i] = { src[i].x, src[i].y };
         }
 
-        loadBones(meshindex, aimesh, scene_skindata);
+        loadBones(meshindex, aimesh, staging.skindata);
 
-        // Populate the index buffer
+        // Copy the indices
+        unsigned int* dst = staging.indices.data() + mesh.base_index;
         for (uint i = 0; i < aimesh->mNumFaces; i++)
         {
             const aiFace& Face = aimesh->mFaces[i];
             assert(Face.mNumIndices == 3);
-            scene_indices.push_back(Face.mIndices[0]);
-            scene_indices.push_back(Face.mIndices[1]);
-            scene_indices.push_back(Face.mIndices[2]);
+            std::memcpy(dst, Face.mIndices, 3 * sizeof(unsigned int));
+            dst += 3;
+        }
+    }
+
+    void RenderableMesh::optimizeMeshes(SceneStaging& staging)
+    {
+        log << priority(PRTSTRICT) << "Optimizing meshes (ACMR/ATVR before -> after)" << std::endl;
+
+        std::vector<unsigned> clusters, remap;
+        std::vector<glm::vec3> scratch3;
+        std::vector<glm::vec2> scratch2;
+        std::vector<SkinData> scratch_skin;
+        for (const auto& mesh : m_meshes)
+        {
+            unsigned* indices = staging.indices.data() + mesh.base_index;
+            const auto before = meshopt::analyze_vertex_cache(indices, mesh.nbr_indices, mesh.nbr_vertices);
+
+            meshopt::optimize_vertex_cache(indices, mesh.nbr_indices, mesh.nbr_vertices, clusters);
+            meshopt::optimize_overdraw(indices, mesh.nbr_indices, staging.positions + mesh.base_vertex, clusters);
+            meshopt::optimize_vertex_fetch(indices, mesh.nbr_indices, mesh.nbr_vertices, remap);
+
+            meshopt::remap_vertices(staging.positions + mesh.base_vertex, remap, scratch3);
+            meshopt::remap_vertices(staging.normals + mesh.base_vertex, remap, scratch3);
+            meshopt::remap_vertices(staging.tangents + mesh.base_vertex, remap, scratch3);
+            meshopt::remap_vertices(staging.binormals + mesh.base_vertex, remap, scratch3);
+            meshopt::remap_vertices(staging.texcoords + mesh.base_vertex, remap, scratch2);
+            meshopt::remap_vertices(staging.skindata.data() + mesh.base_vertex, remap, scratch_skin);
+
+            const auto after = meshopt::analyze_vertex_cache(indices, mesh.nbr_indices, mesh.nbr_vertices);
+            log << "\t" << mesh.nbr_indices / 3 << " triangles, "
+                << clusters.size() << " clusters: "
+                << before.acmr << "/" << before.atvr << " -> "
+                << after.acmr << "/" << after.atvr << std::endl;
+        }
+    }
+
+    void RenderableMesh::generateLods(SceneStaging& staging)
+    {
+        log << priority(PRTSTRICT) << "Generating LODs (triangles per level)" << std::endl;
+
+        std::vector<unsigned> src, dst, clusters, groups;
+        for (auto& mesh : m_meshes)
+        {
+            const glm::vec3* positions = staging.positions + mesh.base_vertex;
+            AABB aabb;
+            for (unsigned i = 0; i < mesh.nbr_vertices; i++)
+                aabb.grow(positions[i]);
+            const float extent = glm::length(aabb.max - aabb.min);
+
+            // Skinned vertices only collapse onto vertices with the same dominant bone
+            groups.clear();
+            if (mesh.is_skinned)
+            {
+                groups.resize(mesh.nbr_vertices);
+                for (unsigned i = 0; i < mesh.nbr_vertices; i++)
+                {
+                    const auto& skin = staging.skindata[mesh.base_vertex + i];
+                    groups[i] = skin.bone_indices[std::max_element(skin.bone_weights, skin.bone_weights + BonesPerVertex) - skin.bone_weights];
+                }
+            }
+
+            src.assign(staging.indices.begin() + mesh.base_index, staging.indices.begin() + mesh.base_index + mesh.nbr_indices);
+            log << "\t" << src.size() / 3;
+            float max_error = 0.005f * extent; // Doubled per level
+            for (; mesh.nbr_lods < MaxLods; mesh.nbr_lods++, max_error *= 2.0f)
+            {
+                dst.resize(src.size());
+                const size_t target = src.size() / 6 * 3;
+                const size_t size = meshopt::simplify(dst.data(), src.data(), src.size(),
+                    positions, mesh.nbr_vertices, target, max_error, groups.size() ? groups.data() : nullptr);
+
+                // Stop when the error bound or locked features prevent further reduction
+                if (size > src.size() * 3 / 4)
+                    break;
+                dst.resize(size);
+                meshopt::optimize_vertex_cache(dst.data(), dst.size(), mesh.nbr_vertices, clusters);
+
+                mesh.lods[mesh.nbr_lods] = { unsigned(staging.indices.size()), unsigned(size) };
+                staging.indices.insert(staging.indices.end(), dst.begin(), dst.end());
+                std::swap(src, dst);
+                log << " -> " << size / 3;
+            }
+            log << std::endl;
+        }
+    }
+
+    void RenderableMesh::buildMeshlets(SceneStaging& staging)
+    {
+        log << priority(PRTSTRICT) << "Building meshlets (triangles, meshlets)" << std::endl;
+
+        // Skinned submeshes deform, so their bounds and cones would not hold
+        std::vector<meshopt::Meshlet> meshlets;
+        for (auto& mesh : m_meshes)
+        {
+            if (mesh.is_skinned)
+                continue;
+
+            const auto& lod = mesh.lods[0];
+            meshopt::build_meshlets(staging.indices.data() + lod.base_index, lod.nbr_indices,
+                staging.positions + mesh.base_vertex, mesh.nbr_vertices, meshlets);
+            mesh.first_meshlet = unsigned(m_meshlets.size());
+            mesh.nbr_meshlets = unsigned(meshlets.size());
+            m_meshlets.insert(m_meshlets.end(), meshlets.begin(), meshlets.end());
+            log << "\t" << lod.nbr_indices / 3 << ", " << meshlets.size() << std::endl;
+        }
+    }
+
+    void RenderableMesh::packIndices(const SceneStaging& staging, std::vector<uint8_t>& index_data)
+    {
+        // Indices are relative to base_vertex, so most submeshes fit 16 bits
+        size_t nbr_bytes = 0;
+        for (auto& mesh : m_meshes)
+        {
+            const bool short_indices = mesh.nbr_vertices <= 0x10000;
+            mesh.index_type = short_indices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            for (unsigned l = 0; l < mesh.nbr_lods; l++)
+            {
+                auto& lod = mesh.lods[l];
+                lod.index_offset = unsigned((nbr_bytes + 3) & ~size_t(3)); // Aligned for both index types
+                nbr_bytes = lod.index_offset + lod.nbr_indices * (short_indices ? sizeof(uint16_t) : sizeof(uint32_t));
+            }
         }
+
+        index_data.assign(nbr_bytes, 0);
+        for (const auto& mesh : m_meshes)
+        {
+            for (unsigned l = 0; l < mesh.nbr_lods; l++)
+            {
+                const auto& lod = mesh.lods[l];
+                const unsigned* src = staging.indices.data() + lod.base_index;
+                uint8_t* dst = index_data.data() + lod.index_offset;
+                if (mesh.index_type == GL_UNSIGNED_SHORT)
+                    std::transform(src, src + lod.nbr_indices, reinterpret_cast<uint16_t*>(dst), [](unsigned i) { return uint16_t(i); });
+                else
+                    std::memcpy(dst, src, lod.nbr_indices * sizeof(uint32_t));
+            }
+        }
+
+        log << priority(PRTSTRICT) << "Index buffer " << nbr_bytes << " bytes ("
+            << staging.indices.size() * sizeof(uint32_t) << " with 32-bit indices)" << std::endl;
     }
 
     AABB RenderableMesh::measureScene(const aiScene* aiscene)
@@ -716,6 +880,7 @@ namespace eeng
             {
                 // New texture found: create & hash it
                 Texture2D texture;
+                texture.m_pooled = true;
                 texture.load_from_file(textureFilename, textureAbsPath);
                 log << priority(PRTSTRICT) << "Loaded texture " << texture << std::endl;
                 textureIndex = (unsigned)m_textures.size();
@@ -775,6 +940,7 @@ namespace eeng
             // std::string filename = std::to_string(i);
 
             Texture2D texture;
+            texture.m_pooled = true;
             if (aitexture->mHeight)
             {
                 // Raw embedded image data
@@ -971,6 +1137,111 @@ namespace eeng
         return translationMatrix * rotationMatrix * scaleMatrix;
     }
 
+    NodeTRS RenderableMesh::sampleNode(
+        size_t node_index,
+        const AnimationClip* anim,
+        float ntime) const
+    {
+        if (!anim || !anim->node_animations[node_index].is_used)
+            return m_bind_pose[node_index];
+
+        auto& node_keyframes = anim->node_animations[node_index];
+        const auto& rot_keys = node_keyframes.rot_keys;
+        const auto& pos_keys = node_keyframes.pos_keys;
+        const auto& scale_keys = node_keyframes.scale_keys;
+        const size_t nbr_pos_keys = pos_keys.size();
+        const size_t nbr_rot_keys = rot_keys.size();
+        const size_t nbr_scale_keys = scale_keys.size();
+        NodeTRS trs;
+
+        // Blend translation keys
+        float pos_indexf = ntime * (nbr_pos_keys - 1ull);
+        size_t pos_index0 = std::floor(pos_indexf);
+        size_t pos_index1 = std::min(pos_index0 + 1ull, nbr_pos_keys - 1ull);
+        trs.pos = glm::mix(pos_keys[pos_index0], pos_keys[pos_index1], pos_indexf - pos_index0);
+
+        // Blend rotation keys
+        float rot_indexf = ntime * (nbr_rot_keys - 1ull);
+        size_t rot_index0 = std::floor(rot_indexf);
+        size_t rot_index1 = std::min(rot_index0 + 1ull, nbr_rot_keys - 1ull);
+        trs.rot = glm::slerp(rot_keys[rot_index0], rot_keys[rot_index1], rot_indexf - rot_index0);
+
+        // Blend scaling keys
+        float scale_indexf = ntime * (nbr_scale_keys - 1ull);
+        size_t scale_index0 = std::floor(scale_indexf);
+        size_t scale_index1 = std::min(scale_index0 + 1ull, nbr_scale_keys - 1ull);
+        trs.scale = glm::mix(scale_keys[scale_index0], scale_keys[scale_index1], scale_indexf - scale_index0);
+
+        return trs;
+    }
+
+    void RenderableMesh::compute_bind_pose()
+    {
+        m_bind_pose.resize(m_nodetree.size());
+        for (size_t i = 0; i < m_bind_pose.size(); i++)
+        {
+            glm::vec3 skew;
+            glm::vec4 perspective;
+            auto& trs = m_bind_pose[i];
+            glm::decompose(m_nodetree.get_payload_at(i).local_tfm, trs.scale, trs.rot, trs.pos, skew, perspective);
+        }
+    }
+
+    void RenderableMesh::sampleLocalPose(
+        int anim_index,
+        float time,
+        LocalPose& pose,
+        AnmationTimeFormat animTimeFormat,
+        bool reduced_detail) const
+    {
+        const AnimationClip* anim = nullptr;
+        if (anim_index >= 0 && anim_index < getNbrAnimations())
+        {
+            anim = &m_animations[anim_index];
+        }
+
+        // Convert to normalized time
+        float ntime = time;
+        if (anim && animTimeFormat == AnmationTimeFormat::RealTime)
+        {
+            const float dur_ticks = anim->duration_ticks;
+            const float animdur_sec = dur_ticks / anim->tps;
+            const float animtime_sec = fmod(time, animdur_sec);
+            const float animtime_ticks = animtime_sec * anim->tps;
+            ntime = animtime_ticks / dur_ticks;
+        }
+
+        const bool masked = reduced_detail && anim && anim->nbr_lod_masked;
+        pose.resize(m_nodetree.size());
+        for (size_t i = 0; i < pose.size(); i++)
+            pose[i] = masked && anim->lod_mask[i] ? m_bind_pose[i] : sampleNode(i, anim, ntime);
+    }
+
+    void RenderableMesh::setLocalPose(const LocalPose& pose)
+    {
+        EENG_ASSERT(pose.size() == m_nodetree.size(), "Pose has {0} nodes, expected {1}", pose.size(), m_nodetree.size());
+
+        m_nodetree.traverse_progressive(
+            [&](SkeletonNode* node, SkeletonNode* parent_node, size_t node_index, size_t parent_index)
+            {
+                const auto& trs = pose[node_index];
+                node->global_tfm =
+                    glm::translate(glm::mat4(1.0f), trs.pos) *
+                    glm::mat4_cast(trs.rot) *
+                    glm::scale(glm::mat4(1.0f), trs.scale);
+
+                if (parent_node)
+                    node->global_tfm = parent_node->global_tfm * node->global_tfm;
+            });
+
+        update_bone_palette();
+    }
+
+    const LocalPose& RenderableMesh::getBindPose() const
+    {
+        return m_bind_pose;
+    }
+
     glm::mat4 RenderableMesh::animateBlendNode(
         size_t node_index,
         const AnimationClip* anim0,
@@ -1038,7 +1309,8 @@ namespace eeng
     void RenderableMesh::animate(
         int anim_index,
         float time,
-        AnmationTimeFormat animTimeFormat)
+        AnmationTimeFormat animTimeFormat,
+        bool reduced_detail)
     {
         AnimationClip* anim = nullptr;
         if (anim_index >= 0 && anim_index < getNbrAnimations())
@@ -1061,48 +1333,16 @@ namespace eeng
         m_nodetree.traverse_progressive(
             [&](SkeletonNode* node, SkeletonNode* parent_node, size_t node_index, size_t parent_index)
             {
-                node->global_tfm = animateNode(node_index, anim, ntime);
+                if (reduced_detail && anim && anim->nbr_lod_masked && anim->lod_mask[node_index])
+                    node->global_tfm = node->local_tfm;
+                else
+                    node->global_tfm = animateNode(node_index, anim, ntime);
 
                 if (parent_node)
                     node->global_tfm = parent_node->global_tfm * node->global_tfm;
             });
 
-        m_model_aabb.reset();
-        for (int i = 0; i < m_bones.size(); i++)
-        {
-            const auto& node_tfm = m_nodetree.get_payload_at(m_bones[i].node_index).global_tfm;
-            const auto& boneIB_tfm = m_bones[i].inversebind_tfm;
-            glm::mat4 M = node_tfm * boneIB_tfm;
-
-            // Bone matrices
-            boneMatrices[i] = M;
-
-            // AABBs
-            if (m_bone_aabbs_bind[i])
-            {
-                m_bone_aabbs_pose[i] = m_bone_aabbs_bind[i].post_transform(glm::vec3(M[3]), glm::mat3(M));
-                m_model_aabb.grow(m_bone_aabbs_pose[i]);
-            }
-        }
-
-        // Puts mesh AABB's in pose and have them grow model AABB
-        for (int i = 0; i < m_meshes.size(); i++)
-        {
-            if (!m_mesh_aabbs_bind[i])
-                continue;
-            if (m_meshes[i].is_skinned)
-                continue;
-
-            if (m_meshes[i].node_index > EENG_NULL_INDEX)
-            {
-                glm::mat4 M = m_nodetree.get_payload_at(m_meshes[i].node_index).global_tfm;
-                m_mesh_aabbs_pose[i] = m_mesh_aabbs_bind[i].post_transform(glm::vec3(M[3]), glm::mat3(M));
-            }
-            else
-                m_mesh_aabbs_pose[i] = m_mesh_aabbs_bind[i];
-
-            m_model_aabb.grow(m_mesh_aabbs_pose[i]);
-        }
+        update_bone_palette();
     }
 
     void RenderableMesh::animateBlend(
@@ -1150,42 +1390,143 @@ namespace eeng
                     node->global_tfm = parent_node->global_tfm * node->global_tfm;
             });
 
-        m_model_aabb.reset();
+        update_bone_palette();
+    }
+
+    void RenderableMesh::update_bone_palette()
+    {
+        // Bone matrices
         for (int i = 0; i < m_bones.size(); i++)
         {
             const auto& node_tfm = m_nodetree.get_payload_at(m_bones[i].node_index).global_tfm;
             const auto& boneIB_tfm = m_bones[i].inversebind_tfm;
-            glm::mat4 M = node_tfm * boneIB_tfm;
+            boneMatrices[i] = node_tfm * boneIB_tfm;
+        }
+        compute_dualquat_palette();
 
-            // Bone matrices
-            boneMatrices[i] = M;
+        compute_pose_aabbs();
+    }
 
-            // AABBs
-            if (m_bone_aabbs_bind[i])
-            {
-                m_bone_aabbs_pose[i] = m_bone_aabbs_bind[i].post_transform(glm::vec3(M[3]), glm::mat3(M));
-                m_model_aabb.grow(m_bone_aabbs_pose[i]);
-            }
+    void RenderableMesh::buildLodMask(int anim_index, int max_height, int min_branches)
+    {
+        EENG_ASSERT(anim_index >= 0 && anim_index < getNbrAnimations(), "{0} is not a valid clip index", anim_index);
+        auto& anim = m_animations[anim_index];
+        const size_t nbr_nodes = m_nodetree.size();
+
+        // Nodes are stored depth-first, so children come after their parent
+        std::vector<int> height(nbr_nodes, 0);
+        std::vector<size_t> parent(nbr_nodes, EENG_NULL_INDEX);
+        for (size_t i = 0; i < nbr_nodes; i++)
+        {
+            auto [node, nbr_children, branch_stride, parent_ofs] = m_nodetree.get_node_info_at(i);
+            if (parent_ofs)
+                parent[i] = i - parent_ofs;
         }
+        for (size_t i = nbr_nodes; i-- > 0; )
+            if (parent[i] != EENG_NULL_INDEX)
+                height[parent[i]] = std::max(height[parent[i]], height[i] + 1);
 
-        // Puts mesh AABB's in pose and have them grow model AABB
-        for (int i = 0; i < m_meshes.size(); i++)
+        // Mask short chains below branching nodes, and everything below them
+        anim.lod_mask.assign(nbr_nodes, false);
+        for (size_t i = 0; i < nbr_nodes; i++)
         {
-            if (!m_mesh_aabbs_bind[i])
+            if (parent[i] == EENG_NULL_INDEX)
                 continue;
-            if (m_meshes[i].is_skinned)
+            const auto [parent_node, nbr_siblings, parent_stride, parent_parent_ofs] = m_nodetree.get_node_info_at(parent[i]);
+            if (anim.lod_mask[parent[i]] || (height[i] <= max_height && nbr_siblings >= min_branches))
+                anim.lod_mask[i] = true;
+        }
+        anim.nbr_lod_masked = (unsigned)std::count(anim.lod_mask.begin(), anim.lod_mask.end(), true);
+    }
+
+    void RenderableMesh::addToLodMask(int anim_index, const std::vector<std::string>& node_names)
+    {
+        EENG_ASSERT(anim_index >= 0 && anim_index < getNbrAnimations(), "{0} is not a valid clip index", anim_index);
+        auto& anim = m_animations[anim_index];
+        anim.lod_mask.resize(m_nodetree.size(), false);
+
+        for (auto& name : node_names)
+        {
+            const size_t node_index = m_nodetree.find_node_index(name);
+            if (node_index == VecTree_NullIndex)
                 continue;
+            auto [node, nbr_children, branch_stride, parent_ofs] = m_nodetree.get_node_info_at(node_index);
+            for (size_t i = node_index; i < node_index + branch_stride; i++)
+                anim.lod_mask[i] = true;
+        }
+        anim.nbr_lod_masked = (unsigned)std::count(anim.lod_mask.begin(), anim.lod_mask.end(), true);
+    }
+
+    unsigned RenderableMesh::getNbrAnimatedNodes(int anim_index, bool reduced_detail) const
+    {
+        unsigned nbr_nodes = (unsigned)m_nodetree.size();
+        if (reduced_detail && anim_index >= 0 && anim_index < getNbrAnimations())
+            nbr_nodes -= m_animations[anim_index].nbr_lod_masked;
+        return nbr_nodes;
+    }
 
+    void RenderableMesh::getPose(std::vector<glm::mat4>& node_tfms) const
+    {
+        node_tfms.resize(m_nodetree.size());
+        for (size_t i = 0; i < node_tfms.size(); i++)
+            node_tfms[i] = m_nodetree.get_payload_at(i).global_tfm;
+    }
+
+    void RenderableMesh::setPose(const std::vector<glm::mat4>& node_tfms)
+    {
+        EENG_ASSERT(node_tfms.size() == m_nodetree.size(), "Pose has {0} nodes, expected {1}", node_tfms.size(), m_nodetree.size());
+        for (size_t i = 0; i < node_tfms.size(); i++)
+            m_nodetree.get_payload_at(i).global_tfm = node_tfms[i];
+
+        update_bone_palette();
+    }
+
+    void RenderableMesh::compute_dualquat_palette()
+    {
+        if (!dualQuatSkinning)
+        {
+            boneDualQuats.clear();
+            return;
+        }
+
+        boneDualQuats.resize(boneMatrices.size());
+        for (size_t i = 0; i < boneMatrices.size(); i++)
+        {
+            const auto dq = mat4ToDualquat(boneMatrices[i]);
+            boneDualQuats[i] = glm::mat2x4(
+                glm::vec4(dq.real.x, dq.real.y, dq.real.z, dq.real.w),
+                glm::vec4(dq.dual.x, dq.dual.y, dq.dual.z, dq.dual.w));
+        }
+    }
+
+    void RenderableMesh::compute_pose_aabbs()
+    {
+        m_model_aabb.reset();
+
+        // Bone AABB's are put in pose by their bone matrices
+        post_transform_batch(m_bone_aabbs_bind_soa, boneMatrices.data(), m_aabbs_pose_soa);
+        for (int i = 0; i < m_bones.size(); i++)
+            m_bone_aabbs_pose[i] = m_aabbs_pose_soa.get(i);
+        AABB bone_union = union_batch(m_aabbs_pose_soa);
+        if (bone_union)
+            m_model_aabb.grow(bone_union);
+
+        // Mesh AABB's are put in pose by their node transforms.
+        // Skinned meshes have empty bind AABB's and are ignored.
+        for (int i = 0; i < m_meshes.size(); i++)
+        {
             if (m_meshes[i].node_index > EENG_NULL_INDEX)
-            {
-                glm::mat4 M = m_nodetree.get_payload_at(m_meshes[i].node_index).global_tfm;
-                m_mesh_aabbs_pose[i] = m_mesh_aabbs_bind[i].post_transform(glm::vec3(M[3]), glm::mat3(M));
-            }
+                m_mesh_pose_tfms[i] = m_nodetree.get_payload_at(m_meshes[i].node_index).global_tfm;
             else
-                m_mesh_aabbs_pose[i] = m_mesh_aabbs_bind[i];
-
-            m_model_aabb.grow(m_mesh_aabbs_pose[i]);
+                m_mesh_pose_tfms[i] = glm::mat4{ 1.0f };
         }
+        post_transform_batch(m_mesh_aabbs_bind_soa, m_mesh_pose_tfms.data(), m_aabbs_pose_soa);
+        for (int i = 0; i < m_meshes.size(); i++)
+            m_mesh_aabbs_pose[i] = m_aabbs_pose_soa.get(i);
+
+        AABB mesh_union = union_batch(m_aabbs_pose_soa);
+        if (mesh_union)
+            m_model_aabb.grow(mesh_union);
     }
 
     unsigned RenderableMesh::getNbrAnimations() const
@@ -1203,15 +1544,10 @@ namespace eeng
         for (auto& t : m_textures)
             t.free();
 
-        if (m_Buffers[0] != 0)
-        {
-            glDeleteBuffers((GLsizei)numelem(m_Buffers), m_Buffers);
-        }
-
-        if (m_VAO != 0)
+        if (m_geometry != GeometryArena::NoHandle)
         {
-            glDeleteVertexArrays(1, &m_VAO);
-            m_VAO = 0;
+            GeometryArena::instance().free(m_geometry);
+            m_geometry = GeometryArena::NoHandle;
         }
     }
 
@@ -15,6 +15,8 @@
 
 #include "glcommon.h"
 #include "AABB.h"
+#include "MeshOptimizer.hpp"
+#include "GeometryArena.hpp"
 #include "Texture.hpp"
 #include "VecTree.h"
 #include "logstreamer.h"
@@ -78,7 +80,10 @@ namespace eeng
     enum xiContentFlags
     {
         xi_load_meshes = 0x1,
-        xi_load_animations = 0x2
+        xi_load_animations = 0x2,
+        xi_optimize_meshes = 0x4,   ///< Reorder submesh indices and vertices for vertex cache, overdraw and fetch
+        xi_generate_lods = 0x8,     ///< Generate simplified index ranges per submesh
+        xi_build_meshlets = 0x10    ///< Split non-skinned submeshes into clusters that can be culled individually
     };
 
     /// @brief Interpretation of time when mapping to keyframes
@@ -92,32 +97,46 @@ namespace eeng
         NormalizedTime
     };
 
+    /// @brief Local translation, rotation and scale of a node
+    struct NodeTRS
+    {
+        glm::vec3 pos{ 0.0f };
+        glm::quat rot{ 1.0f, 0.0f, 0.0f, 0.0f };
+        glm::vec3 scale{ 1.0f };
+    };
+
+    /// @brief Local transforms of all nodes of a mesh, indexed by node
+    using LocalPose = std::vector<NodeTRS>;
+
     /// @brief A model loaded from file prepared with GL textures and buffers
     class RenderableMesh
     {
         friend class ForwardRenderer;
 
     private:
-        enum
-        {
-            IndexBuffer,
-            PositionBuffer,
-            NormalBuffer,
-            TangentBuffer,
-            BinormalBuffer,
-            TexturecoordBuffer,
-            BoneBuffer,
-            BufferCount
-        };
+        static constexpr unsigned MaxLods = 4;
 
         /// A mesh with a single material and a given set of geometry
         struct Submesh
         {
+            /// Index range of a level of detail. All levels index the vertices of the submesh.
+            struct Lod
+            {
+                unsigned base_index = 0;            // First index in the scene index list
+                unsigned nbr_indices = 0;
+                unsigned index_offset = 0;          // Byte offset in the index buffer
+            };
+
             // TODO: GL types?
             unsigned base_index = 0;
             unsigned nbr_indices = 0;
             unsigned base_vertex = 0;
             unsigned nbr_vertices = 0;
+            GLenum index_type = GL_UNSIGNED_INT;    // GL_UNSIGNED_SHORT if the submesh has at most 65536 vertices
+            Lod lods[MaxLods];                      // Full detail first, then coarser
+            unsigned nbr_lods = 1;
+            unsigned first_meshlet = 0;             // Range in m_meshlets. Meshlets split the full detail level.
+            unsigned nbr_meshlets = 0;
 
             int mtl_index = -1;
             int node_index = -1;
@@ -157,18 +176,28 @@ namespace eeng
             float duration_ticks = 0;
             float tps = 1;
             std::vector<NodeKeyframes> node_animations;
+            std::vector<bool> lod_mask;     // Nodes skipped at reduced detail
+            unsigned nbr_lod_masked = 0;    // Number of nodes in lod_mask
         };
 
-        GLuint m_VAO = 0;
-        GLuint m_Buffers[BufferCount] = { 0 };
+        /// Vertices and indices in the shared GeometryArena. Submesh vertex and index offsets are relative to it.
+        GeometryArena::Handle m_geometry = GeometryArena::NoHandle;
+
+        LocalPose m_bind_pose;
 
     public:
         VecTree<SkeletonNode> m_nodetree;
         std::vector<Bone> m_bones;
         std::vector<glm::mat4> boneMatrices;
+        std::vector<glm::mat2x4> boneDualQuats; // Real and dual part per bone, (x, y, z, w). Empty unless dualQuatSkinning is set.
+
+        /// Skin with dual quaternions instead of bone matrices. Bones are treated
+        /// as rigid (scale is dropped). Takes effect at the next animate call.
+        bool dualQuatSkinning = false;
         std::vector<AnimationClip> m_animations;
 
         std::vector<Submesh> m_meshes;
+        std::vector<meshopt::Meshlet> m_meshlets;   // Index offsets relative to the full detail level of their submesh
         std::vector<PhongMaterial> m_materials;
         std::vector<Texture2D> m_textures;
 
@@ -179,6 +208,12 @@ namespace eeng
         std::vector<AABB> m_mesh_aabbs_pose; // Per-mesh pose AABB's – intermediary, used for visualization
         AABB m_model_aabb;                   // AABB for the entire model
 
+        // SoA mirrors of the bind AABB's and scratch data, used for batch transformation
+        AABBSoA m_bone_aabbs_bind_soa;
+        AABBSoA m_mesh_aabbs_bind_soa;
+        AABBSoA m_aabbs_pose_soa;
+        std::vector<glm::mat4> m_mesh_pose_tfms;
+
     public:
         unsigned m_embedded_textures_ofs = 0;
 
@@ -198,17 +233,20 @@ namespace eeng
         ~RenderableMesh();
 
 
-        /// @brief 
-        /// @param file 
-        /// @param just_animations 
+        /// @brief Load meshes and animations from file, or append the animations of a file
+        /// @param file Model file
+        /// @param append_animations If true, only animations are loaded and added to the current clips
+        /// @param extra_xiflags Import processing added to xi_load_meshes | xi_load_animations:
+        /// xi_optimize_meshes, xi_generate_lods and xi_build_meshlets. Ignored when appending animations.
         void load(const std::string& file,
-            bool just_animations = false);
+            bool append_animations = false,
+            unsigned extra_xiflags = 0);
 
 
-        /// @brief 
-        /// @param file 
-        /// @param xiflags 
-        /// @param aiflags 
+        /// @brief Load with explicit import flags
+        /// @param file Model file
+        /// @param xiflags Combination of xi_ flags. xi_load_animations alone appends animations.
+        /// @param aiflags Assimp post-processing flags
         void load(const std::string& file,
             unsigned xiflags,
             unsigned aiflags = 0);
@@ -225,10 +263,12 @@ namespace eeng
         /// @param anim_index Clip index. Use -1 for bind pose.
         /// @param time Animation time, in seconds or normalized time (see animTimeFormat).
         /// @param animTimeFormat Interpretation of time when mapping to keyframes.
+        /// @param reduced_detail Skip nodes in the LOD mask of the clip. They keep their bind pose relative to their parent.
         void animate(
             int anim_index,
             float time,
-            AnmationTimeFormat animTimeFormat = AnmationTimeFormat::RealTime);
+            AnmationTimeFormat animTimeFormat = AnmationTimeFormat::RealTime,
+            bool reduced_detail = false);
 
 
         /// @brief Animate this mesh using a blend of two animation clips
@@ -247,6 +287,53 @@ namespace eeng
             AnmationTimeFormat animTimeFormat0 = AnmationTimeFormat::RealTime,
             AnmationTimeFormat animTimeFormat1 = AnmationTimeFormat::RealTime);
 
+        /// @brief Mark leaf chains of a clip to skip when animating at reduced detail
+        /// Marks chains of at most max_height nodes below nodes with at least
+        /// min_branches children, such as fingers below a hand or face bones below a head.
+        /// @param anim_index Clip index
+        /// @param max_height Maximal height of a masked chain, where a leaf has height 0
+        /// @param min_branches Minimal number of children of the node above a masked chain
+        void buildLodMask(int anim_index, int max_height = 3, int min_branches = 4);
+
+        /// @brief Mark named nodes and their descendants to skip when animating a clip at reduced detail
+        /// @param anim_index Clip index
+        /// @param node_names Names of nodes to mask
+        void addToLodMask(int anim_index, const std::vector<std::string>& node_names);
+
+        /// @brief Number of nodes evaluated when animating a clip
+        /// @param anim_index Clip index
+        /// @param reduced_detail Whether the LOD mask is used
+        unsigned getNbrAnimatedNodes(int anim_index, bool reduced_detail) const;
+
+        /// @brief Sample a clip into local node transforms
+        /// Nodes without keys in the clip get their bind pose transform.
+        /// @param anim_index Clip index. Use -1 for bind pose.
+        /// @param time Animation time, in seconds or normalized time (see animTimeFormat).
+        /// @param pose Output pose, resized to the number of nodes
+        /// @param animTimeFormat Interpretation of time when mapping to keyframes.
+        /// @param reduced_detail If true, nodes in the LOD mask of the clip get their bind pose transform
+        void sampleLocalPose(
+            int anim_index,
+            float time,
+            LocalPose& pose,
+            AnmationTimeFormat animTimeFormat = AnmationTimeFormat::RealTime,
+            bool reduced_detail = false) const;
+
+        /// @brief Set the current pose from local node transforms, e.g. a blend of sampled poses
+        /// @param pose Local transform per node
+        void setLocalPose(const LocalPose& pose);
+
+        /// @brief Local node transforms in bind pose
+        const LocalPose& getBindPose() const;
+
+        /// @brief Copy the global node transforms of the current pose
+        /// @param node_tfms Global transform per node
+        void getPose(std::vector<glm::mat4>& node_tfms) const;
+
+        /// @brief Set the current pose from global node transforms, e.g. a cached or interpolated pose
+        /// @param node_tfms Global transform per node
+        void setPose(const std::vector<glm::mat4>& node_tfms);
+
         /// @brief
         /// @return
         unsigned getNbrAnimations() const;
@@ -258,20 +345,50 @@ namespace eeng
 
     private:
         bool loadScene(const aiScene* pScene,
-            const std::string& file);
+            const std::string& file,
+            unsigned xiflags);
+
+        /// Vertex data of a scene before upload.
+        /// All attributes share one zero-initialized allocation, so missing attributes need no fill.
+        struct SceneStaging
+        {
+            std::vector<float> vertex_data;
+            glm::vec3* positions = nullptr;
+            glm::vec3* normals = nullptr;
+            glm::vec3* tangents = nullptr;
+            glm::vec3* binormals = nullptr;
+            glm::vec2* texcoords = nullptr;
+            std::vector<SkinData> skindata;
+            std::vector<unsigned int> indices;
+            size_t nbr_vertices = 0;
+
+            void allocate(size_t nbr_vertices, size_t nbr_indices);
+        };
 
         void loadMesh(uint MeshIndex,
             const aiMesh* paiMesh,
-            std::vector<glm::vec3>& Positions,
-            std::vector<glm::vec3>& Normals,
-            std::vector<glm::vec3>& Tangents,
-            std::vector<glm::vec3>& Binormals,
-            std::vector<glm::vec2>& TexCoords,
-            std::vector<SkinData>& Bones,
-            std::vector<unsigned int>& Indices);
+            SceneStaging& staging);
+
+        /// Reorder indices and vertices of each submesh. Logs ACMR and ATVR before and after.
+        void optimizeMeshes(SceneStaging& staging);
+
+        /// Append simplified index ranges to each submesh, each with about half the triangles of the previous
+        void generateLods(SceneStaging& staging);
+
+        /// Reorder the full detail indices of non-skinned submeshes into meshlets
+        void buildMeshlets(SceneStaging& staging);
+
+        /// Pack submesh indices with the smallest index type that fits. Sets index offsets and index_type of submeshes.
+        void packIndices(const SceneStaging& staging, std::vector<uint8_t>& index_data);
 
         void compute_bind_aabbs(); // not implemented. where?
-        void compute_pose_aabbs(); // not implemented. where?
+        /// Put bone & mesh AABB's in pose and compute model AABB.
+        /// Expects bone matrices and node transforms to be up to date.
+        void compute_pose_aabbs();
+        /// Convert bone matrices to boneDualQuats if dualQuatSkinning is set
+        void compute_dualquat_palette();
+        /// Update bone matrices, dual quaternions and AABB's from node transforms
+        void update_bone_palette();
 
         void loadNodes(aiNode* node);
         void loadNode(aiNode* node);
@@ -294,6 +411,13 @@ namespace eeng
             const AnimationClip* anim,
             float ntime) const;
 
+        NodeTRS sampleNode(
+            size_t node_index,
+            const AnimationClip* anim,
+            float ntime) const;
+
+        void compute_bind_pose();
+
         glm::mat4 animateBlendNode(
             size_t node_index,
             const AnimationClip* anim0,
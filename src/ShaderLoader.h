@@ -5,8 +5,13 @@
 #define ShaderLoader_H
 
 #include <cstdlib>
+#include <cstdint>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
 #include "glcommon.h"
+#include "ProgramBinaryCache.hpp"
 
 static void printShaderLog(GLuint obj,
 						   GLuint shader)
@@ -100,4 +105,328 @@ static GLuint createShaderProgram(const char *vertexShaderSource,
 	return program;
 }
 
+/// Program with a single shader stage, e.g. a compute shader, or a vertex
+/// shader whose outputs are captured by transform feedback
+static GLuint createSingleShaderProgram(GLenum shaderType,
+										const char *shaderSource,
+										const char *const *feedbackVaryings = nullptr,
+										int nbrFeedbackVaryings = 0)
+{
+	// Make sure GL-errors has not already been thrown elsewhere
+	CheckAndThrowGLErrors();
+
+	GLuint shader = glCreateShader(shaderType);
+	glShaderSource(shader, 1, &shaderSource, 0);
+
+	std::cout << "Compiling shader..." << std::endl;
+	glCompileShader(shader);
+
+	GLuint program = glCreateProgram();
+
+	glAttachShader(program, shader);
+	printShaderLog(program, shader);
+
+	// Varyings are captured interleaved and must be set before linking
+	if (nbrFeedbackVaryings)
+		glTransformFeedbackVaryings(program, nbrFeedbackVaryings, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
+
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (glGetError() != GL_NO_ERROR || !linked)
+	{
+		std::cerr << "errors:\n";
+		printShaderLog(program, shader);
+		throw std::runtime_error("shader compilation failed");
+	}
+
+	// The program keeps the compiled stage
+	glDeleteShader(shader);
+
+	return program;
+}
+
+/// True if the driver compiles and links on background threads (GL_KHR_parallel_shader_compile).
+/// The first call lets the driver use as many threads as it likes.
+static bool parallelShaderCompile()
+{
+	static const bool supported = []
+	{
+		if (!GLEW_KHR_parallel_shader_compile)
+			return false;
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		return true;
+	}();
+	return supported;
+}
+
+/// Program whose shaders are compiled and linked, possibly in the background
+struct PendingShaderProgram
+{
+	GLuint program = 0;
+	GLuint vertexShader = 0;
+	GLuint fragmentShader = 0;
+};
+
+/// Start compiling and linking a program without waiting for the result.
+/// The driver does the work on other threads if parallelShaderCompile() is true,
+/// and otherwise no later than finishShaderProgram.
+static PendingShaderProgram beginShaderProgram(const char *vertexShaderSource,
+											   const char *fragmentShaderSource)
+{
+	// Make sure GL-errors has not already been thrown elsewhere
+	CheckAndThrowGLErrors();
+
+	PendingShaderProgram pending;
+	pending.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	pending.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(pending.vertexShader, 1, &vertexShaderSource, 0);
+	glShaderSource(pending.fragmentShader, 1, &fragmentShaderSource, 0);
+	glCompileShader(pending.vertexShader);
+	glCompileShader(pending.fragmentShader);
+
+	pending.program = glCreateProgram();
+	glAttachShader(pending.program, pending.vertexShader);
+	glAttachShader(pending.program, pending.fragmentShader);
+	glProgramParameteri(pending.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(pending.program);
+
+	return pending;
+}
+
+/// True if finishShaderProgram will not block
+static bool isShaderProgramReady(const PendingShaderProgram &pending)
+{
+	if (!parallelShaderCompile())
+		return true;
+	GLint completed = GL_FALSE;
+	glGetProgramiv(pending.program, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed == GL_TRUE;
+}
+
+/// Wait for a program started with beginShaderProgram and check it for errors
+static GLuint finishShaderProgram(PendingShaderProgram &pending)
+{
+	GLint vertexCompiled = GL_FALSE, fragmentCompiled = GL_FALSE, linked = GL_FALSE;
+	glGetShaderiv(pending.vertexShader, GL_COMPILE_STATUS, &vertexCompiled);
+	glGetShaderiv(pending.fragmentShader, GL_COMPILE_STATUS, &fragmentCompiled);
+	glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+	if (glGetError() != GL_NO_ERROR || !vertexCompiled || !fragmentCompiled || !linked)
+	{
+		std::cerr << "errors:\n";
+		printShaderLog(pending.program, pending.vertexShader);
+		printShaderLog(pending.program, pending.fragmentShader);
+		throw std::runtime_error("shader compilation failed");
+	}
+
+	// The program keeps the compiled stages
+	glDetachShader(pending.program, pending.vertexShader);
+	glDetachShader(pending.program, pending.fragmentShader);
+	glDeleteShader(pending.vertexShader);
+	glDeleteShader(pending.fragmentShader);
+
+	const GLuint program = pending.program;
+	pending = PendingShaderProgram{};
+	return program;
+}
+
+/// Program loaded from the program binary cache, or compiled and stored in it
+static GLuint createCachedShaderProgram(const char *vertexShaderSource,
+										const char *fragmentShaderSource)
+{
+	auto &cache = eeng::ProgramBinaryCache::instance();
+	const std::string key = cache.key({ vertexShaderSource, fragmentShaderSource });
+	if (GLuint program = cache.load(key))
+		return program;
+
+	std::cout << "Compiling shader program..." << std::endl;
+	PendingShaderProgram pending = beginShaderProgram(vertexShaderSource, fragmentShaderSource);
+	const GLuint program = finishShaderProgram(pending);
+	cache.store(key, program);
+	return program;
+}
+
+/// createSingleShaderProgram through the program binary cache
+static GLuint createCachedSingleShaderProgram(GLenum shaderType,
+											  const char *shaderSource,
+											  const char *const *feedbackVaryings = nullptr,
+											  int nbrFeedbackVaryings = 0)
+{
+	auto &cache = eeng::ProgramBinaryCache::instance();
+	std::string varyings = std::to_string(shaderType);
+	for (int i = 0; i < nbrFeedbackVaryings; i++)
+		varyings += std::string(" ") + feedbackVaryings[i];
+	const std::string key = cache.key({ shaderSource, varyings });
+	if (GLuint program = cache.load(key))
+		return program;
+
+	const GLuint program = createSingleShaderProgram(shaderType, shaderSource, feedbackVaryings, nbrFeedbackVaryings);
+	cache.store(key, program);
+	return program;
+}
+
+/// Replace the #version line of a shader source with a header, e.g. a newer version and defines
+static std::string shaderSourceWithHeader(const std::string &source,
+										  const std::string &header)
+{
+	const size_t eol = source.find('\n');
+	return header + (eol == std::string::npos ? std::string() : source.substr(eol + 1));
+}
+
+/// Insert lines, e.g. defines, after the #version line of a shader source
+static std::string shaderSourceWithDefines(const std::string &source,
+										   const std::string &defines)
+{
+	const size_t eol = source.find('\n');
+	if (eol == std::string::npos)
+		return source + "\n" + defines;
+	return source.substr(0, eol + 1) + defines + source.substr(eol + 1);
+}
+
+/// Programs built from one vertex and one fragment shader source with different
+/// sets of #defines. Each permutation is compiled on first use and cached by its key,
+/// in which bit i enables defines[i]. Linked programs are also kept in the program
+/// binary cache, and prepare() lets permutations compile in the background before use.
+class ShaderPermutations
+{
+public:
+	ShaderPermutations() = default;
+	ShaderPermutations(const ShaderPermutations &) = delete;
+	ShaderPermutations &operator=(const ShaderPermutations &) = delete;
+
+	~ShaderPermutations()
+	{
+		clear();
+	}
+
+	/// header replaces the #version line of both sources, unless empty
+	void init(const std::string &vertexSource,
+			  const std::string &fragmentSource,
+			  const std::vector<std::string> &defines,
+			  const std::string &header = "")
+	{
+		clear();
+		m_vertexSource = header.empty() ? vertexSource : shaderSourceWithHeader(vertexSource, header);
+		m_fragmentSource = header.empty() ? fragmentSource : shaderSourceWithHeader(fragmentSource, header);
+		m_defines = defines;
+	}
+
+	bool initialized() const
+	{
+		return !m_vertexSource.empty();
+	}
+
+	/// Load a permutation from the program binary cache, or start compiling it,
+	/// without waiting for the result
+	void prepare(uint32_t key)
+	{
+		if (m_programs.count(key) || m_pending.count(key))
+			return;
+
+		auto &cache = eeng::ProgramBinaryCache::instance();
+		const std::string defines = definesOf(key);
+		const std::string vertexSource = shaderSourceWithDefines(m_vertexSource, defines);
+		const std::string fragmentSource = shaderSourceWithDefines(m_fragmentSource, defines);
+		const std::string cacheKey = cache.key({ vertexSource, fragmentSource });
+		if (GLuint program = cache.load(cacheKey))
+		{
+			m_programs.emplace(key, program);
+			return;
+		}
+
+		std::cout << "Shader permutation " << key << ":\n" << defines;
+		m_pending.emplace(key, Pending{ beginShaderProgram(vertexSource.c_str(), fragmentSource.c_str()), cacheKey });
+	}
+
+	/// Program of a permutation, compiled if not cached.
+	/// While it is still compiling in the background, the first ready permutation
+	/// that only lacks some of the bits in optionalBits is used instead,
+	/// and only if there is none does the call block.
+	GLuint get(uint32_t key, uint32_t optionalBits = 0)
+	{
+		auto it = m_programs.find(key);
+		if (it != m_programs.end())
+			return it->second;
+
+		prepare(key);
+		if (GLuint program = finishIfReady(key))
+			return program;
+
+		// Permutations with fewer of the optional bits, in descending key order
+		const uint32_t optional = key & optionalBits;
+		for (uint32_t drop = (optional - 1) & optional; drop != optional; drop = (drop - 1) & optional)
+		{
+			if (GLuint program = finishIfReady((key & ~optional) | drop))
+				return program;
+		}
+
+		// Blocks until the driver is done with the program
+		return finish(m_pending.find(key));
+	}
+
+	/// #define lines of a key
+	std::string definesOf(uint32_t key) const
+	{
+		std::string defines;
+		for (size_t i = 0; i < m_defines.size(); i++)
+			if (key & (1u << i))
+				defines += "#define " + m_defines[i] + "\n";
+		return defines;
+	}
+
+	size_t size() const
+	{
+		return m_programs.size();
+	}
+
+	void clear()
+	{
+		for (auto &[key, program] : m_programs)
+			glDeleteProgram(program);
+		m_programs.clear();
+		for (auto &[key, pending] : m_pending)
+		{
+			glDeleteShader(pending.program.vertexShader);
+			glDeleteShader(pending.program.fragmentShader);
+			glDeleteProgram(pending.program.program);
+		}
+		m_pending.clear();
+	}
+
+private:
+	struct Pending
+	{
+		PendingShaderProgram program;
+		std::string cacheKey;
+	};
+
+	/// Program of a permutation if it is linked or can be finished without blocking, else 0
+	GLuint finishIfReady(uint32_t key)
+	{
+		auto it = m_programs.find(key);
+		if (it != m_programs.end())
+			return it->second;
+		auto pending = m_pending.find(key);
+		if (pending == m_pending.end() || !isShaderProgramReady(pending->second.program))
+			return 0;
+		return finish(pending);
+	}
+
+	GLuint finish(std::unordered_map<uint32_t, Pending>::iterator pending)
+	{
+		const uint32_t key = pending->first;
+		const GLuint program = finishShaderProgram(pending->second.program);
+		eeng::ProgramBinaryCache::instance().store(pending->second.cacheKey, program);
+		m_pending.erase(pending);
+		m_programs.emplace(key, program);
+		return program;
+	}
+
+	std::string m_vertexSource, m_fragmentSource;
+	std::vector<std::string> m_defines;
+	std::unordered_map<uint32_t, GLuint> m_programs;
+	std::unordered_map<uint32_t, Pending> m_pending;
+};
+
 #endif
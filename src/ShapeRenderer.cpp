@@ -11,6 +11,7 @@
 #include "glcommon.h"
 #include "ShaderLoader.h"
 #include "ShapeRenderer.hpp"
+#include "Profiler.hpp"
 
 namespace ShapeRendering {
 
@@ -83,6 +84,83 @@ namespace ShapeRendering {
             return basis;
         }
 
+        const GLuint poly_pos_location = 0;
+        const GLuint poly_normal_location = 1;
+        const GLuint poly_color_location = 2;
+
+        const GLuint line_pos_location = 0;
+        const GLuint line_color_location = 1;
+
+        const GLuint point_pos_location = 0;
+        const GLuint point_color_location = 1;
+
+        /// Vertex attributes for PolyVertex. Expects the VAO and VBO to be bound.
+        void setup_poly_attributes()
+        {
+            assert(std::is_trivial_v<PolyVertex> || std::is_standard_layout_v<PolyVertex>);
+            glEnableVertexAttribArray(poly_pos_location);
+            glEnableVertexAttribArray(poly_normal_location);
+            glEnableVertexAttribArray(poly_color_location);
+            glVertexAttribPointer(poly_pos_location,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(PolyVertex),
+                (GLvoid*)offsetof(PolyVertex, p));
+            glVertexAttribPointer(poly_normal_location,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(PolyVertex),
+                (GLvoid*)offsetof(PolyVertex, normal));
+            glVertexAttribPointer(poly_color_location,
+                4,
+                GL_UNSIGNED_BYTE,
+                GL_TRUE,
+                sizeof(PolyVertex),
+                (GLvoid*)offsetof(PolyVertex, color));
+        }
+
+        /// Vertex attributes for LineVertex. Expects the VAO and VBO to be bound.
+        void setup_line_attributes()
+        {
+            assert(std::is_trivial_v<LineVertex> || std::is_standard_layout_v<LineVertex>);
+            glEnableVertexAttribArray(line_pos_location);
+            glEnableVertexAttribArray(line_color_location);
+            glVertexAttribPointer(line_pos_location,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(LineVertex),
+                (GLvoid*)offsetof(LineVertex, p));
+            glVertexAttribPointer(line_color_location,
+                4,
+                GL_UNSIGNED_BYTE,
+                GL_TRUE,
+                sizeof(LineVertex),
+                (GLvoid*)offsetof(LineVertex, color));
+        }
+
+        /// Vertex attributes for PointVertex. Expects the VAO and VBO to be bound.
+        void setup_point_attributes()
+        {
+            assert(std::is_trivial_v<PointVertex> || std::is_standard_layout_v<PointVertex>);
+            glEnableVertexAttribArray(point_pos_location);
+            glEnableVertexAttribArray(point_color_location);
+            glVertexAttribPointer(point_pos_location,
+                3,
+                GL_FLOAT,
+                GL_FALSE,
+                sizeof(PointVertex),
+                (GLvoid*)offsetof(PointVertex, p));
+            glVertexAttribPointer(point_color_location,
+                4,
+                GL_UNSIGNED_BYTE,
+                GL_TRUE,
+                sizeof(PointVertex),
+                (GLvoid*)offsetof(PointVertex, color));
+        }
+
         struct unitcube_t
         {
             //static const int face_stride = 4;
@@ -546,19 +624,9 @@ namespace ShapeRendering {
             "   fragcolor = color;"
             "}";
 
-        const GLuint poly_pos_location = 0;
-        const GLuint poly_normal_location = 1;
-        const GLuint poly_color_location = 2;
-
-        const GLuint line_pos_location = 0;
-        const GLuint line_color_location = 1;
-
-        const GLuint point_pos_location = 0;
-        const GLuint point_color_location = 1;
-
-        lambert_shader = createShaderProgram(poly_vshader, poly_fshader);
-        line_shader = createShaderProgram(line_vshader, line_fshader);
-        point_shader = createShaderProgram(point_vshader, point_fshader);
+        lambert_shader = createCachedShaderProgram(poly_vshader, poly_fshader);
+        line_shader = createCachedShaderProgram(line_vshader, line_fshader);
+        point_shader = createCachedShaderProgram(point_vshader, point_fshader);
 
         //
         // Init polygon buffers
@@ -572,28 +640,7 @@ namespace ShapeRendering {
         glBindBuffer(GL_ARRAY_BUFFER, polygon_vbo);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, polygon_ibo);
 
-        assert(std::is_trivial_v<PolyVertex> || std::is_standard_layout_v<PolyVertex>);
-        glEnableVertexAttribArray(poly_pos_location);
-        glEnableVertexAttribArray(poly_normal_location);
-        glEnableVertexAttribArray(poly_color_location);
-        glVertexAttribPointer(poly_pos_location,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(PolyVertex),
-            (GLvoid*)offsetof(PolyVertex, p));
-        glVertexAttribPointer(poly_normal_location,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(PolyVertex),
-            (GLvoid*)offsetof(PolyVertex, normal));
-        glVertexAttribPointer(poly_color_location,
-            4,
-            GL_UNSIGNED_BYTE,
-            GL_TRUE,
-            sizeof(PolyVertex),
-            (GLvoid*)offsetof(PolyVertex, color));
+        setup_poly_attributes();
 
         glBindVertexArray(0);
 
@@ -609,21 +656,7 @@ namespace ShapeRendering {
         glBindBuffer(GL_ARRAY_BUFFER, lines_VBO);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lines_IBO);
 
-        assert(std::is_trivial_v<LineVertex> || std::is_standard_layout_v<LineVertex>);
-        glEnableVertexAttribArray(line_pos_location);
-        glEnableVertexAttribArray(line_color_location);
-        glVertexAttribPointer(line_pos_location,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(LineVertex),
-            (GLvoid*)offsetof(LineVertex, p));
-        glVertexAttribPointer(line_color_location,
-            4,
-            GL_UNSIGNED_BYTE,
-            GL_TRUE,
-            sizeof(LineVertex),
-            (GLvoid*)offsetof(LineVertex, color));
+        setup_line_attributes();
 
         glBindVertexArray(0);
 
@@ -637,21 +670,7 @@ namespace ShapeRendering {
         glBindVertexArray(point_vao);
         glBindBuffer(GL_ARRAY_BUFFER, point_vbo);
 
-        assert(std::is_trivial_v<PointVertex> || std::is_standard_layout_v<PointVertex>);
-        glEnableVertexAttribArray(point_pos_location);
-        glEnableVertexAttribArray(point_color_location);
-        glVertexAttribPointer(point_pos_location,
-            3,
-            GL_FLOAT,
-            GL_FALSE,
-            sizeof(PointVertex),
-            (GLvoid*)offsetof(PointVertex, p));
-        glVertexAttribPointer(point_color_location,
-            4,
-            GL_UNSIGNED_BYTE,
-            GL_TRUE,
-            sizeof(PointVertex),
-            (GLvoid*)offsetof(PointVertex, color));
+        setup_point_attributes();
 
         glBindVertexArray(0);
         CheckAndThrowGLErrors();
@@ -659,6 +678,261 @@ namespace ShapeRendering {
         initialized = true;
     }
 
+    ShapeRenderer::LayerHandle ShapeRenderer::create_layer()
+    {
+        assert(initialized);
+
+        // Recycle a destroyed layer if possible
+        LayerHandle handle = NullLayer;
+        for (size_t i = 0; i < layers.size(); i++)
+            if (!layers[i].in_use) { handle = (LayerHandle)i; break; }
+        if (handle == NullLayer)
+        {
+            handle = (LayerHandle)layers.size();
+            layers.emplace_back();
+        }
+
+        RetainedLayer& layer = layers[handle];
+        layer = RetainedLayer{};
+        layer.in_use = true;
+
+        glGenVertexArrays(1, &layer.polygon_vao);
+        glGenBuffers(1, &layer.polygon_vbo);
+        glGenBuffers(1, &layer.polygon_ibo);
+        glBindVertexArray(layer.polygon_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, layer.polygon_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layer.polygon_ibo);
+        setup_poly_attributes();
+
+        glGenVertexArrays(1, &layer.lines_vao);
+        glGenBuffers(1, &layer.lines_vbo);
+        glGenBuffers(1, &layer.lines_ibo);
+        glBindVertexArray(layer.lines_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, layer.lines_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layer.lines_ibo);
+        setup_line_attributes();
+
+        glGenVertexArrays(1, &layer.point_vao);
+        glGenBuffers(1, &layer.point_vbo);
+        glBindVertexArray(layer.point_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, layer.point_vbo);
+        setup_point_attributes();
+
+        glBindVertexArray(0);
+        CheckAndThrowGLErrors();
+
+        return handle;
+    }
+
+    void ShapeRenderer::destroy_layer(LayerHandle handle)
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        assert(recording_layer != handle);
+        RetainedLayer& layer = layers[handle];
+
+        const GLuint vaos[] = { layer.polygon_vao, layer.lines_vao, layer.point_vao };
+        const GLuint buffers[] = { layer.polygon_vbo, layer.polygon_ibo, layer.lines_vbo, layer.lines_ibo, layer.point_vbo };
+        glDeleteVertexArrays(3, vaos);
+        glDeleteBuffers(5, buffers);
+
+        layer = RetainedLayer{};
+    }
+
+    void ShapeRenderer::begin_layer(LayerHandle handle)
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        assert(recording_layer == NullLayer && "Layers cannot be nested");
+
+        recording_layer = handle;
+        swap_layer_stash();
+    }
+
+    void ShapeRenderer::end_layer()
+    {
+        assert(recording_layer != NullLayer);
+
+        upload_layer(layers[recording_layer]);
+        recording_layer = NullLayer;
+
+        // Drop the recorded geometry and resume the frame's immediate batches
+        polygon_vertices.clear();
+        polygon_indices.clear();
+        polygon_hash.clear();
+        line_vertices.clear();
+        line_hash.clear();
+        point_hash.clear();
+        swap_layer_stash();
+    }
+
+    void ShapeRenderer::invalidate_layer(LayerHandle handle)
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        layers[handle].valid = false;
+    }
+
+    bool ShapeRenderer::is_layer_valid(LayerHandle handle) const
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        return layers[handle].valid;
+    }
+
+    void ShapeRenderer::set_layer_visible(LayerHandle handle, bool visible)
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        layers[handle].visible = visible;
+    }
+
+    bool ShapeRenderer::is_layer_visible(LayerHandle handle) const
+    {
+        assert(handle >= 0 && handle < layers.size() && layers[handle].in_use);
+        return layers[handle].visible;
+    }
+
+    void ShapeRenderer::swap_layer_stash()
+    {
+        std::swap(line_vertices, layer_stash.line_vertices);
+        std::swap(line_hash, layer_stash.line_hash);
+        std::swap(polygon_vertices, layer_stash.polygon_vertices);
+        std::swap(polygon_indices, layer_stash.polygon_indices);
+        std::swap(polygon_hash, layer_stash.polygon_hash);
+        std::swap(point_hash, layer_stash.point_hash);
+    }
+
+    void ShapeRenderer::upload_layer(RetainedLayer& layer)
+    {
+        layer.polygon_draws.clear();
+        layer.line_draws.clear();
+        layer.point_draws.clear();
+
+        // Polygons: same buffer layout as the immediate batches, with the
+        // multi-draw arguments grouped per batch up front
+        if (polygon_hash.size())
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, layer.polygon_vbo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(PolyVertex) * polygon_vertices.size(), polygon_vertices.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layer.polygon_ibo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned) * polygon_indices.size(), polygon_indices.data(), GL_STATIC_DRAW);
+
+            for (auto it = polygon_hash.begin(); it != polygon_hash.end(); )
+            {
+                LayerPolygonDraw draw{ it->first };
+                while (it != polygon_hash.end() && draw.batch == it->first)
+                {
+                    draw.start.push_back(BUFOFS(it->second.start * sizeof(GLuint)));
+                    draw.size.push_back(it->second.size);
+                    draw.ofs.push_back(it->second.ofs);
+                    ++it;
+                }
+                layer.polygon_draws.push_back(std::move(draw));
+            }
+        }
+
+        // Lines: all batches share one index buffer, one range per batch
+        if (line_vertices.size())
+        {
+            std::vector<unsigned> indices;
+            for (auto& [batch, batch_indices] : line_hash)
+            {
+                if (batch_indices.empty()) continue;
+                layer.line_draws.push_back(LayerLineDraw{ batch, (GLsizei)indices.size(), (GLsizei)batch_indices.size() });
+                indices.insert(indices.end(), batch_indices.begin(), batch_indices.end());
+            }
+
+            glBindBuffer(GL_ARRAY_BUFFER, layer.lines_vbo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(LineVertex) * line_vertices.size(), line_vertices.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, layer.lines_ibo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned) * indices.size(), indices.data(), GL_STATIC_DRAW);
+        }
+
+        // Points: all batches share one vertex buffer, one range per batch
+        {
+            std::vector<PointVertex> vertices;
+            for (auto& [batch, batch_vertices] : point_hash)
+            {
+                if (batch_vertices.empty()) continue;
+                layer.point_draws.push_back(LayerPointDraw{ batch, (GLint)vertices.size(), (GLsizei)batch_vertices.size() });
+                vertices.insert(vertices.end(), batch_vertices.begin(), batch_vertices.end());
+            }
+
+            if (vertices.size())
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, layer.point_vbo);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(PointVertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+            }
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        CheckAndThrowGLErrors();
+
+        layer.valid = true;
+    }
+
+    void ShapeRenderer::render_layers(const glm::mat4& PROJ_VIEW)
+    {
+        for (auto& layer : layers)
+        {
+            if (!layer.in_use || !layer.valid || !layer.visible) continue;
+
+            if (layer.polygon_draws.size())
+            {
+                glUseProgram(lambert_shader);
+                glBindVertexArray(layer.polygon_vao);
+                glUniformMatrix4fv(glGetUniformLocation(lambert_shader, "PROJ_VIEW"), 1, 0, glm::value_ptr(PROJ_VIEW));
+                glUniform1f(glGetUniformLocation(lambert_shader, "ambient_ratio"), 0.6);
+
+                for (auto& draw : layer.polygon_draws)
+                {
+                    if (to_integral(draw.batch.depth_test)) glEnable(GL_DEPTH_TEST);
+                    else                                    glDisable(GL_DEPTH_TEST);
+                    if (to_integral(draw.batch.cull_face))  glEnable(GL_CULL_FACE);
+                    else                                    glDisable(GL_CULL_FACE);
+
+                    glMultiDrawElementsBaseVertex(draw.batch.topology,
+                        draw.size.data(),
+                        GL_UNSIGNED_INT,
+                        draw.start.data(),
+                        (GLsizei)draw.start.size(),
+                        draw.ofs.data());
+                }
+            }
+
+            if (layer.line_draws.size())
+            {
+                glUseProgram(line_shader);
+                glBindVertexArray(layer.lines_vao);
+                glUniformMatrix4fv(glGetUniformLocation(line_shader, "PROJ_VIEW"), 1, 0, glm::value_ptr(PROJ_VIEW));
+
+                for (auto& draw : layer.line_draws)
+                {
+                    if (to_integral(draw.batch.depth_test)) glEnable(GL_DEPTH_TEST);
+                    else                                    glDisable(GL_DEPTH_TEST);
+
+                    glDrawElements(draw.batch.topology, draw.size, GL_UNSIGNED_INT, BUFOFS(draw.start * sizeof(GLuint)));
+                }
+            }
+
+            if (layer.point_draws.size())
+            {
+                glUseProgram(point_shader);
+                glBindVertexArray(layer.point_vao);
+                glUniformMatrix4fv(glGetUniformLocation(point_shader, "PROJ_VIEW"), 1, 0, glm::value_ptr(PROJ_VIEW));
+
+                for (auto& draw : layer.point_draws)
+                {
+                    if (to_integral(draw.batch.depth_test)) glEnable(GL_DEPTH_TEST);
+                    else                                    glDisable(GL_DEPTH_TEST);
+
+                    glPointSize(draw.batch.size);
+                    glDrawArrays(GL_POINTS, draw.first, draw.size);
+                }
+            }
+        }
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+        CheckAndThrowGLErrors();
+    }
+
     void ShapeRenderer::push_quad(
         const glm::vec3 points[4],
         const glm::vec3& n)
@@ -1264,7 +1538,10 @@ namespace ShapeRendering {
     void ShapeRenderer::render(const glm::mat4& PROJ_VIEW)
     {
         assert(initialized);
+        assert(recording_layer == NullLayer);
         framenbr++;
+        EENG_PROFILE_SCOPE("ShapeRenderer");
+        EENG_PROFILE_GPU_SCOPE("ShapeRenderer");
 
 #if 0
         bool wireframe = false;
@@ -1312,6 +1589,9 @@ namespace ShapeRendering {
 #endif
 
 
+    // Render retained layers
+    render_layers(PROJ_VIEW);
+
 #if 1
     // Render polygon batches
 
@@ -306,11 +306,102 @@ namespace ShapeRendering {
 
         StateStack<DepthTest, BackfaceCull, glm::mat4, Color4u> state_stack;
 
+        // Retained layers
+        //
+        // Geometry pushed between begin_layer() and end_layer() is uploaded once to
+        // static GPU buffers owned by the layer, and is drawn by render() every frame
+        // (while visible) until the layer is invalidated or destroyed. post_render()
+        // does not touch retained layers.
+
+        struct LayerPolygonDraw
+        {
+            PolygonBatch batch;
+            std::vector<void*> start;
+            std::vector<GLsizei> size;
+            std::vector<GLint> ofs;
+        };
+
+        struct LayerLineDraw
+        {
+            LineBatch batch;
+            GLsizei start, size;
+        };
+
+        struct LayerPointDraw
+        {
+            PointBatch batch;
+            GLint first;
+            GLsizei size;
+        };
+
+        struct RetainedLayer
+        {
+            bool in_use = false;
+            bool valid = false;
+            bool visible = true;
+
+            GLuint polygon_vao = 0, polygon_vbo = 0, polygon_ibo = 0;
+            GLuint lines_vao = 0, lines_vbo = 0, lines_ibo = 0;
+            GLuint point_vao = 0, point_vbo = 0;
+
+            std::vector<LayerPolygonDraw> polygon_draws;
+            std::vector<LayerLineDraw> line_draws;
+            std::vector<LayerPointDraw> point_draws;
+        };
+
+        std::vector<RetainedLayer> layers;
+        int recording_layer = -1;
+
+        // Immediate batches, set aside while a layer is being recorded
+        struct
+        {
+            std::vector<LineVertex> line_vertices;
+            std::unordered_map<LineBatch, std::vector<unsigned>, LineBatchHashFunction> line_hash;
+            std::vector<PolyVertex> polygon_vertices;
+            std::vector<unsigned> polygon_indices;
+            std::unordered_multimap<PolygonBatch, IndexRange, PolygonBatchHashfunction> polygon_hash;
+            std::unordered_map<PointBatch, std::vector<PointVertex>, PointBatchHashFunction > point_hash;
+        } layer_stash;
+
+        void swap_layer_stash();
+
+        void upload_layer(RetainedLayer& layer);
+
+        void render_layers(const glm::mat4& PROJ_VIEW);
+
         bool initialized = false;
 
     public:
+        using LayerHandle = int;
+        static constexpr LayerHandle NullLayer = -1;
+
         void init();
 
+        /// @brief Create an empty retained layer
+        /// @return Handle to the layer. The layer is invalid until recorded.
+        LayerHandle create_layer();
+
+        /// @brief Release the GPU buffers of a layer and recycle its handle
+        void destroy_layer(LayerHandle layer);
+
+        /// @brief Start recording a layer. All push_* calls until end_layer()
+        /// go to the layer instead of the current frame.
+        void begin_layer(LayerHandle layer);
+
+        /// @brief Upload recorded geometry to the layer and resume immediate mode
+        void end_layer();
+
+        /// @brief Mark a layer as stale. It is not drawn until recorded again.
+        void invalidate_layer(LayerHandle layer);
+
+        /// @brief True if the layer has been recorded and not invalidated since
+        bool is_layer_valid(LayerHandle layer) const;
+
+        /// @brief Toggle drawing of a layer, e.g. per frame
+        void set_layer_visible(LayerHandle layer, bool visible);
+
+        bool is_layer_visible(LayerHandle layer) const;
+
         template<typename... Args>
         void push_states(Args&&... args)
         {
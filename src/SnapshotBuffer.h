@@ -0,0 +1,67 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef EENG_SnapshotBuffer_h
+#define EENG_SnapshotBuffer_h
+
+#include <mutex>
+#include <cstdint>
+
+namespace eeng
+{
+    /**
+    Hands state from a writer thread (e.g. simulation) to a reader thread (e.g. rendering).
+    The writer fills its buffer and publishes it, the reader acquires the latest published one.
+    A third, spare buffer lets both sides keep working without waiting for each other;
+    the lock only guards index swaps.
+    */
+    template<class T>
+    class SnapshotBuffer
+    {
+    public:
+        /// @brief Buffer being written. Writer thread only.
+        T& write_buffer()
+        {
+            return buffers[write_index];
+        }
+
+        /// @brief Publish the write buffer. The writer then continues in another buffer,
+        /// which holds older state that should be overwritten.
+        void publish()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(write_index, ready_index);
+            fresh = true;
+            published_count++;
+        }
+
+        /// @brief Latest published buffer. Reader thread only.
+        /// The reference stays valid until the next call.
+        const T& acquire()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (fresh)
+            {
+                std::swap(read_index, ready_index);
+                fresh = false;
+                read_count = published_count;
+            }
+            return buffers[read_index];
+        }
+
+        /// @brief Number of publishes up to the buffer last acquired
+        uint64_t acquired_count() const
+        {
+            return read_count;
+        }
+
+    private:
+        T buffers[3]{};
+        int write_index = 0, ready_index = 1, read_index = 2;
+        bool fresh = false;
+        uint64_t published_count = 0;
+        uint64_t read_count = 0;
+        std::mutex mutex;
+    };
+} // namespace eeng
+
+#endif
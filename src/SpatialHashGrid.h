@@ -0,0 +1,305 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef EENG_SpatialHashGrid_h
+#define EENG_SpatialHashGrid_h
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <glm/glm.hpp>
+#include "WorkerPool.h"
+#include "config.h"
+
+namespace eeng
+{
+    /**
+    Uniform grid of points with hashed cells, for proximity queries over many moving agents.
+    The grid is rebuilt from scratch with a parallel counting sort, which is cheap
+    enough to do every frame. Points are stored sorted by bucket, so queries read
+    contiguous memory. Cells that hash to the same bucket are told apart by their
+    stored cell coordinate.
+    */
+    class SpatialHashGrid
+    {
+    public:
+        struct Neighbor
+        {
+            uint32_t id;
+            float dist2;    // Squared distance to query point
+        };
+
+        /// @param cell_size Cell side, preferably close to typical query radii
+        explicit SpatialHashGrid(float cell_size = 2.0f)
+            : cell_size(cell_size), inv_cell_size(1.0f / cell_size)
+        {
+        }
+
+        /// @brief Rebuild the grid
+        /// @param positions Point positions
+        /// @param ids Point ids, e.g. entity ids
+        /// @param count Number of points
+        /// @param nbr_threads Number of tasks, 0 for one per thread of WorkerPool::instance()
+        void build(
+            const glm::vec3* positions,
+            const uint32_t* ids,
+            size_t count,
+            unsigned nbr_threads = 0)
+        {
+            // Power-of-two table, about one bucket per point
+            table_size = 64;
+            while (table_size < count)
+                table_size *= 2;
+
+            // A task per 4k points, at most one per pool thread
+            if (nbr_threads == 0)
+                nbr_threads = WorkerPool::instance().size();
+            nbr_threads = std::max(1u, std::min(nbr_threads, unsigned(count / 4096 + 1)));
+
+            entries.resize(count);
+            keys.resize(count);
+            cells.resize(count);
+            bucket_start.assign(table_size + 1, 0);
+            counts.assign(size_t(nbr_threads) * table_size, 0);
+            std::vector<glm::ivec3> thread_lo(nbr_threads, glm::ivec3{ std::numeric_limits<int>::max() });
+            std::vector<glm::ivec3> thread_hi(nbr_threads, glm::ivec3{ std::numeric_limits<int>::lowest() });
+
+            // 1. Cells, buckets and per-thread bucket counts
+            parallel_for(nbr_threads, count, [&](unsigned t, size_t begin, size_t end)
+                {
+                    uint32_t* thread_counts = counts.data() + size_t(t) * table_size;
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        cells[i] = cell_of(positions[i]);
+                        keys[i] = bucket_of(cells[i]);
+                        thread_counts[keys[i]]++;
+                        thread_lo[t] = glm::min(thread_lo[t], cells[i]);
+                        thread_hi[t] = glm::max(thread_hi[t], cells[i]);
+                    }
+                });
+            cells_lo = glm::ivec3{ std::numeric_limits<int>::max() };
+            cells_hi = glm::ivec3{ std::numeric_limits<int>::lowest() };
+            for (unsigned t = 0; t < nbr_threads; t++)
+            {
+                cells_lo = glm::min(cells_lo, thread_lo[t]);
+                cells_hi = glm::max(cells_hi, thread_hi[t]);
+            }
+
+            // 2. Exclusive prefix sum over (bucket, thread), in parallel over bucket ranges
+            std::vector<uint32_t> range_base(nbr_threads + 1, 0);
+            parallel_for(nbr_threads, table_size, [&](unsigned t, size_t begin, size_t end)
+                {
+                    uint32_t sum = 0;
+                    for (size_t b = begin; b < end; b++)
+                        for (unsigned u = 0; u < nbr_threads; u++)
+                            sum += counts[size_t(u) * table_size + b];
+                    range_base[t + 1] = sum;
+                });
+            for (unsigned t = 0; t < nbr_threads; t++)
+                range_base[t + 1] += range_base[t];
+            parallel_for(nbr_threads, table_size, [&](unsigned t, size_t begin, size_t end)
+                {
+                    uint32_t offset = range_base[t];
+                    for (size_t b = begin; b < end; b++)
+                    {
+                        bucket_start[b] = offset;
+                        for (unsigned u = 0; u < nbr_threads; u++)
+                        {
+                            uint32_t& c = counts[size_t(u) * table_size + b];
+                            const uint32_t n = c;
+                            c = offset; // Becomes write cursor
+                            offset += n;
+                        }
+                    }
+                });
+            bucket_start[table_size] = uint32_t(count);
+
+            // 3. Scatter, each thread with its own cursors. Keeps input order within buckets.
+            parallel_for(nbr_threads, count, [&](unsigned t, size_t begin, size_t end)
+                {
+                    uint32_t* cursors = counts.data() + size_t(t) * table_size;
+                    for (size_t i = begin; i < end; i++)
+                        entries[cursors[keys[i]]++] = Entry{ positions[i], ids[i], cells[i] };
+                });
+        }
+
+        inline size_t size() const
+        {
+            return entries.size();
+        }
+
+        inline float get_cell_size() const
+        {
+            return cell_size;
+        }
+
+        /// @brief Find points within a radius
+        /// @param point Query point
+        /// @param radius Query radius
+        /// @param callback Called for each point found, void(uint32_t id, const glm::vec3& pos, float dist2)
+        template<class F>
+        void query_radius(const glm::vec3& point, float radius, F&& callback) const
+        {
+            if (entries.empty())
+                return;
+
+            const float r2 = radius * radius;
+            const glm::ivec3 lo = glm::max(cell_of(point - glm::vec3{ radius }), cells_lo);
+            const glm::ivec3 hi = glm::min(cell_of(point + glm::vec3{ radius }), cells_hi);
+            for (int z = lo.z; z <= hi.z; z++)
+                for (int y = lo.y; y <= hi.y; y++)
+                    for (int x = lo.x; x <= hi.x; x++)
+                        visit_cell({ x, y, z }, [&](const Entry& e)
+                            {
+                                const glm::vec3 d = e.pos - point;
+                                const float dist2 = glm::dot(d, d);
+                                if (dist2 <= r2)
+                                    callback(e.id, e.pos, dist2);
+                            });
+        }
+
+        /// @brief Find ids of points within a radius
+        void query_radius(const glm::vec3& point, float radius, std::vector<uint32_t>& result) const
+        {
+            result.clear();
+            query_radius(point, radius, [&](uint32_t id, const glm::vec3&, float) { result.push_back(id); });
+        }
+
+        /// @brief Find the k nearest points, searching cells in growing shells
+        /// @param point Query point
+        /// @param k Number of points to find
+        /// @param result Nearest points, sorted by increasing distance
+        /// @param max_radius Points beyond this distance are ignored
+        void query_knn(
+            const glm::vec3& point,
+            size_t k,
+            std::vector<Neighbor>& result,
+            float max_radius = std::numeric_limits<float>::max()) const
+        {
+            result.clear();
+            if (entries.empty() || k == 0)
+                return;
+
+            auto closer = [](const Neighbor& a, const Neighbor& b) { return a.dist2 < b.dist2; };
+            const float max_r2 = max_radius < std::numeric_limits<float>::max() ? max_radius * max_radius : max_radius;
+            const glm::ivec3 c = cell_of(point);
+
+            // Shortest distance from the query point to the faces of its cell
+            const glm::vec3 cell_min = glm::vec3(c) * cell_size;
+            const glm::vec3 to_faces = glm::min(point - cell_min, cell_min + glm::vec3{ cell_size } - point);
+            const float face_dist = std::max(0.0f, std::min(to_faces.x, std::min(to_faces.y, to_faces.z)));
+
+            // Shells beyond this one contain no points
+            const glm::ivec3 reach = glm::max(glm::abs(c - cells_lo), glm::abs(cells_hi - c));
+            const int max_shell = std::max(reach.x, std::max(reach.y, reach.z));
+
+            auto consider = [&](const Entry& e)
+                {
+                    const glm::vec3 d = e.pos - point;
+                    const float dist2 = glm::dot(d, d);
+                    if (dist2 > max_r2)
+                        return;
+                    if (result.size() < k)
+                    {
+                        result.push_back({ e.id, dist2 });
+                        std::push_heap(result.begin(), result.end(), closer);
+                    }
+                    else if (dist2 < result.front().dist2)
+                    {
+                        std::pop_heap(result.begin(), result.end(), closer);
+                        result.back() = { e.id, dist2 };
+                        std::push_heap(result.begin(), result.end(), closer);
+                    }
+                };
+
+            for (int s = 0; s <= max_shell; s++)
+            {
+                // Points in shell s are at least this far away
+                if (s > 0)
+                {
+                    const float shell_dist = (s - 1) * cell_size + face_dist;
+                    if (shell_dist * shell_dist > max_r2)
+                        break;
+                    if (result.size() == k && shell_dist * shell_dist > result.front().dist2)
+                        break;
+                }
+
+                for (int dz = -s; dz <= s; dz++)
+                    for (int dy = -s; dy <= s; dy++)
+                    {
+                        // Full rows on the shell's z and y faces, end cells otherwise
+                        const bool on_face = (dz == -s || dz == s || dy == -s || dy == s);
+                        const int step = on_face ? 1 : std::max(1, 2 * s);
+                        for (int dx = -s; dx <= s; dx += step)
+                        {
+                            const glm::ivec3 cell = c + glm::ivec3{ dx, dy, dz };
+                            if (glm::any(glm::lessThan(cell, cells_lo)) || glm::any(glm::greaterThan(cell, cells_hi)))
+                                continue;
+                            visit_cell(cell, consider);
+                        }
+                    }
+            }
+
+            std::sort_heap(result.begin(), result.end(), closer);
+        }
+
+    private:
+        struct Entry
+        {
+            glm::vec3 pos;
+            uint32_t id;
+            glm::ivec3 cell;
+        };
+
+        float cell_size, inv_cell_size;
+        size_t table_size = 0;
+        glm::ivec3 cells_lo{ 0 }, cells_hi{ -1 }; // Range of occupied cells
+
+        std::vector<Entry> entries;             // Points sorted by bucket
+        std::vector<uint32_t> bucket_start;     // Bucket b spans [bucket_start[b], bucket_start[b + 1])
+
+        // Build scratch
+        std::vector<uint32_t> keys;
+        std::vector<glm::ivec3> cells;
+        std::vector<uint32_t> counts;           // Per thread and bucket
+
+        inline glm::ivec3 cell_of(const glm::vec3& p) const
+        {
+            return glm::ivec3(glm::floor(p * inv_cell_size));
+        }
+
+        inline uint32_t bucket_of(const glm::ivec3& cell) const
+        {
+            // Teschner et al., Optimized Spatial Hashing for Collision Detection of Deformable Objects
+            const uint32_t h = (uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^ (uint32_t(cell.z) * 83492791u);
+            return h & uint32_t(table_size - 1);
+        }
+
+        template<class F>
+        inline void visit_cell(const glm::ivec3& cell, F&& visitor) const
+        {
+            const uint32_t b = bucket_of(cell);
+            for (uint32_t i = bucket_start[b]; i < bucket_start[b + 1]; i++)
+            {
+                if (entries[i].cell == cell)
+                    visitor(entries[i]);
+            }
+        }
+
+        /// Split [0, count) in nbr_threads ranges and run fn(thread, begin, end) on each,
+        /// using the persistent threads of WorkerPool::instance()
+        template<class F>
+        static void parallel_for(unsigned nbr_threads, size_t count, F&& fn)
+        {
+            const size_t chunk = (count + nbr_threads - 1) / nbr_threads;
+            WorkerPool::instance().run(nbr_threads, [&](unsigned t)
+                {
+                    const size_t begin = std::min(count, t * chunk);
+                    const size_t end = std::min(count, begin + chunk);
+                    fn(t, begin, end);
+                });
+        }
+    };
+} // namespace eeng
+
+#endif
@@ -117,6 +117,12 @@ void Texture2D::load_to_VRAM(const std::string &name,
     m_height = h;
     m_name = name;
 
+    if (m_pooled)
+    {
+        m_layer = eeng::TexturePool::instance().add(image, w, h, format);
+        return;
+    }
+
     glGenTextures(1, &m_handle);
     glBindTexture(GL_TEXTURE_2D, m_handle);
 
@@ -169,6 +175,11 @@ void Texture2D::free()
         glDeleteTextures(1, &m_handle);
         m_handle = 0;
     }
+    if (m_layer)
+    {
+        eeng::TexturePool::instance().free(m_layer);
+        m_layer = {};
+    }
 }
 
 void gl_cubemap_t::load_from_files(const std::string filepaths[])
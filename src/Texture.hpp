@@ -8,6 +8,7 @@
 #include "glcommon.h"
 #include "config.h"
 #include "parseutil.h"
+#include "TexturePool.hpp"
 
 struct texture_filter_mode_t { GLuint min_filter, mag_filter; };
 struct texture_address_mode_t { GLuint s_mode, t_mode; };
@@ -21,6 +22,10 @@ public:
     
     texture_filter_mode_t m_filter_mode = { GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR };
     texture_address_mode_t m_address_mode  { GL_REPEAT, GL_REPEAT };
+
+    /// Load to a layer of eeng::TexturePool instead of a texture of its own, m_handle stays 0
+    bool m_pooled = false;
+    eeng::TexturePool::Layer m_layer;
     
     Texture2D() = default;
     
@@ -0,0 +1,220 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#include <algorithm>
+#include <cmath>
+#include "TexturePool.hpp"
+#include "config.h"
+
+namespace eeng {
+
+    namespace
+    {
+        constexpr int InitialCapacity = 4;
+    }
+
+    TexturePool& TexturePool::instance()
+    {
+        static TexturePool pool;
+        return pool;
+    }
+
+    void TexturePool::init()
+    {
+        EENG_ASSERT(!initialized(), "Texture pool already initialized");
+        glGenFramebuffers(2, m_framebuffers);
+    }
+
+    void TexturePool::shutdown()
+    {
+        if (!initialized())
+            return;
+        for (auto& pool : m_pools)
+            glDeleteTextures(1, &pool.texture);
+        m_pools.clear();
+        glDeleteFramebuffers(2, m_framebuffers);
+        m_framebuffers[0] = m_framebuffers[1] = 0;
+    }
+
+    TexturePool::Layer TexturePool::add(const unsigned char* image, int w, int h, GLenum format)
+    {
+        EENG_ASSERT(initialized(), "Texture pool not initialized");
+        const int p = find_pool(w, h);
+        auto& pool = m_pools[p];
+
+        GLint layer;
+        if (pool.free_layers.size())
+        {
+            layer = pool.free_layers.back();
+            pool.free_layers.pop_back();
+        }
+        else
+        {
+            if (pool.nbr_allocated == pool.capacity)
+                grow(pool);
+            layer = pool.nbr_allocated++;
+        }
+
+        if (pool.width == w && pool.height == h)
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, w, h, 1, format, GL_UNSIGNED_BYTE, image);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+        else
+        {
+            // Resampled through a temporary texture
+            GLuint temp = 0;
+            glGenTextures(1, &temp);
+            glBindTexture(GL_TEXTURE_2D, temp);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, format, GL_UNSIGNED_BYTE, image);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            blit(temp, -1, w, h, pool, layer);
+            glDeleteTextures(1, &temp);
+        }
+        pool.dirty = true;
+        CheckAndThrowGLErrors();
+
+        return { p, layer };
+    }
+
+    void TexturePool::free(const Layer& layer)
+    {
+        if (!initialized())
+            return;
+        EENG_ASSERT(layer.pool >= 0 && layer.pool < (GLint)m_pools.size(), "Invalid texture pool {0}", layer.pool);
+        m_pools[layer.pool].free_layers.push_back(layer.layer);
+    }
+
+    void TexturePool::bind(GLuint first_unit)
+    {
+        for (int i = 0; i < MaxPools; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + first_unit + i);
+            if (i >= (int)m_pools.size())
+            {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+                continue;
+            }
+            auto& pool = m_pools[i];
+            glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+            if (pool.dirty)
+            {
+                glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+                pool.dirty = false;
+            }
+        }
+    }
+
+    void TexturePool::unbind(GLuint first_unit) const
+    {
+        for (int i = 0; i < MaxPools; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + first_unit + i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+    }
+
+    size_t TexturePool::nbr_layers() const
+    {
+        size_t count = 0;
+        for (auto& pool : m_pools)
+            count += pool.nbr_allocated - pool.free_layers.size();
+        return count;
+    }
+
+    int TexturePool::find_pool(int w, int h)
+    {
+        for (int i = 0; i < (int)m_pools.size(); i++)
+            if (m_pools[i].width == w && m_pools[i].height == h)
+                return i;
+
+        if (m_pools.size() < MaxPools)
+        {
+            Pool pool;
+            pool.width = w;
+            pool.height = h;
+            create_storage(pool, InitialCapacity);
+            m_pools.push_back(pool);
+            return (int)m_pools.size() - 1;
+        }
+
+        // Closest by scale factors
+        int closest = 0;
+        float closest_distance = INFINITY;
+        for (int i = 0; i < (int)m_pools.size(); i++)
+        {
+            const float distance =
+                std::abs(std::log2((float)w / m_pools[i].width)) +
+                std::abs(std::log2((float)h / m_pools[i].height));
+            if (distance < closest_distance)
+            {
+                closest = i;
+                closest_distance = distance;
+            }
+        }
+        return closest;
+    }
+
+    void TexturePool::create_storage(Pool& pool, int capacity)
+    {
+        pool.capacity = capacity;
+        glGenTextures(1, &pool.texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, pool.texture);
+
+        const int nbr_levels = 1 + (int)std::log2((float)std::max(pool.width, pool.height));
+        for (int level = 0; level < nbr_levels; level++)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8,
+                std::max(1, pool.width >> level),
+                std::max(1, pool.height >> level),
+                capacity, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+#ifdef EENG_ANISO
+        GLfloat maxAniso;
+#if defined(EENG_GLVERSION_43)
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAniso);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY, std::min(EENG_ANISO_SAMPLES, (GLint)maxAniso));
+#elif defined(EENG_GLVERSION_41)
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAniso);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(EENG_ANISO_SAMPLES, (GLint)maxAniso));
+#endif
+#endif
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        CheckAndThrowGLErrors();
+    }
+
+    void TexturePool::grow(Pool& pool)
+    {
+        // Level 0 is copied, the other levels are regenerated
+        const GLuint old_texture = pool.texture;
+        create_storage(pool, 2 * pool.capacity);
+        for (int layer = 0; layer < pool.nbr_allocated; layer++)
+            blit(old_texture, layer, pool.width, pool.height, pool, layer);
+        glDeleteTextures(1, &old_texture);
+        pool.dirty = true;
+    }
+
+    void TexturePool::blit(GLuint src, GLint src_layer, int src_w, int src_h, const Pool& dst, GLint dst_layer)
+    {
+        // A negative source layer means a GL_TEXTURE_2D source
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffers[0]);
+        if (src_layer < 0)
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, src, 0);
+        else
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, src, 0, src_layer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffers[1]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst.texture, 0, dst_layer);
+
+        glBlitFramebuffer(0, 0, src_w, src_h, 0, 0, dst.width, dst.height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+} // namespace eeng
@@ -0,0 +1,98 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef TexturePool_hpp
+#define TexturePool_hpp
+
+#include <vector>
+#include "glcommon.h"
+
+namespace eeng {
+
+    /// @brief 2D textures stored as layers of GL_TEXTURE_2D_ARRAY textures, one array per image size.
+    /// All arrays are bound at once, so draws with different textures need no texture binding.
+    /// Shaders select an array and layer with the id of a Layer, see phong_frag.glsl.
+    ///
+    /// Layers are RGBA8 with mipmaps and repeat addressing. Images with a size of their own
+    /// once MaxPools arrays exist are resampled to the closest array size.
+    class TexturePool
+    {
+    public:
+        /// Arrays bound to consecutive texture units, and sampler array size in the shaders
+        static constexpr int MaxPools = 8;
+
+        struct Layer
+        {
+            GLint pool = -1;
+            GLint layer = 0;
+
+            explicit operator bool() const { return pool >= 0; }
+
+            /// @brief Array index in the high 16 bits and layer in the low 16 bits, or -1
+            GLint id() const { return pool < 0 ? -1 : (pool << 16) | layer; }
+        };
+
+        /// @brief The process-wide pool. Holds no GL objects outside init() and shutdown().
+        static TexturePool& instance();
+
+        /// @brief Create the framebuffers used for copies. Call once a GL context is current.
+        void init();
+
+        /// @brief Delete all arrays and framebuffers. Call before the GL context is destroyed.
+        /// Layers freed afterwards are ignored, so textures may outlive the context.
+        void shutdown();
+
+        bool initialized() const { return m_framebuffers[0] != 0; }
+
+        /// @brief Copy an image to a free layer
+        /// @param image Pixel data, rows of w pixels with the unpack alignment in effect
+        /// @param format GL_RED, GL_RG, GL_RGB or GL_RGBA
+        Layer add(const unsigned char* image, int w, int h, GLenum format);
+
+        /// @brief Release a layer returned by add. Ignored after shutdown().
+        void free(const Layer& layer);
+
+        /// @brief Bind all arrays to texture units first_unit to first_unit + MaxPools - 1
+        /// Arrays with layers added since they were last bound have their mipmaps generated first.
+        void bind(GLuint first_unit);
+
+        /// @brief Unbind the units of bind
+        void unbind(GLuint first_unit) const;
+
+        size_t nbr_pools() const { return m_pools.size(); }
+        size_t nbr_layers() const;
+
+    private:
+        struct Pool
+        {
+            GLuint texture = 0;
+            int width = 0, height = 0;
+            int capacity = 0;
+            int nbr_allocated = 0;
+            std::vector<int> free_layers;
+            bool dirty = false;     // Mipmaps out of date
+        };
+
+        std::vector<Pool> m_pools;
+        GLuint m_framebuffers[2] = { 0 };   // Read and draw framebuffers of blit copies
+
+        TexturePool() = default;
+        ~TexturePool() = default;
+        TexturePool(const TexturePool&) = delete;
+        TexturePool& operator=(const TexturePool&) = delete;
+
+        /// Array of the size, or the closest size if no array can be added
+        int find_pool(int w, int h);
+
+        /// Allocate storage of an array, with all mip levels
+        void create_storage(Pool& pool, int capacity);
+
+        /// Reallocate an array with room for more layers, keeping its layers
+        void grow(Pool& pool);
+
+        /// Copy level 0 of a source (array layer or 2D texture) to an array layer, scaling if sizes differ
+        void blit(GLuint src, GLint src_layer, int src_w, int src_h, const Pool& dst, GLint dst_layer);
+    };
+
+} // namespace eeng
+
+#endif /* TexturePool_hpp */
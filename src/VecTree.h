@@ -8,6 +8,8 @@
 #include <vector>
 #include <queue>
 #include <stack>
+#include <tuple>
+#include <algorithm>
 #include <cassert>
 
 #define VecTree_NullIndex -1
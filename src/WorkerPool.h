@@ -0,0 +1,144 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef EENG_WorkerPool_h
+#define EENG_WorkerPool_h
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+namespace eeng
+{
+    /**
+    Persistent worker threads for data-parallel loops run every frame.
+    run() hands out task indices to the workers and the calling thread, and returns
+    when all tasks are done, so no threads are created or joined per call.
+    Calls from several threads are serialized.
+    */
+    class WorkerPool
+    {
+    public:
+        /// @param nbr_workers Threads besides the calling thread
+        explicit WorkerPool(unsigned nbr_workers)
+        {
+            for (unsigned i = 0; i < nbr_workers; i++)
+                threads.emplace_back([this] { worker(); });
+        }
+
+        ~WorkerPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        /// @brief Process-wide pool with a worker per additional hardware thread
+        static WorkerPool& instance()
+        {
+            static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+            return pool;
+        }
+
+        /// Number of threads running tasks, including the calling thread
+        inline unsigned size() const
+        {
+            return unsigned(threads.size()) + 1;
+        }
+
+        /// @brief Run fn(task) for each task in [0, nbr_tasks) and wait for all of them
+        template<class F>
+        void run(unsigned nbr_tasks, F&& fn)
+        {
+            if (nbr_tasks == 0)
+                return;
+            if (nbr_tasks == 1 || threads.empty())
+            {
+                for (unsigned task = 0; task < nbr_tasks; task++)
+                    fn(task);
+                return;
+            }
+
+            std::lock_guard<std::mutex> run_lock(run_mutex);
+            auto call = [](void* f, unsigned task) { (*static_cast<std::remove_reference_t<F>*>(f))(task); };
+            const Job j{ call, static_cast<void*>(&fn), nbr_tasks };
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = j;
+                next_task = 0;
+                generation++;
+            }
+            wake.notify_all();
+
+            process(j);
+
+            // Workers that picked up the job are done once busy is zero, and any
+            // that wake up later see no job
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return busy == 0; });
+            job = Job{};
+        }
+
+    private:
+        struct Job
+        {
+            void (*call)(void*, unsigned) = nullptr;
+            void* fn = nullptr;
+            unsigned nbr_tasks = 0;
+        };
+
+        std::vector<std::thread> threads;
+        std::mutex mutex, run_mutex;
+        std::condition_variable wake, done;
+        Job job;
+        std::atomic<unsigned> next_task{ 0 };
+        uint64_t generation = 0;
+        unsigned busy = 0;
+        bool stop = false;
+
+        void process(const Job& j)
+        {
+            for (unsigned task = next_task++; task < j.nbr_tasks; task = next_task++)
+                j.call(j.fn, task);
+        }
+
+        void worker()
+        {
+            uint64_t seen = 0;
+            for (;;)
+            {
+                Job j;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return stop || (generation != seen && job.call); });
+                    if (stop)
+                        return;
+                    seen = generation;
+                    j = job;
+                    busy++;
+                }
+
+                process(j);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy--;
+                }
+                done.notify_one();
+            }
+        }
+    };
+} // namespace eeng
+
+#endif
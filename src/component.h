@@ -2,6 +2,8 @@
 #include <glm/glm.hpp>
 #include "iostream"
 #include "RenderableMesh.hpp"
+#include "AnimationLOD.hpp"
+#include "ForwardRenderer.hpp"
 
 struct TransformComponent {
 	glm::vec3 translation;
@@ -9,6 +11,10 @@ struct TransformComponent {
 	glm::vec3 scale;
 };
 
+struct InterpolationComponent {
+	glm::vec3 prev_translation;	// Translation before the last simulation step
+};
+
 struct LinearVelocityComponent {
 	glm::vec3 velocity;
 	float speed = 20;
@@ -42,6 +48,12 @@ struct RayComponent {
 
 };
 
+struct AnimationLODComponent {
+	eeng::AnimationLODState state;
+	eeng::SkinnedInstance skinned;	// Pose of the frame, see ForwardRenderer::skinMesh
+};
+
 struct AABBComponent {
 	eeng::AABB mesh_aabb;
+	int bvh_proxy = EENG_NULL_INDEX; // Proxy in the scene BVH
 };
\ No newline at end of file
@@ -51,6 +51,23 @@
 #define EENG_COMPILER_GCC
 #endif
 
+/// SIMD (SSE2 is part of the x86-64 baseline, so no compiler flags are needed)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EENG_SSE
+#endif
+
+/// Profiling (CPU/GPU scopes, see Profiler.hpp)
+#define EENG_PROFILE
+
+/// Log levels below this are compiled out (0 Trace, 1 Debug, 2 Info, 3 Warning, 4 Error)
+#ifndef EENG_LOG_MIN_LEVEL
+#if !defined(NDEBUG) || defined(_DEBUG)
+#define EENG_LOG_MIN_LEVEL 0
+#else
+#define EENG_LOG_MIN_LEVEL 2
+#endif
+#endif
+
 /// Debug
 #if !defined(NDEBUG) || defined(_DEBUG)
 #define EENG_DEBUG
@@ -2,6 +2,14 @@
 // Licensed under the MIT License. See LICENSE file for details.
 
 #include "glmcommon.hpp"
+#include "glmcommon_simd.h"
+#include "config.h"
+#ifdef EENG_SSE
+#include <xmmintrin.h>
+#ifdef EENG_COMPILER_MSVC
+#include <intrin.h>
+#endif
+#endif
 
 namespace
 {
@@ -83,6 +91,73 @@ namespace
         t_min = MaxT[WhichPlane];
         return true;    // ray hits box
     }
+
+    /// Slab test of a ray against AABB i of a set. t is the entry distance, zero if the origin is inside.
+    inline bool RaySlabIntersection(
+        const glm::vec3& origin,
+        const glm::vec3& inv_dir,
+        const glm_aux::AABBSoAView& aabbs,
+        size_t i,
+        float t_max,
+        float& t)
+    {
+        const float aabb_min[3] = { aabbs.min_x[i], aabbs.min_y[i], aabbs.min_z[i] };
+        const float aabb_max[3] = { aabbs.max_x[i], aabbs.max_y[i], aabbs.max_z[i] };
+
+        float t0 = 0.0f, t1 = t_max;
+        for (int k = 0; k < 3; k++)
+        {
+            float tn = (aabb_min[k] - origin[k]) * inv_dir[k];
+            float tf = (aabb_max[k] - origin[k]) * inv_dir[k];
+            if (tn > tf) std::swap(tn, tf);
+            t0 = tn > t0 ? tn : t0;
+            t1 = tf < t1 ? tf : t1;
+        }
+        t = t0;
+        return t0 <= t1;
+    }
+
+#ifdef EENG_SSE
+    // Thin wrapper over SSE floats, see glmcommon_simd.h
+    struct SseFloat
+    {
+        using V = __m128;
+        static constexpr int Width = 4;
+        static inline V zero() { return _mm_setzero_ps(); }
+        static inline V set1(float a) { return _mm_set1_ps(a); }
+        static inline V iota() { return _mm_setr_ps(0, 1, 2, 3); }
+        static inline V load(const float* p) { return _mm_loadu_ps(p); }
+        static inline void store(float* p, V a) { _mm_storeu_ps(p, a); }
+        static inline V add(V a, V b) { return _mm_add_ps(a, b); }
+        static inline V sub(V a, V b) { return _mm_sub_ps(a, b); }
+        static inline V mul(V a, V b) { return _mm_mul_ps(a, b); }
+        static inline V min(V a, V b) { return _mm_min_ps(a, b); }
+        static inline V max(V a, V b) { return _mm_max_ps(a, b); }
+        static inline V cmple(V a, V b) { return _mm_cmple_ps(a, b); }
+        static inline V select(V mask, V a, V b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    };
+
+    /// True if the AVX kernels are built and the CPU and OS support AVX
+    bool use_avx()
+    {
+        static const bool avx = []
+        {
+            if (!glm_aux::simd::avx_compiled())
+                return false;
+#ifdef EENG_COMPILER_MSVC
+            int info[4];
+            __cpuid(info, 1);
+            const bool osxsave = info[2] & (1 << 27);
+            const bool cpu_avx = info[2] & (1 << 28);
+            // The OS must save the YMM registers
+            return osxsave && cpu_avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+            return __builtin_cpu_supports("avx") != 0;
+#endif
+        }();
+        return avx;
+    }
+#endif
 }
 
 namespace glm_aux {
@@ -114,6 +189,52 @@ namespace glm_aux {
         return true;
     }
 
+    int intersect_ray_AABBs(
+        Ray& ray,
+        const AABBSoAView& aabbs)
+    {
+        EENG_ASSERT(aabbs.count <= (1u << 24), "Too many AABBs for batch ray test ({0})", aabbs.count);
+        const glm::vec3 inv_dir = 1.0f / ray.dir;
+        int hit = -1;
+        size_t i = 0;
+
+#ifdef EENG_SSE
+        const float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+        const float inv[3] = { inv_dir.x, inv_dir.y, inv_dir.z };
+        i = use_avx() ?
+            simd::nearest_AABB_avx(origin, inv, ray.z_near, hit, aabbs) :
+            simd::nearest_AABB<SseFloat>(origin, inv, ray.z_near, hit, aabbs);
+#endif
+        float t;
+        for (; i < aabbs.count; i++)
+        {
+            if (RaySlabIntersection(ray.origin, inv_dir, aabbs, i, ray.z_near, t))
+            {
+                ray.z_near = t;
+                hit = int(i);
+            }
+        }
+        return hit;
+    }
+
+    void intersect_ray_packet_AABBs(
+        Ray* rays,
+        size_t nbr_rays,
+        const AABBSoAView& aabbs,
+        int* hit_indices)
+    {
+        size_t r = 0;
+
+#ifdef EENG_SSE
+        EENG_ASSERT(aabbs.count <= (1u << 24), "Too many AABBs for batch ray test ({0})", aabbs.count);
+        r = use_avx() ?
+            simd::nearest_AABB_packet_avx(rays, nbr_rays, aabbs, hit_indices) :
+            simd::nearest_AABB_packet<SseFloat>(rays, nbr_rays, aabbs, hit_indices);
+#endif
+        for (; r < nbr_rays; r++)
+            hit_indices[r] = intersect_ray_AABBs(rays[r], aabbs);
+    }
+
     std::string to_string(const glm::vec3& vec)
     {
         std::ostringstream oss;
@@ -39,6 +39,40 @@ namespace glm_aux {
         const glm::vec3& aabb_max
     );
 
+    /// @brief Non-owning view of AABBs in structure-of-arrays layout
+    struct AABBSoAView
+    {
+        const float* min_x, * min_y, * min_z;
+        const float* max_x, * max_y, * max_z;
+        size_t count;
+    };
+
+    /// @brief Find the nearest AABB in a set that is hit by a ray.
+    /// Uses the slab method, four (SSE) or eight (AVX) boxes at a time.
+    /// AVX is used if the CPU supports it, whatever the compiler flags of the rest of the build.
+    /// As for intersect_ray_AABB, only hits closer than ray.z_near are considered,
+    /// and ray.z_near is set to the distance of the nearest hit.
+    /// A ray that starts inside an AABB hits it at distance zero.
+    /// @param ray Ray to test
+    /// @param aabbs AABBs to test against (at most 2^24)
+    /// @return Index of the nearest AABB hit, or -1
+    int intersect_ray_AABBs(
+        Ray& ray,
+        const AABBSoAView& aabbs);
+
+    /// @brief Find the nearest AABB hit by each ray in a packet.
+    /// Rays are tested four (SSE) or eight (AVX) at a time against each AABB,
+    /// which favors many coherent rays against few AABBs.
+    /// @param rays Rays to test, updated as for intersect_ray_AABBs
+    /// @param nbr_rays Number of rays
+    /// @param aabbs AABBs to test against
+    /// @param hit_indices Output index of the nearest AABB per ray, or -1
+    void intersect_ray_packet_AABBs(
+        Ray* rays,
+        size_t nbr_rays,
+        const AABBSoAView& aabbs,
+        int* hit_indices);
+
     /// @brief Convert glm::vec3 to string
     /// @param vec Vector to convert
     std::string to_string(const glm::vec3& vec);
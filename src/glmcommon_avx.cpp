@@ -0,0 +1,72 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+// AVX kernels of glmcommon. This file alone is built with AVX enabled on x86 (see CMakeLists.txt),
+// and glmcommon.cpp only calls into it after checking that the CPU supports AVX.
+
+#include "glmcommon_simd.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace
+{
+#ifdef __AVX__
+    struct AvxFloat
+    {
+        using V = __m256;
+        static constexpr int Width = 8;
+        static inline V zero() { return _mm256_setzero_ps(); }
+        static inline V set1(float a) { return _mm256_set1_ps(a); }
+        static inline V iota() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+        static inline V load(const float* p) { return _mm256_loadu_ps(p); }
+        static inline void store(float* p, V a) { _mm256_storeu_ps(p, a); }
+        static inline V add(V a, V b) { return _mm256_add_ps(a, b); }
+        static inline V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+        static inline V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+        static inline V min(V a, V b) { return _mm256_min_ps(a, b); }
+        static inline V max(V a, V b) { return _mm256_max_ps(a, b); }
+        static inline V cmple(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+        static inline V select(V mask, V a, V b) { return _mm256_blendv_ps(b, a, mask); }
+    };
+#endif
+}
+
+namespace glm_aux::simd {
+
+    bool avx_compiled()
+    {
+#ifdef __AVX__
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    size_t nearest_AABB_avx(
+        const float origin[3],
+        const float inv_dir[3],
+        float& z_near,
+        int& hit,
+        const AABBSoAView& aabbs)
+    {
+#ifdef __AVX__
+        return nearest_AABB<AvxFloat>(origin, inv_dir, z_near, hit, aabbs);
+#else
+        return 0;
+#endif
+    }
+
+    size_t nearest_AABB_packet_avx(
+        Ray* rays,
+        size_t nbr_rays,
+        const AABBSoAView& aabbs,
+        int* hit_indices)
+    {
+#ifdef __AVX__
+        return nearest_AABB_packet<AvxFloat>(rays, nbr_rays, aabbs, hit_indices);
+#else
+        return 0;
+#endif
+    }
+
+} // namespace glm_aux::simd
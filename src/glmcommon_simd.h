@@ -0,0 +1,159 @@
+// Licensed under the MIT License. See LICENSE file for details.
+
+#ifndef glmcommon_simd_h
+#define glmcommon_simd_h
+
+#include <cstddef>
+#include "glmcommon.hpp"
+
+/// Batch ray-vs-AABB kernels of glmcommon, written once for any SIMD width.
+/// S wraps one float SIMD type (see SseFloat in glmcommon.cpp and AvxFloat in glmcommon_avx.cpp).
+/// Each file instantiates the kernels with a wrapper of its own in an unnamed namespace,
+/// so code built with AVX enabled is never shared with other translation units.
+/// For the same reason the kernels call no glm functions.
+namespace glm_aux::simd {
+
+    /// Slab test for one SIMD lane set. Ray entry distances are returned in t0, hits as lane mask.
+    template<class S>
+    inline typename S::V slab_intersection(
+        const typename S::V origin[3],
+        const typename S::V inv_dir[3],
+        const typename S::V aabb_min[3],
+        const typename S::V aabb_max[3],
+        typename S::V t_max,
+        typename S::V& t0)
+    {
+        t0 = S::zero();
+        typename S::V t1 = t_max;
+        for (int k = 0; k < 3; k++)
+        {
+            const typename S::V tn = S::mul(S::sub(aabb_min[k], origin[k]), inv_dir[k]);
+            const typename S::V tf = S::mul(S::sub(aabb_max[k], origin[k]), inv_dir[k]);
+            t0 = S::max(S::min(tn, tf), t0);
+            t1 = S::min(S::max(tn, tf), t1);
+        }
+        return S::cmple(t0, t1);
+    }
+
+    /// Nearest AABB hit by one ray, among the leading multiple of S::Width AABBs.
+    /// z_near and hit are updated as by intersect_ray_AABBs.
+    /// @return Number of AABBs tested, the rest are left to the caller
+    template<class S>
+    size_t nearest_AABB(
+        const float origin[3],
+        const float inv_dir[3],
+        float& z_near,
+        int& hit,
+        const AABBSoAView& aabbs)
+    {
+        if (aabbs.count < S::Width)
+            return 0;
+
+        typename S::V o[3], inv[3];
+        for (int k = 0; k < 3; k++)
+        {
+            o[k] = S::set1(origin[k]);
+            inv[k] = S::set1(inv_dir[k]);
+        }
+
+        // Nearest hit per lane. Indices are kept as floats, exact up to 2^24.
+        typename S::V best_t = S::set1(z_near);
+        typename S::V best_i = S::set1(-1.0f);
+        typename S::V index = S::iota();
+        const typename S::V step = S::set1(float(S::Width));
+
+        size_t i = 0;
+        for (; i + S::Width <= aabbs.count; i += S::Width)
+        {
+            const typename S::V aabb_min[3] = { S::load(aabbs.min_x + i), S::load(aabbs.min_y + i), S::load(aabbs.min_z + i) };
+            const typename S::V aabb_max[3] = { S::load(aabbs.max_x + i), S::load(aabbs.max_y + i), S::load(aabbs.max_z + i) };
+            typename S::V t0;
+            const typename S::V mask = slab_intersection<S>(o, inv, aabb_min, aabb_max, best_t, t0);
+            best_t = S::select(mask, t0, best_t);
+            best_i = S::select(mask, index, best_i);
+            index = S::add(index, step);
+        }
+
+        // Reduce lanes. Ties go to the higher index, as for a sequential test.
+        float lane_t[S::Width], lane_i[S::Width];
+        S::store(lane_t, best_t);
+        S::store(lane_i, best_i);
+        for (int k = 0; k < S::Width; k++)
+        {
+            if (lane_i[k] < 0.0f)
+                continue;
+            if (lane_t[k] < z_near || (lane_t[k] == z_near && int(lane_i[k]) > hit))
+            {
+                z_near = lane_t[k];
+                hit = int(lane_i[k]);
+            }
+        }
+        return i;
+    }
+
+    /// Nearest AABB hit by each ray of a packet, for the leading multiple of S::Width rays.
+    /// @return Number of rays tested, the rest are left to the caller
+    template<class S>
+    size_t nearest_AABB_packet(
+        Ray* rays,
+        size_t nbr_rays,
+        const AABBSoAView& aabbs,
+        int* hit_indices)
+    {
+        float lanes[S::Width];
+        size_t r = 0;
+        for (; r + S::Width <= nbr_rays; r += S::Width)
+        {
+            // Rays in lanes
+            typename S::V origin[3], inv[3];
+            for (int k = 0; k < 3; k++)
+            {
+                for (int l = 0; l < S::Width; l++) lanes[l] = (&rays[r + l].origin.x)[k];
+                origin[k] = S::load(lanes);
+                for (int l = 0; l < S::Width; l++) lanes[l] = 1.0f / (&rays[r + l].dir.x)[k];
+                inv[k] = S::load(lanes);
+            }
+            for (int l = 0; l < S::Width; l++) lanes[l] = rays[r + l].z_near;
+            typename S::V best_t = S::load(lanes);
+            typename S::V best_i = S::set1(-1.0f);
+
+            // AABBs broadcast over lanes
+            for (size_t i = 0; i < aabbs.count; i++)
+            {
+                const typename S::V aabb_min[3] = { S::set1(aabbs.min_x[i]), S::set1(aabbs.min_y[i]), S::set1(aabbs.min_z[i]) };
+                const typename S::V aabb_max[3] = { S::set1(aabbs.max_x[i]), S::set1(aabbs.max_y[i]), S::set1(aabbs.max_z[i]) };
+                typename S::V t0;
+                const typename S::V mask = slab_intersection<S>(origin, inv, aabb_min, aabb_max, best_t, t0);
+                best_t = S::select(mask, t0, best_t);
+                best_i = S::select(mask, S::set1(float(i)), best_i);
+            }
+
+            S::store(lanes, best_t);
+            for (int l = 0; l < S::Width; l++) rays[r + l].z_near = lanes[l];
+            S::store(lanes, best_i);
+            for (int l = 0; l < S::Width; l++) hit_indices[r + l] = int(lanes[l]);
+        }
+        return r;
+    }
+
+    /// @brief True if glmcommon_avx.cpp was built with AVX enabled
+    bool avx_compiled();
+
+    /// nearest_AABB with eight lanes, see glmcommon_avx.cpp. Only call if avx_compiled() and the CPU has AVX.
+    size_t nearest_AABB_avx(
+        const float origin[3],
+        const float inv_dir[3],
+        float& z_near,
+        int& hit,
+        const AABBSoAView& aabbs);
+
+    /// nearest_AABB_packet with eight lanes. Only call if avx_compiled() and the CPU has AVX.
+    size_t nearest_AABB_packet_avx(
+        Ray* rays,
+        size_t nbr_rays,
+        const AABBSoAView& aabbs,
+        int* hit_indices);
+
+} // namespace glm_aux::simd
+
+#endif /* glmcommon_simd_h */
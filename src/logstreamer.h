@@ -5,25 +5,47 @@
 #define streamlogger_h
 
 #include <vector>
+#include <memory>
 #include <ostream>
 #include <fstream>
+#include <sstream>
+#include "Log.hpp"
 
 namespace logstreamer
 {
     
     //! Distributes log output to multiple stream with priority
     //
+    // Output is buffered per stream and handed to the log writer thread at stream
+    // manipulators (e.g. std::endl) and when the logstreamer is destroyed.
+    // Streams added with add_ostream must outlive pending writes (see eeng::LogFlush).
+    //
     // Note: ostream <=> basic_ostream<char>
     //
     class logstreamer_t
     {
-        std::vector< std::pair<std::ostream*, int> > strms; // Streams & priorities
-        std::vector<std::ofstream*> file_strms;             // Open file streams
+        struct stream_t
+        {
+            std::shared_ptr<std::ostream> strm;
+            int priolvl;
+            std::ostringstream buffer;
+            
+            stream_t(std::shared_ptr<std::ostream> strm, int priolvl) : strm(std::move(strm)), priolvl(priolvl) {}
+        };
+        std::vector<std::unique_ptr<stream_t>> strms;       // Streams, priorities & pending output
         int priolvl = 0;                                    // Current priority
         
         // Signature for std stream manipulators such as endl, setw, setfill ...
         using iomanip_func = std::ostream& (*)(std::ostream&);
         
+        void submit(stream_t& strm)
+        {
+            if (strm.buffer.tellp() <= std::streamoff(0))
+                return;
+            eeng::internal::LogWriteStream(strm.strm, strm.buffer.str());
+            strm.buffer.str(std::string{});
+        }
+        
     public:
         
         struct priority_t
@@ -52,26 +74,24 @@ namespace logstreamer
         
         void add_ostream(std::ostream& strm, int priolvl)
         {
-            strms.push_back( {{&strm}, {priolvl}} );
+            // Not owned
+            strms.push_back(std::make_unique<stream_t>(std::shared_ptr<std::ostream>(&strm, [](std::ostream*) {}), priolvl));
         }
         
         void add_ofstream(const std::string& file, int priolvl)
         {
-            std::ofstream *filestrm = new std::ofstream;
-            filestrm->open(file, std::ios::out);
+            // Owned by the writer thread's pending writes once this logstreamer is gone
+            auto filestrm = std::make_shared<std::ofstream>(file, std::ios::out);
             if (filestrm->is_open())
-            {
-                strms.push_back( {{filestrm},{priolvl}});
-                file_strms.push_back(filestrm);
-            }
+                strms.push_back(std::make_unique<stream_t>(filestrm, priolvl));
         }
         
         template<class T>
         logstreamer_t& operator << (const T& item)
         {
             for (auto& strm : strms)
-                if (strm.second <= priolvl)
-                    *(strm.first) << item;
+                if (strm->priolvl <= priolvl)
+                    strm->buffer << item;
             
             return *this;
             
@@ -80,8 +100,11 @@ namespace logstreamer
         logstreamer_t& operator << (iomanip_func iofunc)
         {            
             for (auto& strm : strms)
-                if (strm.second <= priolvl)
-                    *(strm.first) << iofunc;
+                if (strm->priolvl <= priolvl)
+                {
+                    strm->buffer << iofunc;
+                    submit(*strm);
+                }
             
             return *this;
         }
@@ -94,7 +117,8 @@ namespace logstreamer
         
         ~logstreamer_t()
         {
-            for (auto* fstrm : file_strms) { fstrm->close(); delete fstrm; }
+            for (auto& strm : strms)
+                submit(*strm);
         }
     };
     
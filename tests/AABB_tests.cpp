@@ -0,0 +1,151 @@
+#include "AABB.h"
+#include <gtest/gtest.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+    using namespace eeng;
+
+    void make_random_batch(
+        size_t n,
+        std::vector<AABB>& aabbs,
+        std::vector<glm::mat4>& tfms,
+        unsigned seed = 1234)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+        std::uniform_real_distribution<float> ext(0.1f, 2.0f);
+        std::uniform_real_distribution<float> ang(-glm::pi<float>(), glm::pi<float>());
+
+        aabbs.resize(n);
+        tfms.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const glm::vec3 c{ pos(rng), pos(rng), pos(rng) };
+            const glm::vec3 e{ ext(rng), ext(rng), ext(rng) };
+            aabbs[i].min = c - e;
+            aabbs[i].max = c + e;
+
+            const glm::vec3 axis = glm::normalize(glm::vec3{ pos(rng), pos(rng), pos(rng) } + glm::vec3{ 0.01f });
+            tfms[i] = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ pos(rng), pos(rng), pos(rng) })
+                * glm::rotate(glm::mat4{ 1.0f }, ang(rng), axis)
+                * glm::scale(glm::mat4{ 1.0f }, glm::vec3{ ext(rng) });
+        }
+    }
+
+    void expect_aabb_eq(const AABB& a, const AABB& b)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            EXPECT_FLOAT_EQ(a.min[k], b.min[k]);
+            EXPECT_FLOAT_EQ(a.max[k], b.max[k]);
+        }
+    }
+}
+
+TEST(AABBSoATest, AssignAndGet) {
+    std::vector<AABB> aabbs;
+    std::vector<glm::mat4> tfms;
+    make_random_batch(7, aabbs, tfms);
+
+    AABBSoA soa;
+    soa.assign(aabbs);
+    ASSERT_EQ(soa.size(), aabbs.size());
+    for (size_t i = 0; i < aabbs.size(); i++)
+        expect_aabb_eq(soa.get(i), aabbs[i]);
+}
+
+TEST(AABBSoATest, PostTransformBatchMatchesScalar) {
+    // Sizes chosen to exercise both the SIMD body and the scalar tail
+    for (size_t n : { 0u, 1u, 3u, 4u, 5u, 17u, 64u })
+    {
+        std::vector<AABB> aabbs;
+        std::vector<glm::mat4> tfms;
+        make_random_batch(n, aabbs, tfms);
+
+        AABBSoA in, out;
+        in.assign(aabbs);
+        post_transform_batch(in, tfms.data(), out);
+        ASSERT_EQ(out.size(), n);
+
+        for (size_t i = 0; i < n; i++)
+            expect_aabb_eq(out.get(i), aabbs[i].post_transform(tfms[i]));
+    }
+}
+
+TEST(AABBSoATest, PostTransformBatchSkipsEmpty) {
+    std::vector<AABB> aabbs;
+    std::vector<glm::mat4> tfms;
+    make_random_batch(8, aabbs, tfms);
+    aabbs[2].reset();
+    aabbs[7].reset();
+
+    AABBSoA in, out;
+    in.assign(aabbs);
+    post_transform_batch(in, tfms.data(), out);
+
+    AABB e2 = out.get(2), e7 = out.get(7), v0 = out.get(0);
+    EXPECT_FALSE((bool)e2);
+    EXPECT_FALSE((bool)e7);
+    EXPECT_TRUE((bool)v0);
+}
+
+TEST(AABBSoATest, UnionBatchMatchesScalar) {
+    for (size_t n : { 1u, 3u, 4u, 9u, 100u })
+    {
+        std::vector<AABB> aabbs;
+        std::vector<glm::mat4> tfms;
+        make_random_batch(n, aabbs, tfms);
+        aabbs[0].reset(); // Empty AABB's do not contribute
+
+        AABB ref;
+        for (size_t i = 1; i < n; i++)
+            ref.grow(aabbs[i]);
+
+        AABBSoA soa;
+        soa.assign(aabbs);
+        expect_aabb_eq(union_batch(soa), ref);
+    }
+}
+
+TEST(AABBSoABenchmark, PostTransformAndUnion) {
+    const size_t n = 10000;
+    const int iterations = 100;
+
+    std::vector<AABB> aabbs, aabbs_out(n);
+    std::vector<glm::mat4> tfms;
+    make_random_batch(n, aabbs, tfms);
+    AABBSoA in, out;
+    in.assign(aabbs);
+
+    using clock = std::chrono::high_resolution_clock;
+    float sink = 0.0f;
+
+    auto t0 = clock::now();
+    for (int it = 0; it < iterations; it++)
+    {
+        AABB model;
+        for (size_t i = 0; i < n; i++)
+        {
+            aabbs_out[i] = aabbs[i].post_transform(glm::vec3(tfms[i][3]), glm::mat3(tfms[i]));
+            model.grow(aabbs_out[i]);
+        }
+        sink += model.max.x;
+    }
+    auto t1 = clock::now();
+    for (int it = 0; it < iterations; it++)
+    {
+        post_transform_batch(in, tfms.data(), out);
+        sink += union_batch(out).max.x;
+    }
+    auto t2 = clock::now();
+
+    const double scalar_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / iterations;
+    const double batch_us = std::chrono::duration<double, std::micro>(t2 - t1).count() / iterations;
+    std::cout << "AABB transform + union, " << n << " boxes: scalar " << scalar_us
+        << " us, batch " << batch_us << " us (x" << scalar_us / batch_us << ")" << std::endl;
+    EXPECT_NE(sink, 0.0f);
+}
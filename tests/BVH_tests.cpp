@@ -0,0 +1,294 @@
+#include "BVH.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    using namespace eeng;
+
+    std::vector<AABB> make_random_aabbs(size_t n, float world_size, unsigned seed = 1234)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-world_size, world_size);
+        std::uniform_real_distribution<float> ext(0.1f, 1.5f);
+
+        std::vector<AABB> aabbs(n);
+        for (auto& aabb : aabbs)
+        {
+            const glm::vec3 c{ pos(rng), pos(rng), pos(rng) };
+            const glm::vec3 e{ ext(rng), ext(rng), ext(rng) };
+            aabb.min = c - e;
+            aabb.max = c + e;
+        }
+        return aabbs;
+    }
+
+    std::vector<glm_aux::Ray> make_random_rays(size_t n, float world_size, unsigned seed = 4321)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-world_size, world_size);
+
+        std::vector<glm_aux::Ray> rays(n);
+        for (auto& ray : rays)
+        {
+            const glm::vec3 o{ pos(rng), pos(rng), pos(rng) };
+            const glm::vec3 target{ pos(rng), pos(rng), pos(rng) };
+            ray = glm_aux::Ray{ o, glm::normalize(target - o + glm::vec3{ 1e-3f }) };
+        }
+        return rays;
+    }
+
+    /// Reference: nearest hit using the BVH slab convention (inside gives zero distance)
+    int brute_force_ray(glm_aux::Ray& ray, const std::vector<AABB>& aabbs)
+    {
+        const glm::vec3 inv_dir = 1.0f / ray.dir;
+        int hit = EENG_NULL_INDEX;
+        for (int i = 0; i < aabbs.size(); i++)
+        {
+            float t0 = 0.0f, t1 = ray.z_near;
+            for (int k = 0; k < 3; k++)
+            {
+                float tn = (aabbs[i].min[k] - ray.origin[k]) * inv_dir[k];
+                float tf = (aabbs[i].max[k] - ray.origin[k]) * inv_dir[k];
+                if (tn > tf) std::swap(tn, tf);
+                t0 = std::max(t0, tn);
+                t1 = std::min(t1, tf);
+            }
+            if (t0 <= t1)
+            {
+                ray.z_near = t0;
+                hit = i;
+            }
+        }
+        return hit;
+    }
+
+    BVH make_bvh(const std::vector<AABB>& aabbs, std::vector<BVH::ProxyId>& proxies)
+    {
+        BVH bvh;
+        proxies.clear();
+        for (uint32_t i = 0; i < aabbs.size(); i++)
+            proxies.push_back(bvh.insert(aabbs[i], i));
+        return bvh;
+    }
+}
+
+TEST(BVHTest, Empty) {
+    BVH bvh;
+    EXPECT_EQ(bvh.size(), 0);
+    glm_aux::Ray ray{ glm::vec3{ 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+    EXPECT_EQ(bvh.query_ray(ray), EENG_NULL_INDEX);
+    bvh.rebuild();
+    EXPECT_EQ(bvh.height(), 0);
+}
+
+TEST(BVHTest, RayMatchesBruteForce) {
+    const auto aabbs = make_random_aabbs(500, 50.0f);
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (auto ray : make_random_rays(200, 60.0f))
+        {
+            auto ref_ray = ray;
+            const int ref = brute_force_ray(ref_ray, aabbs);
+            const auto hit = bvh.query_ray(ray);
+
+            ASSERT_EQ(hit == EENG_NULL_INDEX, ref == EENG_NULL_INDEX);
+            if (ref != EENG_NULL_INDEX)
+                EXPECT_FLOAT_EQ(ray.z_near, ref_ray.z_near);
+        }
+        bvh.rebuild();
+    }
+}
+
+TEST(BVHTest, RayFilter) {
+    std::vector<AABB> aabbs(2);
+    aabbs[0].min = { 1, -1, -1 }; aabbs[0].max = { 2, 1, 1 };
+    aabbs[1].min = { 4, -1, -1 }; aabbs[1].max = { 5, 1, 1 };
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+
+    glm_aux::Ray ray{ glm::vec3{ 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+    EXPECT_EQ(bvh.query_ray(ray), proxies[0]);
+    EXPECT_FLOAT_EQ(ray.z_near, 1.0f);
+
+    glm_aux::Ray ray2{ glm::vec3{ 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+    EXPECT_EQ(bvh.query_ray(ray2, [&](auto proxy) { return proxy != proxies[0]; }), proxies[1]);
+    EXPECT_FLOAT_EQ(ray2.z_near, 4.0f);
+}
+
+TEST(BVHTest, PacketMatchesSingleRays) {
+    const auto aabbs = make_random_aabbs(500, 50.0f);
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+    bvh.rebuild();
+
+    auto rays = make_random_rays(256, 60.0f);
+    for (size_t i = 0; i < rays.size(); i += 4)
+    {
+        glm_aux::Ray packet[4] = { rays[i], rays[i + 1], rays[i + 2], rays[i + 3] };
+        BVH::ProxyId hits[4];
+        bvh.query_ray_packet(packet, hits);
+
+        for (int k = 0; k < 4; k++)
+        {
+            auto ray = rays[i + k];
+            EXPECT_EQ(bvh.query_ray(ray), hits[k]);
+            if (hits[k] != EENG_NULL_INDEX)
+                EXPECT_FLOAT_EQ(ray.z_near, packet[k].z_near);
+        }
+    }
+}
+
+TEST(BVHTest, AABBQueryMatchesBruteForce) {
+    const auto aabbs = make_random_aabbs(500, 50.0f);
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+
+    for (const auto& query : make_random_aabbs(50, 50.0f, 99))
+    {
+        AABB q = query;
+        q.min -= glm::vec3{ 5.0f };
+        q.max += glm::vec3{ 5.0f };
+
+        std::vector<uint32_t> result, ref;
+        bvh.query_aabb(q, [&](auto proxy) { result.push_back(bvh.get_user_data(proxy)); });
+        for (uint32_t i = 0; i < aabbs.size(); i++)
+            if (aabbs[i].intersect(q)) ref.push_back(i);
+
+        std::sort(result.begin(), result.end());
+        EXPECT_EQ(result, ref);
+    }
+}
+
+TEST(BVHTest, FrustumQueryMatchesBruteForce) {
+    const auto aabbs = make_random_aabbs(1000, 50.0f);
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+    bvh.rebuild();
+
+    const glm::mat4 P = glm::perspective(glm::radians(60.0f), 1.5f, 1.0f, 40.0f);
+    const glm::mat4 V = glm::lookAt(glm::vec3{ 0.0f, 0.0f, 30.0f }, glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+    const Frustum frustum{ P * V };
+
+    std::vector<uint32_t> result, ref;
+    bvh.query_frustum(frustum, [&](auto proxy) { result.push_back(bvh.get_user_data(proxy)); });
+    for (uint32_t i = 0; i < aabbs.size(); i++)
+        if (frustum.classify(aabbs[i]) >= 0) ref.push_back(i);
+
+    std::sort(result.begin(), result.end());
+    EXPECT_FALSE(ref.empty());
+    EXPECT_EQ(result, ref);
+}
+
+TEST(BVHTest, FrustumSphere) {
+    const glm::mat4 P = glm::perspective(glm::radians(60.0f), 1.5f, 1.0f, 40.0f);
+    const glm::mat4 V = glm::lookAt(glm::vec3{ 0.0f, 0.0f, 30.0f }, glm::vec3{ 0.0f }, glm::vec3{ 0.0f, 1.0f, 0.0f });
+    const Frustum frustum{ P * V };
+
+    EXPECT_TRUE(frustum.intersects_sphere({ 0.0f, 0.0f, 0.0f }, 1.0f));
+    EXPECT_FALSE(frustum.intersects_sphere({ 0.0f, 0.0f, 40.0f }, 1.0f));   // Behind the camera
+    EXPECT_FALSE(frustum.intersects_sphere({ 100.0f, 0.0f, 0.0f }, 1.0f));
+    EXPECT_TRUE(frustum.intersects_sphere({ 100.0f, 0.0f, 0.0f }, 90.0f));  // Reaches into the frustum
+}
+
+TEST(BVHTest, UpdateRefitAndRemove) {
+    auto aabbs = make_random_aabbs(300, 50.0f);
+    std::vector<BVH::ProxyId> proxies;
+    BVH bvh = make_bvh(aabbs, proxies);
+    bvh.rebuild();
+
+    // Move everything
+    for (int i = 0; i < aabbs.size(); i++)
+    {
+        const glm::vec3 d{ float(i % 7) - 3.0f, 0.5f, float(i % 5) - 2.0f };
+        aabbs[i].min += d;
+        aabbs[i].max += d;
+        bvh.update(proxies[i], aabbs[i]);
+    }
+    EXPECT_TRUE(bvh.is_dirty());
+    bvh.refit();
+    EXPECT_FALSE(bvh.is_dirty());
+    EXPECT_NEAR(bvh.sah_cost(), bvh.compute_sah_cost(), 1e-3f * bvh.compute_sah_cost());
+
+    // Remove every other
+    std::vector<AABB> remaining;
+    for (int i = 0; i < aabbs.size(); i++)
+    {
+        if (i % 2) bvh.remove(proxies[i]);
+        else remaining.push_back(aabbs[i]);
+    }
+    EXPECT_EQ(bvh.size(), remaining.size());
+    EXPECT_NEAR(bvh.sah_cost(), bvh.compute_sah_cost(), 1e-3f * bvh.compute_sah_cost());
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (auto ray : make_random_rays(200, 60.0f))
+        {
+            auto ref_ray = ray;
+            const int ref = brute_force_ray(ref_ray, remaining);
+            const auto hit = bvh.query_ray(ray);
+            ASSERT_EQ(hit == EENG_NULL_INDEX, ref == EENG_NULL_INDEX);
+            if (ref != EENG_NULL_INDEX)
+                EXPECT_FLOAT_EQ(ray.z_near, ref_ray.z_near);
+        }
+        bvh.rebuild();
+    }
+}
+
+TEST(BVHBenchmark, RayQueriesVsBruteForce) {
+    using clock = std::chrono::high_resolution_clock;
+    const size_t nbr_rays = 256;
+
+    for (size_t n : { 1000u, 10000u, 100000u })
+    {
+        // Scale world so density stays roughly constant
+        const float world_size = 10.0f * std::cbrt(float(n));
+        auto aabbs = make_random_aabbs(n, world_size);
+        const auto rays = make_random_rays(nbr_rays, world_size);
+
+        std::vector<BVH::ProxyId> proxies;
+        auto t0 = clock::now();
+        BVH bvh = make_bvh(aabbs, proxies);
+        auto t1 = clock::now();
+        bvh.rebuild();
+        auto t2 = clock::now();
+
+        // Move all boxes slightly and refit
+        for (size_t i = 0; i < n; i++)
+        {
+            aabbs[i].min.x += 0.5f;
+            aabbs[i].max.x += 0.5f;
+            bvh.update(proxies[i], aabbs[i]);
+        }
+        bvh.refit();
+        auto t3 = clock::now();
+
+        int hits_bvh = 0, hits_bf = 0;
+        for (auto ray : rays)
+            hits_bvh += bvh.query_ray(ray) != EENG_NULL_INDEX;
+        auto t4 = clock::now();
+        for (size_t i = 0; i < nbr_rays; i += 4)
+        {
+            glm_aux::Ray packet[4] = { rays[i], rays[i + 1], rays[i + 2], rays[i + 3] };
+            BVH::ProxyId hits[4];
+            bvh.query_ray_packet(packet, hits);
+        }
+        auto t5 = clock::now();
+        for (auto ray : rays)
+            hits_bf += brute_force_ray(ray, aabbs) != EENG_NULL_INDEX;
+        auto t6 = clock::now();
+
+        auto us = [](auto a, auto b) { return std::chrono::duration<double, std::micro>(b - a).count(); };
+        std::cout << n << " boxes: insert " << us(t0, t1) << " us, rebuild " << us(t1, t2)
+            << " us, update+refit " << us(t2, t3) << " us (height " << bvh.height() << ")\n"
+            << "  " << nbr_rays << " rays: BVH " << us(t3, t4) << " us, packets " << us(t4, t5)
+            << " us, brute force " << us(t5, t6) << " us" << std::endl;
+        EXPECT_EQ(hits_bvh, hits_bf);
+    }
+}
@@ -0,0 +1,324 @@
+#include "MeshOptimizer.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using namespace eeng::meshopt;
+
+    /// Grid of n x n quads in the xz-plane with triangles in random order
+    void make_grid(unsigned n, std::vector<glm::vec3>& positions, std::vector<unsigned>& indices, unsigned seed = 1234)
+    {
+        positions.clear();
+        for (unsigned z = 0; z <= n; z++)
+            for (unsigned x = 0; x <= n; x++)
+                positions.push_back({ float(x), 0.0f, float(z) });
+
+        std::vector<std::array<unsigned, 3>> triangles;
+        for (unsigned z = 0; z < n; z++)
+            for (unsigned x = 0; x < n; x++)
+            {
+                const unsigned i0 = z * (n + 1) + x, i1 = i0 + 1, i2 = i0 + n + 1, i3 = i2 + 1;
+                triangles.push_back({ i0, i2, i1 });
+                triangles.push_back({ i1, i2, i3 });
+            }
+        std::shuffle(triangles.begin(), triangles.end(), std::mt19937(seed));
+
+        indices.clear();
+        for (auto& t : triangles)
+            indices.insert(indices.end(), t.begin(), t.end());
+    }
+
+    /// Triangles rotated to start at their smallest index, which keeps winding, then sorted
+    std::vector<std::array<unsigned, 3>> canonical_triangles(const std::vector<unsigned>& indices)
+    {
+        std::vector<std::array<unsigned, 3>> triangles;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            std::array<unsigned, 3> t{ indices[i], indices[i + 1], indices[i + 2] };
+            std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+            triangles.push_back(t);
+        }
+        std::sort(triangles.begin(), triangles.end());
+        return triangles;
+    }
+
+    /// Surface area, and whether all triangles face +y
+    float total_area(const std::vector<unsigned>& indices, const std::vector<glm::vec3>& positions, bool& all_up)
+    {
+        float area = 0.0f;
+        all_up = true;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            const glm::vec3 n = glm::cross(
+                positions[indices[i + 1]] - positions[indices[i]],
+                positions[indices[i + 2]] - positions[indices[i]]);
+            area += glm::length(n) * 0.5f;
+            all_up &= n.y > 0.0f;
+        }
+        return area;
+    }
+}
+
+TEST(MeshOptimizerTest, AnalyzeStrip) {
+    // Each triangle after the first adds one vertex
+    std::vector<unsigned> indices;
+    for (unsigned i = 0; i < 10; i++)
+        indices.insert(indices.end(), { i, i + 1, i + 2 });
+    auto stats = analyze_vertex_cache(indices.data(), indices.size(), 12);
+    EXPECT_FLOAT_EQ(stats.acmr, 12.0f / 10.0f);
+    EXPECT_FLOAT_EQ(stats.atvr, 1.0f);
+
+    // A cache of one entry misses on every index
+    stats = analyze_vertex_cache(indices.data(), indices.size(), 12, 1);
+    EXPECT_FLOAT_EQ(stats.acmr, 3.0f);
+}
+
+TEST(MeshOptimizerTest, VertexCacheKeepsTriangles) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(32, positions, indices);
+    const auto before = canonical_triangles(indices);
+
+    std::vector<unsigned> clusters;
+    optimize_vertex_cache(indices.data(), indices.size(), positions.size(), clusters);
+    EXPECT_EQ(canonical_triangles(indices), before);
+
+    ASSERT_FALSE(clusters.empty());
+    EXPECT_EQ(clusters[0], 0u);
+    for (size_t i = 1; i < clusters.size(); i++)
+    {
+        EXPECT_GT(clusters[i], clusters[i - 1]);
+        EXPECT_EQ(clusters[i] % 3, 0u);
+        EXPECT_LT(clusters[i], indices.size());
+    }
+}
+
+TEST(MeshOptimizerTest, VertexCacheLowersACMR) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(64, positions, indices);
+    const auto before = analyze_vertex_cache(indices.data(), indices.size(), positions.size());
+
+    std::vector<unsigned> clusters;
+    optimize_vertex_cache(indices.data(), indices.size(), positions.size(), clusters);
+    const auto after = analyze_vertex_cache(indices.data(), indices.size(), positions.size());
+
+    // A shuffled grid misses nearly every vertex, an ordered grid approaches 0.5
+    EXPECT_GT(before.acmr, 2.0f);
+    EXPECT_LT(after.acmr, 1.0f);
+    EXPECT_LT(after.atvr, before.atvr);
+}
+
+TEST(MeshOptimizerTest, OverdrawKeepsTrianglesAndACMR) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(64, positions, indices);
+
+    std::vector<unsigned> clusters;
+    optimize_vertex_cache(indices.data(), indices.size(), positions.size(), clusters);
+    const auto before = canonical_triangles(indices);
+    const auto cache_stats = analyze_vertex_cache(indices.data(), indices.size(), positions.size());
+
+    optimize_overdraw(indices.data(), indices.size(), positions.data(), clusters);
+    EXPECT_EQ(canonical_triangles(indices), before);
+
+    // Clusters start on cache flushes, so moving them around costs little
+    const auto after = analyze_vertex_cache(indices.data(), indices.size(), positions.size());
+    EXPECT_LT(after.acmr, cache_stats.acmr * 1.1f);
+}
+
+TEST(MeshOptimizerTest, VertexFetchOrder) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(16, positions, indices);
+    positions.push_back(glm::vec3{ -1.0f }); // Unreferenced vertex
+    const auto old_positions = positions;
+    const auto old_indices = indices;
+
+    std::vector<unsigned> remap;
+    optimize_vertex_fetch(indices.data(), indices.size(), positions.size(), remap);
+    std::vector<glm::vec3> scratch;
+    remap_vertices(positions.data(), remap, scratch);
+
+    // Vertices are numbered in order of first use
+    unsigned next = 0;
+    for (auto i : indices)
+    {
+        EXPECT_LE(i, next);
+        if (i == next)
+            next++;
+    }
+
+    // Remap is a permutation and the mesh is unchanged
+    auto sorted_remap = remap;
+    std::sort(sorted_remap.begin(), sorted_remap.end());
+    for (unsigned i = 0; i < sorted_remap.size(); i++)
+        EXPECT_EQ(sorted_remap[i], i);
+    for (size_t i = 0; i < indices.size(); i++)
+        EXPECT_EQ(positions[indices[i]], old_positions[old_indices[i]]);
+    EXPECT_EQ(positions.back(), glm::vec3{ -1.0f });
+}
+
+TEST(MeshOptimizerTest, Empty) {
+    std::vector<unsigned> indices, clusters, remap;
+    optimize_vertex_cache(indices.data(), 0, 0, clusters);
+    EXPECT_EQ(clusters.size(), 1u);
+    optimize_overdraw(indices.data(), 0, nullptr, clusters);
+    optimize_vertex_fetch(indices.data(), 0, 0, remap);
+    EXPECT_TRUE(remap.empty());
+    const auto stats = analyze_vertex_cache(indices.data(), 0, 0);
+    EXPECT_EQ(stats.acmr, 0.0f);
+}
+
+TEST(MeshOptimizerTest, SimplifyFlatGrid) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(32, positions, indices);
+
+    // A plane simplifies without error, borders included
+    const size_t target = indices.size() / 10;
+    std::vector<unsigned> lod(indices.size());
+    const size_t size = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), target, 1e-4f);
+    lod.resize(size);
+    EXPECT_LE(size, target);
+    EXPECT_EQ(size % 3, 0u);
+
+    bool all_up;
+    EXPECT_NEAR(total_area(lod, positions, all_up), 32.0f * 32.0f, 1e-2f);
+    EXPECT_TRUE(all_up);
+}
+
+TEST(MeshOptimizerTest, SimplifyErrorBound) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(32, positions, indices);
+    for (auto& p : positions)
+        p.y = std::sin(p.x * 0.5f) * std::cos(p.z * 0.5f);
+
+    std::vector<unsigned> lod(indices.size());
+    const size_t strict = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), 0, 1e-3f);
+    const size_t loose = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), 0, 0.5f);
+    EXPECT_GT(strict, indices.size() / 2);
+    EXPECT_LT(loose, strict);
+    EXPECT_GT(loose, 0u);
+}
+
+TEST(MeshOptimizerTest, SimplifyKeepsSeams) {
+    // Two grids side by side that share positions along x = n but not vertices
+    const unsigned n = 16;
+    std::vector<glm::vec3> positions, right_positions;
+    std::vector<unsigned> indices, right_indices;
+    make_grid(n, positions, indices, 1);
+    make_grid(n, right_positions, right_indices, 2);
+    const unsigned right_base = unsigned(positions.size());
+    for (auto& p : right_positions)
+        positions.push_back(p + glm::vec3(float(n), 0.0f, 0.0f));
+    for (auto i : right_indices)
+        indices.push_back(i + right_base);
+
+    std::vector<unsigned> lod(indices.size());
+    const size_t size = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), indices.size() / 8, 1e-4f);
+    lod.resize(size);
+    EXPECT_LT(size, indices.size() / 2);
+
+    // Triangles do not mix vertices of both sides, and the surface has no holes
+    for (size_t i = 0; i < lod.size(); i += 3)
+    {
+        const bool right = lod[i] >= right_base;
+        EXPECT_EQ(lod[i + 1] >= right_base, right);
+        EXPECT_EQ(lod[i + 2] >= right_base, right);
+    }
+    bool all_up;
+    EXPECT_NEAR(total_area(lod, positions, all_up), 2.0f * n * n, 1e-2f);
+    EXPECT_TRUE(all_up);
+}
+
+TEST(MeshOptimizerTest, SimplifyVertexGroups) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(16, positions, indices);
+    std::vector<unsigned> lod(indices.size());
+
+    // Neighboring vertices are all in different groups, so nothing collapses
+    std::vector<unsigned> groups(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        groups[i] = unsigned(positions[i].x) % 2 + 2 * (unsigned(positions[i].z) % 2);
+    size_t size = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), 0, 1e-4f, groups.data());
+    EXPECT_EQ(size, indices.size());
+
+    // Two halves simplify separately
+    for (size_t i = 0; i < positions.size(); i++)
+        groups[i] = positions[i].x < 8.0f ? 0 : 1;
+    size = simplify(lod.data(), indices.data(), indices.size(), positions.data(), positions.size(), 0, 1e-4f, groups.data());
+    lod.resize(size);
+    EXPECT_LT(size, indices.size() / 4);
+    bool all_up;
+    EXPECT_NEAR(total_area(lod, positions, all_up), 16.0f * 16.0f, 1e-2f);
+    EXPECT_TRUE(all_up);
+}
+
+TEST(MeshOptimizerTest, MeshletsKeepTrianglesAndLimits) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(32, positions, indices);
+    std::vector<unsigned> clusters;
+    optimize_vertex_cache(indices.data(), indices.size(), positions.size(), clusters);
+    const auto before = canonical_triangles(indices);
+
+    std::vector<Meshlet> meshlets;
+    build_meshlets(indices.data(), indices.size(), positions.data(), positions.size(), meshlets, 64, 124);
+    EXPECT_EQ(canonical_triangles(indices), before);
+
+    // Contiguous ranges within limits, with spheres bounding their vertices
+    unsigned offset = 0;
+    for (const auto& m : meshlets)
+    {
+        EXPECT_EQ(m.index_offset, offset);
+        EXPECT_GT(m.nbr_indices, 0u);
+        EXPECT_LE(m.nbr_indices, 124u * 3);
+        offset += m.nbr_indices;
+
+        std::vector<unsigned> vertices(indices.begin() + m.index_offset, indices.begin() + m.index_offset + m.nbr_indices);
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        EXPECT_LE(vertices.size(), 64u);
+        for (auto v : vertices)
+            EXPECT_LE(glm::length(positions[v] - m.center), m.radius * 1.0001f);
+
+        // Flat and facing +y
+        EXPECT_NEAR(m.cone_axis.y, 1.0f, 1e-5f);
+        EXPECT_NEAR(m.cone_cutoff, 0.0f, 1e-3f);
+    }
+    EXPECT_EQ(offset, indices.size());
+
+    // Compact clusters reuse vertices, far from one cluster per 64 / 3 triangles
+    EXPECT_LT(meshlets.size(), indices.size() / 3 / 48);
+}
+
+TEST(MeshOptimizerTest, MeshletCones) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    make_grid(6, positions, indices);
+    std::vector<Meshlet> meshlets;
+    build_meshlets(indices.data(), indices.size(), positions.data(), positions.size(), meshlets);
+    ASSERT_EQ(meshlets.size(), 1u);
+
+    // The grid faces +y, so it is culled from below only
+    EXPECT_FALSE(is_backfacing(meshlets[0], { 3.0f, 10.0f, 3.0f }));
+    EXPECT_TRUE(is_backfacing(meshlets[0], { 3.0f, -10.0f, 3.0f }));
+    EXPECT_FALSE(is_backfacing(meshlets[0], { 40.0f, -1.0f, 3.0f }));
+
+    // Triangles facing opposite ways disable the cone
+    positions = { { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 } };
+    indices = { 0, 1, 2, 0, 2, 1 };
+    build_meshlets(indices.data(), indices.size(), positions.data(), positions.size(), meshlets);
+    ASSERT_EQ(meshlets.size(), 1u);
+    EXPECT_EQ(meshlets[0].cone_cutoff, 1.0f);
+    EXPECT_FALSE(is_backfacing(meshlets[0], { 0.0f, -10.0f, 0.0f }));
+    EXPECT_FALSE(is_backfacing(meshlets[0], { 0.0f, 10.0f, 0.0f }));
+}
@@ -0,0 +1,88 @@
+#include "RangeAllocator.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+using eeng::RangeAllocator;
+
+TEST(RangeAllocatorTest, FirstFitAndCoalesce) {
+    RangeAllocator allocator(100);
+    const size_t a = allocator.allocate(10);
+    const size_t b = allocator.allocate(20);
+    const size_t c = allocator.allocate(30);
+    EXPECT_EQ(a, 0u);
+    EXPECT_EQ(b, 10u);
+    EXPECT_EQ(c, 30u);
+    EXPECT_EQ(allocator.used(), 60u);
+    EXPECT_EQ(allocator.allocate(41), RangeAllocator::NoRange);
+
+    // The hole left by b is reused first
+    allocator.free(b);
+    EXPECT_EQ(allocator.allocate(15), 10u);
+    EXPECT_EQ(allocator.largest_free(), 40u);
+
+    // Freeing everything leaves one range
+    allocator.free(a);
+    allocator.free(10);
+    allocator.free(c);
+    EXPECT_EQ(allocator.used(), 0u);
+    EXPECT_EQ(allocator.largest_free(), 100u);
+    EXPECT_EQ(allocator.allocate(100), 0u);
+}
+
+TEST(RangeAllocatorTest, Grow) {
+    RangeAllocator allocator(10);
+    EXPECT_EQ(allocator.allocate(8), 0u);
+    EXPECT_EQ(allocator.allocate(8), RangeAllocator::NoRange);
+
+    // The free tail joins the added space
+    allocator.grow(20);
+    EXPECT_EQ(allocator.largest_free(), 12u);
+    EXPECT_EQ(allocator.allocate(12), 8u);
+    EXPECT_EQ(allocator.capacity(), 20u);
+}
+
+TEST(RangeAllocatorTest, CompactPacksInOrder) {
+    RangeAllocator allocator(1000);
+    std::mt19937 rng(42);
+    std::vector<std::pair<size_t, size_t>> live; // Offset, size
+    for (int i = 0; i < 200; i++)
+    {
+        if (live.size() && rng() % 3 == 0)
+        {
+            const size_t k = rng() % live.size();
+            allocator.free(live[k].first);
+            live.erase(live.begin() + k);
+        }
+        const size_t size = 1 + rng() % 8;
+        const size_t offset = allocator.allocate(size);
+        if (offset != RangeAllocator::NoRange)
+            live.push_back({ offset, size });
+    }
+    std::sort(live.begin(), live.end());
+
+    // Moves go down, in order, and pack the live ranges
+    const auto moves = allocator.compact();
+    size_t packed = 0;
+    auto move = moves.begin();
+    for (auto& [offset, size] : live)
+    {
+        if (offset != packed)
+        {
+            ASSERT_NE(move, moves.end());
+            EXPECT_EQ(move->from, offset);
+            EXPECT_EQ(move->to, packed);
+            EXPECT_EQ(move->size, size);
+            ++move;
+        }
+        packed += size;
+    }
+    EXPECT_EQ(move, moves.end());
+    EXPECT_EQ(allocator.used(), packed);
+    EXPECT_EQ(allocator.largest_free(), allocator.capacity() - packed);
+
+    // Ranges are freed at their new offsets
+    if (moves.size())
+        allocator.free(moves.front().to);
+}
@@ -0,0 +1,60 @@
+#include "SnapshotBuffer.h"
+#include <gtest/gtest.h>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+TEST(SnapshotBufferTest, ReaderSeesLatestPublished) {
+    eeng::SnapshotBuffer<int> buffer;
+    EXPECT_EQ(buffer.acquire(), 0);
+    EXPECT_EQ(buffer.acquired_count(), 0u);
+
+    buffer.write_buffer() = 1;
+    buffer.publish();
+    buffer.write_buffer() = 2;
+    buffer.publish();
+    EXPECT_EQ(buffer.acquire(), 2);
+    EXPECT_EQ(buffer.acquired_count(), 2u);
+
+    // Nothing new: same buffer again
+    buffer.write_buffer() = 3;
+    EXPECT_EQ(buffer.acquire(), 2);
+    buffer.publish();
+    EXPECT_EQ(buffer.acquire(), 3);
+}
+
+TEST(SnapshotBufferTest, ConcurrentSnapshotsAreConsistent) {
+    // Writer fills each snapshot with its sequence number
+    eeng::SnapshotBuffer<std::vector<int>> buffer;
+    const int nbr_snapshots = 20000;
+    std::atomic<bool> done{ false };
+
+    std::thread writer([&]()
+        {
+            for (int i = 1; i <= nbr_snapshots; i++)
+            {
+                auto& state = buffer.write_buffer();
+                state.assign(64, i);
+                buffer.publish();
+            }
+            done = true;
+        });
+
+    int last = 0;
+    bool consistent = true, increasing = true;
+    while (!done || last < nbr_snapshots)
+    {
+        const auto& state = buffer.acquire();
+        if (state.empty())
+            continue;
+        for (int v : state)
+            consistent &= (v == state[0]);
+        increasing &= (state[0] >= last);
+        last = state[0];
+    }
+    writer.join();
+
+    EXPECT_TRUE(consistent);
+    EXPECT_TRUE(increasing);
+    EXPECT_EQ(last, nbr_snapshots);
+}
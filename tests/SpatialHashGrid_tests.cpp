@@ -0,0 +1,170 @@
+#include "SpatialHashGrid.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+    using namespace eeng;
+
+    /// Agents spread over the ground plane, as NPCs are
+    void make_agents(size_t n, float world_size, std::vector<glm::vec3>& positions, std::vector<uint32_t>& ids, unsigned seed = 1234)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-world_size, world_size);
+        std::uniform_real_distribution<float> height(0.0f, 2.0f);
+
+        positions.resize(n);
+        ids.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            positions[i] = { pos(rng), height(rng), pos(rng) };
+            ids[i] = uint32_t(i);
+        }
+    }
+
+    std::vector<uint32_t> brute_force_radius(const std::vector<glm::vec3>& positions, const glm::vec3& p, float r)
+    {
+        std::vector<uint32_t> result;
+        for (uint32_t i = 0; i < positions.size(); i++)
+        {
+            const glm::vec3 d = positions[i] - p;
+            if (glm::dot(d, d) <= r * r)
+                result.push_back(i);
+        }
+        return result;
+    }
+}
+
+TEST(SpatialHashGridTest, Empty) {
+    SpatialHashGrid grid;
+    grid.build(nullptr, nullptr, 0);
+    std::vector<uint32_t> result;
+    grid.query_radius(glm::vec3{ 0.0f }, 10.0f, result);
+    EXPECT_TRUE(result.empty());
+    std::vector<SpatialHashGrid::Neighbor> knn;
+    grid.query_knn(glm::vec3{ 0.0f }, 5, knn);
+    EXPECT_TRUE(knn.empty());
+}
+
+TEST(SpatialHashGridTest, RadiusMatchesBruteForce) {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> ids;
+    make_agents(5000, 100.0f, positions, ids);
+
+    for (unsigned threads : { 1u, 4u })
+    {
+        SpatialHashGrid grid{ 3.0f };
+        grid.build(positions.data(), ids.data(), positions.size(), threads);
+        EXPECT_EQ(grid.size(), positions.size());
+
+        std::vector<glm::vec3> queries;
+        std::vector<uint32_t> query_ids;
+        make_agents(100, 110.0f, queries, query_ids, 99);
+        for (const auto& q : queries)
+        {
+            for (float r : { 0.5f, 3.0f, 10.0f })
+            {
+                std::vector<uint32_t> result;
+                grid.query_radius(q, r, result);
+                std::sort(result.begin(), result.end());
+                EXPECT_EQ(result, brute_force_radius(positions, q, r));
+            }
+        }
+    }
+}
+
+TEST(SpatialHashGridTest, KnnMatchesBruteForce) {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> ids;
+    make_agents(3000, 100.0f, positions, ids);
+
+    SpatialHashGrid grid{ 4.0f };
+    grid.build(positions.data(), ids.data(), positions.size());
+
+    std::vector<glm::vec3> queries;
+    std::vector<uint32_t> query_ids;
+    make_agents(100, 150.0f, queries, query_ids, 99);
+    for (const auto& q : queries)
+    {
+        for (size_t k : { 1u, 8u, 32u })
+        {
+            std::vector<float> ref;
+            for (const auto& p : positions)
+                ref.push_back(glm::dot(p - q, p - q));
+            std::sort(ref.begin(), ref.end());
+            ref.resize(k);
+
+            std::vector<SpatialHashGrid::Neighbor> knn;
+            grid.query_knn(q, k, knn);
+            ASSERT_EQ(knn.size(), k);
+            for (size_t i = 0; i < k; i++)
+                EXPECT_FLOAT_EQ(knn[i].dist2, ref[i]);
+        }
+    }
+}
+
+TEST(SpatialHashGridTest, KnnWithFewPointsAndMaxRadius) {
+    std::vector<glm::vec3> positions{ { 0, 0, 0 }, { 5, 0, 0 }, { 50, 0, 0 } };
+    std::vector<uint32_t> ids{ 10, 11, 12 };
+    SpatialHashGrid grid{ 2.0f };
+    grid.build(positions.data(), ids.data(), positions.size());
+
+    std::vector<SpatialHashGrid::Neighbor> knn;
+    grid.query_knn(glm::vec3{ 1.0f, 0.0f, 0.0f }, 10, knn);
+    ASSERT_EQ(knn.size(), 3u);
+    EXPECT_EQ(knn[0].id, 10u);
+    EXPECT_EQ(knn[1].id, 11u);
+    EXPECT_EQ(knn[2].id, 12u);
+
+    grid.query_knn(glm::vec3{ 1.0f, 0.0f, 0.0f }, 10, knn, 6.0f);
+    EXPECT_EQ(knn.size(), 2u);
+}
+
+TEST(SpatialHashGridBenchmark, RebuildAndQuery50k) {
+    using clock = std::chrono::high_resolution_clock;
+    auto ms = [](auto a, auto b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+
+    const size_t n = 50000;
+    const size_t nbr_queries = 1000;
+    const float radius = 3.0f;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> ids;
+    make_agents(n, 500.0f, positions, ids);
+
+    SpatialHashGrid grid{ radius };
+    for (unsigned threads : { 1u, 0u })
+    {
+        grid.build(positions.data(), ids.data(), n, threads); // Warm up allocations
+        auto t0 = clock::now();
+        const int frames = 20;
+        for (int f = 0; f < frames; f++)
+            grid.build(positions.data(), ids.data(), n, threads);
+        auto t1 = clock::now();
+        std::cout << n << " agents, rebuild with " << (threads ? "1 thread" : "all threads") << ": "
+            << ms(t0, t1) / frames << " ms" << std::endl;
+    }
+
+    size_t found_grid = 0, found_bf = 0;
+    auto t0 = clock::now();
+    std::vector<uint32_t> result;
+    for (size_t i = 0; i < nbr_queries; i++)
+    {
+        grid.query_radius(positions[i], radius, result);
+        found_grid += result.size();
+    }
+    auto t1 = clock::now();
+    for (size_t i = 0; i < nbr_queries; i++)
+        found_bf += brute_force_radius(positions, positions[i], radius).size();
+    auto t2 = clock::now();
+    std::vector<SpatialHashGrid::Neighbor> knn;
+    for (size_t i = 0; i < nbr_queries; i++)
+        grid.query_knn(positions[i], 8, knn);
+    auto t3 = clock::now();
+
+    std::cout << nbr_queries << " radius queries: grid " << ms(t0, t1) << " ms, brute force " << ms(t1, t2)
+        << " ms; " << nbr_queries << " 8-NN queries: " << ms(t2, t3) << " ms" << std::endl;
+    EXPECT_EQ(found_grid, found_bf);
+}
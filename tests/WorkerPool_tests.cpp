@@ -0,0 +1,35 @@
+#include "WorkerPool.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <vector>
+
+using namespace eeng;
+
+TEST(WorkerPoolTest, RunsEachTaskOnce) {
+    WorkerPool pool(3);
+    EXPECT_EQ(pool.size(), 4u);
+
+    // Repeated runs reuse the same threads
+    for (unsigned nbr_tasks : { 0u, 1u, 3u, 4u, 17u, 1000u })
+    {
+        std::vector<std::atomic<int>> counts(nbr_tasks);
+        pool.run(nbr_tasks, [&](unsigned task) { counts[task]++; });
+        for (auto& count : counts)
+            EXPECT_EQ(count.load(), 1);
+    }
+}
+
+TEST(WorkerPoolTest, ManySmallRuns) {
+    WorkerPool pool(2);
+    std::atomic<int> sum{ 0 };
+    for (int i = 0; i < 10000; i++)
+        pool.run(3, [&](unsigned task) { sum += int(task); });
+    EXPECT_EQ(sum.load(), 10000 * 3);
+}
+
+TEST(WorkerPoolTest, NoWorkers) {
+    WorkerPool pool(0);
+    int sum = 0;
+    pool.run(5, [&](unsigned task) { sum += int(task); });
+    EXPECT_EQ(sum, 10);
+}
@@ -0,0 +1,151 @@
+#include "glmcommon.hpp"
+#include "AABB.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+    void make_random_aabbs(size_t n, float world_size, eeng::AABBSoA& aabbs, unsigned seed = 1234)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-world_size, world_size);
+        std::uniform_real_distribution<float> ext(0.1f, 1.5f);
+
+        aabbs.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const glm::vec3 c{ pos(rng), pos(rng), pos(rng) };
+            const glm::vec3 e{ ext(rng), ext(rng), ext(rng) };
+            eeng::AABB aabb;
+            aabb.min = c - e;
+            aabb.max = c + e;
+            aabbs.set(i, aabb);
+        }
+    }
+
+    std::vector<glm_aux::Ray> make_random_rays(size_t n, float world_size, unsigned seed = 4321)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> pos(-world_size, world_size);
+
+        std::vector<glm_aux::Ray> rays(n);
+        for (auto& ray : rays)
+        {
+            const glm::vec3 o{ pos(rng), pos(rng), pos(rng) };
+            const glm::vec3 target{ pos(rng), pos(rng), pos(rng) };
+            ray = glm_aux::Ray{ o, glm::normalize(target - o + glm::vec3{ 1e-3f }) };
+        }
+        return rays;
+    }
+
+    glm_aux::AABBSoAView make_view(const eeng::AABBSoA& aabbs)
+    {
+        return {
+            aabbs.min_x.data(), aabbs.min_y.data(), aabbs.min_z.data(),
+            aabbs.max_x.data(), aabbs.max_y.data(), aabbs.max_z.data(),
+            aabbs.size() };
+    }
+
+    /// Reference using the scalar single-box test
+    int scalar_nearest(glm_aux::Ray& ray, const eeng::AABBSoA& aabbs)
+    {
+        int hit = -1;
+        for (size_t i = 0; i < aabbs.size(); i++)
+        {
+            const auto aabb = aabbs.get(i);
+            if (glm_aux::intersect_ray_AABB(ray, aabb.min, aabb.max))
+                hit = int(i);
+        }
+        return hit;
+    }
+}
+
+TEST(RayAABBBatchTest, MatchesScalar) {
+    // Counts chosen to exercise both the SIMD body and the scalar tail
+    for (size_t n : { 0u, 1u, 7u, 8u, 13u, 100u, 1000u })
+    {
+        eeng::AABBSoA aabbs;
+        make_random_aabbs(n, 30.0f, aabbs);
+        const auto view = make_view(aabbs);
+
+        for (auto ray : make_random_rays(100, 40.0f))
+        {
+            auto ref_ray = ray;
+            const int ref = scalar_nearest(ref_ray, aabbs);
+            const int hit = glm_aux::intersect_ray_AABBs(ray, view);
+
+            ASSERT_EQ(hit, ref);
+            if (ref >= 0)
+                EXPECT_NEAR(ray.z_near, ref_ray.z_near, 1e-4f);
+        }
+    }
+}
+
+TEST(RayAABBBatchTest, RespectsZNear) {
+    eeng::AABBSoA aabbs;
+    aabbs.resize(2);
+    eeng::AABB a, b;
+    a.min = { 1, -1, -1 }; a.max = { 2, 1, 1 };
+    b.min = { 4, -1, -1 }; b.max = { 5, 1, 1 };
+    aabbs.set(0, b);
+    aabbs.set(1, a);
+
+    glm_aux::Ray ray{ glm::vec3{ 0.0f }, glm::vec3{ 1.0f, 0.0f, 0.0f } };
+    EXPECT_EQ(glm_aux::intersect_ray_AABBs(ray, make_view(aabbs)), 1);
+    EXPECT_FLOAT_EQ(ray.z_near, 1.0f);
+
+    ray.z_near = 0.5f;
+    EXPECT_EQ(glm_aux::intersect_ray_AABBs(ray, make_view(aabbs)), -1);
+    EXPECT_FLOAT_EQ(ray.z_near, 0.5f);
+}
+
+TEST(RayAABBBatchTest, PacketMatchesSingleRays) {
+    eeng::AABBSoA aabbs;
+    make_random_aabbs(200, 30.0f, aabbs);
+    const auto view = make_view(aabbs);
+
+    auto rays = make_random_rays(37, 40.0f);
+    auto packet = rays;
+    std::vector<int> hits(rays.size());
+    glm_aux::intersect_ray_packet_AABBs(packet.data(), packet.size(), view, hits.data());
+
+    for (size_t r = 0; r < rays.size(); r++)
+    {
+        EXPECT_EQ(glm_aux::intersect_ray_AABBs(rays[r], view), hits[r]);
+        EXPECT_FLOAT_EQ(rays[r].z_near, packet[r].z_near);
+    }
+}
+
+TEST(RayAABBBatchBenchmark, Throughput) {
+    using clock = std::chrono::high_resolution_clock;
+    const size_t n = 100000;
+    const size_t nbr_rays = 64;
+
+    eeng::AABBSoA aabbs;
+    make_random_aabbs(n, 200.0f, aabbs);
+    const auto view = make_view(aabbs);
+    const auto rays = make_random_rays(nbr_rays, 250.0f);
+
+    int hits_scalar = 0, hits_batch = 0, hits_packet = 0;
+    auto t0 = clock::now();
+    for (auto ray : rays)
+        hits_scalar += scalar_nearest(ray, aabbs) >= 0;
+    auto t1 = clock::now();
+    for (auto ray : rays)
+        hits_batch += glm_aux::intersect_ray_AABBs(ray, view) >= 0;
+    auto t2 = clock::now();
+    auto packet = rays;
+    std::vector<int> hits(nbr_rays);
+    glm_aux::intersect_ray_packet_AABBs(packet.data(), nbr_rays, view, hits.data());
+    for (int h : hits)
+        hits_packet += h >= 0;
+    auto t3 = clock::now();
+
+    auto mtests = [&](auto a, auto b) { return double(n * nbr_rays) / std::chrono::duration<double, std::micro>(b - a).count(); };
+    std::cout << nbr_rays << " rays vs " << n << " AABBs (million tests/s): scalar " << mtests(t0, t1)
+        << ", batch " << mtests(t1, t2) << ", packet " << mtests(t2, t3) << std::endl;
+    EXPECT_EQ(hits_batch, hits_scalar);
+    EXPECT_EQ(hits_packet, hits_scalar);
+}